@@ -0,0 +1,169 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Allocation-counting check for function calls
+//
+// Runs a recursive (fib-style) script once, and then with the same call
+// repeated in a loop, counting heap allocations made by evaluate(). Calls
+// should not allocate once the stacks have grown to their high-water
+// mark, so both runs should make the same number of allocations.
+//
+// build: g++ -O2 -std=c++17 -Isrc -o alloc_count.out bench/alloc_count.cpp src/data_stack_type.cpp src/evaluate.cpp src/jit.cpp src/loop_trace.cpp src/parser_type.cpp
+//
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "evaluate.h"
+#include "parser_type.h"
+
+
+namespace {
+
+  size_t allocation_count = 0U;
+  bool   counting         = false;
+
+
+  class null_buffer_type : public std::streambuf {
+    protected:
+      int overflow( int c ) override { return c; }
+  };
+
+
+  bool count_allocations( const std::string &script, evaluate_engine_type engine, size_t &count )
+  {
+    parser_type parser;
+    for ( char c : script ) {
+      if ( !parser.parse_char( c ) ) {
+        return false;
+      }
+    }
+    if ( !parser.parse_char( '\0' ) ) {
+      return false;
+    }
+
+    null_buffer_type null_buffer;
+    std::ostream     null_out( &null_buffer );
+
+    program_type    program( parser.statements() );
+    vm_context_type context( data_stack_type::DEFAULT_MAX_SIZE, null_out );
+    allocation_count = 0U;
+    counting         = true;
+    evaluate_options_type options;
+    options.engine = engine;
+
+    bool rv = evaluate<evaluate_debug_policy_type>( program, context, options );
+    counting         = false;
+    count            = allocation_count;
+
+    return rv;
+  }
+
+}
+
+
+namespace {
+
+  void *allocate( size_t size ) noexcept
+  {
+    if ( counting ) {
+      ++allocation_count;
+    }
+    return std::malloc( size ? size : 1U );
+  }
+
+  void *allocate_or_throw( size_t size )
+  {
+    void *p = allocate( size );
+    if ( !p ) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+}
+
+
+// Every replaceable form that allocates counts, and every form of delete
+//  frees, so that array allocations are counted too and new/delete
+//  always match
+//
+void *operator new( size_t size )                                 { return allocate_or_throw( size ); }
+void *operator new[]( size_t size )                               { return allocate_or_throw( size ); }
+void *operator new( size_t size, const std::nothrow_t & ) noexcept   { return allocate( size ); }
+void *operator new[]( size_t size, const std::nothrow_t & ) noexcept { return allocate( size ); }
+
+void operator delete( void *p ) noexcept                             { std::free( p ); }
+void operator delete[]( void *p ) noexcept                           { std::free( p ); }
+void operator delete( void *p, size_t ) noexcept                     { std::free( p ); }
+void operator delete[]( void *p, size_t ) noexcept                   { std::free( p ); }
+void operator delete( void *p, const std::nothrow_t & ) noexcept     { std::free( p ); }
+void operator delete[]( void *p, const std::nothrow_t & ) noexcept   { std::free( p ); }
+
+
+int main()
+{
+  const std::string fib =
+    "fn double fib( double n ) {\n"
+    "  if ( n < 2 ) {\n"
+    "    return n;\n"
+    "  }\n"
+    "  return fib( n - 1 ) + fib( n - 2 );\n"
+    "}\n";
+
+  const std::string once = fib +
+    "double i = 0;\n"
+    "fib( 15 );\n";
+
+  const std::string repeated = fib +
+    "double i = 0;\n"
+    "while ( i < 20 ) {\n"
+    "  fib( 15 );\n"
+    "  i = i + 1;\n"
+    "}\n";
+
+  bool ok = true;
+  for ( evaluate_engine_type engine : { EVALUATE_ENGINE_TYPE_SWITCH, EVALUATE_ENGINE_TYPE_THREADED } ) {
+    size_t once_count     = 0U;
+    size_t repeated_count = 0U;
+    if ( !count_allocations( once, engine, once_count ) || !count_allocations( repeated, engine, repeated_count ) ) {
+      std::cerr << "ERROR: evaluation error\n";
+      return 1;
+    }
+
+    std::cout << ( engine == EVALUATE_ENGINE_TYPE_SWITCH ? "switch" : "threaded" )
+              << ": 1973 calls -> " << once_count << " allocations, "
+              << "39460 calls -> " << repeated_count << " allocations\n";
+
+    if ( repeated_count != once_count ) {
+      ok = false;
+    }
+  }
+
+  std::cout << ( ok ? "PASS" : "FAIL" ) << "\n";
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Throughput of batch evaluation, in rows/s
+//
+// Runs a small formula script over generated rows three ways: the old
+// way (build a script with the row's values in it, parse it and
+// evaluate it, once per row; only for a sample of rows, as it is slow),
+// and with run_batch() on 1, 2, 4, ... threads. Batch outputs are
+// checked against the same formula computed in C++.
+//
+// usage: batch_throughput.out [--rows=N] [--max-threads=N]
+//
+// build: g++ -O2 -std=c++17 -pthread -Isrc -o batch_throughput.out bench/batch_throughput.cpp src/batch.cpp src/data_stack_type.cpp src/evaluate.cpp src/jit.cpp src/lanes.cpp src/loop_trace.cpp src/parser_type.cpp
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "parser_type.h"
+
+
+namespace {
+
+  const char *SCRIPT =
+    "double total = price * qty * ( 1 + rate );\n"
+    "double discount = 0;\n"
+    "if ( total > 500 ) {\n"
+    "  discount = total / 10;\n"
+    "}\n"
+    "total = total - discount;\n";
+
+
+  double expected_total( double price, int32_t qty, double rate )
+  {
+    double total = price * qty * ( 1 + rate );
+    double discount = 0;
+    if ( total > 500 ) {
+      discount = total / 10;
+    }
+    return total - discount;
+  }
+
+
+  class null_buffer_type : public std::streambuf {
+    protected:
+      int overflow( int c ) override { return c; }
+  };
+
+
+  // One row, evaluated the way a caller without the batch API has to
+  //
+  bool evaluate_row( double price, double qty, double rate, std::ostream &out )
+  {
+    std::ostringstream script;
+    script.precision( 17 );
+    script << "double price = " << price << ";\n"
+           << "int qty = " << static_cast<int32_t>( qty ) << ";\n"
+           << "double rate = " << rate << ";\n"
+           << SCRIPT;
+
+    parser_type parser;
+    for ( char c : script.str() ) {
+      if ( !parser.parse_char( c ) ) {
+        return false;
+      }
+    }
+    if ( !parser.parse_char( '\0' ) ) {
+      return false;
+    }
+
+    program_type          program( parser.statements() );
+    vm_context_type       context( data_stack_type::DEFAULT_MAX_SIZE, out );
+    evaluate_options_type options;
+    options.trace = false;
+    return evaluate( program, context, options );
+  }
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+  size_t rows        = 1000000U;
+  size_t max_threads = std::thread::hardware_concurrency();
+
+  for ( int iarg = 1; iarg < argc; ++iarg ) {
+    if ( std::strncmp( argv[iarg], "--rows=", 7U ) == 0 ) {
+      rows = std::strtoull( argv[iarg] + 7U, nullptr, 10 );
+    }
+    else if ( std::strncmp( argv[iarg], "--max-threads=", 14U ) == 0 ) {
+      max_threads = std::strtoull( argv[iarg] + 14U, nullptr, 10 );
+    }
+  }
+  if ( max_threads == 0U ) {
+    max_threads = 1U;
+  }
+
+  std::vector<batch_column_type> inputs{ { "price", {} }, { "qty", {} }, { "rate", {} } };
+  for ( size_t row = 0U; row < rows; ++row ) {
+    inputs[0].values.push_back( 1.0 + static_cast<double>( row % 997U ) / 4.0 );
+    inputs[1].values.push_back( static_cast<double>( 1U + row % 7U ) );
+    inputs[2].values.push_back( static_cast<double>( row % 13U ) / 100.0 );
+  }
+
+  // Per-row parse and evaluate, on a sample
+  //
+  {
+    null_buffer_type null_buffer;
+    std::ostream     null_out( &null_buffer );
+
+    size_t sample = ( rows < 10000U ) ? rows : 10000U;
+    auto start_time = std::chrono::steady_clock::now();
+    for ( size_t row = 0U; row < sample; ++row ) {
+      if ( !evaluate_row( inputs[0].values[row], inputs[1].values[row], inputs[2].values[row], null_out ) ) {
+        std::cerr << "ERROR: evaluation error in row " << row << "\n";
+        return 1;
+      }
+    }
+    auto elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+    std::cout << "parse + evaluate per row: " << static_cast<double>( sample ) / elapsed << " rows/s\n";
+  }
+
+  batch_program_type batch_program;
+  std::string        error;
+  if ( !compile_batch(
+                      SCRIPT
+                     ,{ { "price", OPERAND_TYPE_DOUBLE }, { "qty", OPERAND_TYPE_INT32 }, { "rate", OPERAND_TYPE_DOUBLE } }
+                     ,{ "total", "discount" }
+                     ,batch_program
+                     ,error
+                     ) ) {
+    std::cerr << "ERROR: " << error << "\n";
+    return 1;
+  }
+
+  bool ok = true;
+
+  std::vector<size_t> thread_counts;
+  for ( size_t thread_count = 1U; thread_count < max_threads; thread_count *= 2U ) {
+    thread_counts.push_back( thread_count );
+  }
+  thread_counts.push_back( max_threads );
+
+  for ( size_t thread_count : thread_counts ) {
+    batch_options_type options;
+    options.threads = thread_count;
+
+    std::vector<batch_column_type> outputs;
+    auto start_time = std::chrono::steady_clock::now();
+    if ( !run_batch( batch_program, inputs, outputs, options, error ) ) {
+      std::cerr << "ERROR: " << error << "\n";
+      return 1;
+    }
+    auto elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+
+    size_t mismatches = 0U;
+    for ( size_t row = 0U; row < rows; ++row ) {
+      double expected = expected_total( inputs[0].values[row], static_cast<int32_t>( inputs[1].values[row] ), inputs[2].values[row] );
+      // NOTE: not bit-exact; the interpreter may multiply in another order
+      //
+      if ( std::fabs( outputs[0].values[row] - expected ) > 1e-12 * std::fabs( expected ) ) {
+        ++mismatches;
+      }
+    }
+
+    std::cout << "run_batch, " << thread_count << " thread(s): " << static_cast<double>( rows ) / elapsed << " rows/s";
+    if ( mismatches != 0U ) {
+      std::cout << ", " << mismatches << " row(s) WRONG";
+      ok = false;
+    }
+    std::cout << "\n";
+  }
+
+  std::cout << ( ok ? "PASS" : "FAIL" ) << "\n";
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmark suite driver
+//
+// Runs each workload several times, timing three phases separately:
+// lexing (the parse_char() loop with the parser in lex-only mode),
+// parsing (the full parse_char() loop, which lexes as it goes) and
+// evaluate(), with statement results dropped. Writes JSON with the
+// median, mean, variance, minimum and maximum of each phase, in
+// microseconds, so that runs can be compared release to release.
+//
+// The default workloads are the bench/*.txt scripts (run from the
+// repository root), plus a large generated source file for parse speed
+// (which is also evaluated). Scripts given on the command line replace
+// them.
+//
+// usage: bench.out [--runs=N] [--out=FILE] [--threaded] [--no-checks]
+//                  [--jit] [--fold] [--branches] [--dce]
+//                  [--ir] [--fuse] [script ...]
+//
+// build: make bench (or: g++ -O2 -std=c++17 -pthread -Isrc -o bench.out bench/bench.cpp src/*.cpp, leaving out src/main.cpp)
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "evaluate.h"
+#include "ir.h"
+#include "optimize.h"
+#include "parser_type.h"
+#include "result_sink.h"
+
+
+namespace {
+
+  struct workload_type {
+    std::string name;
+    std::string source;
+  };
+
+  // A workload under each default name; the file is bench/<name>.txt
+  //
+  const char * const DEFAULT_WORKLOADS[] = {
+     "loop"          // tight while loop
+    ,"expr_loop"     // wide expressions
+    ,"fib"           // call-heavy recursion
+    ,"recursion"     // deep recursion
+    ,"calls"         // small functions calling each other
+    ,"globals"       // many global variables
+    ,"print_loop"    // many statement results
+    ,"nested_loops"  // loop-invariant expressions in nested loops
+  };
+
+
+  // Many small functions and statements, for parse speed
+  //
+  std::string generated_source( size_t functions )
+  {
+    std::ostringstream out;
+    for ( size_t i = 0U; i < functions; ++i ) {
+      out << "fn double f" << i << "( double a, double b ) {\n"
+          << "  double t = a * " << i << " + b;\n"
+          << "  if ( t > " << i << " ) {\n"
+          << "    t = t - 1;\n"
+          << "  }\n"
+          << "  return t;\n"
+          << "}\n"
+          << "double x" << i << " = f" << i << "( " << i << ", 2 ) + " << ( i % 7 ) << ".5 * ( 3 - 1 );\n";
+    }
+    out << "x0 + x" << ( functions - 1U ) << ";\n";
+    return out.str();
+  }
+
+
+  bool read_file( const std::string &path, std::string &contents )
+  {
+    std::ifstream file( path );
+    if ( !file ) {
+      return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+  }
+
+
+  bool parse( const std::string &source, bool lex_only, parser_type &parser )
+  {
+    parser.set_lex_only( lex_only );
+    for ( char c : source ) {
+      if ( !parser.parse_char( c ) ) {
+        return false;
+      }
+    }
+    return parser.parse_char( '\0' );
+  }
+
+
+  struct stats_type {
+    double median{};
+    double mean{};
+    double variance{};
+    double min{};
+    double max{};
+  };
+
+  stats_type summarize( std::vector<double> samples )
+  {
+    stats_type stats;
+    if ( samples.empty() ) {
+      return stats;
+    }
+
+    std::sort( samples.begin(), samples.end() );
+    const size_t n = samples.size();
+    stats.median = ( n % 2U ) ? samples[ n / 2U ] : ( samples[ n / 2U - 1U ] + samples[ n / 2U ] ) / 2.0;
+    stats.min    = samples.front();
+    stats.max    = samples.back();
+
+    for ( double sample : samples ) {
+      stats.mean += sample;
+    }
+    stats.mean /= static_cast<double>( n );
+
+    // sample variance
+    //
+    if ( n > 1U ) {
+      for ( double sample : samples ) {
+        stats.variance += ( sample - stats.mean ) * ( sample - stats.mean );
+      }
+      stats.variance /= static_cast<double>( n - 1U );
+    }
+
+    return stats;
+  }
+
+
+  double elapsed_us( std::chrono::steady_clock::time_point start )
+  {
+    return std::chrono::duration<double,std::micro>( std::chrono::steady_clock::now() - start ).count();
+  }
+
+
+  std::string json_string( const std::string &text )
+  {
+    std::string quoted( "\"" );
+    for ( char c : text ) {
+      if ( c == '"' || c == '\\' ) {
+        quoted += '\\';
+        quoted += c;
+      }
+      else if ( static_cast<unsigned char>( c ) < 0x20U ) {
+        quoted += ' ';
+      }
+      else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  }
+
+
+  void write_stats( std::ostream &out, const char *phase, const stats_type &stats )
+  {
+    out << "      " << json_string( phase ) << ": {"
+        << " \"median_us\": "   << stats.median
+        << ", \"mean_us\": "    << stats.mean
+        << ", \"variance_us2\": " << stats.variance
+        << ", \"min_us\": "     << stats.min
+        << ", \"max_us\": "     << stats.max
+        << " }";
+  }
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+  size_t      runs = 5U;
+  std::string out_path;
+  bool        fold     = false;
+  bool        branches = false;
+  bool        dce      = false;
+  bool        ir       = false;
+  bool        fuse     = false;
+
+  evaluate_options_type options;
+  options.trace = false;
+
+  std::vector<workload_type> workloads;
+
+  for ( int iarg = 1; iarg < argc; ++iarg ) {
+    if ( std::strncmp( argv[iarg], "--runs=", 7U ) == 0 ) {
+      runs = std::strtoull( argv[iarg] + 7U, nullptr, 10 );
+    }
+    else if ( std::strncmp( argv[iarg], "--out=", 6U ) == 0 ) {
+      out_path = argv[iarg] + 6U;
+    }
+    else if ( std::strcmp( argv[iarg], "--threaded" ) == 0 ) {
+      options.engine = EVALUATE_ENGINE_TYPE_THREADED;
+    }
+    else if ( std::strcmp( argv[iarg], "--no-checks" ) == 0 ) {
+      options.checks = false;
+    }
+    else if ( std::strcmp( argv[iarg], "--jit" ) == 0 ) {
+      options.jit = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--fold" ) == 0 ) {
+      fold = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--dce" ) == 0 ) {
+      dce = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--branches" ) == 0 ) {
+      branches = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--ir" ) == 0 ) {
+      ir = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--fuse" ) == 0 ) {
+      fuse = true;
+    }
+    else {
+      workload_type workload;
+      workload.name = argv[iarg];
+      if ( !read_file( argv[iarg], workload.source ) ) {
+        std::cerr << "ERROR: could not open " << argv[iarg] << "\n";
+        return 1;
+      }
+      workloads.push_back( workload );
+    }
+  }
+  if ( runs == 0U ) {
+    runs = 1U;
+  }
+
+  if ( workloads.empty() ) {
+    for ( const char *name : DEFAULT_WORKLOADS ) {
+      workload_type workload;
+      workload.name = name;
+      const std::string path = std::string( "bench/" ) + name + ".txt";
+      if ( !read_file( path, workload.source ) ) {
+        std::cerr << "ERROR: could not open " << path << " (run from the repository root)\n";
+        return 1;
+      }
+      workloads.push_back( workload );
+    }
+
+    workloads.push_back( workload_type{ "generated_parse", generated_source( 10000U ) } );
+  }
+
+  std::ofstream out_file;
+  if ( !out_path.empty() ) {
+    out_file.open( out_path );
+    if ( !out_file ) {
+      std::cerr << "ERROR: could not write " << out_path << "\n";
+      return 1;
+    }
+  }
+  std::ostream &out = out_path.empty() ? std::cout : out_file;
+
+  out << "{\n"
+      << "  \"runs\": " << runs << ",\n"
+      << "  \"engine\": " << json_string( ( options.engine == EVALUATE_ENGINE_TYPE_THREADED ) ? "threaded" : "switch" ) << ",\n"
+      << "  \"checks\": " << ( options.checks ? "true" : "false" ) << ",\n"
+      << "  \"jit\": " << ( options.jit ? "true" : "false" ) << ",\n"
+      << "  \"fold\": " << ( fold ? "true" : "false" ) << ",\n"
+      << "  \"branches\": " << ( branches ? "true" : "false" ) << ",\n"
+      << "  \"dce\": " << ( dce ? "true" : "false" ) << ",\n"
+      << "  \"ir\": " << ( ir ? "true" : "false" ) << ",\n"
+      << "  \"fuse\": " << ( fuse ? "true" : "false" ) << ",\n"
+      << "  \"workloads\": [\n";
+
+  bool all_ok = true;
+
+  for ( size_t w = 0U; w < workloads.size(); ++w ) {
+    const workload_type &workload = workloads[w];
+    std::cerr << "bench: " << workload.name << "\n";
+
+    std::vector<double>           lex_us;
+    std::vector<double>           parse_us;
+    std::vector<double>           evaluate_us;
+    size_t                        tokens = 0U;
+    std::vector<instruction_type> instructions;
+    std::vector<std::string>      function_names;
+    bool                          ok = true;
+
+    vm_context_type       context;
+    null_result_sink_type results;
+    context.results = &results;
+
+    for ( size_t run = 0U; ok && run < runs; ++run ) {
+      {
+        auto start = std::chrono::steady_clock::now();
+        parser_type lexer;
+        ok = parse( workload.source, true, lexer );
+        lex_us.push_back( elapsed_us( start ) );
+        tokens = lexer.tokens_lexed();
+      }
+
+      if ( ok ) {
+        auto start = std::chrono::steady_clock::now();
+        parser_type parser;
+        ok = parse( workload.source, false, parser );
+        parse_us.push_back( elapsed_us( start ) );
+        instructions   = parser.statements();
+        function_names = parser.function_names();
+      }
+
+      if ( ok ) {
+        if ( fold ) {
+          fold_constants( instructions, nullptr );
+        }
+        if ( branches ) {
+          simplify_branches( instructions, nullptr );
+        }
+        if ( dce ) {
+          eliminate_dead_code( instructions, nullptr );
+        }
+        if ( ir ) {
+          ir_pass_manager_type passes;
+          passes.add( "gvn" );
+          passes.add( "licm" );
+          passes.run( instructions, nullptr );
+        }
+        if ( fuse ) {
+          fuse_superinstructions( instructions );
+        }
+        const program_type program( instructions, function_names );
+
+        auto start = std::chrono::steady_clock::now();
+        ok = evaluate( program, context, options );
+        evaluate_us.push_back( elapsed_us( start ) );
+      }
+    }
+
+    if ( !ok ) {
+      std::cerr << "ERROR: " << workload.name << " failed\n";
+      all_ok = false;
+    }
+
+    out << "    {\n"
+        << "      \"name\": " << json_string( workload.name ) << ",\n"
+        << "      \"ok\": " << ( ok ? "true" : "false" ) << ",\n"
+        << "      \"source_bytes\": " << workload.source.size() << ",\n"
+        << "      \"tokens\": " << tokens << ",\n"
+        << "      \"instructions\": " << instructions.size() << ",\n";
+    write_stats( out, "lex", summarize( lex_us ) );
+    out << ",\n";
+    write_stats( out, "parse", summarize( parse_us ) );
+    out << ",\n";
+    write_stats( out, "evaluate", summarize( evaluate_us ) );
+    out << "\n    }" << ( ( w + 1U < workloads.size() ) ? "," : "" ) << "\n";
+  }
+
+  out << "  ]\n"
+      << "}\n";
+
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmark: lane-parallel batch evaluation
+//
+// Runs a branch-free formula over generated rows with run_batch(), once
+// one row at a time (the scalar engine) and once lane_program_type::LANES
+// rows at a time (see lanes.h), on one thread, and reports rows/s and
+// the speedup. Both runs do the same operations in the same order, so
+// their outputs must match exactly.
+//
+// usage: lane_bench.out [--rows=N] [--runs=N]
+//
+// build: g++ -O2 -std=c++17 -pthread -Isrc -o lane_bench.out bench/lane_bench.cpp src/batch.cpp src/data_stack_type.cpp src/evaluate.cpp src/jit.cpp src/lanes.cpp src/loop_trace.cpp src/parser_type.cpp
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+
+namespace {
+
+  const char *SCRIPT =
+    "double total = price * qty * ( 1 + rate );\n"
+    "double discount = ( total > 500 ) * total / 10;\n"
+    "double net = total - discount;\n"
+    "double flagged = ( net > 1000 ) + ( rate == 0 ) * ( qty > 5 ) + !( price < 100 );\n";
+
+
+  bool time_batch(
+                  const batch_program_type             &batch_program
+                 ,const std::vector<batch_column_type> &inputs
+                 ,bool                                  lanes
+                 ,size_t                                runs
+                 ,std::vector<batch_column_type>       &outputs
+                 ,double                               &rate
+                 )
+  {
+    batch_options_type options;
+    options.lanes = lanes;
+
+    std::string error;
+    auto start_time = std::chrono::steady_clock::now();
+    for ( size_t run = 0U; run < runs; ++run ) {
+      if ( !run_batch( batch_program, inputs, outputs, options, error ) ) {
+        std::cerr << "ERROR: " << error << "\n";
+        return false;
+      }
+    }
+    auto elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+
+    rate = static_cast<double>( runs * inputs.front().values.size() ) / elapsed;
+    return true;
+  }
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+  size_t rows = 1000000U;
+  size_t runs = 5U;
+
+  for ( int iarg = 1; iarg < argc; ++iarg ) {
+    if ( std::strncmp( argv[iarg], "--rows=", 7U ) == 0 ) {
+      rows = std::strtoull( argv[iarg] + 7U, nullptr, 10 );
+    }
+    else if ( std::strncmp( argv[iarg], "--runs=", 7U ) == 0 ) {
+      runs = std::strtoull( argv[iarg] + 7U, nullptr, 10 );
+    }
+  }
+  if ( rows == 0U ) {
+    rows = 1U;
+  }
+  if ( runs == 0U ) {
+    runs = 1U;
+  }
+
+  std::vector<batch_column_type> inputs{ { "price", {} }, { "qty", {} }, { "rate", {} } };
+  for ( size_t row = 0U; row < rows; ++row ) {
+    inputs[0].values.push_back( 1.0 + static_cast<double>( row % 997U ) / 4.0 );
+    inputs[1].values.push_back( static_cast<double>( 1U + row % 7U ) );
+    inputs[2].values.push_back( static_cast<double>( row % 13U ) / 100.0 );
+  }
+
+  batch_program_type batch_program;
+  std::string        error;
+  if ( !compile_batch( SCRIPT, { { "price" }, { "qty" }, { "rate" } }, { "net", "flagged" }, batch_program, error ) ) {
+    std::cerr << "ERROR: " << error << "\n";
+    return 1;
+  }
+  if ( !batch_program.lanes ) {
+    std::cerr << "ERROR: formula cannot be run in lanes on this build\n";
+    return 1;
+  }
+
+  std::vector<batch_column_type> scalar_outputs;
+  std::vector<batch_column_type> lane_outputs;
+  double scalar_rate = 0.0;
+  double lane_rate   = 0.0;
+  if ( !time_batch( batch_program, inputs, false, runs, scalar_outputs, scalar_rate ) ||
+       !time_batch( batch_program, inputs, true,  runs, lane_outputs,   lane_rate ) ) {
+    return 1;
+  }
+
+  size_t mismatches = 0U;
+  for ( size_t i = 0U; i < scalar_outputs.size(); ++i ) {
+    for ( size_t row = 0U; row < rows; ++row ) {
+      if ( std::memcmp( &( scalar_outputs[i].values[row] ), &( lane_outputs[i].values[row] ), sizeof( double ) ) != 0 ) {
+        ++mismatches;
+      }
+    }
+  }
+
+  std::cout << "scalar:               " << scalar_rate << " rows/s\n";
+  std::cout << "lanes (" << lane_program_type::LANES << " wide, " << ( batch_program.lanes->avx2() ? "AVX2" : "SSE2" ) << "): " << lane_rate << " rows/s\n";
+  std::cout << "speedup:              " << lane_rate / scalar_rate << "\n";
+  if ( mismatches != 0U ) {
+    std::cout << mismatches << " output(s) differ\n";
+  }
+
+  std::cout << ( mismatches == 0U ? "PASS" : "FAIL" ) << "\n";
+  return ( mismatches == 0U ) ? 0 : 1;
+}
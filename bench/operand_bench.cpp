@@ -0,0 +1,146 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Microbenchmark: e-stack operand layout
+//
+// Evaluates a right-leaning "deep" expression, 1 + (1 + (1 + ...)), the
+// way evaluate() does: every operand is pushed before the first add, so
+// the e-stack grows to the expression depth, and then it is reduced back
+// down. This is run with the legacy 32-byte operand and the 8-byte
+// (NaN-boxed) operand_data_type, for a range of depths, so the point at
+// which each falls out of cache can be seen.
+//
+// build: g++ -O2 -std=c++17 -Isrc -o operand_bench.out bench/operand_bench.cpp
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "operand_data_type.h"
+
+
+namespace {
+
+  // the e-stack operand as it was before NaN-boxing
+  //
+  struct legacy_operand_data_type {
+    explicit legacy_operand_data_type( double in_value )
+      :value{ in_value }
+      ,ivalue{}
+      ,addr{}
+      ,type{ OPERAND_TYPE_DOUBLE }
+    {}
+
+    void set_value( double in_value )
+    {
+      value = in_value;
+      type  = OPERAND_TYPE_DOUBLE;
+    }
+
+    double value_() const { return value; }
+
+    double       value;
+    int          ivalue;
+    size_t       addr;
+    operand_type type;
+  };
+
+
+  struct boxed_operand_data_type : public operand_data_type {
+    explicit boxed_operand_data_type( double in_value ) : operand_data_type( in_value ) {}
+    double value_() const { return value(); }
+  };
+
+
+  template<typename Operand>
+  double run( std::vector<Operand> &stack, size_t depth, size_t repeat )
+  {
+    double total = 0.0;
+    for ( size_t r=0U; r<repeat; ++r ) {
+      stack.clear();
+      for ( size_t i=0U; i<depth; ++i ) {
+        stack.push_back( Operand( 1.0 ) );
+      }
+      while ( stack.size() > 1U ) {
+        double value1 = (stack.rbegin() + 1U)->value_();
+        double value2 = (stack.rbegin()     )->value_();
+        stack.pop_back();
+        stack.back().set_value( value1 + value2 );
+      }
+      total += stack.back().value_();
+    }
+    return total;
+  }
+
+
+  template<typename Operand>
+  double time_ns_per_op( size_t depth, size_t ops )
+  {
+    std::vector<Operand> stack;
+    stack.reserve( depth );
+
+    size_t repeat = ops / depth + 1U;
+
+    run( stack, depth, 1U ); // warm up
+
+    auto start = std::chrono::steady_clock::now();
+    double total = run( stack, depth, repeat );
+    auto elapsed = std::chrono::duration<double,std::nano>( std::chrono::steady_clock::now() - start );
+
+    if ( total != static_cast<double>( depth * repeat ) ) {
+      std::cerr << "ERROR: bad result\n";
+      std::exit( 1 );
+    }
+
+    return elapsed.count() / static_cast<double>( repeat * depth * 2U );
+  }
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+  size_t ops = 100000000U;
+  if ( argc > 1 ) {
+    ops = std::strtoull( argv[1], nullptr, 10 );
+  }
+
+  std::cout << "operand size: legacy " << sizeof( legacy_operand_data_type )
+            << " bytes, boxed " << sizeof( boxed_operand_data_type ) << " bytes\n";
+  std::cout << "depth\tlegacy-KiB\tboxed-KiB\tlegacy-ns/op\tboxed-ns/op\n";
+
+  for ( size_t depth = 16U; depth <= (16U << 20); depth *= 4U ) {
+    double legacy = time_ns_per_op<legacy_operand_data_type>( depth, ops );
+    double boxed  = time_ns_per_op<boxed_operand_data_type>( depth, ops );
+
+    std::cout << depth
+              << "\t" << depth * sizeof( legacy_operand_data_type ) / 1024U
+              << "\t" << depth * sizeof( boxed_operand_data_type ) / 1024U
+              << "\t" << legacy
+              << "\t" << boxed
+              << "\n";
+  }
+
+  return 0;
+}
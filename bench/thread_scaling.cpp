@@ -0,0 +1,197 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Thread scaling (and stress) check for shared programs
+//
+// Parses a script once into a program_type, then for 1, 2, ... N threads
+// has every thread evaluate that same program repeatedly, each in its own
+// vm_context_type writing to its own string stream. Every run's output is
+// compared with a single-threaded reference run, so any state leaking
+// between threads shows up as a mismatch. Reports runs/s and the speedup
+// over one thread.
+//
+// usage: thread_scaling.out [script] [--max-threads=N] [--runs=N] [--jit]
+//
+// build: g++ -O2 -std=c++17 -pthread -Isrc -o thread_scaling.out bench/thread_scaling.cpp src/data_stack_type.cpp src/evaluate.cpp src/jit.cpp src/loop_trace.cpp src/parser_type.cpp
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "evaluate.h"
+#include "parser_type.h"
+
+
+namespace {
+
+  const char *DEFAULT_SCRIPT =
+    "fn double fib( double n ) {\n"
+    "  if ( n < 2 ) {\n"
+    "    return n;\n"
+    "  }\n"
+    "  return fib( n - 1 ) + fib( n - 2 );\n"
+    "}\n"
+    "double i = 0;\n"
+    "double total = 0;\n"
+    "while ( i < 10 ) {\n"
+    "  total = total + fib( 15 + i / 4 );\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "total;\n";
+
+
+  bool parse( const std::string &script, std::vector<instruction_type> &instructions )
+  {
+    parser_type parser;
+    for ( char c : script ) {
+      if ( !parser.parse_char( c ) ) {
+        return false;
+      }
+    }
+    if ( !parser.parse_char( '\0' ) ) {
+      return false;
+    }
+    instructions = parser.statements();
+    return true;
+  }
+
+
+  bool run_once( const program_type &program, vm_context_type &context, std::ostringstream &out, const evaluate_options_type &options )
+  {
+    out.str( std::string() );
+    out.clear();
+    return evaluate( program, context, options );
+  }
+
+}
+
+
+int main( int argc, char* argv[] )
+{
+  std::string script      = DEFAULT_SCRIPT;
+  size_t      max_threads = std::thread::hardware_concurrency();
+  size_t      runs        = 200U;
+
+  evaluate_options_type options;
+  options.trace = false;
+
+  for ( int iarg = 1; iarg < argc; ++iarg ) {
+    if ( std::strncmp( argv[iarg], "--max-threads=", 14U ) == 0 ) {
+      max_threads = std::strtoull( argv[iarg] + 14U, nullptr, 10 );
+    }
+    else if ( std::strncmp( argv[iarg], "--runs=", 7U ) == 0 ) {
+      runs = std::strtoull( argv[iarg] + 7U, nullptr, 10 );
+    }
+    else if ( std::strcmp( argv[iarg], "--jit" ) == 0 ) {
+      options.jit = true;
+    }
+    else {
+      std::ifstream file( argv[iarg] );
+      if ( !file ) {
+        std::cerr << "ERROR: could not open " << argv[iarg] << "\n";
+        return 1;
+      }
+      std::stringstream contents;
+      contents << file.rdbuf();
+      script = contents.str();
+    }
+  }
+  if ( max_threads == 0U ) {
+    max_threads = 1U;
+  }
+  if ( runs == 0U ) {
+    runs = 1U;
+  }
+
+  std::vector<instruction_type> instructions;
+  if ( !parse( script, instructions ) ) {
+    std::cerr << "ERROR: parse error\n";
+    return 1;
+  }
+  const program_type program( instructions );
+
+  // Reference output, from a single run on this thread
+  //
+  std::ostringstream reference_out;
+  vm_context_type    reference_context( data_stack_type::DEFAULT_MAX_SIZE, reference_out );
+  if ( !run_once( program, reference_context, reference_out, options ) ) {
+    std::cerr << "ERROR: evaluation error at instruction " << reference_context.pc << "\n";
+    return 1;
+  }
+  const std::string reference = reference_out.str();
+
+  double single_rate = 0.0;
+  bool   ok          = true;
+
+  // 1, 2, 4, ... threads, always finishing with max_threads
+  //
+  std::vector<size_t> thread_counts;
+  for ( size_t thread_count = 1U; thread_count < max_threads; thread_count *= 2U ) {
+    thread_counts.push_back( thread_count );
+  }
+  thread_counts.push_back( max_threads );
+
+  for ( size_t thread_count : thread_counts ) {
+    std::atomic<size_t> mismatches( 0U );
+    std::vector<std::thread> threads;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for ( size_t t = 0U; t < thread_count; ++t ) {
+      threads.emplace_back( [&]() {
+        std::ostringstream out;
+        vm_context_type    context( data_stack_type::DEFAULT_MAX_SIZE, out );
+        for ( size_t run = 0U; run < runs; ++run ) {
+          if ( !run_once( program, context, out, options ) || ( out.str() != reference ) ) {
+            ++mismatches;
+          }
+        }
+      } );
+    }
+    for ( std::thread &thread : threads ) {
+      thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+
+    double rate = static_cast<double>( thread_count * runs ) / elapsed;
+    if ( thread_count == 1U ) {
+      single_rate = rate;
+    }
+
+    std::cout << thread_count << " thread(s): " << rate << " runs/s, speedup " << ( rate / single_rate );
+    if ( mismatches != 0U ) {
+      std::cout << ", " << mismatches << " run(s) FAILED";
+      ok = false;
+    }
+    std::cout << "\n";
+  }
+
+  std::cout << ( ok ? "PASS" : "FAIL" ) << "\n";
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+#include "batch.h"
+#include "parser_type.h"
+
+
+namespace {
+
+  struct shard_result_type {
+    bool    ok{ true };
+    size_t  failed_row{};
+    size_t  pc{};
+    bool    overflowed{};
+    bool    bad_input{};  // an int input that is not an int32 value
+    size_t  input{};      // (which one)
+  };
+
+
+  void run_shard(
+                 const batch_program_type             &batch_program
+                ,const std::vector<batch_column_type> &inputs
+                ,std::vector<batch_column_type>       &outputs
+                ,size_t                                begin
+                ,size_t                                end
+                ,const evaluate_options_type          &evaluate_options
+                ,const lane_program_type              *lanes
+                ,size_t                                dstack_max
+                ,shard_result_type                    &result
+                )
+  {
+    vm_context_type context( dstack_max );
+    context.results = nullptr;
+
+    if ( !context.data.valid() ) {
+      result.ok         = false;
+      result.failed_row = begin;
+      result.overflowed = true;
+      return;
+    }
+
+    auto run_row = [&]( size_t row ) {
+      context.reset();
+
+      bool row_ok = context.data.resize( batch_program.input_size );
+      if ( row_ok ) {
+        for ( size_t i = 0U; i < batch_program.inputs.size(); ++i ) {
+          const batch_variable_type &input = batch_program.inputs[i];
+          double value = inputs[i].values[row];
+          if ( input.type == OPERAND_TYPE_INT32 ) {
+            // truncated toward zero, as D2I does; NaN, infinite and
+            //  out-of-range values fail the row
+            //
+            if ( !std::isfinite( value ) || !( value > -2147483649.0 && value < 2147483648.0 ) ) {
+              row_ok = false;
+              if ( result.ok ) {
+                result.bad_input = true;
+                result.input     = i;
+              }
+              break;
+            }
+            int32_t ivalue = static_cast<int32_t>( value );
+            std::memcpy( &( context.data[input.addr] ), &ivalue, sizeof( ivalue ) );
+          }
+          else {
+            std::memcpy( &( context.data[input.addr] ), &value, sizeof( value ) );
+          }
+        }
+
+        if ( row_ok ) {
+          row_ok = evaluate( *batch_program.program, context, evaluate_options );
+        }
+      }
+
+      for ( size_t i = 0U; i < batch_program.outputs.size(); ++i ) {
+        const batch_variable_type &output = batch_program.outputs[i];
+        double value = std::numeric_limits<double>::quiet_NaN();
+        if ( row_ok ) {
+          if ( output.type == OPERAND_TYPE_INT32 ) {
+            int32_t ivalue;
+            std::memcpy( &ivalue, &( context.data[output.addr] ), sizeof( ivalue ) );
+            value = ivalue;
+          }
+          else {
+            std::memcpy( &value, &( context.data[output.addr] ), sizeof( value ) );
+          }
+        }
+        outputs[i].values[row] = value;
+      }
+
+      if ( !row_ok && result.ok ) {
+        result.ok         = false;
+        result.failed_row = row;
+        result.pc         = context.pc;
+        result.overflowed = context.data.overflowed();
+      }
+    };
+
+    size_t row = begin;
+
+    // Whole groups of rows in lanes; a group with a row that fails is run
+    //  again by the scalar engine, which finds the row (and its error)
+    //
+    if ( lanes ) {
+      const size_t        LANES = lane_program_type::LANES;
+      std::vector<double> registers( lanes->registers() * LANES, 0.0 );
+
+      for ( ; row + LANES <= end; row += LANES ) {
+        for ( size_t i = 0U; i < batch_program.inputs.size(); ++i ) {
+          double *input = &( registers[( batch_program.inputs[i].addr / 8U ) * LANES] );
+          for ( size_t lane = 0U; lane < LANES; ++lane ) {
+            input[lane] = inputs[i].values[row + lane];
+          }
+        }
+
+        if ( lanes->run( registers.data() ) ) {
+          for ( size_t i = 0U; i < batch_program.outputs.size(); ++i ) {
+            const double *output = &( registers[( batch_program.outputs[i].addr / 8U ) * LANES] );
+            for ( size_t lane = 0U; lane < LANES; ++lane ) {
+              outputs[i].values[row + lane] = output[lane];
+            }
+          }
+        }
+        else {
+          for ( size_t lane = 0U; lane < LANES; ++lane ) {
+            run_row( row + lane );
+          }
+        }
+      }
+    }
+
+    for ( ; row < end; ++row ) {
+      run_row( row );
+    }
+  }
+}
+
+
+batch_pool_type::~batch_pool_type()
+{
+  {
+    std::lock_guard<std::mutex> lock( mutex_ );
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for ( std::thread &thread : threads_ ) {
+    thread.join();
+  }
+}
+
+
+void batch_pool_type::run( const std::vector<std::function<void()>> &tasks )
+{
+  if ( tasks.empty() ) {
+    return;
+  }
+
+  size_t unfinished = tasks.size() - 1U;
+  if ( unfinished != 0U ) {
+    std::lock_guard<std::mutex> lock( mutex_ );
+    for ( size_t t = 1U; t < tasks.size(); ++t ) {
+      queue_.push_back( std::make_pair( tasks[t], &unfinished ) );
+    }
+
+    // enough workers for every queued task to run at once
+    //
+    while ( idle_ < queue_.size() ) {
+      threads_.emplace_back( &batch_pool_type::work, this );
+      ++idle_;
+    }
+  }
+  work_ready_.notify_all();
+
+  tasks[0]();
+
+  std::unique_lock<std::mutex> lock( mutex_ );
+  work_done_.wait( lock, [&unfinished]() { return unfinished == 0U; } );
+}
+
+
+size_t batch_pool_type::workers() const
+{
+  std::lock_guard<std::mutex> lock( mutex_ );
+  return threads_.size();
+}
+
+
+void batch_pool_type::work()
+{
+  std::unique_lock<std::mutex> lock( mutex_ );
+  for ( ;; ) {
+    work_ready_.wait( lock, [this]() { return stopping_ || !queue_.empty(); } );
+    if ( queue_.empty() ) {
+      return;
+    }
+
+    std::pair<std::function<void()>,size_t*> task( std::move( queue_.front() ) );
+    queue_.pop_front();
+    --idle_;
+
+    lock.unlock();
+    task.first();
+    lock.lock();
+
+    ++idle_;
+    if ( --*task.second == 0U ) {
+      work_done_.notify_all();
+    }
+  }
+}
+
+
+batch_pool_type &default_batch_pool()
+{
+  static batch_pool_type pool;
+  return pool;
+}
+
+
+bool compile_batch(
+                   const std::string                      &script
+                  ,const std::vector<batch_variable_type> &inputs
+                  ,const std::vector<std::string>         &outputs
+                  ,batch_program_type                     &batch_program
+                  ,std::string                            &error
+                  )
+{
+  parser_type parser;
+
+  for ( const batch_variable_type &input : inputs ) {
+    if ( !parser.declare_global( input.name, input.type ) ) {
+      error = "input '" + input.name + "' is not a valid variable name, or is repeated";
+      return false;
+    }
+  }
+  size_t input_size = parser.data_size();
+
+  for ( char c : script ) {
+    if ( !parser.parse_char( c ) ) {
+      error = "parse error";
+      return false;
+    }
+  }
+  if ( !parser.parse_char( '\0' ) ) {
+    error = "parse error";
+    return false;
+  }
+
+  batch_program.inputs.clear();
+  for ( const batch_variable_type &input : inputs ) {
+    const symbol_table_data_type *symbol = parser.find_global( input.name );
+    batch_program.inputs.push_back( batch_variable_type{ input.name, symbol->value_type, symbol->addr } );
+  }
+
+  batch_program.outputs.clear();
+  for ( const std::string &name : outputs ) {
+    const symbol_table_data_type *symbol = parser.find_global( name );
+    if ( !symbol || ( symbol->type != SYMBOL_TYPE_VARIABLE ) ) {
+      error = "output '" + name + "' is not a global variable";
+      return false;
+    }
+    batch_program.outputs.push_back( batch_variable_type{ name, symbol->value_type, symbol->addr } );
+  }
+
+  batch_program.program.reset( new program_type( parser.statements(), parser.function_names() ) );
+  batch_program.input_size = input_size;
+
+  // Lanes only hold doubles
+  //
+  batch_program.lanes.reset( new lane_program_type );
+  bool all_doubles = true;
+  for ( const batch_variable_type &variable : batch_program.inputs ) {
+    all_doubles &= ( variable.type == OPERAND_TYPE_DOUBLE );
+  }
+  for ( const batch_variable_type &variable : batch_program.outputs ) {
+    all_doubles &= ( variable.type == OPERAND_TYPE_DOUBLE );
+  }
+  if ( !all_doubles || !batch_program.lanes->compile( batch_program.program->instructions(), input_size ) ) {
+    batch_program.lanes.reset();
+  }
+
+  return true;
+}
+
+
+bool run_batch(
+               const batch_program_type             &batch_program
+              ,const std::vector<batch_column_type> &inputs
+              ,std::vector<batch_column_type>       &outputs
+              ,const batch_options_type             &options
+              ,std::string                          &error
+              )
+{
+  if ( !batch_program.program ) {
+    error = "batch program is not compiled";
+    return false;
+  }
+  if ( inputs.size() != batch_program.inputs.size() ) {
+    error = "expected " + std::to_string( batch_program.inputs.size() ) + " input column(s)";
+    return false;
+  }
+
+  size_t rows = inputs.empty() ? 0U : inputs.front().values.size();
+  for ( size_t i = 0U; i < inputs.size(); ++i ) {
+    if ( inputs[i].values.size() != rows ) {
+      error = "input column '" + inputs[i].name + "' has a different number of rows";
+      return false;
+    }
+  }
+
+  outputs.resize( batch_program.outputs.size() );
+  for ( size_t i = 0U; i < outputs.size(); ++i ) {
+    outputs[i].name = batch_program.outputs[i].name;
+    outputs[i].values.assign( rows, 0.0 );
+  }
+
+  // Each row starts from the inputs just stored; nothing is traced or
+  //  printed. The switch engine is used, as the threaded engine, JIT and
+  //  loop tracer are all set up again by every evaluate() call, i.e. for
+  //  every row
+  //
+  evaluate_options_type evaluate_options;
+  evaluate_options.engine        = EVALUATE_ENGINE_TYPE_SWITCH;
+  evaluate_options.trace         = false;
+  evaluate_options.checks        = options.checks;
+  evaluate_options.reset_context = false;
+
+  size_t threads = options.threads;
+  if ( threads == 0U ) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if ( threads > rows ) {
+    threads = rows;
+  }
+  if ( threads == 0U ) {
+    threads = 1U;
+  }
+
+  std::vector<shard_result_type> results( threads );
+
+  const lane_program_type *lanes = options.lanes ? batch_program.lanes.get() : nullptr;
+
+  std::vector<std::function<void()>> shards;
+  for ( size_t t = 0U; t < threads; ++t ) {
+    size_t begin = rows * t / threads;
+    size_t end   = rows * ( t + 1U ) / threads;
+    shards.push_back( [&, begin, end, t]() {
+      run_shard( batch_program, inputs, outputs, begin, end, evaluate_options, lanes, options.dstack_max, results[t] );
+    } );
+  }
+
+  batch_pool_type &pool = options.pool ? *options.pool : default_batch_pool();
+  pool.run( shards );
+
+  // shards are in row order, so the first failure found is the first
+  //  failing row
+  //
+  for ( const shard_result_type &result : results ) {
+    if ( !result.ok ) {
+      error = "row " + std::to_string( result.failed_row ) + ": ";
+      if ( result.bad_input ) {
+        error += "input '" + inputs[ result.input ].name + "' is not an int32 value";
+      }
+      else if ( result.overflowed ) {
+        error += "d-stack overflow";
+      }
+      else {
+        error += "evaluation error at instruction " + std::to_string( result.pc );
+      }
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "evaluate.h"
+#include "lanes.h"
+#include "operand_data_type.h"
+#include "program.h"
+
+
+// Batch evaluation: compile a script once, then run it for every row of
+//  a table of inputs, collecting outputs.
+//
+// Inputs are global variables declared ahead of the script (so the
+//  script uses them without declaring them); before each row, they are
+//  stored at the bottom of the d-stack. Outputs are globals the script
+//  declares, read back from the d-stack when the row finishes.
+//
+// Each worker reuses one vm_context_type for all its rows: the d-stack
+//  and e-stack keep their space, and results are not printed. Programs
+//  with no branches that only use doubles run several rows at a time
+//  instead (see lanes.h).
+//
+
+// A column of a batch: one value per row. int inputs are converted
+//  from the column values, truncating toward zero; a value that is NaN,
+//  infinite or out of int32 range fails its row. int outputs are stored
+//  as doubles
+//
+struct batch_column_type {
+  std::string          name;
+  std::vector<double>  values;
+};
+
+
+// A global variable used as an input or output
+//
+struct batch_variable_type {
+  std::string   name;
+  operand_type  type{ OPERAND_TYPE_DOUBLE };
+  size_t        addr{};
+};
+
+
+struct batch_program_type {
+  std::unique_ptr<program_type>      program;
+  std::vector<batch_variable_type>   inputs;
+  std::vector<batch_variable_type>   outputs;
+
+  // bytes of d-stack the inputs take up
+  //
+  size_t                             input_size{};
+
+  // the same program, run in lanes; null if it cannot be (see lanes.h)
+  //
+  std::unique_ptr<lane_program_type> lanes;
+};
+
+
+// Long-lived worker threads that run_batch() shards rows across, so
+//  that callers running many small batches do not start threads for
+//  each one. Workers are started as they are first needed, and stopped
+//  when the pool is destroyed. A pool can be shared by several threads
+//  calling run_batch() at once
+//
+class batch_pool_type {
+
+  public:
+    batch_pool_type() :stopping_( false ), idle_( 0U ) {}
+    ~batch_pool_type();
+
+    batch_pool_type( const batch_pool_type & ) = delete;
+    batch_pool_type &operator=( const batch_pool_type & ) = delete;
+
+    // Run the tasks, in parallel on the workers, and wait for them all
+    //  to finish
+    //
+    void run( const std::vector<std::function<void()>> &tasks );
+
+    size_t workers() const;
+
+  private:
+    void work();
+
+    mutable std::mutex                                  mutex_;
+    std::condition_variable                             work_ready_;
+    std::condition_variable                             work_done_;
+    std::deque<std::pair<std::function<void()>,size_t*>> queue_;  // (task, its run()'s count of unfinished tasks)
+    std::vector<std::thread>                            threads_;
+    bool                                                stopping_;
+    size_t                                              idle_;
+};
+
+
+// The pool run_batch() uses when none is given: process-wide, and
+//  stopped at exit
+//
+batch_pool_type &default_batch_pool();
+
+
+struct batch_options_type {
+  // rows are split into this many contiguous shards: the first is run on
+  //  the calling thread, the rest on pool workers; 0 means one per
+  //  hardware thread
+  //
+  size_t  threads{ 1U };
+
+  // the workers; null for default_batch_pool()
+  //
+  batch_pool_type *pool{};
+
+  size_t  dstack_max{ data_stack_type::DEFAULT_MAX_SIZE };
+  bool    checks{ true };
+
+  // run rows lane_program_type::LANES at a time, if the program can be
+  //  run in lanes
+  //
+  bool    lanes{ true };
+};
+
+
+// Compile script, with inputs (name and type; addr is ignored) declared
+//  ahead of it, and outputs (names of globals the script declares) to
+//  collect. Returns false, with a message in error, if the script does
+//  not parse or an input/output is not valid
+//
+bool compile_batch(
+                   const std::string                      &script
+                  ,const std::vector<batch_variable_type> &inputs
+                  ,const std::vector<std::string>         &outputs
+                  ,batch_program_type                     &batch_program
+                  ,std::string                            &error
+                  );
+
+
+// Run batch_program once per row. inputs has one column per program
+//  input, in the same order, all the same length; outputs is set to one
+//  column per program output. Returns false, with a message in error, if
+//  the columns do not match or any row fails to evaluate (the first
+//  failing row is reported; the outputs of failed rows are NaN)
+//
+bool run_batch(
+               const batch_program_type             &batch_program
+              ,const std::vector<batch_column_type> &inputs
+              ,std::vector<batch_column_type>       &outputs
+              ,const batch_options_type             &options
+              ,std::string                          &error
+              );
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cfg.h"
+
+
+bool is_control_transfer( instruction_id_type id )
+{
+  return jump_type_of( id ) != JUMP_TYPE_NONE || id == INSTRUCTION_ID_TYPE_RETURN;
+}
+
+
+bool falls_through( instruction_id_type id )
+{
+  switch ( id ) {
+  case INSTRUCTION_ID_TYPE_JMP:
+  case INSTRUCTION_ID_TYPE_JMPA:
+  case INSTRUCTION_ID_TYPE_TAILCALL:
+  case INSTRUCTION_ID_TYPE_RETURN:
+    return false;
+  default:
+    return true;
+  }
+}
+
+
+std::vector<bool> find_entry_points( const std::vector<instruction_type> &instructions )
+{
+  std::vector<bool> is_entry( instructions.size() + 1U, false );
+
+  for ( size_t i=0U; i<instructions.size(); ++i ) {
+    int64_t target;
+    if ( jump_target_of( instructions[i], i, &target )
+      && target >= 0 && target <= static_cast<int64_t>( instructions.size() ) ) {
+      is_entry[ target ] = true;
+    }
+
+    // return point
+    //
+    if ( instructions[i].id == INSTRUCTION_ID_TYPE_CALL ) {
+      is_entry[ i + 1U ] = true;
+    }
+  }
+
+  return is_entry;
+}
+
+
+std::vector<basic_block_type> build_cfg(
+                                        const std::vector<instruction_type> &instructions
+                                       ,bool                                 follow_calls
+                                       ,std::vector<size_t>                 *block_of
+                                       )
+{
+  std::vector<bool> is_leader( find_entry_points( instructions ) );
+  is_leader[0] = true;
+  for ( size_t i=0U; i<instructions.size(); ++i ) {
+    if ( is_control_transfer( instructions[i].id ) ) {
+      is_leader[ i + 1U ] = true;
+    }
+  }
+
+  std::vector<basic_block_type> blocks;
+  std::vector<size_t>           block( instructions.size() + 1U, 0U );
+  for ( size_t i=0U; i<instructions.size(); ++i ) {
+    if ( is_leader[i] ) {
+      blocks.emplace_back();
+      blocks.back().begin = i;
+    }
+    blocks.back().end = i + 1U;
+    block[i] = blocks.size() - 1U;
+  }
+  block[ instructions.size() ] = blocks.size();  // falling off the end
+
+  for ( basic_block_type &b : blocks ) {
+    const size_t              last = b.end - 1U;
+    const instruction_id_type id   = instructions[last].id;
+    int64_t                   target;
+    if ( ( follow_calls || id != INSTRUCTION_ID_TYPE_CALL )
+      && jump_target_of( instructions[last], last, &target )
+      && target >= 0 && target < static_cast<int64_t>( instructions.size() ) ) {
+      b.successors.push_back( block[ target ] );
+    }
+    if ( falls_through( id ) && b.end < instructions.size() ) {
+      b.successors.push_back( block[ b.end ] );
+    }
+  }
+
+  if ( block_of ) {
+    block_of->swap( block );
+  }
+  return blocks;
+}
+
+
+std::vector<bool> reachable_blocks( const std::vector<basic_block_type> &blocks, size_t from )
+{
+  std::vector<bool>   reached( blocks.size(), false );
+  std::vector<size_t> work;
+  if ( from < blocks.size() ) {
+    reached[from] = true;
+    work.push_back( from );
+  }
+  while ( !work.empty() ) {
+    const size_t b = work.back();
+    work.pop_back();
+    for ( size_t s : blocks[b].successors ) {
+      if ( !reached[s] ) {
+        reached[s] = true;
+        work.push_back( s );
+      }
+    }
+  }
+  return reached;
+}
+
+
+void remap_jumps(
+                 std::vector<instruction_type> &out
+                ,const std::vector<size_t>     &old_index
+                ,const std::vector<size_t>     &new_index
+                )
+{
+  const int64_t old_size = static_cast<int64_t>( new_index.size() ) - 1;
+
+  for ( size_t k=0U; k<out.size(); ++k ) {
+    int64_t target;
+    if ( !jump_target_of( out[k], old_index[k], &target )
+      || target < 0 || target > old_size ) {
+      continue;
+    }
+
+    switch ( jump_type_of( out[k].id ) ) {
+    case JUMP_TYPE_RELATIVE:
+      out[k].arg.i32 = static_cast<int32_t>( new_index[ target ] ) - static_cast<int32_t>( k );
+      break;
+    case JUMP_TYPE_RELATIVE_ARG2:
+      out[k].arg2    = static_cast<int32_t>( new_index[ target ] ) - static_cast<int32_t>( k );
+      break;
+    case JUMP_TYPE_ABSOLUTE:
+      out[k].arg.sz  = new_index[ target ];
+      break;
+    case JUMP_TYPE_NONE:
+      break;
+    }
+  }
+}
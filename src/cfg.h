@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "instruction_type.h"
+
+
+// A basic block: instructions [begin, end), entered only at begin
+//
+struct basic_block_type {
+  size_t              begin{};
+  size_t              end{};
+  std::vector<size_t> successors;  // block indices
+};
+
+
+// Does the instruction end a basic block (a jump, call or return)?
+//
+bool is_control_transfer( instruction_id_type id );
+
+
+// Can control pass from the instruction to the next one?
+//
+bool falls_through( instruction_id_type id );
+
+
+// Instructions that can be entered other than by falling through from
+//  the previous one: jump and call targets, and return points
+//
+std::vector<bool> find_entry_points( const std::vector<instruction_type> &instructions );
+
+
+// Split the instructions into basic blocks, and link them. With
+//  follow_calls, a call's successors include the callee's entry (so the
+//  graph covers the whole program); without, they are only the return
+//  point (so each function's graph is separate). block_of, if given,
+//  receives the block of each instruction (and one past the last block
+//  for the end of the instructions)
+//
+std::vector<basic_block_type> build_cfg(
+                                        const std::vector<instruction_type> &instructions
+                                       ,bool                                 follow_calls
+                                       ,std::vector<size_t>                 *block_of
+                                       );
+
+
+// Blocks reachable from the given one
+//
+std::vector<bool> reachable_blocks( const std::vector<basic_block_type> &blocks, size_t from );
+
+
+// Remap the jumps in out, where out[k] was at old_index[k] and original
+//  instruction i (of new_index.size() - 1) is now at new_index[i]. Jump
+//  targets are taken relative to the original index
+//
+void remap_jumps(
+                 std::vector<instruction_type> &out
+                ,const std::vector<size_t>     &old_index
+                ,const std::vector<size_t>     &new_index
+                );
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define SINTERP_MMAP 1
+#endif
+
+#include <cstdlib>
+
+#include "data_stack_type.h"
+
+
+namespace {
+
+  size_t page_size()
+  {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return info.dwPageSize;
+#elif defined(SINTERP_MMAP)
+    return static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+#else
+    return 4096U;
+#endif
+  }
+
+
+#if defined(_WIN32)
+  // Pages are committed this many bytes at a time, so that a growing
+  //  stack does not call VirtualAlloc() for every page
+  //
+  const size_t COMMIT_CHUNK = 256U * 1024U;
+#endif
+
+}
+
+
+data_stack_type::data_stack_type( size_t max_size )
+  :base_{}
+  ,size_{}
+  ,max_size_{ max_size }
+  ,reserved_size_{}
+  ,committed_size_{}
+  ,high_water_mark_{}
+  ,overflowed_{}
+{
+  // Round up to a whole number of pages, and add the guard page
+  //
+  const size_t page = page_size();
+  const size_t usable_size = ( max_size + page - 1U ) / page * page;
+  reserved_size_ = usable_size + page;
+
+#if defined(_WIN32)
+  // Reserved only: nothing but the guard page is charged against the
+  //  commit limit until resize() commits it
+  //
+  void *p = VirtualAlloc( nullptr, reserved_size_, MEM_RESERVE, PAGE_NOACCESS );
+  if ( p ) {
+    VirtualAlloc( static_cast<char*>( p ) + usable_size, page, MEM_COMMIT, PAGE_NOACCESS );
+    base_ = static_cast<char*>( p );
+  }
+#elif defined(SINTERP_MMAP)
+  // Pages are only backed by memory once they are touched, so reserving
+  //  a large maximum costs nothing up front
+  //
+  void *p = mmap( nullptr, reserved_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+  if ( p != MAP_FAILED ) {
+    mprotect( static_cast<char*>( p ) + usable_size, page, PROT_NONE );
+    base_ = static_cast<char*>( p );
+  }
+#else
+  // No virtual memory API; no guard page either
+  //
+  base_ = static_cast<char*>( std::malloc( reserved_size_ ) );
+#endif
+
+#if !defined(_WIN32)
+  committed_size_ = base_ ? max_size_ : 0U;
+#endif
+}
+
+
+bool data_stack_type::commit( size_t new_size )
+{
+#if defined(_WIN32)
+  if ( !base_ ) {
+    return false;
+  }
+
+  const size_t page        = page_size();
+  const size_t usable_size = reserved_size_ - page;
+
+  size_t end = ( new_size + COMMIT_CHUNK - 1U ) / COMMIT_CHUNK * COMMIT_CHUNK;
+  if ( end > usable_size ) {
+    end = usable_size;
+  }
+  if ( !VirtualAlloc( base_ + committed_size_, end - committed_size_, MEM_COMMIT, PAGE_READWRITE ) ) {
+    return false;
+  }
+
+  committed_size_ = end;
+  return true;
+#else
+  ( void )new_size;
+  return false;
+#endif
+}
+
+
+data_stack_type::~data_stack_type()
+{
+  if ( !base_ ) {
+    return;
+  }
+
+#if defined(_WIN32)
+  VirtualFree( base_, 0, MEM_RELEASE );
+#elif defined(SINTERP_MMAP)
+  munmap( base_, reserved_size_ );
+#else
+  std::free( base_ );
+#endif
+}
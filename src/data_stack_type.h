@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+
+// The "data stack" (d-stack): globals, function args, return values,
+//  locals, and call bookkeeping (return address, caller's stack frame
+//  base).
+//
+// The whole stack is reserved as one block of virtual memory up front, so
+//  it never moves, and growing or shrinking it just moves the end. New
+//  space is not zero-filled. A PROT_NONE guard page above the maximum size
+//  catches any stray access past the end; growing beyond the maximum size
+//  fails (and sets overflowed()) rather than reallocating.
+//
+// On POSIX systems the reservation is MAP_NORESERVE, and pages are only
+//  backed as they are touched. Windows has no such mapping, so there the
+//  region is only reserved, and pages are committed, in chunks, as the
+//  end of the stack first grows over them.
+//
+class data_stack_type {
+
+  public:
+    static constexpr size_t DEFAULT_MAX_SIZE = 64U * 1024U * 1024U;
+
+    explicit data_stack_type( size_t max_size = DEFAULT_MAX_SIZE );
+    ~data_stack_type();
+
+    data_stack_type( const data_stack_type & ) = delete;
+    data_stack_type &operator=( const data_stack_type & ) = delete;
+
+    // false if the stack could not be reserved
+    //
+    bool valid() const { return base_ != nullptr; }
+
+    char       *data()       { return base_; }
+    const char *data() const { return base_; }
+
+    size_t size() const { return size_; }
+
+    char       &operator[]( size_t i )       { return base_[i]; }
+    const char &operator[]( size_t i ) const { return base_[i]; }
+
+    // Move the end of the stack. Returns false (leaving the size
+    //  unchanged) if new_size exceeds the maximum size, or the memory
+    //  for it cannot be committed
+    //
+    bool resize( size_t new_size )
+    {
+      if ( new_size > max_size_ || ( new_size > committed_size_ && !commit( new_size ) ) ) {
+        overflowed_ = true;
+        return false;
+      }
+      size_ = new_size;
+      if ( size_ > high_water_mark_ ) {
+        high_water_mark_ = size_;
+      }
+      return true;
+    }
+
+    size_t max_size()        const { return max_size_; }
+    size_t high_water_mark() const { return high_water_mark_; }
+    bool   overflowed()      const { return overflowed_; }
+
+    // Generated code (see jit.h) moves the end of the stack itself, and
+    //  needs the addresses of the fields resize() updates
+    //
+    size_t *size_address()            { return &size_; }
+    size_t *high_water_mark_address() { return &high_water_mark_; }
+
+  private:
+    // Commit pages up to at least new_size; false if they cannot be
+    //
+    bool commit( size_t new_size );
+
+    char   *base_;
+    size_t  size_;
+    size_t  max_size_;
+    size_t  reserved_size_;  // max_size_, plus padding and guard page
+    size_t  committed_size_; // usable without committing more (all of it, but on Windows)
+    size_t  high_water_mark_;
+    bool    overflowed_;
+};
@@ -20,630 +20,1342 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+
+#include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "evaluate.h"
+#include "operand_data_type.h"
+#include "profile.h"
+
+
+// Computed goto ("labels as values") is a GCC/Clang extension. Where it
+//  is not available, the threaded engine still runs from the pre-translated
+//  instructions, but dispatches through the switch
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define SINTERP_COMPUTED_GOTO 1
+#else
+#define SINTERP_COMPUTED_GOTO 0
+#endif
 
 
 namespace {
 
-  enum operand_type {
-     OPERAND_TYPE_DOUBLE
-    ,OPERAND_TYPE_INT32
-    ,OPERAND_TYPE_SIZET
+  // Initial e-stack capacity; deep enough that ordinary scripts never
+  //  reallocate it
+  //
+  const size_t EVALUATION_STACK_RESERVE = 1024U;
+
+
+  // An instruction, translated for the threaded engine. The handler
+  //  is resolved once, up front, so that dispatching to the next
+  //  instruction is a single indirect jump
+  //
+  struct threaded_instruction_type {
+    const void           *handler;
+    instruction_id_type   id;
+    int32_t               arg2;
+    instruction_arg_type  arg;
   };
 
-  struct operand_data_type {
-    explicit operand_data_type( double in_value )
-      :value{ in_value }
-      ,ivalue{}
-      ,addr{}
-      ,type{ OPERAND_TYPE_DOUBLE }
-    {}
-
-    explicit operand_data_type( int32_t in_ivalue )
-      :value{}
-      ,ivalue{ in_ivalue }
-      ,addr{}
-      ,type{ OPERAND_TYPE_INT32 }
-    {}
-
-    explicit operand_data_type( size_t in_addr )
-      :value{}
-      ,ivalue{}
-      ,addr{ in_addr }
-      ,type{ OPERAND_TYPE_SIZET }
-    {}
-
-    void set_value( double in_value )
-    {
-      value = in_value;
-      type  = OPERAND_TYPE_DOUBLE;
-    }
 
-    double       value;
-    int          ivalue;
-    size_t       addr;
-    operand_type type;
-  };
+  const void *handler_of( const threaded_instruction_type *iter ) { return iter->handler; }
+  const void *handler_of( const instruction_type * )              { return nullptr; }
 
-}
+  void set_handler( threaded_instruction_type *iter, const void *handler ) { iter->handler = handler; }
+  void set_handler( const instruction_type *, const void * )               {}
 
 
-bool evaluate(
-              const std::vector<instruction_type> &instructions
-             ,std::vector<char>                   &data
-             )
-{
-  // instructions is the sequence of operands to execute
-  // data is the "data stack" (d-stack)
+  // Translate instructions into threaded form. One extra (sentinel) instruction
+  //  is appended, which marks the end of the instruction stream.
+  //
+  // The threaded engine does not bounds-check the instruction index, so any
+  //  jump with a fixed destination is checked here instead
+  //
+  bool translate(
+                 const std::vector<instruction_type>     &instructions
+                ,std::vector<threaded_instruction_type> &threaded
+                )
+  {
+    threaded.clear();
+    threaded.reserve( instructions.size() + 1U );
 
-  // this is the evaluation stack, which holds the "working" state of
-  //  any computations
-  std::vector<std::vector<operand_data_type>> evaluation_stack{ std::vector<operand_data_type> };
-  size_t                                      stack_frame_base{};
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
 
-  size_t instr_index = 0U;
-  while ( instr_index < instructions.size() ) {
+      const instruction_type &instruction = instructions[i];
 
-    bool    jump_absolute  = false;
-    // TODO. make this int16_t for 32-bit?
-    int32_t iter_increment = 1;
+      int64_t target;
+      if ( jump_target_of( instruction, i, &target ) ) {
+        if ( target < 0 || target > static_cast<int64_t>( instructions.size() ) ) {
+          return false;
+        }
+      }
+
+      threaded.push_back( threaded_instruction_type{ nullptr, instruction.id, instruction.arg2, instruction.arg } );
+    }
+
+    threaded.push_back( threaded_instruction_type{ nullptr, INSTRUCTION_ID_TYPE_FINALIZE, 0, instruction_arg_type{} } );
+
+    return true;
+  }
 
-    std::vector<instruction_type>::const_iterator iter = instructions.begin() + instr_index;
+
+  // Execute instructions [begin,end). This is instantiated for each
+  //  engine: once to run the instructions directly through a switch, and
+  //  once to run threaded instructions (see translate(), above). The
+  //  handlers are shared between the two; only the dispatch differs.
+  //
+  // Policy (see evaluate_policy_type) selects, at compile time, whether
+  //  the debug trace is written, and whether the e-stack depth and return
+  //  addresses are checked. With both off, the handlers contain no I/O
+  //  (other than statement results) and no checks
+  //
+  template<bool Threaded, typename Policy, typename Instruction>
+  bool execute(
+               Instruction       *begin
+              ,Instruction       *end
+              ,vm_context_type   &context
+              ,size_t            *execution_counts
+              ,uint64_t          *execution_cycles
+              ,jit_type          *jit
+              ,loop_tracer_type  *loop_tracer
+              )
+  {
+    // context holds the "data stack" (d-stack), and receives the final
+    //  state of the registers below
+    // execution_counts and execution_cycles (only used if Policy::COUNT)
+    //  have one counter per instruction, plus one
+
+    data_stack_type &data = context.data;
+    std::ostream    &out  = *context.out;
+    result_sink_type *const results = context.results;
+    call_stack_type  *const call_stack = context.call_stack;
+
+    // this is the evaluation stack, which holds the "working" state of
+    //  any computations. All function calls share one contiguous e-stack:
+    //  a call pushes a frame marker (holding the caller's e-stack base),
+    //  and the callee's e-stack starts just above it
+    //
+    // NOTE: the e-stack and registers are locals while running, so that
+    //  they can live in machine registers; they are moved into the
+    //  context however execution ends
+    //
+    std::vector<operand_data_type> evaluation_stack;
+    size_t                         evaluation_stack_base{ context.evaluation_stack_base };
+    size_t                         stack_frame_base{ context.stack_frame_base };
+
+    evaluation_stack.swap( context.evaluation_stack );
+    evaluation_stack.reserve( EVALUATION_STACK_RESERVE );
+
+    const size_t instr_count = end - begin;
+
+    // The switch engine tracks the instruction index (and bounds-checks it
+    //  before each dispatch); the threaded engine tracks the instruction
+    //  itself
+    //
+    size_t       instr_index = context.pc;
+    Instruction *iter        = begin + context.pc;
+
+    // Profiling: the time from one dispatch to the next is charged to the
+    //  instruction dispatched first (time before the first dispatch goes
+    //  to the end-of-instructions counter)
+    //
+    uint64_t     profile_last  = Policy::COUNT ? profile_clock() : 0U;
+    size_t       profile_index = instr_count;
+
+    struct save_state_type {
+      vm_context_type                &context;
+      std::vector<operand_data_type> &evaluation_stack;
+      const size_t                   &evaluation_stack_base;
+      const size_t                   &stack_frame_base;
+      const size_t                   &instr_index;
+      Instruction * const            &iter;
+      Instruction * const             begin;
+
+      ~save_state_type()
+      {
+        context.evaluation_stack.swap( evaluation_stack );
+        context.evaluation_stack_base = evaluation_stack_base;
+        context.stack_frame_base      = stack_frame_base;
+        context.pc                    = Threaded ? static_cast<size_t>( iter - begin ) : instr_index;
+      }
+    } save_state{ context, evaluation_stack, evaluation_stack_base, stack_frame_base, instr_index, iter, begin };
+
+#if SINTERP_COMPUTED_GOTO
+    // NOTE: needs to match up with instruction_id_type enum
+    //
+    static const void * const handlers[] = {
+       &&op_PUSHDOUBLE
+      ,&&op_PUSHINT32
+      ,&&op_PUSHSIZET
+
+      ,&&op_NOT
+      ,&&op_NEGATE
+
+      ,&&op_NOOP          // LPARENS
+      ,&&op_NOOP          // RPARENS
+
+      ,&&op_NOOP          // FINALIZE
+
+      ,&&op_CLEAR
+      ,&&op_POP
+      ,&&op_JNEZ
+      ,&&op_JEQZ
+      ,&&op_JCEQZ
+      ,&&op_JMP
+      ,&&op_JMPA
+
+      ,&&op_COPYTOADDR
+      ,&&op_COPYFROMADDR
+      ,&&op_COPYTOSTACKOFFSET
+      ,&&op_COPYFROMSTACKOFFSET
+
+      ,&&op_MOVE_END_OF_STACK
+      ,&&op_CALL
+      ,&&op_RETURN
+      ,&&op_TAILCALL
+
+      ,&&op_DEBUG_PRINT_STACK
+
+      ,&&op_I2D
+      ,&&op_D2I
+
+      ,&&op_IADD
+      ,&&op_ISUBTRACT
+      ,&&op_IDIVIDE
+      ,&&op_IMULTIPLY
+      ,&&op_IEQ
+      ,&&op_INEQ
+      ,&&op_IGE
+      ,&&op_IGT
+      ,&&op_ILE
+      ,&&op_ILT
+
+      ,&&op_INEGATE
+
+      ,&&op_COPYTOADDR_I32
+      ,&&op_COPYFROMADDR_I32
+      ,&&op_COPYTOSTACKOFFSET_I32
+      ,&&op_COPYFROMSTACKOFFSET_I32
+      ,&&op_ASSIGN_I32
+
+      ,&&op_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD
+      ,&&op_PUSHDOUBLE_LT_JCEQZ
+      ,&&op_PUSHDOUBLE_LE_JCEQZ
+      ,&&op_COPYTOSTACKOFFSET_POP
+      ,&&op_PUSHDOUBLE_ADD
+
+      ,&&op_NOOP          // FN
+
+      ,&&op_ADD
+      ,&&op_SUBTRACT
+
+      ,&&op_DIVIDE
+      ,&&op_MULTIPLY
+
+      ,&&op_EQ
+      ,&&op_NEQ
+      ,&&op_GE
+      ,&&op_GT
+      ,&&op_LE
+      ,&&op_LT
+
+      ,&&op_AND
+      ,&&op_OR
+
+      ,&&op_NOOP          // COMMA
+
+      ,&&op_ASSIGN
+    };
+
+    static_assert( sizeof( handlers ) / sizeof( handlers[0] ) == INSTRUCTION_ID_TYPE_ASSIGN + 1
+                 , "handlers[] must match up with instruction_id_type" );
+
+    if ( Threaded ) {
+      for ( Instruction *i = begin; i != end; ++i ) {
+        set_handler( i, handlers[ i->id ] );
+      }
+      set_handler( end, &&halt );
+    }
+#define EVAL_OP( name )  case INSTRUCTION_ID_TYPE_##name: op_##name:
+#define EVAL_DISPATCH()  do { if ( Threaded ) { EVAL_COUNT(); goto *handler_of( iter ); } goto dispatch; } while ( 0 )
+#else
+#define EVAL_OP( name )  case INSTRUCTION_ID_TYPE_##name:
+#define EVAL_DISPATCH()  goto dispatch
+#endif
+
+#define EVAL_INDEX()              ( Threaded ? static_cast<size_t>( iter - begin ) : instr_index )
+#define EVAL_COUNT()              do { if ( Policy::COUNT ) { const uint64_t now = profile_clock(); execution_cycles[ profile_index ] += now - profile_last; profile_last = now; profile_index = EVAL_INDEX(); ++execution_counts[ profile_index ]; } } while ( 0 )
+#define EVAL_JUMP_RELATIVE( n )   do { if ( Threaded ) { iter += (n); } else { instr_index += (n); } EVAL_DISPATCH(); } while ( 0 )
+#define EVAL_JUMP_ABSOLUTE( n )   do { if ( Threaded ) { iter = begin + (n); } else { instr_index = (n); } EVAL_DISPATCH(); } while ( 0 )
+#define EVAL_NEXT()               EVAL_JUMP_RELATIVE( 1 )
+
+    EVAL_DISPATCH();
+
+  dispatch:
+    if ( Threaded ) {
+      if ( iter == end ) {
+        goto halt;
+      }
+    }
+    else {
+      if ( instr_index >= instr_count ) {
+        goto halt;
+      }
+      iter = begin + instr_index;
+    }
+
+    if ( !Threaded || !SINTERP_COMPUTED_GOTO ) {
+      EVAL_COUNT();
+    }
 
     switch ( iter->id ) {
-    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+    EVAL_OP( PUSHDOUBLE )
       // PUSH-DOUBLE <double>
       //  (reqd min size of e-stack, e-stack # of elems popped, e-stack # of elems pushed)
       //  0, -0, +1
-      evaluation_stack.back().push_back( operand_data_type( iter->arg.d ) );
-      break;
+      evaluation_stack.push_back( operand_data_type( iter->arg.d ) );
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_PUSHINT32:
+    EVAL_OP( PUSHINT32 )
       // PUSH-INT32 <int32>
       //  0, -0, +1
-      evaluation_stack.back().push_back( operand_data_type( iter->arg.i32 ) );
-      break;
+      evaluation_stack.push_back( operand_data_type( iter->arg.i32 ) );
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+    EVAL_OP( PUSHSIZET )
       // PUSH-SIZET <sizet>
       //  0, -0, +1
-      evaluation_stack.back().push_back( operand_data_type( iter->arg.sz ) );
-      break;
+      evaluation_stack.push_back( operand_data_type( iter->arg.sz ) );
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_NOT:
+    EVAL_OP( NOT )
       // OP-NOT
       //  1, -1, +1 
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        // TODO. type-aware not
-        double value = evaluation_stack.back().back().value;
+        // int32 operands are converted (I2D) first
+        double value = evaluation_stack.back().value();
 
-        evaluation_stack.back().back().set_value( (value == 0.0) ? 1.0 : 0.0 );
+        evaluation_stack.back().set_value( (value == 0.0) ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_NEGATE:
+    EVAL_OP( NEGATE )
       // OP-NEGATE
       //  1, -1, +1
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        // TODO. type-aware negate
-        double value = evaluation_stack.back().back().value;
+        // the double form; int32 uses INEGATE
+        double value = evaluation_stack.back().value();
 
-        evaluation_stack.back().back().set_value( -1.0 * value );
+        evaluation_stack.back().set_value( -1.0 * value );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_ADD:
+    EVAL_OP( ADD )
       // OP-ADD
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware add
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IADD
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         double result = value1 + value2;
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    EVAL_OP( SUBTRACT )
       // OP-SUB
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware subtract
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses ISUBTRACT
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         double result = value1 - value2;
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result );
 
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_DIVIDE:
+    EVAL_OP( DIVIDE )
       // OP-DIV
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware divide
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IDIVIDE
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         if ( value2 == 0.0 ) {
           return false;
         }
 
         double result = value1 / value2;
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    EVAL_OP( MULTIPLY )
       // OP-MULT
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware multiply
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IMULTIPLY
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         double result = value1 * value2;
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_EQ:
+    EVAL_OP( EQ )
       // OP-EQ
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware equality check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IEQ
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 == value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_NEQ:
+    EVAL_OP( NEQ )
       // OP-NEQ
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware !equality check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses INEQ
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 != value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_GE:
+    EVAL_OP( GE )
       // OP-GE
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware >= check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IGE
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 >= value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_GT:
+    EVAL_OP( GT )
       // OP-GT
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware > check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses IGT
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 > value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_LE:
+    EVAL_OP( LE )
       // OP-LE
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware <= check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses ILE
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 <= value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_LT:
+    EVAL_OP( LT )
       // OP-LT
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware < check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
-        double value2 = (evaluation_stack.back().rbegin()     )->value;
+        // the double form; int32 uses ILT
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
+        double value2 = (evaluation_stack.rbegin()     )->value();
 
         bool result = ( value1 < value2 );
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_AND:
+    EVAL_OP( AND )
       // OP-AND
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware && check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
+        // int32 operands are converted (I2D) first
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
         bool result = ( value1 != 0.0 );
 
         if ( result ) {
-          double value2 = (evaluation_stack.back().rbegin()     )->value;
+          double value2 = (evaluation_stack.rbegin()     )->value();
           result &= (value2 != 0.0);
         }
 
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_OR:
+    EVAL_OP( OR )
       // OP-OR
       //  2, -2, +1
       {
-        if ( evaluation_stack.back().size() < 2 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
           return false;
         }
 
-        // TODO. type-aware || check
-        double value1 = (evaluation_stack.back().rbegin() + 1U)->value;
+        // int32 operands are converted (I2D) first
+        double value1 = (evaluation_stack.rbegin() + 1U)->value();
         bool result = ( value1 != 0.0 );
 
         if ( !result ) {
-          double value2 = (evaluation_stack.back().rbegin()     )->value;
+          double value2 = (evaluation_stack.rbegin()     )->value();
           result |= (value2 != 0.0);
         }
 
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().set_value( result ? 1.0 : 0.0 );
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( result ? 1.0 : 0.0 );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_ASSIGN:
+    EVAL_OP( ASSIGN )
       // OP-ASSIGN
       //  3, -3, +1
       {
-        if ( evaluation_stack.back().size() < 3 ) {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 3 ) {
           return false;
         }
 
-
-        double new_value = (evaluation_stack.back().rbegin())->value; // TODO. varible type
+        // the double form; int32 uses ASSIGN_I32
+        double new_value = (evaluation_stack.rbegin())->value();
         char *src = reinterpret_cast<char*>( &new_value );
 
-        int is_abs = (evaluation_stack.back().rbegin() + 1U)->ivalue;
+        int is_abs = (evaluation_stack.rbegin() + 1U)->ivalue();
+
+        if ( is_abs ) {
+          size_t dst_idx = (evaluation_stack.rbegin() + 2U)->addr();
+          std::copy( src, src+8U, &(data[dst_idx]) );
+        }
+        else {
+          int32_t dst_offset = (evaluation_stack.rbegin() + 2U)->ivalue();
+          std::copy( src, src+8U, &(data[dst_offset + stack_frame_base]) );
+        }
+
+        evaluation_stack.pop_back();
+        evaluation_stack.pop_back();
+        evaluation_stack.back().set_value( new_value );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( ASSIGN_I32 )
+      // OP-ASSIGN-I32
+      //  3, -3, +1
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 3 ) {
+          return false;
+        }
+
+        int32_t new_value = (evaluation_stack.rbegin())->ivalue();
+
+        int is_abs = (evaluation_stack.rbegin() + 1U)->ivalue();
 
         if ( is_abs ) {
-          size_t dst_idx = (evaluation_stack.back().rbegin() + 2U)->addr;
-          std::copy( src, src+8U, &(data[dst_idx]) ); // TODO. variable type
+          size_t dst_idx = (evaluation_stack.rbegin() + 2U)->addr();
+          std::memcpy( &(data[dst_idx]), &new_value, sizeof( new_value ) );
         }
         else {
-          int32_t dst_offset = (evaluation_stack.back().rbegin() + 2U)->ivalue;
-          std::copy( src, src+8U, &(data[dst_offset + stack_frame_base]) ); // TODO. variable type
+          int32_t dst_offset = (evaluation_stack.rbegin() + 2U)->ivalue();
+          std::memcpy( &(data[dst_offset + stack_frame_base]), &new_value, sizeof( new_value ) );
         }
 
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().pop_back();
-        evaluation_stack.back().back().value = new_value;
+        evaluation_stack.pop_back();
+        evaluation_stack.pop_back();
+        evaluation_stack.back() = operand_data_type( new_value );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_CLEAR:
+    EVAL_OP( CLEAR )
       // OP-CLEAR
       //  clears estack
       {
-        if ( !evaluation_stack.back().empty() ) {
-          double value = (evaluation_stack.back().rbegin())->value;
-          std::cout << " => " << value << "\n";
-          if ( evaluation_stack.back().size() > 1 ) {
-            std::cout << "WARNING: final stack size is " << evaluation_stack.back().size() << "\n";
+        if ( results && ( evaluation_stack.size() != evaluation_stack_base ) ) {
+          const operand_data_type &result = *(evaluation_stack.rbegin());
+          if ( result.type() == OPERAND_TYPE_INT32 ) {
+            results->put( result.ivalue() );
+          }
+          else {
+            results->put( result.value() );
+          }
+          if ( evaluation_stack.size() > evaluation_stack_base + 1 ) {
+            results->stack_size_warning( evaluation_stack.size() - evaluation_stack_base );
           }
         }
-        evaluation_stack.back().clear();
+        evaluation_stack.erase( evaluation_stack.begin() + evaluation_stack_base, evaluation_stack.end() );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_POP:
+    EVAL_OP( POP )
       // OP-POP <narg>
       //  narg, -narg, +0
       {
-        std::cout << "debug: pop\n";
-        if ( evaluation_stack.back().size() < iter->arg.sz ) {
+        if ( Policy::TRACE ) {
+          out << "debug: pop\n";
+        }
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + iter->arg.sz ) {
           return false;
         }
 
         for ( size_t i=0; i<iter->arg.sz; ++i ) {
-          evaluation_stack.back().pop_back();
+          evaluation_stack.pop_back();
         }
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_JNEZ:
+    EVAL_OP( JNEZ )
       // OP-JNEZ <offset>
       //  1, -0, +0
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        // TODO. type-aware JNEZ
-        double value = (evaluation_stack.back().rbegin())->value;
+        // int32 conditions are converted (I2D) first
+        double value = (evaluation_stack.rbegin())->value();
 
         if ( value != 0.0 ) {
-          iter_increment = iter->arg.i32;
+          EVAL_JUMP_RELATIVE( iter->arg.i32 );
         }
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_JEQZ:
+    EVAL_OP( JEQZ )
       // OP-JEQZ <offset>
       //  1, -0, +0
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        // TODO. type-aware JEQZ
-        double value = (evaluation_stack.back().rbegin())->value;
+        // int32 conditions are converted (I2D) first
+        double value = (evaluation_stack.rbegin())->value();
         if ( value == 0.0 ) {
-          iter_increment = iter->arg.i32;
+          EVAL_JUMP_RELATIVE( iter->arg.i32 );
         }
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_JCEQZ:
+    EVAL_OP( JCEQZ )
       // OP-JCEQZ <offset>
       //  1, -1, +0
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        // TODO. type-aware JCEQZ
-        double value = (evaluation_stack.back().rbegin())->value;
+        // int32 conditions are converted (I2D) first
+        double value = (evaluation_stack.rbegin())->value();
+
+        evaluation_stack.pop_back();
 
         if ( value == 0.0 ) {
-          iter_increment = iter->arg.i32;
+          EVAL_JUMP_RELATIVE( iter->arg.i32 );
         }
-        evaluation_stack.back().pop_back();
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_JMP:
+    EVAL_OP( JMP )
       // OP-JMP <offset>
       //  0, -0, +0
-      {
-        iter_increment = iter->arg.i32;
+      //
+      // A backward jump closes a loop, which may be hot enough to trace
+      //
+      if ( !Policy::TRACE && !Policy::COUNT && loop_tracer && iter->arg.i32 < 0 ) {
+        size_t next_index;
+        if ( loop_tracer->back_edge( EVAL_INDEX(), EVAL_INDEX() + iter->arg.i32, stack_frame_base, evaluation_stack, evaluation_stack_base, &next_index ) ) {
+          EVAL_JUMP_ABSOLUTE( next_index );
+        }
       }
-      break;
+      EVAL_JUMP_RELATIVE( iter->arg.i32 );
 
-    case INSTRUCTION_ID_TYPE_JMPA:
+    EVAL_OP( JMPA )
       // OP-JMPA <addr>
       //  0, -0, +0
-      {
-        instr_index   = iter->arg.sz;
-        jump_absolute = true;
-      }
-      break;
+      EVAL_JUMP_ABSOLUTE( iter->arg.sz );
 
-    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    EVAL_OP( COPYFROMADDR )
       // OP-COPY-FROM-ADDR <addr>
       //  0, -0, +1
       {
+        // the double form; int32 uses COPYFROMADDR_I32
         double new_value;
         char *src = &(data[iter->arg.sz]);
         char *dst = reinterpret_cast<char*>( &new_value );
-        std::copy( src, src+8U, dst ); // TODO. variable-size copy
+        std::copy( src, src+8U, dst );
 
-        evaluation_stack.back().emplace_back( operand_data_type( new_value ) );
+        evaluation_stack.emplace_back( operand_data_type( new_value ) );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    EVAL_OP( COPYFROMSTACKOFFSET )
       // OP-COPY-FROM-OFFSET <offset>
       //  0, -0, +1
       {
+        // the double form; int32 uses COPYFROMSTACKOFFSET_I32
         double new_value;
         char *src = &(data[iter->arg.i32 + stack_frame_base]);
         char *dst = reinterpret_cast<char*>( &new_value );
-        std::copy( src, src+8U, dst ); // TODO. variable-size copy
+        std::copy( src, src+8U, dst );
 
-        evaluation_stack.back().emplace_back( operand_data_type( new_value ) );
+        evaluation_stack.emplace_back( operand_data_type( new_value ) );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    EVAL_OP( COPYTOADDR )
       // OP-COPY-TO-ADDR <addr>
       //  1, -0, +0
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        double value = (evaluation_stack.back().rbegin())->value;
+        // the double form; int32 uses COPYTOADDR_I32
+        double value = (evaluation_stack.rbegin())->value();
 
         char *src = reinterpret_cast<char*>( &value );
-        std::copy( src, src+8U, &(data[iter->arg.sz]) ); // TODO. variable-size copy
+        std::copy( src, src+8U, &(data[iter->arg.sz]) );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    EVAL_OP( COPYTOSTACKOFFSET )
       // OP-COPY-TO-STACK-OFFSET <offset>
       //  1, -0, +0
       {
-        if ( evaluation_stack.back().empty() ) {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
           return false;
         }
 
-        double value = (evaluation_stack.back().rbegin())->value;
+        // the double form; int32 uses COPYTOSTACKOFFSET_I32
+        double value = (evaluation_stack.rbegin())->value();
 
         char *src = reinterpret_cast<char*>( &value );
-        std::copy( src, src+8U, &(data[iter->arg.i32 + stack_frame_base]) ); // TODO. variable-size copy
+        std::copy( src, src+8U, &(data[iter->arg.i32 + stack_frame_base]) );
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+    EVAL_OP( COPYFROMADDR_I32 )
+      // OP-COPY-FROM-ADDR-I32 <addr>
+      //  0, -0, +1
+      {
+        int32_t new_value;
+        std::memcpy( &new_value, &(data[iter->arg.sz]), sizeof( new_value ) );
+
+        evaluation_stack.emplace_back( operand_data_type( new_value ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( COPYFROMSTACKOFFSET_I32 )
+      // OP-COPY-FROM-OFFSET-I32 <offset>
+      //  0, -0, +1
+      {
+        int32_t new_value;
+        std::memcpy( &new_value, &(data[iter->arg.i32 + stack_frame_base]), sizeof( new_value ) );
+
+        evaluation_stack.emplace_back( operand_data_type( new_value ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( COPYTOADDR_I32 )
+      // OP-COPY-TO-ADDR-I32 <addr>
+      //  1, -0, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        int32_t value = (evaluation_stack.rbegin())->ivalue();
+        std::memcpy( &(data[iter->arg.sz]), &value, sizeof( value ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( COPYTOSTACKOFFSET_I32 )
+      // OP-COPY-TO-STACK-OFFSET-I32 <offset>
+      //  1, -0, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        int32_t value = (evaluation_stack.rbegin())->ivalue();
+        std::memcpy( &(data[iter->arg.i32 + stack_frame_base]), &value, sizeof( value ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( MOVE_END_OF_STACK )
       // OP-MOVE-END-OF-STACK
       //  0, -0, +0
       {
         size_t new_size = data.size() + iter->arg.i32;
-        data.resize( new_size );
+        if ( !data.resize( new_size ) ) {
+          return false;
+        }
       }
-      break;
+      EVAL_NEXT();
 
-    case INSTRUCTION_ID_TYPE_CALL:
+    EVAL_OP( CALL )
       {
-        std::cout << "=====CALL=====\n";
-        std::cout << "current stack frame base is " << stack_frame_base << "\n";
-        std::cout << "data stack size is " << data.size() << "\n";
+        if ( Policy::TRACE ) {
+          out << "=====CALL=====\n";
+          out << "current stack frame base is " << stack_frame_base << "\n";
+          out << "data stack size is " << data.size() << "\n";
+        }
+
+        // make room for the return address and stack frame base
+        if ( !data.resize( data.size() + 16U ) ) {
+          return false;
+        }
 
         // push address of next instruction onto stack
-        data.resize( data.size() + 8U );
-        *(reinterpret_cast<size_t*>( &(data[data.size()-8U]) )) = instr_index + 1U;
-        std::cout << "pushing return addr : " << *(reinterpret_cast<size_t*>( &(data[data.size()-8U]) )) << "\n";
+        *(reinterpret_cast<size_t*>( &(data[data.size()-16U]) )) = EVAL_INDEX() + 1U;
 
         // push current stack frame base onto stack
-        data.resize( data.size() + 8U );
         *(reinterpret_cast<size_t*>( &(data[data.size()-8U]) )) = stack_frame_base;
-        std::cout << "pushing current stack frame base : " << *(reinterpret_cast<size_t*>( &(data[data.size()-8U]) )) << "\n";
+
+        if ( Policy::TRACE ) {
+          out << "pushing return addr : " << *(reinterpret_cast<size_t*>( &(data[data.size()-16U]) )) << "\n";
+          out << "pushing current stack frame base : " << *(reinterpret_cast<size_t*>( &(data[data.size()-8U]) )) << "\n";
+        }
 
         // reset stack frame base to end-of-stack, in preparation for
         // function execution
         //
         stack_frame_base = data.size();
-        std::cout << "new stack frame base will be " << stack_frame_base << "\n";
 
-        // New evaluation stack for the function
+        // New evaluation stack for the function, above a marker
+        //  recording the caller's
         //
-        evaluation_stack.push_back( std::vector<operand_data_type>() );
+        evaluation_stack.push_back( operand_data_type( evaluation_stack_base ) );
+        evaluation_stack_base = evaluation_stack.size();
+
+        if ( call_stack ) {
+          call_stack->push( iter->arg.sz );
+        }
 
         // jump to function start
         //
-        instr_index   = iter->arg.sz;
-        std::cout << "jumping to " << instr_index << "\n";
-        jump_absolute = true;
+        if ( Policy::TRACE ) {
+          out << "new stack frame base will be " << stack_frame_base << "\n";
+          out << "jumping to " << iter->arg.sz << "\n";
+        }
+
+        size_t next_index;
+        if ( !Policy::TRACE && !Policy::COUNT && jit
+          && jit->call( iter->arg.sz, stack_frame_base, evaluation_stack, &next_index ) ) {
+          EVAL_JUMP_ABSOLUTE( next_index );
+        }
+        EVAL_JUMP_ABSOLUTE( iter->arg.sz );
       }
-      break;
 
-    case INSTRUCTION_ID_TYPE_RETURN:
+    EVAL_OP( RETURN )
       {
-        std::cout << "=====RETURN=====\n";
+        // Not in a function?
+        //
+        if ( Policy::CHECKS && evaluation_stack_base == 0U ) {
+          return false;
+        }
 
         size_t old_stack_frame_base = *(reinterpret_cast<size_t*>(&(data[stack_frame_base -  8])));
-        std::cout << "debug: setting stack frame base to " << old_stack_frame_base << "\n";
         size_t return_address       = *(reinterpret_cast<size_t*>(&(data[stack_frame_base - 16])));
-        std::cout << "debug: jump back addr is " << return_address << "\n";
         data.resize( stack_frame_base - 16 );
-        std::cout << "data stack size is now " << data.size() << "\n";
 
-        // Remove the function's evaluation stack
+        if ( Policy::TRACE ) {
+          out << "=====RETURN=====\n";
+          out << "debug: setting stack frame base to " << old_stack_frame_base << "\n";
+          out << "debug: jump back addr is " << return_address << "\n";
+          out << "data stack size is now " << data.size() << "\n";
+        }
+
+        // Remove the function's evaluation stack, and its marker
         //
-        evaluation_stack.pop_back();
+        size_t old_evaluation_stack_base = evaluation_stack[ evaluation_stack_base - 1U ].addr();
+        evaluation_stack.erase( evaluation_stack.begin() + (evaluation_stack_base - 1U), evaluation_stack.end() );
+        evaluation_stack_base = old_evaluation_stack_base;
 
         // Restore state before returning to caller
         //
         stack_frame_base = old_stack_frame_base;
-        instr_index      = return_address;
-        jump_absolute    = true;
+
+        if ( call_stack ) {
+          call_stack->pop();
+        }
+
+        // The threaded engine does not bounds-check jumps, so make sure
+        //  the return address is sane
+        //
+        if ( Policy::CHECKS && Threaded && return_address > instr_count ) {
+          return false;
+        }
+
+        size_t next_index;
+        if ( !Policy::TRACE && !Policy::COUNT && jit
+          && jit->resume( return_address, stack_frame_base, evaluation_stack, evaluation_stack_base, &next_index ) ) {
+          EVAL_JUMP_ABSOLUTE( next_index );
+        }
+        EVAL_JUMP_ABSOLUTE( return_address );
       }
-      break;
 
-    case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
-      // TODO.
-      std::cout << "DEBUG: stack size is " << data.size() << "\n";
+    EVAL_OP( TAILCALL )
       {
+        // The function's arguments have already been replaced by the
+        //  callee's. Drop the rest of its frame and its e-stack, and jump
+        //  to the callee, which takes over the frame (and so returns
+        //  straight to the function's caller)
+        //
+        if ( Policy::CHECKS && evaluation_stack_base == 0U ) {
+          return false;
+        }
+
+        data.resize( stack_frame_base );
+        evaluation_stack.erase( evaluation_stack.begin() + evaluation_stack_base, evaluation_stack.end() );
+
+        if ( Policy::TRACE ) {
+          out << "=====TAILCALL=====\n";
+          out << "current stack frame base is " << stack_frame_base << "\n";
+          out << "jumping to " << iter->arg.sz << "\n";
+        }
+
+        if ( call_stack ) {
+          call_stack->replace_top( iter->arg.sz );
+        }
+
+        size_t next_index;
+        if ( !Policy::TRACE && !Policy::COUNT && jit
+          && jit->call( iter->arg.sz, stack_frame_base, evaluation_stack, &next_index ) ) {
+          EVAL_JUMP_ABSOLUTE( next_index );
+        }
+        EVAL_JUMP_ABSOLUTE( iter->arg.sz );
+      }
+
+    EVAL_OP( DEBUG_PRINT_STACK )
+      // TODO.
+      if ( Policy::TRACE ) {
+        out << "DEBUG: stack size is " << data.size() << "\n";
         for ( size_t i=0U; i<data.size(); i += 8 ) {
-          std::cout << i << ": " << *(reinterpret_cast<double*>( &(data[i]) )) << ","
+          out << i << ": " << *(reinterpret_cast<double*>( &(data[i]) )) << ","
                     << *(reinterpret_cast<size_t*>( &(data[i]) )) << "\n";
         }
       }
-      break;
+      EVAL_NEXT();
+
+    // int32 instructions. The operands are known (by the parser) to be
+    //  int32s, so their tags are not checked. Arithmetic is done on the
+    //  unsigned values, so that overflow wraps rather than being undefined
+    //
+    EVAL_OP( I2D )
+      // OP-I2D <depth>
+      //  depth+1, -0, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + iter->arg.i32 + 1U ) {
+          return false;
+        }
+
+        operand_data_type &operand = *(evaluation_stack.rbegin() + iter->arg.i32);
+        operand.set_value( static_cast<double>( operand.ivalue() ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( D2I )
+      // OP-D2I
+      //  1, -1, +1
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        // truncates toward zero; NaN and out-of-range values are errors
+        //
+        double value = evaluation_stack.back().value();
+        if ( !( value > -2147483649.0 && value < 2147483648.0 ) ) {
+          return false;
+        }
+
+        evaluation_stack.back() = operand_data_type( static_cast<int32_t>( value ) );
+      }
+      EVAL_NEXT();
+
+#define EVAL_INT32_BINARY_OP( name, expr )                                                    \
+    EVAL_OP( name )                                                                             \
+      {                                                                                         \
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {          \
+          return false;                                                                         \
+        }                                                                                       \
+                                                                                                \
+        int32_t value1 = (evaluation_stack.rbegin() + 1U)->ivalue();                            \
+        int32_t value2 = (evaluation_stack.rbegin()     )->ivalue();                            \
+                                                                                                \
+        evaluation_stack.pop_back();                                                            \
+        evaluation_stack.back() = (expr);                                                       \
+      }                                                                                         \
+      EVAL_NEXT();
+
+#define EVAL_INT32_WRAP( expr )  operand_data_type( static_cast<int32_t>( expr ) )
+#define EVAL_INT32_TEST( expr )  operand_data_type( (expr) ? 1.0 : 0.0 )
+
+    // OP-IADD, OP-ISUB, OP-IMULT
+    //  2, -2, +1
+    EVAL_INT32_BINARY_OP( IADD,      EVAL_INT32_WRAP( static_cast<uint32_t>( value1 ) + static_cast<uint32_t>( value2 ) ) )
+    EVAL_INT32_BINARY_OP( ISUBTRACT, EVAL_INT32_WRAP( static_cast<uint32_t>( value1 ) - static_cast<uint32_t>( value2 ) ) )
+    EVAL_INT32_BINARY_OP( IMULTIPLY, EVAL_INT32_WRAP( static_cast<uint32_t>( value1 ) * static_cast<uint32_t>( value2 ) ) )
+
+    // OP-IEQ, OP-INEQ, OP-IGE, OP-IGT, OP-ILE, OP-ILT
+    //  2, -2, +1
+    EVAL_INT32_BINARY_OP( IEQ,  EVAL_INT32_TEST( value1 == value2 ) )
+    EVAL_INT32_BINARY_OP( INEQ, EVAL_INT32_TEST( value1 != value2 ) )
+    EVAL_INT32_BINARY_OP( IGE,  EVAL_INT32_TEST( value1 >= value2 ) )
+    EVAL_INT32_BINARY_OP( IGT,  EVAL_INT32_TEST( value1 >  value2 ) )
+    EVAL_INT32_BINARY_OP( ILE,  EVAL_INT32_TEST( value1 <= value2 ) )
+    EVAL_INT32_BINARY_OP( ILT,  EVAL_INT32_TEST( value1 <  value2 ) )
+
+#undef EVAL_INT32_TEST
+#undef EVAL_INT32_WRAP
+#undef EVAL_INT32_BINARY_OP
+
+    EVAL_OP( IDIVIDE )
+      // OP-IDIV
+      //  2, -2, +1
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() < evaluation_stack_base + 2 ) {
+          return false;
+        }
+
+        int32_t value1 = (evaluation_stack.rbegin() + 1U)->ivalue();
+        int32_t value2 = (evaluation_stack.rbegin()     )->ivalue();
+
+        if ( value2 == 0 ) {
+          return false;
+        }
+
+        // truncates toward zero; INT32_MIN / -1 wraps
+        //
+        int32_t result = ( value2 == -1 ) ? static_cast<int32_t>( 0U - static_cast<uint32_t>( value1 ) ) : value1 / value2;
+        evaluation_stack.pop_back();
+        evaluation_stack.back() = operand_data_type( result );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( INEGATE )
+      // OP-INEGATE
+      //  1, -1, +1
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        int32_t value = evaluation_stack.back().ivalue();
+        evaluation_stack.back() = operand_data_type( static_cast<int32_t>( 0U - static_cast<uint32_t>( value ) ) );
+      }
+      EVAL_NEXT();
+
+    // Superinstructions (see optimize.h); each behaves exactly like
+    //  the sequence it replaces
+    //
+    EVAL_OP( COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD )
+      // OP-COPY-FROM-OFFSET <offset> ; OP-COPY-FROM-OFFSET <offset2> ; OP-ADD
+      //  0, -0, +1
+      {
+        double value1;
+        double value2;
+        std::memcpy( &value1, &(data[iter->arg.i32 + stack_frame_base]), sizeof( value1 ) );
+        std::memcpy( &value2, &(data[iter->arg2    + stack_frame_base]), sizeof( value2 ) );
+
+        evaluation_stack.emplace_back( operand_data_type( value1 + value2 ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( PUSHDOUBLE_LT_JCEQZ )
+      // OP-PUSH-DOUBLE <double> ; OP-LT ; OP-JCEQZ <offset2>
+      //  1, -1, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        double value = (evaluation_stack.rbegin())->value();
+        evaluation_stack.pop_back();
+
+        if ( !( value < iter->arg.d ) ) {
+          EVAL_JUMP_RELATIVE( iter->arg2 );
+        }
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( PUSHDOUBLE_LE_JCEQZ )
+      // OP-PUSH-DOUBLE <double> ; OP-LE ; OP-JCEQZ <offset2>
+      //  1, -1, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        double value = (evaluation_stack.rbegin())->value();
+        evaluation_stack.pop_back();
+
+        if ( !( value <= iter->arg.d ) ) {
+          EVAL_JUMP_RELATIVE( iter->arg2 );
+        }
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( COPYTOSTACKOFFSET_POP )
+      // OP-COPY-TO-STACK-OFFSET <offset> ; OP-POP 1
+      //  1, -1, +0
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        if ( Policy::TRACE ) {
+          out << "debug: pop\n";
+        }
+
+        double value = (evaluation_stack.rbegin())->value();
+        evaluation_stack.pop_back();
+
+        std::memcpy( &(data[iter->arg.i32 + stack_frame_base]), &value, sizeof( value ) );
+      }
+      EVAL_NEXT();
+
+    EVAL_OP( PUSHDOUBLE_ADD )
+      // OP-PUSH-DOUBLE <double> ; OP-ADD
+      //  1, -1, +1
+      {
+        if ( Policy::CHECKS && evaluation_stack.size() == evaluation_stack_base ) {
+          return false;
+        }
+
+        evaluation_stack.back().set_value( evaluation_stack.back().value() + iter->arg.d );
+      }
+      EVAL_NEXT();
 
     case INSTRUCTION_ID_TYPE_COMMA:
     case INSTRUCTION_ID_TYPE_FINALIZE:
     case INSTRUCTION_ID_TYPE_FN:
     case INSTRUCTION_ID_TYPE_LPARENS:
     case INSTRUCTION_ID_TYPE_RPARENS:
+#if SINTERP_COMPUTED_GOTO
+    op_NOOP:
+#endif
       // NOTE. These should never occur...
-      break;
+      EVAL_NEXT();
     }
 
-    if ( !jump_absolute ) {
-      instr_index += iter_increment;
+  halt:
+    return true;
+
+#undef EVAL_NEXT
+#undef EVAL_JUMP_ABSOLUTE
+#undef EVAL_JUMP_RELATIVE
+#undef EVAL_COUNT
+#undef EVAL_INDEX
+#undef EVAL_DISPATCH
+#undef EVAL_OP
+  }
+
+}
+
+
+template<typename Policy>
+bool evaluate(
+              const program_type                  &program
+             ,vm_context_type                     &context
+             ,const evaluate_options_type         &options
+             )
+{
+  const std::vector<instruction_type> &instructions = program.instructions();
+
+  if ( options.reset_context ) {
+    context.reset();
+  }
+
+  size_t               *execution_counts = nullptr;
+  uint64_t             *execution_cycles = nullptr;
+  std::vector<uint64_t> unreported_cycles;
+  if ( Policy::COUNT ) {
+    if ( !options.execution_counts ) {
+      return false;
     }
+    options.execution_counts->assign( instructions.size() + 1U, 0U );
+    execution_counts = options.execution_counts->data();
+
+    std::vector<uint64_t> &cycles = options.execution_cycles ? *options.execution_cycles : unreported_cycles;
+    cycles.assign( instructions.size() + 1U, 0U );
+    execution_cycles = cycles.data();
+  }
+
+  std::unique_ptr<jit_type> jit;
+  if ( options.jit && !Policy::TRACE && !Policy::COUNT ) {
+    jit.reset( new jit_type( instructions, context.data, context.results, options.jit_threshold ) );
+  }
+
+  std::unique_ptr<loop_tracer_type> loop_tracer;
+  if ( options.loop_traces && !Policy::TRACE && !Policy::COUNT ) {
+    loop_tracer.reset( new loop_tracer_type( instructions, context.data, context.results, options.loop_trace_threshold ) );
   }
 
-  return true;
+  bool rv = false;
+  bool done = false;
+
+  if ( options.engine == EVALUATE_ENGINE_TYPE_THREADED ) {
+    std::vector<threaded_instruction_type> threaded;
+    if ( translate( instructions, threaded ) ) {
+      rv   = execute<true,Policy>( threaded.data(), threaded.data() + instructions.size(), context, execution_counts, execution_cycles, jit.get(), loop_tracer.get() );
+      done = true;
+    }
+    else {
+      // Instructions with out-of-range jumps can only be run
+      //  safely by the (bounds-checked) switch engine
+      //
+      std::cerr << "WARNING: instructions cannot be threaded; using switch engine\n";
+    }
+  }
+
+  if ( !done ) {
+    rv = execute<false,Policy>( instructions.data(), instructions.data() + instructions.size(), context, execution_counts, execution_cycles, jit.get(), loop_tracer.get() );
+  }
+
+  if ( options.jit_compiled ) {
+    *options.jit_compiled = jit ? jit->compiled_count() : 0U;
+  }
+
+  if ( Policy::COUNT ) {
+    // drop the end-of-instructions counters
+    //
+    options.execution_counts->pop_back();
+    if ( options.execution_cycles ) {
+      options.execution_cycles->pop_back();
+    }
+  }
+
+  return rv;
+}
+
+
+// NOTE: all policies are instantiated here; see evaluate.h
+//
+template bool evaluate<evaluate_policy_type<true, true, false>>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<true, false,false>>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<false,true, false>>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<false,false,false>>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<true, true, true >>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<true, false,true >>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<false,true, true >>( const program_type &, vm_context_type &, const evaluate_options_type & );
+template bool evaluate<evaluate_policy_type<false,false,true >>( const program_type &, vm_context_type &, const evaluate_options_type & );
+
+
+namespace {
+
+  template<bool Trace, bool Checks>
+  bool evaluate_counted(
+                        const program_type                  &program
+                       ,vm_context_type                     &context
+                       ,const evaluate_options_type         &options
+                       )
+  {
+    if ( options.execution_counts ) {
+      return evaluate<evaluate_policy_type<Trace,Checks,true>>( program, context, options );
+    }
+    return evaluate<evaluate_policy_type<Trace,Checks,false>>( program, context, options );
+  }
+
+}
+
+
+bool evaluate(
+              const program_type                  &program
+             ,vm_context_type                     &context
+             ,const evaluate_options_type         &options
+             )
+{
+  if ( options.trace ) {
+    if ( options.checks ) {
+      return evaluate_counted<true,true>( program, context, options );
+    }
+    return evaluate_counted<true,false>( program, context, options );
+  }
+
+  if ( options.checks ) {
+    return evaluate_counted<false,true>( program, context, options );
+  }
+  return evaluate_counted<false,false>( program, context, options );
 }
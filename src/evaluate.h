@@ -22,14 +22,111 @@
 
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
 
+#include "data_stack_type.h"
 #include "instruction_type.h"
+#include "jit.h"
+#include "loop_trace.h"
+#include "program.h"
 
 
+// Available execution engines. Both produce identical results;
+//  the choice only affects how instructions are dispatched
+//
+enum evaluate_engine_type {
+   EVALUATE_ENGINE_TYPE_SWITCH    // switch over instruction id, per instruction
+  ,EVALUATE_ENGINE_TYPE_THREADED  // pre-translated, direct-threaded code
+};
+
+
+// Compile-time evaluation policy:
+//
+//   TRACE  - write the debug trace (calls, returns, pops, d-stack dumps)
+//   CHECKS - check e-stack depth and return addresses before use
+//   COUNT  - count executions of, and time spent in, each instruction
+//            (for profiling; see profile.h)
+//
+// With CHECKS off, the instructions must be well-formed (as emitted by
+//  parser_type); malformed instructions have undefined behavior
+//
+template<bool Trace, bool Checks, bool Count = false>
+struct evaluate_policy_type {
+  static constexpr bool TRACE  = Trace;
+  static constexpr bool CHECKS = Checks;
+  static constexpr bool COUNT  = Count;
+};
+
+using evaluate_debug_policy_type   = evaluate_policy_type<true,true>;
+using evaluate_release_policy_type = evaluate_policy_type<false,false>;
+
+
+// Run-time selection of engine and policy
+//
+struct evaluate_options_type {
+  evaluate_engine_type  engine{ EVALUATE_ENGINE_TYPE_SWITCH };
+  bool                  trace{ true };
+  bool                  checks{ true };
+
+  // if set, receives the number of times each instruction was executed
+  //  (and selects the COUNT policy)
+  //
+  std::vector<size_t>  *execution_counts{ nullptr };
+
+  // if set (with execution_counts), receives the time spent in each
+  //  instruction, in profile_clock() ticks
+  //
+  std::vector<uint64_t> *execution_cycles{ nullptr };
+
+  // compile hot functions to native code (see jit.h); only used by the
+  //  untraced, uncounted policies
+  //
+  bool                  jit{ false };
+  size_t                jit_threshold{ jit_type::DEFAULT_THRESHOLD };
+
+  // if set, receives the number of functions the JIT compiled (0 if it
+  //  was not used)
+  //
+  size_t               *jit_compiled{ nullptr };
+
+  // record and run traces of hot loops (see loop_trace.h); likewise only
+  //  used by the untraced, uncounted policies
+  //
+  bool                  loop_traces{ false };
+  size_t                loop_trace_threshold{ loop_tracer_type::DEFAULT_THRESHOLD };
+
+  // if cleared, start from the context as it is (at context.pc, with its
+  //  d-stack contents) instead of resetting it; used to run a program
+  //  with its inputs already stored (see batch.h)
+  //
+  bool                  reset_context{ true };
+};
+
+
+// Evaluate program from the start, in context (which is reset first,
+//  unless options.reset_context is cleared).
+//  Everything evaluation changes is in context, and program is only
+//  read, so different threads can evaluate the same program at once,
+//  each in its own context.
+//
+// Evaluate with a fixed policy; trace and checks in options are ignored
+//
+// NOTE: instantiated (in evaluate.cpp) for all policies
+//
+template<typename Policy>
+bool evaluate(
+              const program_type                  &program
+              ,vm_context_type                   &context
+              ,const evaluate_options_type       &options
+              );
+
+// Evaluate with the policy selected by options
+//
 bool evaluate(
-              const std::vector<instruction_type> &instructions
-              ,std::vector<char>                 &data
+              const program_type                  &program
+              ,vm_context_type                   &context
+              ,const evaluate_options_type       &options = evaluate_options_type()
               );
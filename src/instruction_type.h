@@ -56,11 +56,51 @@ enum instruction_id_type {
   ,INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET
 
   ,INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK
-  ,INSTRUCTION_ID_TYPE_CALL
+  ,INSTRUCTION_ID_TYPE_CALL                  // arg.sz: function entry; arg2: function index (see parser_type::function_names())
   ,INSTRUCTION_ID_TYPE_RETURN
+  ,INSTRUCTION_ID_TYPE_TAILCALL              // as CALL, but reuses the current frame
 
   ,INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK
 
+  // int32 instructions. The parser picks these (instead of the double
+  //  instructions above and below) when the operands are known to be
+  //  int32; the arithmetic ones wrap on overflow, and the comparisons
+  //  push a double 1.0/0.0, like their double counterparts
+  //
+  ,INSTRUCTION_ID_TYPE_I2D                   // arg.i32: e-stack depth (0 = top)
+  ,INSTRUCTION_ID_TYPE_D2I
+
+  ,INSTRUCTION_ID_TYPE_IADD                  // NOTE: IADD..ILT in the same order as ADD..LT
+  ,INSTRUCTION_ID_TYPE_ISUBTRACT
+  ,INSTRUCTION_ID_TYPE_IDIVIDE
+  ,INSTRUCTION_ID_TYPE_IMULTIPLY
+  ,INSTRUCTION_ID_TYPE_IEQ
+  ,INSTRUCTION_ID_TYPE_INEQ
+  ,INSTRUCTION_ID_TYPE_IGE
+  ,INSTRUCTION_ID_TYPE_IGT
+  ,INSTRUCTION_ID_TYPE_ILE
+  ,INSTRUCTION_ID_TYPE_ILT
+
+  ,INSTRUCTION_ID_TYPE_INEGATE
+
+  // 4-byte d-stack accesses (otherwise as their 8-byte counterparts)
+  //
+  ,INSTRUCTION_ID_TYPE_COPYTOADDR_I32
+  ,INSTRUCTION_ID_TYPE_COPYFROMADDR_I32
+  ,INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32
+  ,INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32
+  ,INSTRUCTION_ID_TYPE_ASSIGN_I32
+
+  // Superinstructions. These are never emitted by the parser; they
+  //  replace common sequences (see optimize.h). The second operand, if
+  //  any, is in arg2
+  //
+  ,INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD // arg.i32, arg2: offsets
+  ,INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ                         // arg.d: value, arg2: jump offset
+  ,INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ                         // arg.d: value, arg2: jump offset
+  ,INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP                        // arg.i32: offset (pops 1)
+  ,INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD                              // arg.d: value
+
   ,INSTRUCTION_ID_TYPE_FN
 
   // NOTE: from this point down,
@@ -92,10 +132,18 @@ enum instruction_id_type {
 };
 
 
+union instruction_arg_type {
+  double  d;
+  int32_t i32;
+  size_t  sz;
+};
+
+
 struct instruction_type {
 
   explicit instruction_type( double in_value )
     :id( INSTRUCTION_ID_TYPE_PUSHDOUBLE )
+    ,arg2( 0 )
     ,linked_idx( 0U )
     ,symbol_data( nullptr )
   {
@@ -104,6 +152,7 @@ struct instruction_type {
 
   explicit instruction_type( int in_ivalue )
     :id( INSTRUCTION_ID_TYPE_PUSHINT32 )
+    ,arg2( 0 )
     ,linked_idx( 0U )
     ,symbol_data( nullptr )
   {
@@ -112,18 +161,73 @@ struct instruction_type {
 
   explicit instruction_type( instruction_id_type in_id )
     :id( in_id )
+    ,arg2( 0 )
     ,linked_idx( 0U )
     ,symbol_data( nullptr )
   {}
   
   instruction_id_type  id;
+  int32_t              arg2; // superinstructions, CALL and TAILCALL only
   size_t               linked_idx;
 
-  union {
-    double  d;
-    int32_t i32;
-    size_t  sz;
-  } arg;
+  instruction_arg_type arg;
 
   const symbol_table_data_type *symbol_data;
 };
+
+
+// How an instruction encodes its jump target, if it has one
+//
+enum jump_type {
+   JUMP_TYPE_NONE
+  ,JUMP_TYPE_RELATIVE       // arg.i32, relative to the instruction's index
+  ,JUMP_TYPE_RELATIVE_ARG2  // arg2, relative to the instruction's index
+  ,JUMP_TYPE_ABSOLUTE       // arg.sz
+};
+
+
+inline jump_type jump_type_of( instruction_id_type id )
+{
+  switch ( id ) {
+  case INSTRUCTION_ID_TYPE_JNEZ:
+  case INSTRUCTION_ID_TYPE_JEQZ:
+  case INSTRUCTION_ID_TYPE_JCEQZ:
+  case INSTRUCTION_ID_TYPE_JMP:
+    return JUMP_TYPE_RELATIVE;
+
+  case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+  case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+    return JUMP_TYPE_RELATIVE_ARG2;
+
+  case INSTRUCTION_ID_TYPE_JMPA:
+  case INSTRUCTION_ID_TYPE_CALL:
+  case INSTRUCTION_ID_TYPE_TAILCALL:
+    return JUMP_TYPE_ABSOLUTE;
+
+  default:
+    return JUMP_TYPE_NONE;
+  }
+}
+
+
+// Jump target of the instruction at index (for instruction_type, or
+//  anything laid out like it). Returns false if it has none
+//
+template<typename Instruction>
+bool jump_target_of( const Instruction &instruction, size_t index, int64_t *target )
+{
+  switch ( jump_type_of( instruction.id ) ) {
+  case JUMP_TYPE_RELATIVE:
+    *target = static_cast<int64_t>( index ) + instruction.arg.i32;
+    return true;
+  case JUMP_TYPE_RELATIVE_ARG2:
+    *target = static_cast<int64_t>( index ) + instruction.arg2;
+    return true;
+  case JUMP_TYPE_ABSOLUTE:
+    *target = static_cast<int64_t>( instruction.arg.sz );
+    return true;
+  case JUMP_TYPE_NONE:
+    break;
+  }
+  return false;
+}
@@ -0,0 +1,1435 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include "cfg.h"
+#include "ir.h"
+#include "parser_type.h"
+#include "verify.h"
+
+
+namespace {
+
+  // What an instruction does to the e-stack
+  //
+  struct effect_type {
+    ir_kind_type kind{ IR_KIND_TYPE_OTHER };
+    size_t       reads{};    // entries read, from the top
+    size_t       pops{};     // of those, how many are popped
+    bool         pushes{};   // a result
+    ir_data_type type{ IR_DATA_TYPE_DOUBLE };  // of the result
+  };
+
+
+  // Returns false for superinstructions (the IR is built before fusing)
+  //
+  bool effect_of( const instruction_type &instruction, size_t depth, effect_type *effect )
+  {
+    effect_type e;
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+      e.kind = IR_KIND_TYPE_CONST; e.pushes = true;
+      break;
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+      e.kind = IR_KIND_TYPE_CONST; e.pushes = true; e.type = IR_DATA_TYPE_INT32;
+      break;
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+      e.kind = IR_KIND_TYPE_CONST; e.pushes = true; e.type = IR_DATA_TYPE_SIZET;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+      e.kind = IR_KIND_TYPE_LOAD; e.pushes = true;
+      break;
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+      e.kind = IR_KIND_TYPE_LOAD; e.pushes = true; e.type = IR_DATA_TYPE_INT32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+    case INSTRUCTION_ID_TYPE_I2D:      // at depth 0; deeper ones are handled by the builder
+      e.kind = IR_KIND_TYPE_OPERATION; e.reads = e.pops = 1U; e.pushes = true;
+      break;
+    case INSTRUCTION_ID_TYPE_INEGATE:
+    case INSTRUCTION_ID_TYPE_D2I:
+      e.kind = IR_KIND_TYPE_OPERATION; e.reads = e.pops = 1U; e.pushes = true; e.type = IR_DATA_TYPE_INT32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+    case INSTRUCTION_ID_TYPE_IGE:
+    case INSTRUCTION_ID_TYPE_IGT:
+    case INSTRUCTION_ID_TYPE_ILE:
+    case INSTRUCTION_ID_TYPE_ILT:
+      e.kind = IR_KIND_TYPE_OPERATION; e.reads = e.pops = 2U; e.pushes = true;
+      break;
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_ISUBTRACT:
+    case INSTRUCTION_ID_TYPE_IDIVIDE:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+      e.kind = IR_KIND_TYPE_OPERATION; e.reads = e.pops = 2U; e.pushes = true; e.type = IR_DATA_TYPE_INT32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+      e.kind = IR_KIND_TYPE_STORE; e.reads = 1U;
+      break;
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+      e.reads = e.pops = 3U; e.pushes = true;
+      break;
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      e.reads = e.pops = 3U; e.pushes = true; e.type = IR_DATA_TYPE_INT32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_POP:
+      e.reads = e.pops = instruction.arg.sz;
+      break;
+    case INSTRUCTION_ID_TYPE_CLEAR:
+    case INSTRUCTION_ID_TYPE_RETURN:
+    case INSTRUCTION_ID_TYPE_TAILCALL:
+      e.reads = e.pops = depth;
+      break;
+    case INSTRUCTION_ID_TYPE_JEQZ:
+    case INSTRUCTION_ID_TYPE_JNEZ:
+      e.reads = 1U;
+      break;
+    case INSTRUCTION_ID_TYPE_JCEQZ:
+      e.reads = e.pops = 1U;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+      return false;
+
+    default:
+      // jumps, calls, stack bookkeeping
+      break;
+    }
+
+    *effect = e;
+    return true;
+  }
+
+
+  bool is_absolute_access( instruction_id_type id )
+  {
+    switch ( id ) {
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+
+  size_t width_of( instruction_id_type id )
+  {
+    switch ( id ) {
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      return 4U;
+    default:
+      return 8U;
+    }
+  }
+
+
+  // The defining instruction of a value, or nullptr for a parameter
+  //
+  const ir_instruction_type *definition_of( const ir_program_type &program, size_t value )
+  {
+    const ir_value_type &v = program.values[value];
+    if ( v.instruction == IR_NONE ) {
+      return nullptr;
+    }
+    return &program.blocks[ v.block ].instructions[ v.instruction ];
+  }
+
+
+  // Reverse postorder of the blocks reachable from entry
+  //
+  std::vector<size_t> reverse_postorder( const std::vector<ir_block_type> &blocks, size_t entry )
+  {
+    std::vector<size_t>                   order;
+    std::vector<bool>                     seen( blocks.size(), false );
+    std::vector<std::pair<size_t,size_t>> stack;  // (block, next successor)
+
+    seen[entry] = true;
+    stack.push_back( std::make_pair( entry, 0U ) );
+    while ( !stack.empty() ) {
+      const size_t b = stack.back().first;
+      if ( stack.back().second < blocks[b].successors.size() ) {
+        const size_t s = blocks[b].successors[ stack.back().second++ ];
+        if ( !seen[s] ) {
+          seen[s] = true;
+          stack.push_back( std::make_pair( s, 0U ) );
+        }
+      }
+      else {
+        order.push_back( b );
+        stack.pop_back();
+      }
+    }
+
+    std::reverse( order.begin(), order.end() );
+    return order;
+  }
+
+
+  // Immediate dominators, by the iterative algorithm of Cooper, Harvey
+  //  and Kennedy ("A Simple, Fast Dominance Algorithm")
+  //
+  void find_dominators( ir_program_type &program, const ir_function_type &function )
+  {
+    std::map<size_t,size_t> position;  // in reverse postorder
+    for ( size_t k=0U; k<function.blocks.size(); ++k ) {
+      position[ function.blocks[k] ] = k;
+    }
+
+    std::vector<size_t> idom( function.blocks.size(), IR_NONE );
+    idom[0] = 0U;
+
+    for ( bool changed = true; changed; ) {
+      changed = false;
+      for ( size_t k=1U; k<function.blocks.size(); ++k ) {
+        size_t new_idom = IR_NONE;
+        for ( size_t p : program.blocks[ function.blocks[k] ].predecessors ) {
+          size_t other = position[p];
+          if ( idom[other] == IR_NONE ) {
+            continue;
+          }
+          if ( new_idom == IR_NONE ) {
+            new_idom = other;
+            continue;
+          }
+          size_t a = other;
+          size_t b = new_idom;
+          while ( a != b ) {
+            while ( a > b ) { a = idom[a]; }
+            while ( b > a ) { b = idom[b]; }
+          }
+          new_idom = a;
+        }
+        if ( new_idom != idom[k] ) {
+          idom[k] = new_idom;
+          changed = true;
+        }
+      }
+    }
+
+    for ( size_t k=1U; k<function.blocks.size(); ++k ) {
+      program.blocks[ function.blocks[k] ].idom = function.blocks[ idom[k] ];
+    }
+  }
+
+
+  std::string describe( const instruction_type &instruction )
+  {
+    std::ostringstream text;
+    text << instruction_name( instruction.id );
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+      text << " " << instruction.arg.d;
+      break;
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+    case INSTRUCTION_ID_TYPE_I2D:
+      text << " " << instruction.arg.i32;
+      break;
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_POP:
+      text << " " << instruction.arg.sz;
+      break;
+    default:
+      break;
+    }
+
+    return text.str();
+  }
+
+
+  // The temporary a value is in: its own, or that of the value it is
+  //  the same as
+  //
+  size_t temp_of( const ir_program_type &program, size_t value )
+  {
+    while ( program.values[value].temp == IR_NONE && program.values[value].same_as != IR_NONE ) {
+      value = program.values[value].same_as;
+    }
+    return program.values[value].temp;
+  }
+
+
+  // Temporaries are reserved on entry, which only works if the entry
+  //  block is not also jumped back to (other than by a tail call, which
+  //  starts the frame over)
+  //
+  bool can_reserve( const ir_program_type &program, const ir_function_type &function )
+  {
+    for ( size_t p : program.blocks[ function.entry ].predecessors ) {
+      const ir_block_type &block = program.blocks[p];
+      if ( block.instructions.back().instruction.id != INSTRUCTION_ID_TYPE_TAILCALL ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  void dump_values( std::ostream &out, const char *open, const std::vector<size_t> &values, const char *close )
+  {
+    out << open;
+    for ( size_t k=0U; k<values.size(); ++k ) {
+      out << ( k ? " v" : "v" ) << values[k];
+    }
+    out << close;
+  }
+
+
+  void dump_instruction( std::ostream &out, const ir_program_type &program, const ir_instruction_type &ir, const char *indent )
+  {
+    std::ostringstream line;
+    line << indent;
+    if ( ir.result != IR_NONE ) {
+      line << "v" << ir.result << " = ";
+    }
+    line << describe( ir.instruction );
+    for ( size_t operand : ir.operands ) {
+      line << " v" << operand;
+    }
+
+    const bool  has_temp = ( ir.result != IR_NONE ) && ( program.values[ ir.result ].temp != IR_NONE );
+    std::string text     = line.str();
+    if ( text.size() < 44U && ( ir.removed || has_temp ) ) {
+      text.resize( 44U, ' ' );
+    }
+    out << text;
+
+    if ( ir.reload ) {
+      out << " ; = v" << program.values[ ir.result ].same_as << ", from t" << temp_of( program, ir.result );
+    }
+    else if ( ir.removed ) {
+      out << " ; removed";
+    }
+    else if ( has_temp ) {
+      out << " ; -> t" << program.values[ ir.result ].temp;
+    }
+    out << "\n";
+  }
+
+}
+
+
+bool build_ir( const std::vector<instruction_type> &instructions, ir_program_type &program )
+{
+  program = ir_program_type();
+  program.size = instructions.size();
+
+  std::vector<verify_state_type> states;
+  if ( instructions.empty() || !verify( instructions, nullptr, &states ) ) {
+    return false;
+  }
+
+  std::vector<size_t>                 block_of;
+  const std::vector<basic_block_type> cfg = build_cfg( instructions, false, &block_of );
+
+  program.blocks.resize( cfg.size() );
+  program.functions.emplace_back();
+  program.functions[0].top_level = true;
+
+  std::map<size_t,size_t> function_at;  // entry instruction -> function
+  for ( size_t b=0U; b<cfg.size(); ++b ) {
+    ir_block_type &block = program.blocks[b];
+    block.begin   = cfg[b].begin;
+    block.end     = cfg[b].end;
+    block.reached = states[ block.begin ].reached;
+    if ( !block.reached ) {
+      continue;
+    }
+
+    block.successors = cfg[b].successors;
+
+    if ( states[ block.begin ].in_function ) {
+      const size_t entry = states[ block.begin ].function;
+      auto         found = function_at.find( entry );
+      if ( found == function_at.end() ) {
+        found = function_at.insert( std::make_pair( entry, program.functions.size() ) ).first;
+        program.functions.emplace_back();
+        program.functions.back().entry = block_of[ entry ];
+      }
+      block.function = found->second;
+    }
+  }
+
+  for ( size_t b=0U; b<cfg.size(); ++b ) {
+    for ( size_t s : program.blocks[b].successors ) {
+      program.blocks[s].predecessors.push_back( b );
+    }
+  }
+
+  // Values: each block's parameters, then what its instructions push
+  //
+  for ( size_t b=0U; b<program.blocks.size(); ++b ) {
+    ir_block_type &block = program.blocks[b];
+
+    std::vector<size_t> stack;
+    if ( block.reached ) {
+      for ( size_t k=0U; k<states[ block.begin ].e_depth; ++k ) {
+        block.params.push_back( program.values.size() );
+        stack.push_back( program.values.size() );
+        program.values.emplace_back();
+        program.values.back().block = b;
+      }
+    }
+
+    for ( size_t i=block.begin; i<block.end; ++i ) {
+      block.instructions.emplace_back( instructions[i], i );
+      ir_instruction_type &ir = block.instructions.back();
+      ir.d_offset = states[i].d_offset;
+
+      if ( !block.reached ) {
+        continue;
+      }
+
+      effect_type effect;
+      if ( !effect_of( instructions[i], stack.size(), &effect ) ) {
+        return false;
+      }
+
+      if ( instructions[i].id == INSTRUCTION_ID_TYPE_I2D && instructions[i].arg.i32 != 0 ) {
+        // converts an entry below the top, in place
+        //
+        const size_t at = stack.size() - 1U - static_cast<size_t>( instructions[i].arg.i32 );
+        ir.operands.push_back( stack[at] );
+        ir.result = program.values.size();
+        stack[at] = ir.result;
+      }
+      else {
+        ir.kind = effect.kind;
+        ir.operands.assign( stack.end() - effect.reads, stack.end() );
+        stack.resize( stack.size() - effect.pops );
+        if ( effect.pushes ) {
+          ir.result = program.values.size();
+          stack.push_back( ir.result );
+        }
+      }
+
+      if ( ir.result != IR_NONE ) {
+        program.values.emplace_back();
+        program.values.back().block       = b;
+        program.values.back().instruction = block.instructions.size() - 1U;
+        program.values.back().type        = effect.type;
+      }
+
+      if ( ir.kind == IR_KIND_TYPE_LOAD || ir.kind == IR_KIND_TYPE_STORE ) {
+        ir.space = is_absolute_access( instructions[i].id ) ? IR_SPACE_TYPE_ABSOLUTE : IR_SPACE_TYPE_FRAME;
+      }
+    }
+
+    block.exit = stack;
+  }
+
+  // Resolve parameters that only ever get one value (other than
+  //  themselves, around a loop)
+  //
+  std::vector<size_t> alias( program.values.size(), IR_NONE );
+  auto resolve = [&alias]( size_t value ) {
+    while ( alias[value] != IR_NONE ) {
+      value = alias[value];
+    }
+    return value;
+  };
+
+  for ( bool changed = true; changed; ) {
+    changed = false;
+    for ( ir_block_type &block : program.blocks ) {
+      if ( block.predecessors.empty() ) {
+        continue;
+      }
+      for ( size_t k=0U; k<block.params.size(); ++k ) {
+        const size_t param = block.params[k];
+        if ( alias[param] != IR_NONE ) {
+          continue;
+        }
+        size_t only   = IR_NONE;
+        bool   unique = true;
+        for ( size_t p : block.predecessors ) {
+          const size_t incoming = resolve( program.blocks[p].exit[k] );
+          if ( incoming == param || incoming == only ) {
+            continue;
+          }
+          unique = unique && ( only == IR_NONE );
+          only   = incoming;
+        }
+        if ( unique && only != IR_NONE ) {
+          alias[param] = only;
+          changed      = true;
+        }
+      }
+    }
+  }
+
+  for ( ir_block_type &block : program.blocks ) {
+    for ( size_t &param : block.params ) {
+      param = resolve( param );
+    }
+    for ( size_t &value : block.exit ) {
+      value = resolve( value );
+    }
+    for ( ir_instruction_type &ir : block.instructions ) {
+      for ( size_t &operand : ir.operands ) {
+        operand = resolve( operand );
+      }
+    }
+  }
+
+  // Assignment targets are constants, pushed as an address or a frame
+  //  offset (see verify()). Temporaries can only be added if every one
+  //  is found, and every address pushed is one
+  //
+  program.can_rebase = true;
+  for ( ir_block_type &block : program.blocks ) {
+    for ( ir_instruction_type &ir : block.instructions ) {
+      const instruction_id_type id = ir.instruction.id;
+      if ( ( id != INSTRUCTION_ID_TYPE_ASSIGN && id != INSTRUCTION_ID_TYPE_ASSIGN_I32 ) || ir.operands.size() != 3U ) {
+        continue;
+      }
+      const ir_value_type &target = program.values[ ir.operands[0] ];
+      const ir_value_type &flag   = program.values[ ir.operands[1] ];
+      if ( target.instruction == IR_NONE || flag.instruction == IR_NONE
+        || program.blocks[ flag.block ].instructions[ flag.instruction ].instruction.id != INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+        program.can_rebase = false;
+        continue;
+      }
+      ir_instruction_type &target_ir = program.blocks[ target.block ].instructions[ target.instruction ];
+      ir.space = target_ir.space = program.blocks[ flag.block ].instructions[ flag.instruction ].instruction.arg.i32
+                                 ? IR_SPACE_TYPE_ABSOLUTE : IR_SPACE_TYPE_FRAME;
+    }
+  }
+  for ( const ir_block_type &block : program.blocks ) {
+    for ( const ir_instruction_type &ir : block.instructions ) {
+      if ( block.reached && ir.instruction.id == INSTRUCTION_ID_TYPE_PUSHSIZET && ir.space == IR_SPACE_TYPE_NONE ) {
+        program.can_rebase = false;
+      }
+    }
+  }
+
+  // Uses, for passes to tell which values only feed one instruction
+  //
+  for ( const ir_block_type &block : program.blocks ) {
+    for ( const ir_instruction_type &ir : block.instructions ) {
+      for ( size_t operand : ir.operands ) {
+        ++program.values[operand].uses;
+      }
+    }
+    for ( size_t value : block.exit ) {
+      ++program.values[value].uses;
+    }
+  }
+
+  for ( ir_function_type &function : program.functions ) {
+    function.blocks = reverse_postorder( program.blocks, function.entry );
+    find_dominators( program, function );
+  }
+
+  return true;
+}
+
+
+void lower_ir( const ir_program_type &program, std::vector<instruction_type> &instructions )
+{
+  std::vector<instruction_type> out;
+  std::vector<size_t>           old_index;
+  std::vector<size_t>           new_index( program.size + 1U );
+
+  out.reserve( program.size + 16U );
+  old_index.reserve( program.size + 16U );
+
+  // Each function's temporaries are the first slots of its frame; the
+  //  top level's frame starts at address 0, so moving it up moves the
+  //  globals too
+  //
+  const int32_t global_shift = static_cast<int32_t>( 8U * program.functions[0].temps );
+
+  auto temp_offset = [&program]( size_t value ) {
+    return static_cast<int32_t>( 8U * temp_of( program, value ) );
+  };
+
+  auto emit = [&out, &old_index]( const instruction_type &instruction, size_t index ) {
+    out.push_back( instruction );
+    old_index.push_back( index );
+  };
+
+  // An instruction as it was, but for the shift of what it accesses,
+  //  and, for a value with a temporary, a copy to it
+  //
+  auto emit_shifted = [&]( const ir_instruction_type &ir, int32_t shift ) {
+    instruction_type instruction( ir.instruction );
+    if ( ir.space == IR_SPACE_TYPE_ABSOLUTE ) {
+      if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+        instruction.arg.i32 += global_shift;
+      }
+      else {
+        instruction.arg.sz += global_shift;
+      }
+    }
+    else if ( ir.space == IR_SPACE_TYPE_FRAME && instruction.arg.i32 >= 0 ) {
+      instruction.arg.i32 += shift;
+    }
+    emit( instruction, ir.index );
+
+    if ( ir.result != IR_NONE && program.values[ ir.result ].temp != IR_NONE ) {
+      instruction_type save( INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET );
+      save.arg.i32 = temp_offset( ir.result );
+      emit( save, ir.index );
+    }
+  };
+
+  for ( size_t b=0U; b<program.blocks.size(); ++b ) {
+    const ir_block_type    &block    = program.blocks[b];
+    const ir_function_type &function = program.functions[ block.function ];
+    const int32_t           shift    = static_cast<int32_t>( 8U * function.temps );
+
+    new_index[ block.begin ] = out.size();
+    if ( block.reached && function.entry == b && function.temps != 0U ) {
+      instruction_type reserve( INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK );
+      reserve.arg.i32 = shift;
+      emit( reserve, block.begin );
+    }
+
+    // The block is only entered by falling through, other than from
+    //  inside its loop (see ir_hoist_invariants()), so jumps to it skip
+    //  the preheader
+    //
+    if ( !block.preheader.empty() ) {
+      for ( const ir_instruction_type &ir : block.preheader ) {
+        emit_shifted( ir, shift );
+        if ( ir.result != IR_NONE && program.values[ ir.result ].temp != IR_NONE ) {
+          instruction_type pop( INSTRUCTION_ID_TYPE_POP );
+          pop.arg.sz = 1U;
+          emit( pop, block.begin );
+        }
+      }
+      new_index[ block.begin ] = out.size();
+    }
+
+    for ( const ir_instruction_type &ir : block.instructions ) {
+      if ( ir.index != block.begin ) {
+        new_index[ ir.index ] = out.size();
+      }
+
+      if ( ir.reload ) {
+        instruction_type load( INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET );
+        load.arg.i32 = temp_offset( ir.result );
+        emit( load, ir.index );
+      }
+      if ( ir.removed ) {
+        continue;
+      }
+
+      if ( block.reached ) {
+        emit_shifted( ir, shift );
+      }
+      else {
+        emit( ir.instruction, ir.index );
+      }
+    }
+  }
+  new_index[ program.size ] = out.size();
+
+  remap_jumps( out, old_index, new_index );
+  instructions.swap( out );
+}
+
+
+void dump_ir( std::ostream &out, const ir_program_type &program )
+{
+  for ( size_t f=0U; f<program.functions.size(); ++f ) {
+    const ir_function_type &function = program.functions[f];
+    const ir_block_type    &entry    = program.blocks[ function.entry ];
+
+    if ( function.top_level ) {
+      out << "top level";
+    }
+    else {
+      out << "function at " << entry.begin;
+    }
+    out << ": " << function.blocks.size() << " block(s), " << function.temps << " temporar" << ( ( function.temps == 1U ) ? "y" : "ies" ) << "\n";
+
+    for ( size_t b : function.blocks ) {
+      const ir_block_type &block = program.blocks[b];
+
+      out << "  b" << b << " [" << block.begin << ", " << block.end << ")";
+      if ( !block.params.empty() ) {
+        dump_values( out, " (", block.params, ")" );
+      }
+      if ( block.idom != IR_NONE ) {
+        out << " idom b" << block.idom;
+      }
+      out << " <-";
+      for ( size_t p : block.predecessors ) {
+        out << " b" << p;
+      }
+      out << " ->";
+      for ( size_t s : block.successors ) {
+        out << " b" << s;
+      }
+      out << "\n";
+
+      for ( const ir_instruction_type &ir : block.preheader ) {
+        dump_instruction( out, program, ir, "    ^ " );
+      }
+      for ( const ir_instruction_type &ir : block.instructions ) {
+        dump_instruction( out, program, ir, "    " );
+      }
+
+      if ( !block.exit.empty() ) {
+        dump_values( out, "    exit (", block.exit, ")\n" );
+      }
+    }
+  }
+}
+
+
+size_t ir_computation_size( const ir_program_type &program, size_t value, size_t *first )
+{
+  const ir_value_type &v = program.values[value];
+  if ( v.instruction == IR_NONE ) {
+    return 0U;
+  }
+
+  const ir_block_type &block = program.blocks[ v.block ];
+  if ( block.instructions[ v.instruction ].kind != IR_KIND_TYPE_OPERATION ) {
+    return 0U;
+  }
+
+  // Walk back from the operation: each instruction must compute an
+  //  operand still wanted, for nothing else
+  //
+  std::vector<size_t> wanted;
+  size_t              i = v.instruction;
+  for ( ;; ) {
+    const ir_instruction_type &ir = block.instructions[i];
+    if ( ir.removed || ir.result == IR_NONE
+      || ( ir.kind != IR_KIND_TYPE_CONST && ir.kind != IR_KIND_TYPE_LOAD && ir.kind != IR_KIND_TYPE_OPERATION ) ) {
+      return 0U;
+    }
+    if ( i != v.instruction ) {
+      if ( wanted.empty() || wanted.back() != ir.result
+        || program.values[ ir.result ].uses != 1U || program.values[ ir.result ].temp != IR_NONE ) {
+        return 0U;
+      }
+      wanted.pop_back();
+    }
+    wanted.insert( wanted.end(), ir.operands.begin(), ir.operands.end() );
+    if ( wanted.empty() ) {
+      break;
+    }
+    if ( i == 0U ) {
+      return 0U;
+    }
+    --i;
+  }
+
+  if ( first ) {
+    *first = i;
+  }
+  return v.instruction - i + 1U;
+}
+
+
+bool ir_replace_with( ir_program_type &program, size_t value, size_t with )
+{
+  size_t first;
+  if ( !program.can_rebase || value == with
+    || ir_computation_size( program, value, &first ) == 0U
+    || program.values[value].type != IR_DATA_TYPE_DOUBLE
+    || program.values[with].type  != IR_DATA_TYPE_DOUBLE
+    || program.values[with].instruction == IR_NONE
+    || program.blocks[ program.values[with].block ].function != program.blocks[ program.values[value].block ].function ) {
+    return false;
+  }
+
+  ir_value_type &w = program.values[with];
+  if ( program.blocks[ w.block ].instructions[ w.instruction ].removed
+    || !can_reserve( program, program.functions[ program.blocks[ w.block ].function ] ) ) {
+    return false;
+  }
+  if ( w.temp == IR_NONE ) {
+    w.temp = program.functions[ program.blocks[ w.block ].function ].temps++;
+  }
+
+  ir_value_type &v = program.values[value];
+  ir_block_type &block = program.blocks[ v.block ];
+  for ( size_t i=first; i<=v.instruction; ++i ) {
+    block.instructions[i].removed = true;
+    for ( size_t operand : block.instructions[i].operands ) {
+      --program.values[operand].uses;
+    }
+  }
+  block.instructions[ v.instruction ].reload = true;
+  v.same_as = with;
+  ++w.uses;
+
+  return true;
+}
+
+
+namespace {
+
+  bool is_commutative( instruction_id_type id )
+  {
+    switch ( id ) {
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+
+  // A d-stack location written since the state's epoch began
+  //
+  struct written_type {
+    bool    absolute{};
+    int64_t address{};
+    size_t  width{};
+    int64_t version{};
+  };
+
+
+  // Top-level frame offsets are addresses: the frame starts at 0
+  //
+  written_type location_of( const ir_function_type &function, const ir_instruction_type &ir )
+  {
+    written_type where;
+    where.absolute = ( ir.space == IR_SPACE_TYPE_ABSOLUTE ) || function.top_level;
+    where.address  = ( ir.space == IR_SPACE_TYPE_ABSOLUTE ) ? static_cast<int64_t>( ir.instruction.arg.sz ) : ir.instruction.arg.i32;
+    where.width    = width_of( ir.instruction.id );
+    return where;
+  }
+
+
+  // Where an assignment (with a known target) writes
+  //
+  written_type target_of( const ir_program_type &program, const ir_function_type &function, const ir_instruction_type &ir )
+  {
+    const ir_instruction_type &target = *definition_of( program, ir.operands[0] );
+    written_type               where;
+    where.absolute = ( ir.space == IR_SPACE_TYPE_ABSOLUTE ) || function.top_level;
+    where.address  = ( target.instruction.id == INSTRUCTION_ID_TYPE_PUSHSIZET )
+                   ? static_cast<int64_t>( target.instruction.arg.sz ) : target.instruction.arg.i32;
+    where.width    = width_of( ir.instruction.id );
+    return where;
+  }
+
+
+  bool overlaps( const written_type &a, const written_type &b )
+  {
+    return a.absolute == b.absolute
+        && a.address < b.address + static_cast<int64_t>( b.width )
+        && b.address < a.address + static_cast<int64_t>( a.width );
+  }
+
+
+  // What is known about memory at a point: loads in the same epoch, with
+  //  no overlapping write in between, read the same value
+  //
+  struct memory_state_type {
+    int64_t                    epoch{};
+    std::vector<written_type>  written;
+  };
+
+
+  const size_t MAX_WRITTEN = 64U;
+
+
+  class value_numbering_type {
+
+    public:
+      explicit value_numbering_type( ir_program_type &program )
+        :program_( program )
+        ,number_( program.values.size() )
+        ,states_( program.blocks.size() )
+        ,next_version_( 0 )
+      {
+        for ( size_t v=0U; v<number_.size(); ++v ) {
+          number_[v] = v;
+        }
+      }
+
+      size_t run()
+      {
+        for ( const ir_function_type &function : program_.functions ) {
+          number( function );
+        }
+
+        // Largest computations first: replacing one removes the smaller
+        //  ones inside it
+        //
+        std::vector<std::pair<size_t,size_t>> candidates;  // (original index, value)
+        for ( size_t v=0U; v<number_.size(); ++v ) {
+          if ( number_[v] != v ) {
+            const ir_value_type &value = program_.values[v];
+            candidates.push_back( std::make_pair( program_.blocks[ value.block ].instructions[ value.instruction ].index, v ) );
+          }
+        }
+        std::sort( candidates.rbegin(), candidates.rend() );
+
+        size_t replaced = 0U;
+        for ( const auto &candidate : candidates ) {
+          const size_t value  = candidate.second;
+          const size_t leader = number_[value];
+          const size_t size   = ir_computation_size( program_, value, nullptr );
+          if ( ( size >= 3U || ( size == 2U && program_.values[leader].temp != IR_NONE ) )
+            && ir_replace_with( program_, value, leader ) ) {
+            ++replaced;
+          }
+        }
+        return replaced;
+      }
+
+    private:
+      typedef std::vector<int64_t> key_type;
+
+      // Over the dominator tree, in preorder; what a block adds to the
+      //  table is taken out again once its subtree is done
+      //
+      void number( const ir_function_type &function )
+      {
+        std::map<size_t,std::vector<size_t>> children;
+        for ( size_t b : function.blocks ) {
+          if ( program_.blocks[b].idom != IR_NONE ) {
+            children[ program_.blocks[b].idom ].push_back( b );
+          }
+        }
+
+        std::map<key_type,size_t>                  table;
+        std::vector<std::pair<size_t,size_t>>      stack;   // (block, next child)
+        std::vector<std::vector<key_type>>         added;   // by each block on the stack
+
+        stack.push_back( std::make_pair( function.entry, 0U ) );
+        added.emplace_back();
+        enter( function, function.entry, table, added.back() );
+        while ( !stack.empty() ) {
+          const size_t               b    = stack.back().first;
+          const std::vector<size_t> &kids = children[b];
+          if ( stack.back().second < kids.size() ) {
+            const size_t child = kids[ stack.back().second++ ];
+            stack.push_back( std::make_pair( child, 0U ) );
+            added.emplace_back();
+            enter( function, child, table, added.back() );
+          }
+          else {
+            for ( const key_type &key : added.back() ) {
+              table.erase( key );
+            }
+            added.pop_back();
+            stack.pop_back();
+          }
+        }
+      }
+
+      void enter( const ir_function_type &function, size_t b, std::map<key_type,size_t> &table, std::vector<key_type> &added )
+      {
+        ir_block_type     &block = program_.blocks[b];
+        memory_state_type &state = states_[b];
+
+        if ( block.predecessors.size() == 1U && b != function.entry ) {
+          state = states_[ block.predecessors[0] ];
+        }
+        else {
+          forget( state );
+        }
+
+        for ( ir_instruction_type &ir : block.instructions ) {
+          if ( ir.result != IR_NONE && ir.kind != IR_KIND_TYPE_OTHER && !ir.removed ) {
+            const key_type key = key_of( function, ir, state );
+            auto           found = table.find( key );
+            if ( found != table.end() ) {
+              number_[ ir.result ] = found->second;
+            }
+            else {
+              table.insert( std::make_pair( key, ir.result ) );
+              added.push_back( key );
+            }
+          }
+          update( function, ir, state );
+        }
+      }
+
+      key_type key_of( const ir_function_type &function, const ir_instruction_type &ir, const memory_state_type &state ) const
+      {
+        key_type key{ static_cast<int64_t>( ir.instruction.id ) };
+
+        switch ( ir.kind ) {
+        case IR_KIND_TYPE_CONST:
+          {
+            int64_t bits = 0;
+            std::memcpy( &bits, &ir.instruction.arg, std::min( sizeof( bits ), sizeof( ir.instruction.arg ) ) );
+            if ( ir.instruction.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+              bits = ir.instruction.arg.i32;
+            }
+            key.push_back( bits );
+          }
+          break;
+
+        case IR_KIND_TYPE_LOAD:
+          {
+            written_type where = location_of( function, ir );
+            int64_t      version = 0;
+            for ( const written_type &w : state.written ) {
+              if ( overlaps( w, where ) ) {
+                version = std::max( version, w.version );
+              }
+            }
+            key.push_back( where.absolute );
+            key.push_back( where.address );
+            key.push_back( state.epoch );
+            key.push_back( version );
+          }
+          break;
+
+        default:
+          {
+            std::vector<int64_t> operands;
+            for ( size_t operand : ir.operands ) {
+              operands.push_back( static_cast<int64_t>( number_[operand] ) );
+            }
+            if ( is_commutative( ir.instruction.id ) ) {
+              std::sort( operands.begin(), operands.end() );
+            }
+            key.insert( key.end(), operands.begin(), operands.end() );
+          }
+          break;
+        }
+
+        return key;
+      }
+
+      void forget( memory_state_type &state )
+      {
+        state.epoch = ++next_version_;
+        state.written.clear();
+      }
+
+      void write( memory_state_type &state, const written_type &where )
+      {
+        if ( state.written.size() == MAX_WRITTEN ) {
+          forget( state );
+        }
+        state.written.push_back( where );
+        state.written.back().version = ++next_version_;
+      }
+
+      void update( const ir_function_type &function, const ir_instruction_type &ir, memory_state_type &state )
+      {
+        switch ( ir.instruction.id ) {
+        case INSTRUCTION_ID_TYPE_COPYTOADDR:
+        case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+        case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+        case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+          write( state, location_of( function, ir ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_ASSIGN:
+        case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+          if ( ir.space == IR_SPACE_TYPE_NONE || ir.operands.size() != 3U ) {
+            forget( state );
+          }
+          else {
+            write( state, target_of( program_, function, ir ) );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_CALL:  // the callee writes globals, and its args
+          forget( state );
+          break;
+
+        case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+          // space given back, and taken again, is cleared
+          //
+          if ( ir.instruction.arg.i32 < 0 ) {
+            forget( state );
+          }
+          break;
+
+        default:
+          break;
+        }
+      }
+
+      ir_program_type                &program_;
+      std::vector<size_t>             number_;   // each value's leader
+      std::vector<memory_state_type>  states_;   // at the end of each block
+      int64_t                         next_version_;
+  };
+
+}
+
+
+size_t ir_value_numbering( ir_program_type &program )
+{
+  return value_numbering_type( program ).run();
+}
+
+
+namespace {
+
+  bool can_fail( instruction_id_type id )
+  {
+    return id == INSTRUCTION_ID_TYPE_DIVIDE || id == INSTRUCTION_ID_TYPE_IDIVIDE || id == INSTRUCTION_ID_TYPE_D2I;
+  }
+
+
+  // A natural loop: a header, and the blocks that reach a back edge to
+  //  it without going through it
+  //
+  struct loop_type {
+    size_t                    header{};
+    std::vector<bool>         body;        // by block
+    size_t                    size{};
+    bool                      hoistable{};  // the header can have a preheader
+    bool                      clobbers{};   // writes memory that is not known (a call, say)
+    std::vector<written_type> written;
+  };
+
+
+  bool dominates( const ir_program_type &program, size_t a, size_t b )
+  {
+    for ( ; b != IR_NONE; b = program.blocks[b].idom ) {
+      if ( b == a ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  std::vector<loop_type> find_loops( const ir_program_type &program, const ir_function_type &function )
+  {
+    std::vector<loop_type> loops;
+
+    for ( size_t h : function.blocks ) {
+      const ir_block_type &header = program.blocks[h];
+
+      loop_type           loop;
+      std::vector<size_t> work;
+      loop.header = h;
+      loop.body.assign( program.blocks.size(), false );
+      loop.body[h] = true;
+      for ( size_t p : header.predecessors ) {
+        if ( dominates( program, h, p ) ) {
+          work.push_back( p );
+        }
+      }
+      if ( work.empty() ) {
+        continue;
+      }
+      while ( !work.empty() ) {
+        const size_t b = work.back();
+        work.pop_back();
+        if ( !loop.body[b] ) {
+          loop.body[b] = true;
+          work.insert( work.end(), program.blocks[b].predecessors.begin(), program.blocks[b].predecessors.end() );
+        }
+      }
+
+      // The preheader is emitted just before the header, so the only
+      //  way into the loop must be by falling through to it
+      //
+      size_t entries = 0U;
+      bool   falls   = false;
+      for ( size_t p : header.predecessors ) {
+        if ( !loop.body[p] ) {
+          ++entries;
+          falls = ( program.blocks[p].end == header.begin )
+               && !is_control_transfer( program.blocks[p].instructions.back().instruction.id );
+        }
+      }
+      loop.hoistable = ( h != function.entry ) && header.params.empty() && entries == 1U && falls;
+
+      for ( size_t b=0U; b<program.blocks.size(); ++b ) {
+        if ( !loop.body[b] ) {
+          continue;
+        }
+        ++loop.size;
+        for ( const ir_instruction_type &ir : program.blocks[b].instructions ) {
+          switch ( ir.instruction.id ) {
+          case INSTRUCTION_ID_TYPE_COPYTOADDR:
+          case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+          case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+          case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+            loop.written.push_back( location_of( function, ir ) );
+            break;
+
+          case INSTRUCTION_ID_TYPE_ASSIGN:
+          case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+            if ( ir.space == IR_SPACE_TYPE_NONE || ir.operands.size() != 3U ) {
+              loop.clobbers = true;
+            }
+            else {
+              loop.written.push_back( target_of( program, function, ir ) );
+            }
+            break;
+
+          case INSTRUCTION_ID_TYPE_CALL:
+            loop.clobbers = true;
+            break;
+
+          case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+            if ( ir.instruction.arg.i32 < 0 ) {
+              // everything above the new end is cleared when taken again
+              //
+              written_type above;
+              above.absolute = function.top_level;
+              above.address  = ir.d_offset + ir.instruction.arg.i32;
+              above.width    = static_cast<size_t>( INT32_MAX );
+              loop.written.push_back( above );
+            }
+            break;
+
+          default:
+            break;
+          }
+        }
+      }
+
+      loops.push_back( loop );
+    }
+
+    // Outermost first
+    //
+    std::stable_sort( loops.begin(), loops.end(), []( const loop_type &a, const loop_type &b ) { return a.size > b.size; } );
+    return loops;
+  }
+
+
+  // Instructions [first, last] of a block compute the same value every
+  //  time round the loop, and cannot fail
+  //
+  bool is_invariant( const ir_function_type &function, const ir_block_type &block, size_t first, size_t last, const loop_type &loop )
+  {
+    for ( size_t i=first; i<=last; ++i ) {
+      const ir_instruction_type &ir = block.instructions[i];
+      if ( ir.kind == IR_KIND_TYPE_LOAD ) {
+        if ( loop.clobbers ) {
+          return false;
+        }
+        const written_type where = location_of( function, ir );
+        for ( const written_type &w : loop.written ) {
+          if ( overlaps( w, where ) ) {
+            return false;
+          }
+        }
+      }
+      else if ( ir.kind == IR_KIND_TYPE_OPERATION && can_fail( ir.instruction.id ) ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+}
+
+
+size_t ir_hoist_invariants( ir_program_type &program )
+{
+  if ( !program.can_rebase ) {
+    return 0U;
+  }
+
+  size_t hoisted = 0U;
+  for ( ir_function_type &function : program.functions ) {
+    if ( !can_reserve( program, function ) ) {
+      continue;
+    }
+
+    const std::vector<loop_type> loops = find_loops( program, function );
+    if ( loops.empty() ) {
+      continue;
+    }
+
+    // Largest computations first (see ir_value_numbering())
+    //
+    std::vector<std::pair<size_t,size_t>> candidates;  // (original index, value)
+    for ( size_t b : function.blocks ) {
+      for ( const ir_instruction_type &ir : program.blocks[b].instructions ) {
+        if ( ir.kind == IR_KIND_TYPE_OPERATION && !ir.removed && program.values[ ir.result ].type == IR_DATA_TYPE_DOUBLE ) {
+          candidates.push_back( std::make_pair( ir.index, ir.result ) );
+        }
+      }
+    }
+    std::sort( candidates.rbegin(), candidates.rend() );
+
+    for ( const auto &candidate : candidates ) {
+      const size_t   value = candidate.second;
+      ir_value_type &v     = program.values[value];
+      ir_block_type &block = program.blocks[ v.block ];
+      size_t         first;
+      if ( ir_computation_size( program, value, &first ) == 0U ) {
+        continue;
+      }
+
+      // Out of the outermost loop it does not change in
+      //
+      const loop_type *out_of = nullptr;
+      for ( const loop_type &loop : loops ) {
+        if ( loop.body[ v.block ] && loop.hoistable && is_invariant( function, block, first, v.instruction, loop ) ) {
+          out_of = &loop;
+          break;
+        }
+      }
+      if ( !out_of ) {
+        continue;
+      }
+
+      // The value is now computed ahead of the loop, into a temporary
+      //  (its own, if it already had one)
+      //
+      const size_t hoisted_value = program.values.size();
+      program.values.emplace_back();
+      ir_value_type &h = program.values.back();
+      ir_value_type &r = program.values[value];
+      h.block = out_of->header;
+      h.uses  = 1U;
+      h.temp  = ( r.temp != IR_NONE ) ? r.temp : function.temps++;
+      r.temp    = IR_NONE;
+      r.same_as = hoisted_value;
+
+      std::vector<ir_instruction_type> &preheader = program.blocks[ out_of->header ].preheader;
+      for ( size_t i=first; i<=r.instruction; ++i ) {
+        ir_instruction_type &ir = block.instructions[i];
+        preheader.push_back( ir );
+        ir.removed = true;
+      }
+      preheader.back().result = hoisted_value;
+      block.instructions[ r.instruction ].reload = true;
+
+      ++hoisted;
+    }
+  }
+
+  return hoisted;
+}
+
+
+void ir_pass_manager_type::add( const std::string &name, pass_type pass )
+{
+  passes_.push_back( std::make_pair( name, pass ) );
+}
+
+
+bool ir_pass_manager_type::add( const std::string &name )
+{
+  if ( name == "gvn" ) {
+    add( name, ir_value_numbering );
+    return true;
+  }
+  if ( name == "licm" ) {
+    add( name, ir_hoist_invariants );
+    return true;
+  }
+  return false;
+}
+
+
+bool ir_pass_manager_type::run( std::vector<instruction_type> &instructions, std::ostream *dump )
+{
+  results_.clear();
+
+  ir_program_type program;
+  if ( !build_ir( instructions, program ) ) {
+    return false;
+  }
+  if ( dump ) {
+    *dump << "ir: built\n";
+    dump_ir( *dump, program );
+  }
+
+  for ( const auto &pass : passes_ ) {
+    const size_t changes = pass.second( program );
+    results_.push_back( std::make_pair( pass.first, changes ) );
+    if ( dump ) {
+      *dump << "ir: after " << pass.first << " (" << changes << " change(s))\n";
+      dump_ir( *dump, program );
+    }
+  }
+
+  std::vector<instruction_type> lowered;
+  lower_ir( program, lowered );
+  if ( !verify( lowered, nullptr ) ) {
+    results_.clear();
+    return false;
+  }
+
+  instructions.swap( lowered );
+  return true;
+}
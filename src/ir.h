@@ -0,0 +1,226 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "instruction_type.h"
+
+
+// A mid-level IR, in SSA form, built from (verified) instructions and
+//  lowered back to them, so that optimizations that need to see across
+//  statements and blocks can be written as passes over values rather
+//  than over the e-stack.
+//
+// Every e-stack entry is a value, defined once: by the instruction that
+//  pushes it, or, if it is on the e-stack when a block is entered, by a
+//  parameter of the block (which each predecessor supplies from its
+//  exit stack - the IR's phi). Parameters that always get the same value
+//  are resolved to it. Variables stay in memory: loads and stores are
+//  instructions, and passes track which locations are written.
+//
+// Lowering emits the original instructions, except as passes have
+//  changed them: a value that a pass found to be the same as another
+//  one (which dominates it) is no longer computed, but loaded from a
+//  temporary that the other value is copied to when it is computed.
+//  Temporaries are the first slots of each stack frame (the first
+//  global addresses, at the top level); the rest of the frame, and
+//  everything that refers to it, is moved up to make room.
+//
+
+const size_t IR_NONE = static_cast<size_t>( -1 );
+
+
+enum ir_kind_type {
+   IR_KIND_TYPE_CONST       // push-double, push-int32, push-sizet
+  ,IR_KIND_TYPE_LOAD        // copy-from-addr, copy-from-stack-offset (and -i32)
+  ,IR_KIND_TYPE_OPERATION   // arithmetic, comparisons, logic and conversions of the top entries
+  ,IR_KIND_TYPE_STORE       // copy-to-addr, copy-to-stack-offset (and -i32); the value stays on the e-stack
+  ,IR_KIND_TYPE_OTHER       // everything else: assignments, calls, jumps, pops, stack bookkeeping
+};
+
+
+enum ir_data_type {
+   IR_DATA_TYPE_DOUBLE
+  ,IR_DATA_TYPE_INT32
+  ,IR_DATA_TYPE_SIZET
+};
+
+
+// Where an access (or an assignment target) is
+//
+enum ir_space_type {
+   IR_SPACE_TYPE_NONE
+  ,IR_SPACE_TYPE_ABSOLUTE   // a global address
+  ,IR_SPACE_TYPE_FRAME      // an offset from the stack frame base
+};
+
+
+struct ir_value_type {
+  size_t       block{};                   // defining block
+  size_t       instruction{ IR_NONE };    // index in the block's instructions; IR_NONE for a parameter
+  ir_data_type type{ IR_DATA_TYPE_DOUBLE };
+  size_t       same_as{ IR_NONE };        // set by passes: a value that dominates this one, and always equals it
+  size_t       temp{ IR_NONE };           // the temporary it is copied to, if any
+  size_t       uses{};                    // operands and exit stack entries that are this value
+};
+
+
+struct ir_instruction_type {
+
+  ir_instruction_type( const instruction_type &in_instruction, size_t in_index )
+    :instruction( in_instruction )
+    ,index( in_index )
+  {}
+
+  instruction_type    instruction;             // the original
+  size_t              index{};                 // of the original
+  ir_kind_type        kind{ IR_KIND_TYPE_OTHER };
+  std::vector<size_t> operands;                // values read, deepest first
+  size_t              result{ IR_NONE };
+  ir_space_type       space{ IR_SPACE_TYPE_NONE };  // loads, stores, and constants that are assignment targets
+  int64_t             d_offset{};              // d-stack size before it, relative to the frame base (see verify())
+  bool                removed{};               // by a pass: not emitted
+  bool                reload{};                // removed, and its result loaded from result.same_as's temporary instead
+};
+
+
+struct ir_block_type {
+  size_t                           begin{};    // the original instructions
+  size_t                           end{};
+  bool                             reached{};  // blocks not reached (see verify()) have no IR, and are emitted as they are
+  size_t                           function{}; // index in ir_program_type::functions
+  std::vector<size_t>              params;     // values on the e-stack on entry, deepest first
+  std::vector<ir_instruction_type> instructions;
+  std::vector<ir_instruction_type> preheader;  // hoisted out of the loop this block heads, emitted before it
+  std::vector<size_t>              exit;       // values on the e-stack on exit, to every successor
+  std::vector<size_t>              successors;
+  std::vector<size_t>              predecessors;
+  size_t                           idom{ IR_NONE };  // immediate dominator (IR_NONE for the entry)
+};
+
+
+// The top level, or a function: its own stack frame and control flow
+//  graph
+//
+struct ir_function_type {
+  bool                top_level{};
+  size_t              entry{};       // block
+  std::vector<size_t> blocks;        // in reverse postorder
+  size_t              temps{};       // temporaries needed
+};
+
+
+struct ir_program_type {
+  std::vector<ir_block_type>    blocks;        // all of them, in instruction order
+  std::vector<ir_function_type> functions;     // the top level first
+  std::vector<ir_value_type>    values;
+  bool                          can_rebase{};  // every frame and global access is known, so temporaries can be added
+  size_t                        size{};        // of the original instructions
+};
+
+
+// Build the IR. The instructions must pass verify(), and not have been
+//  fused; returns false otherwise
+//
+bool build_ir( const std::vector<instruction_type> &instructions, ir_program_type &program );
+
+// Instructions for the IR, as passes have left it
+//
+void lower_ir( const ir_program_type &program, std::vector<instruction_type> &instructions );
+
+// Print the IR, one line per instruction, with the values it reads and
+//  defines, and each block's parameters, exit stack and edges
+//
+void dump_ir( std::ostream &out, const ir_program_type &program );
+
+
+// The number of instructions computing value: an operation, and the
+//  instructions just before it that compute its operands (and nothing
+//  else), recursively. 0 if the value is not computed like that. first,
+//  if given, receives the index (in the block) of the first of them
+//
+size_t ir_computation_size( const ir_program_type &program, size_t value, size_t *first );
+
+// Replace the computation of value (see ir_computation_size()) with a
+//  load of with's temporary, which with must dominate. Fails if value
+//  is not computed like that, or either value cannot be kept in a
+//  temporary
+//
+bool ir_replace_with( ir_program_type &program, size_t value, size_t with );
+
+
+// Global value numbering: over each function's dominator tree, values
+//  computed the same way from the same values (and loads of locations
+//  not written in between) are numbered the same, and computations of
+//  at least two instructions are replaced with the first such value,
+//  where it pays for the temporary. Returns the number replaced
+//
+size_t ir_value_numbering( ir_program_type &program );
+
+
+// Loop-invariant code motion: computations in a loop (a while loop,
+//  say) over constants and locations the loop does not write, and that
+//  cannot fail, are moved to the loop's preheader, each into a
+//  temporary, out of the outermost loop they do not change in. A loop
+//  with a call, or an assignment to an unknown location, is taken to
+//  write everything. Returns the number moved
+//
+size_t ir_hoist_invariants( ir_program_type &program );
+
+
+// Runs passes over the IR of a set of instructions, then lowers it back
+//
+class ir_pass_manager_type {
+
+  public:
+    typedef std::function<size_t( ir_program_type& )> pass_type;  // returns the number of changes
+
+    void add( const std::string &name, pass_type pass );
+
+    // Add one of the passes above by name ("gvn", "licm"); false if
+    //  there is no such pass
+    //
+    bool add( const std::string &name );
+
+    // Build the IR, run the passes in order, and lower. If dump is
+    //  given, the IR is printed to it after building and after each
+    //  pass. Returns false (leaving the instructions alone) if the IR
+    //  cannot be built, or the result does not verify
+    //
+    bool run( std::vector<instruction_type> &instructions, std::ostream *dump );
+
+    // The number of changes each pass made, in order, from the last run()
+    //
+    const std::vector<std::pair<std::string,size_t>> &results() const { return results_; }
+
+  private:
+    std::vector<std::pair<std::string,pass_type>> passes_;
+    std::vector<std::pair<std::string,size_t>>    results_;
+};
@@ -0,0 +1,1203 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Native code is only generated for x86-64, with the System V calling
+//  convention (Linux, BSD, macOS)
+//
+#if defined(__x86_64__) && !defined(_WIN32) && ( defined(__unix__) || defined(__APPLE__) )
+#include <sys/mman.h>
+#include <unistd.h>
+#define SINTERP_JIT 1
+#else
+#define SINTERP_JIT 0
+#endif
+
+#include <cstddef>
+#include <cstring>
+
+#include "jit.h"
+
+
+namespace {
+
+  // OP-CLEAR, for the native code
+  //
+  void print_result( jit_type::context_type *context, double value, size_t depth )
+  {
+    if ( !context->results ) {
+      return;
+    }
+    context->results->put( value );
+    if ( depth > 1U ) {
+      context->results->stack_size_warning( depth );
+    }
+  }
+
+
+#if SINTERP_JIT
+
+  uint64_t bits_of( double value )
+  {
+    uint64_t rv;
+    std::memcpy( &rv, &value, sizeof( rv ) );
+    return rv;
+  }
+
+
+  // An e-stack operand, at compile time. Doubles are in xmm<slot>;
+  //  anything else is a constant (the raw operand_data_type bits)
+  //
+  struct slot_type {
+    operand_type  type;
+    uint64_t      bits;
+
+    bool operator==( const slot_type &rhs ) const
+    {
+      return type == rhs.type && ( type == OPERAND_TYPE_DOUBLE || bits == rhs.bits );
+    }
+    bool operator!=( const slot_type &rhs ) const { return !( *this == rhs ); }
+  };
+
+  typedef std::vector<slot_type> stack_model_type;
+
+  const slot_type DOUBLE_SLOT = { OPERAND_TYPE_DOUBLE, 0U };
+
+
+  bool doubles_on_top( const stack_model_type &stack, size_t n )
+  {
+    if ( stack.size() < n ) {
+      return false;
+    }
+    for ( size_t i=stack.size()-n; i<stack.size(); ++i ) {
+      if ( stack[i].type != OPERAND_TYPE_DOUBLE ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  bool fits_disp32( size_t addr )
+  {
+    return addr <= 0x7FFFFFFFU;
+  }
+
+
+  // The e-stack effect of an instruction: updates stack from the
+  //  e-stack before the instruction to the e-stack after it, and sets
+  //  *falls_through and *target (-1 if none).
+  //
+  // Returns false if the instruction is left to the interpreter, either
+  //  because it is not supported, or because the e-stack is not in the
+  //  form the native code needs (e.g. too deep)
+  //
+  bool model_instruction(
+                         const instruction_type &instruction
+                        ,size_t                  index
+                        ,size_t                  instr_count
+                        ,stack_model_type       &stack
+                        ,bool                   *falls_through
+                        ,int64_t                *target
+                        )
+  {
+    *falls_through = true;
+    *target        = -1;
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      if ( stack.size() >= jit_type::MAX_DEPTH ) {
+        return false;
+      }
+      stack.push_back( DOUBLE_SLOT );
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+      if ( stack.size() >= jit_type::MAX_DEPTH || !fits_disp32( instruction.arg.sz ) ) {
+        return false;
+      }
+      stack.push_back( DOUBLE_SLOT );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+      if ( stack.size() >= jit_type::MAX_DEPTH ) {
+        return false;
+      }
+      stack.push_back( slot_type{ OPERAND_TYPE_INT32, operand_data_type( instruction.arg.i32 ).bits() } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+      if ( stack.size() >= jit_type::MAX_DEPTH ) {
+        return false;
+      }
+      stack.push_back( slot_type{ OPERAND_TYPE_SIZET, operand_data_type( instruction.arg.sz ).bits() } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+      if ( !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+      if ( !doubles_on_top( stack, 1U ) || !fits_disp32( instruction.arg.sz ) ) {
+        return false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+      if ( !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      stack.pop_back();
+      break;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+      if ( !doubles_on_top( stack, 2U ) ) {
+        return false;
+      }
+      stack.pop_back();
+      break;
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+      {
+        // <target> <is-abs> <value>; the target is only known if it
+        //  (and is-abs) are constants
+        //
+        if ( !doubles_on_top( stack, 1U ) || stack.size() < 3U ) {
+          return false;
+        }
+        const slot_type &dst    = stack[ stack.size() - 3U ];
+        const slot_type &is_abs = stack[ stack.size() - 2U ];
+        if ( is_abs.type != OPERAND_TYPE_INT32 ) {
+          return false;
+        }
+        if ( operand_data_type::from_bits( is_abs.bits ).ivalue() ) {
+          if ( dst.type != OPERAND_TYPE_SIZET || !fits_disp32( operand_data_type::from_bits( dst.bits ).addr() ) ) {
+            return false;
+          }
+        }
+        else if ( dst.type != OPERAND_TYPE_INT32 ) {
+          return false;
+        }
+        stack.pop_back();
+        stack.pop_back();
+        stack.back() = DOUBLE_SLOT;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_CLEAR:
+      if ( !stack.empty() && !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      stack.clear();
+      break;
+
+    case INSTRUCTION_ID_TYPE_POP:
+      if ( stack.size() < instruction.arg.sz ) {
+        return false;
+      }
+      stack.resize( stack.size() - instruction.arg.sz );
+      break;
+
+    case INSTRUCTION_ID_TYPE_JNEZ:
+    case INSTRUCTION_ID_TYPE_JEQZ:
+      if ( !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      *target = static_cast<int64_t>( index ) + instruction.arg.i32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_JCEQZ:
+      if ( !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      stack.pop_back();
+      *target = static_cast<int64_t>( index ) + instruction.arg.i32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+      if ( !doubles_on_top( stack, 1U ) ) {
+        return false;
+      }
+      stack.pop_back();
+      *target = static_cast<int64_t>( index ) + instruction.arg2;
+      break;
+
+    case INSTRUCTION_ID_TYPE_JMP:
+      *falls_through = false;
+      *target = static_cast<int64_t>( index ) + instruction.arg.i32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+    case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK: // only traced
+    case INSTRUCTION_ID_TYPE_LPARENS:
+    case INSTRUCTION_ID_TYPE_RPARENS:
+    case INSTRUCTION_ID_TYPE_FINALIZE:
+    case INSTRUCTION_ID_TYPE_FN:
+    case INSTRUCTION_ID_TYPE_COMMA:
+      break;
+
+    case INSTRUCTION_ID_TYPE_JMPA:
+    case INSTRUCTION_ID_TYPE_CALL:
+    case INSTRUCTION_ID_TYPE_RETURN:
+    case INSTRUCTION_ID_TYPE_TAILCALL:
+      return false;
+
+    // int32 operands are left to the interpreter
+    //
+    case INSTRUCTION_ID_TYPE_I2D:
+    case INSTRUCTION_ID_TYPE_D2I:
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_ISUBTRACT:
+    case INSTRUCTION_ID_TYPE_IDIVIDE:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+    case INSTRUCTION_ID_TYPE_IGE:
+    case INSTRUCTION_ID_TYPE_IGT:
+    case INSTRUCTION_ID_TYPE_ILE:
+    case INSTRUCTION_ID_TYPE_ILT:
+    case INSTRUCTION_ID_TYPE_INEGATE:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      return false;
+    }
+
+    if ( *target >= 0 && *target > static_cast<int64_t>( instr_count ) ) {
+      return false;
+    }
+    if ( *target < -1 ) {
+      return false;
+    }
+
+    return true;
+  }
+
+
+  enum gpr_type {
+     GPR_RAX = 0
+    ,GPR_RCX = 1
+    ,GPR_RDX = 2
+    ,GPR_RBX = 3
+    ,GPR_RSI = 6
+    ,GPR_RDI = 7
+    ,GPR_R12 = 12
+    ,GPR_R13 = 13
+  };
+
+  // Registers used by the native code:
+  //
+  //   r12       d-stack base
+  //   rbx       d-stack base + stack frame base
+  //   r13       context_type
+  //   xmm0-13   e-stack operands
+  //   xmm14-15  scratch
+  //
+  const int GPR_DATA    = GPR_R12;
+  const int GPR_FRAME   = GPR_RBX;
+  const int GPR_CONTEXT = GPR_R13;
+  const int XMM_TEMP1   = 14;
+  const int XMM_TEMP2   = 15;
+
+  // SSE opcodes (0F xx); scalar-double ops take an F2 prefix, the
+  //  others 66
+  //
+  const uint8_t PREFIX_SD = 0xF2;
+  const uint8_t PREFIX_PD = 0x66;
+
+  const uint8_t SSE_MOVSD_LOAD  = 0x10;
+  const uint8_t SSE_MOVSD_STORE = 0x11;
+  const uint8_t SSE_MOVAPD      = 0x28;
+  const uint8_t SSE_UCOMISD     = 0x2E;
+  const uint8_t SSE_ANDPD       = 0x54;
+  const uint8_t SSE_ORPD        = 0x56;
+  const uint8_t SSE_XORPD       = 0x57;
+  const uint8_t SSE_ADDSD       = 0x58;
+  const uint8_t SSE_MULSD       = 0x59;
+  const uint8_t SSE_SUBSD       = 0x5C;
+  const uint8_t SSE_DIVSD       = 0x5E;
+  const uint8_t SSE_CMPSD       = 0xC2;
+
+  // cmpsd predicates
+  //
+  const uint8_t CMP_EQ  = 0;
+  const uint8_t CMP_LT  = 1;
+  const uint8_t CMP_LE  = 2;
+  const uint8_t CMP_NEQ = 4;
+
+  // condition codes (jcc is 0F 8x)
+  //
+  const uint8_t CC_B  = 0x2;
+  const uint8_t CC_NE = 0x5;
+  const uint8_t CC_E  = 0x4;
+  const uint8_t CC_BE = 0x6;
+  const uint8_t CC_A  = 0x7;
+  const uint8_t CC_P  = 0xA;
+
+
+  // A minimal x86-64 assembler: just the instructions the code generator
+  //  uses. Memory operands are always [base + disp32]; jumps are always
+  //  rel32, to labels resolved by finish()
+  //
+  class assembler_type {
+
+    public:
+      size_t new_label()
+      {
+        labels_.push_back( -1 );
+        return labels_.size() - 1U;
+      }
+
+      void bind( size_t label ) { labels_[label] = static_cast<int64_t>( code_.size() ); }
+
+      void jmp( size_t label )
+      {
+        byte( 0xE9 );
+        fixup( label );
+      }
+
+      void jcc( uint8_t cc, size_t label )
+      {
+        byte( 0x0F );
+        byte( 0x80 | cc );
+        fixup( label );
+      }
+
+      // op xmm_dst, xmm_src
+      //
+      void sse( uint8_t prefix, uint8_t op, int dst, int src )
+      {
+        byte( prefix );
+        rex( false, dst, src );
+        byte( 0x0F );
+        byte( op );
+        modrm_reg( dst, src );
+      }
+
+      // op xmm, [base + disp] (or, for stores, op [base + disp], xmm)
+      //
+      void sse( uint8_t prefix, uint8_t op, int xmm, int base, int32_t disp )
+      {
+        byte( prefix );
+        rex( false, xmm, base );
+        byte( 0x0F );
+        byte( op );
+        modrm_mem( xmm, base, disp );
+      }
+
+      void cmpsd( int dst, int src, uint8_t predicate )
+      {
+        sse( PREFIX_SD, SSE_CMPSD, dst, src );
+        byte( predicate );
+      }
+
+      void load_double( int xmm, double value )
+      {
+        uint64_t bits = bits_of( value );
+        if ( bits == 0U ) {
+          sse( PREFIX_PD, SSE_XORPD, xmm, xmm );
+          return;
+        }
+        mov_imm( GPR_RAX, bits );
+        // movq xmm, rax
+        byte( 0x66 );
+        rex( true, xmm, GPR_RAX );
+        byte( 0x0F );
+        byte( 0x6E );
+        modrm_reg( xmm, GPR_RAX );
+      }
+
+      void mov_imm( int gpr, uint64_t value )
+      {
+        rex( true, 0, gpr );
+        byte( 0xB8 | ( gpr & 7 ) );
+        for ( int i=0; i<8; ++i ) {
+          byte( static_cast<uint8_t>( value >> ( 8 * i ) ) );
+        }
+      }
+
+      // op r64, [base + disp] (or op [base + disp], r64)
+      //
+      void alu( uint8_t op, int reg, int base, int32_t disp )
+      {
+        rex( true, reg, base );
+        byte( op );
+        modrm_mem( reg, base, disp );
+      }
+
+      void load( int reg, int base, int32_t disp )  { alu( 0x8B, reg, base, disp ); }
+      void store( int base, int32_t disp, int reg ) { alu( 0x89, reg, base, disp ); }
+      void cmp( int reg, int base, int32_t disp )   { alu( 0x3B, reg, base, disp ); }
+
+      void add_imm( int gpr, int32_t value )
+      {
+        rex( true, 0, gpr );
+        byte( 0x81 );
+        modrm_reg( 0, gpr );
+        dword( static_cast<uint32_t>( value ) );
+      }
+
+      void cmp_imm( int gpr, int32_t value )
+      {
+        rex( true, 7, gpr );
+        byte( 0x81 );
+        modrm_reg( 7, gpr );
+        dword( static_cast<uint32_t>( value ) );
+      }
+
+      void mov( int dst, int src )
+      {
+        rex( true, src, dst );
+        byte( 0x89 );
+        modrm_reg( src, dst );
+      }
+
+      void push( int gpr )
+      {
+        rex( false, 0, gpr );
+        byte( 0x50 | ( gpr & 7 ) );
+      }
+
+      void pop( int gpr )
+      {
+        rex( false, 0, gpr );
+        byte( 0x58 | ( gpr & 7 ) );
+      }
+
+      void call( int base, int32_t disp )
+      {
+        rex( false, 2, base );
+        byte( 0xFF );
+        modrm_mem( 2, base, disp );
+      }
+
+      void ret() { byte( 0xC3 ); }
+
+      // Resolve jumps; false if any label was never bound
+      //
+      bool finish()
+      {
+        for ( const auto &f : fixups_ ) {
+          if ( labels_[f.second] < 0 ) {
+            return false;
+          }
+          int64_t rel = labels_[f.second] - static_cast<int64_t>( f.first + 4U );
+          uint32_t rel32 = static_cast<uint32_t>( static_cast<int32_t>( rel ) );
+          std::memcpy( &code_[f.first], &rel32, sizeof( rel32 ) );
+        }
+        return true;
+      }
+
+      const std::vector<uint8_t> &code() const { return code_; }
+
+    private:
+      void byte( uint8_t b ) { code_.push_back( b ); }
+
+      void dword( uint32_t d )
+      {
+        for ( int i=0; i<4; ++i ) {
+          byte( static_cast<uint8_t>( d >> ( 8 * i ) ) );
+        }
+      }
+
+      void rex( bool w, int reg, int rm )
+      {
+        uint8_t r = 0x40 | ( w ? 0x08 : 0 ) | ( ( reg >> 3 ) << 2 ) | ( rm >> 3 );
+        if ( r != 0x40 ) {
+          byte( r );
+        }
+      }
+
+      void modrm_reg( int reg, int rm )
+      {
+        byte( 0xC0 | ( ( reg & 7 ) << 3 ) | ( rm & 7 ) );
+      }
+
+      void modrm_mem( int reg, int base, int32_t disp )
+      {
+        byte( 0x80 | ( ( reg & 7 ) << 3 ) | ( base & 7 ) );
+        if ( ( base & 7 ) == 4 ) {
+          byte( 0x24 ); // SIB, for rsp/r12
+        }
+        dword( static_cast<uint32_t>( disp ) );
+      }
+
+      void fixup( size_t label )
+      {
+        fixups_.emplace_back( code_.size(), label );
+        dword( 0U );
+      }
+
+      std::vector<uint8_t>                    code_;
+      std::vector<int64_t>                    labels_;
+      std::vector<std::pair<size_t,size_t>>   fixups_;
+  };
+
+
+  const int32_t CONTEXT_DATA            = static_cast<int32_t>( offsetof( jit_type::context_type, data ) );
+  const int32_t CONTEXT_FRAME           = static_cast<int32_t>( offsetof( jit_type::context_type, frame ) );
+  const int32_t CONTEXT_SIZE            = static_cast<int32_t>( offsetof( jit_type::context_type, size ) );
+  const int32_t CONTEXT_MAX_SIZE        = static_cast<int32_t>( offsetof( jit_type::context_type, max_size ) );
+  const int32_t CONTEXT_HIGH_WATER_MARK = static_cast<int32_t>( offsetof( jit_type::context_type, high_water_mark ) );
+  const int32_t CONTEXT_PRINT           = static_cast<int32_t>( offsetof( jit_type::context_type, print ) );
+
+  int32_t scratch_offset( size_t slot )
+  {
+    return static_cast<int32_t>( offsetof( jit_type::context_type, scratch ) + 8U * slot );
+  }
+
+
+  // Generates the code for one function
+  //
+  class code_generator_type {
+
+    public:
+      code_generator_type(
+                          const std::vector<instruction_type> &instructions
+                         ,const std::vector<stack_model_type> &stack_in
+                         ,const std::vector<bool>             &reached
+                         ,const std::vector<bool>             &native
+                         )
+        :instructions_{ instructions }
+        ,stack_in_{ stack_in }
+        ,reached_{ reached }
+        ,native_{ native }
+        ,labels_( instructions.size() )
+      {}
+
+      // resume_points are the return points (each with its own entry id,
+      //  starting from 1; entry 0 is the function entry)
+      //
+      bool generate( size_t entry, const std::vector<size_t> &resume_points )
+      {
+        epilogue_ = asm_.new_label();
+        for ( size_t i=0U; i<instructions_.size(); ++i ) {
+          if ( reached_[i] ) {
+            labels_[i] = asm_.new_label();
+          }
+        }
+
+        // prologue; three pushes keep the stack 16-byte aligned for calls
+        //
+        asm_.push( GPR_RBX );
+        asm_.push( GPR_R12 );
+        asm_.push( GPR_R13 );
+        asm_.mov( GPR_CONTEXT, GPR_RDI );
+        asm_.load( GPR_DATA,  GPR_CONTEXT, CONTEXT_DATA );
+        asm_.load( GPR_FRAME, GPR_CONTEXT, CONTEXT_FRAME );
+
+        std::vector<size_t> loaders;
+        for ( size_t k=0U; k<resume_points.size(); ++k ) {
+          loaders.push_back( asm_.new_label() );
+          asm_.cmp_imm( GPR_RSI, static_cast<int32_t>( k + 1U ) );
+          asm_.jcc( CC_E, loaders.back() );
+        }
+        asm_.jmp( labels_[entry] );
+
+        for ( size_t i=0U; i<instructions_.size(); ++i ) {
+          if ( !reached_[i] ) {
+            continue;
+          }
+          asm_.bind( labels_[i] );
+          if ( !native_[i] ) {
+            asm_.jmp( exit_label( i, stack_in_[i] ) );
+            continue;
+          }
+          if ( !generate_instruction( i ) ) {
+            return false;
+          }
+        }
+
+        // re-entry at a return point: reload the e-stack from the scratch area
+        //
+        for ( size_t k=0U; k<resume_points.size(); ++k ) {
+          asm_.bind( loaders[k] );
+          const stack_model_type &stack = stack_in_[ resume_points[k] ];
+          for ( size_t j=0U; j<stack.size(); ++j ) {
+            if ( stack[j].type == OPERAND_TYPE_DOUBLE ) {
+              asm_.sse( PREFIX_SD, SSE_MOVSD_LOAD, static_cast<int>( j ), GPR_CONTEXT, scratch_offset( j ) );
+            }
+          }
+          asm_.jmp( labels_[ resume_points[k] ] );
+        }
+
+        // exits: spill the e-stack to the scratch area, and return the
+        //  depth and the instruction to continue from
+        //
+        for ( size_t k=0U; k<exits_.size(); ++k ) {
+          asm_.bind( exits_[k].label );
+          const stack_model_type &stack = exits_[k].stack;
+          for ( size_t j=0U; j<stack.size(); ++j ) {
+            if ( stack[j].type == OPERAND_TYPE_DOUBLE ) {
+              asm_.sse( PREFIX_SD, SSE_MOVSD_STORE, static_cast<int>( j ), GPR_CONTEXT, scratch_offset( j ) );
+            }
+            else {
+              asm_.mov_imm( GPR_RAX, stack[j].bits );
+              asm_.store( GPR_CONTEXT, scratch_offset( j ), GPR_RAX );
+            }
+          }
+          asm_.mov_imm( GPR_RAX, ( static_cast<uint64_t>( stack.size() ) << 32 ) | exits_[k].index );
+          asm_.jmp( epilogue_ );
+        }
+
+        asm_.bind( epilogue_ );
+        asm_.pop( GPR_R13 );
+        asm_.pop( GPR_R12 );
+        asm_.pop( GPR_RBX );
+        asm_.ret();
+
+        return asm_.finish();
+      }
+
+      const std::vector<uint8_t> &code() const { return asm_.code(); }
+
+    private:
+      struct exit_type {
+        size_t            label;
+        size_t            index;
+        stack_model_type  stack;
+      };
+
+      size_t exit_label( size_t index, const stack_model_type &stack )
+      {
+        exits_.push_back( exit_type{ asm_.new_label(), index, stack } );
+        return exits_.back().label;
+      }
+
+      // Where to go for instruction index, with the e-stack in stack
+      //
+      size_t label_of( size_t index, const stack_model_type &stack )
+      {
+        if ( index < instructions_.size() ) {
+          return labels_[index];
+        }
+        return exit_label( index, stack );
+      }
+
+      // Materialize (x op y) ? 1.0 : 0.0, from an all-ones/all-zeros mask
+      //
+      void mask_to_double( int xmm )
+      {
+        asm_.load_double( XMM_TEMP1, 1.0 );
+        asm_.sse( PREFIX_PD, SSE_ANDPD, xmm, XMM_TEMP1 );
+      }
+
+      bool generate_instruction( size_t i )
+      {
+        const instruction_type &instruction = instructions_[i];
+
+        const stack_model_type &before = stack_in_[i];
+        stack_model_type after = before;
+        bool    falls_through;
+        int64_t target;
+        if ( !model_instruction( instruction, i, instructions_.size(), after, &falls_through, &target ) ) {
+          return false;
+        }
+
+        const int d   = static_cast<int>( before.size() );
+        const int top = d - 1;     // only valid if d > 0
+        const int nxt = d - 2;     // only valid if d > 1
+
+        switch ( instruction.id ) {
+        case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+          asm_.load_double( d, instruction.arg.d );
+          break;
+
+        case INSTRUCTION_ID_TYPE_PUSHINT32:
+        case INSTRUCTION_ID_TYPE_PUSHSIZET:
+          // constants; nothing to do until they are used
+          break;
+
+        case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+          asm_.sse( PREFIX_SD, SSE_MOVSD_LOAD, d, GPR_DATA, static_cast<int32_t>( instruction.arg.sz ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+          asm_.sse( PREFIX_SD, SSE_MOVSD_LOAD, d, GPR_FRAME, instruction.arg.i32 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_COPYTOADDR:
+          asm_.sse( PREFIX_SD, SSE_MOVSD_STORE, top, GPR_DATA, static_cast<int32_t>( instruction.arg.sz ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+        case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+          asm_.sse( PREFIX_SD, SSE_MOVSD_STORE, top, GPR_FRAME, instruction.arg.i32 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_NOT:
+          asm_.sse( PREFIX_PD, SSE_XORPD, XMM_TEMP2, XMM_TEMP2 );
+          asm_.cmpsd( XMM_TEMP2, top, CMP_EQ );
+          mask_to_double( XMM_TEMP2 );
+          asm_.sse( PREFIX_PD, SSE_MOVAPD, top, XMM_TEMP2 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_NEGATE:
+          asm_.load_double( XMM_TEMP1, -1.0 );
+          asm_.sse( PREFIX_SD, SSE_MULSD, top, XMM_TEMP1 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_ADD:
+          asm_.sse( PREFIX_SD, SSE_ADDSD, nxt, top );
+          break;
+
+        case INSTRUCTION_ID_TYPE_SUBTRACT:
+          asm_.sse( PREFIX_SD, SSE_SUBSD, nxt, top );
+          break;
+
+        case INSTRUCTION_ID_TYPE_MULTIPLY:
+          asm_.sse( PREFIX_SD, SSE_MULSD, nxt, top );
+          break;
+
+        case INSTRUCTION_ID_TYPE_DIVIDE:
+          {
+            // leave division by zero to the interpreter, which reports it
+            //
+            size_t ok = asm_.new_label();
+            asm_.sse( PREFIX_PD, SSE_XORPD, XMM_TEMP2, XMM_TEMP2 );
+            asm_.sse( PREFIX_PD, SSE_UCOMISD, top, XMM_TEMP2 );
+            asm_.jcc( CC_P, ok );
+            asm_.jcc( CC_NE, ok );
+            asm_.jmp( exit_label( i, before ) );
+            asm_.bind( ok );
+            asm_.sse( PREFIX_SD, SSE_DIVSD, nxt, top );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_EQ:
+        case INSTRUCTION_ID_TYPE_NEQ:
+        case INSTRUCTION_ID_TYPE_LT:
+        case INSTRUCTION_ID_TYPE_LE:
+          {
+            uint8_t predicate = ( instruction.id == INSTRUCTION_ID_TYPE_EQ  ) ? CMP_EQ
+                              : ( instruction.id == INSTRUCTION_ID_TYPE_NEQ ) ? CMP_NEQ
+                              : ( instruction.id == INSTRUCTION_ID_TYPE_LT  ) ? CMP_LT
+                              :                                                 CMP_LE;
+            asm_.cmpsd( nxt, top, predicate );
+            mask_to_double( nxt );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_GT:
+        case INSTRUCTION_ID_TYPE_GE:
+          // x > y is y < x (and the same for NaN)
+          asm_.cmpsd( top, nxt, ( instruction.id == INSTRUCTION_ID_TYPE_GT ) ? CMP_LT : CMP_LE );
+          mask_to_double( top );
+          asm_.sse( PREFIX_PD, SSE_MOVAPD, nxt, top );
+          break;
+
+        case INSTRUCTION_ID_TYPE_AND:
+        case INSTRUCTION_ID_TYPE_OR:
+          asm_.sse( PREFIX_PD, SSE_XORPD, XMM_TEMP1, XMM_TEMP1 );
+          asm_.sse( PREFIX_PD, SSE_MOVAPD, XMM_TEMP2, nxt );
+          asm_.cmpsd( XMM_TEMP2, XMM_TEMP1, CMP_NEQ );
+          asm_.cmpsd( top, XMM_TEMP1, CMP_NEQ );
+          asm_.sse( PREFIX_PD, ( instruction.id == INSTRUCTION_ID_TYPE_AND ) ? SSE_ANDPD : SSE_ORPD, XMM_TEMP2, top );
+          mask_to_double( XMM_TEMP2 );
+          asm_.sse( PREFIX_PD, SSE_MOVAPD, nxt, XMM_TEMP2 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_ASSIGN:
+          {
+            const operand_data_type dst    = operand_data_type::from_bits( before[ d - 3 ].bits );
+            const operand_data_type is_abs = operand_data_type::from_bits( before[ d - 2 ].bits );
+            if ( is_abs.ivalue() ) {
+              asm_.sse( PREFIX_SD, SSE_MOVSD_STORE, top, GPR_DATA, static_cast<int32_t>( dst.addr() ) );
+            }
+            else {
+              asm_.sse( PREFIX_SD, SSE_MOVSD_STORE, top, GPR_FRAME, dst.ivalue() );
+            }
+            asm_.sse( PREFIX_PD, SSE_MOVAPD, d - 3, top );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_CLEAR:
+          if ( d > 0 ) {
+            if ( top != 0 ) {
+              asm_.sse( PREFIX_PD, SSE_MOVAPD, 0, top );
+            }
+            asm_.mov( GPR_RDI, GPR_CONTEXT );
+            asm_.mov_imm( GPR_RSI, static_cast<uint64_t>( d ) );
+            asm_.call( GPR_CONTEXT, CONTEXT_PRINT );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_POP:
+          break;
+
+        case INSTRUCTION_ID_TYPE_JNEZ:
+          asm_.sse( PREFIX_PD, SSE_XORPD, XMM_TEMP2, XMM_TEMP2 );
+          asm_.sse( PREFIX_PD, SSE_UCOMISD, top, XMM_TEMP2 );
+          asm_.jcc( CC_NE, label_of( target, after ) );
+          asm_.jcc( CC_P,  label_of( target, after ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_JEQZ:
+        case INSTRUCTION_ID_TYPE_JCEQZ:
+          {
+            size_t not_zero = asm_.new_label();
+            asm_.sse( PREFIX_PD, SSE_XORPD, XMM_TEMP2, XMM_TEMP2 );
+            asm_.sse( PREFIX_PD, SSE_UCOMISD, top, XMM_TEMP2 );
+            asm_.jcc( CC_P, not_zero );
+            asm_.jcc( CC_E, label_of( target, after ) );
+            asm_.bind( not_zero );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_JMP:
+          asm_.jmp( label_of( target, after ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+          {
+            // as data_stack_type::resize(); overflow is left to the
+            //  interpreter, which reports it
+            //
+            size_t no_new_high = asm_.new_label();
+            asm_.load( GPR_RAX, GPR_CONTEXT, CONTEXT_SIZE );
+            asm_.load( GPR_RCX, GPR_RAX, 0 );
+            asm_.add_imm( GPR_RCX, instruction.arg.i32 );
+            asm_.cmp( GPR_RCX, GPR_CONTEXT, CONTEXT_MAX_SIZE );
+            asm_.jcc( CC_A, exit_label( i, before ) );
+            asm_.store( GPR_RAX, 0, GPR_RCX );
+            asm_.load( GPR_RDX, GPR_CONTEXT, CONTEXT_HIGH_WATER_MARK );
+            asm_.cmp( GPR_RCX, GPR_RDX, 0 );
+            asm_.jcc( CC_BE, no_new_high );
+            asm_.store( GPR_RDX, 0, GPR_RCX );
+            asm_.bind( no_new_high );
+          }
+          break;
+
+        case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+          asm_.sse( PREFIX_SD, SSE_MOVSD_LOAD, d, GPR_FRAME, instruction.arg.i32 );
+          asm_.sse( PREFIX_SD, SSE_ADDSD,      d, GPR_FRAME, instruction.arg2 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+          // jump unless value < c, i.e. unless c > value ("above")
+          asm_.load_double( XMM_TEMP2, instruction.arg.d );
+          asm_.sse( PREFIX_PD, SSE_UCOMISD, XMM_TEMP2, top );
+          asm_.jcc( CC_BE, label_of( target, after ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+          // jump unless value <= c, i.e. unless c >= value ("above or equal")
+          asm_.load_double( XMM_TEMP2, instruction.arg.d );
+          asm_.sse( PREFIX_PD, SSE_UCOMISD, XMM_TEMP2, top );
+          asm_.jcc( CC_B, label_of( target, after ) );
+          break;
+
+        case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+          asm_.load_double( XMM_TEMP2, instruction.arg.d );
+          asm_.sse( PREFIX_SD, SSE_ADDSD, top, XMM_TEMP2 );
+          break;
+
+        case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+        case INSTRUCTION_ID_TYPE_LPARENS:
+        case INSTRUCTION_ID_TYPE_RPARENS:
+        case INSTRUCTION_ID_TYPE_FINALIZE:
+        case INSTRUCTION_ID_TYPE_FN:
+        case INSTRUCTION_ID_TYPE_COMMA:
+          break;
+
+        case INSTRUCTION_ID_TYPE_JMPA:
+        case INSTRUCTION_ID_TYPE_CALL:
+        case INSTRUCTION_ID_TYPE_RETURN:
+        case INSTRUCTION_ID_TYPE_TAILCALL:
+        case INSTRUCTION_ID_TYPE_I2D:
+        case INSTRUCTION_ID_TYPE_D2I:
+        case INSTRUCTION_ID_TYPE_IADD:
+        case INSTRUCTION_ID_TYPE_ISUBTRACT:
+        case INSTRUCTION_ID_TYPE_IDIVIDE:
+        case INSTRUCTION_ID_TYPE_IMULTIPLY:
+        case INSTRUCTION_ID_TYPE_IEQ:
+        case INSTRUCTION_ID_TYPE_INEQ:
+        case INSTRUCTION_ID_TYPE_IGE:
+        case INSTRUCTION_ID_TYPE_IGT:
+        case INSTRUCTION_ID_TYPE_ILE:
+        case INSTRUCTION_ID_TYPE_ILT:
+        case INSTRUCTION_ID_TYPE_INEGATE:
+        case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+        case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+        case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+        case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+        case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+          return false;
+        }
+
+        if ( falls_through && i + 1U == instructions_.size() ) {
+          asm_.jmp( exit_label( i + 1U, after ) );
+        }
+
+        return true;
+      }
+
+      const std::vector<instruction_type> &instructions_;
+      const std::vector<stack_model_type> &stack_in_;
+      const std::vector<bool>             &reached_;
+      const std::vector<bool>             &native_;
+
+      assembler_type          asm_;
+      std::vector<size_t>     labels_;
+      std::vector<exit_type>  exits_;
+      size_t                  epilogue_;
+  };
+
+#endif
+
+}
+
+
+jit_type::jit_type(
+                   const std::vector<instruction_type> &instructions
+                  ,data_stack_type                     &data
+                  ,result_sink_type                    *results
+                  ,size_t                               threshold
+                  )
+  :instructions_{ instructions }
+  ,data_{ data }
+  ,threshold_{ threshold }
+  ,context_{}
+  ,functions_( instructions.size(), function_type{ 0U, false, nullptr } )
+  ,resume_points_( instructions.size() + 1U, resume_point_type{ nullptr, 0U, 0U } )
+  ,buffers_{}
+{
+  context_.data            = data.data();
+  context_.frame           = data.data();
+  context_.size            = data.size_address();
+  context_.max_size        = data.max_size();
+  context_.high_water_mark = data.high_water_mark_address();
+  context_.results         = results;
+  context_.print           = print_result;
+}
+
+
+jit_type::~jit_type()
+{
+#if SINTERP_JIT
+  for ( const auto &buffer : buffers_ ) {
+    munmap( buffer.first, buffer.second );
+  }
+#endif
+}
+
+
+bool jit_type::available()
+{
+  return SINTERP_JIT != 0;
+}
+
+
+bool jit_type::call(
+                    size_t                          entry
+                   ,size_t                          stack_frame_base
+                   ,std::vector<operand_data_type> &evaluation_stack
+                   ,size_t                         *next_index
+                   )
+{
+  if ( entry >= functions_.size() ) {
+    return false;
+  }
+
+  function_type &function = functions_[entry];
+  if ( !function.code ) {
+    if ( function.failed || ++function.calls < threshold_ ) {
+      return false;
+    }
+    if ( !compile_( entry ) ) {
+      function.failed = true;
+      return false;
+    }
+  }
+
+  return run_( function.code, 0U, stack_frame_base, evaluation_stack, next_index );
+}
+
+
+bool jit_type::resume(
+                      size_t                          return_address
+                     ,size_t                          stack_frame_base
+                     ,std::vector<operand_data_type> &evaluation_stack
+                     ,size_t                          evaluation_stack_base
+                     ,size_t                         *next_index
+                     )
+{
+  if ( return_address >= resume_points_.size() ) {
+    return false;
+  }
+
+  const resume_point_type &point = resume_points_[return_address];
+  if ( !point.code || evaluation_stack.size() != evaluation_stack_base + point.depth ) {
+    return false;
+  }
+
+  for ( size_t i=0U; i<point.depth; ++i ) {
+    context_.scratch[i] = evaluation_stack[ evaluation_stack_base + i ].bits();
+  }
+  evaluation_stack.erase( evaluation_stack.begin() + evaluation_stack_base, evaluation_stack.end() );
+
+  return run_( point.code, point.entry, stack_frame_base, evaluation_stack, next_index );
+}
+
+
+bool jit_type::run_(
+                    native_function_type            code
+                   ,size_t                          entry
+                   ,size_t                          stack_frame_base
+                   ,std::vector<operand_data_type> &evaluation_stack
+                   ,size_t                         *next_index
+                   )
+{
+  context_.frame = data_.data() + stack_frame_base;
+
+  uint64_t rv = code( &context_, entry );
+
+  size_t depth = static_cast<size_t>( rv >> 32 );
+  for ( size_t i=0U; i<depth; ++i ) {
+    evaluation_stack.push_back( operand_data_type::from_bits( context_.scratch[i] ) );
+  }
+
+  *next_index = static_cast<size_t>( static_cast<uint32_t>( rv ) );
+  return true;
+}
+
+
+bool jit_type::compile_( size_t entry )
+{
+#if SINTERP_JIT
+  const size_t instr_count = instructions_.size();
+  if ( instr_count > 0x7FFFFFFFU ) {
+    return false;
+  }
+
+  // Find the e-stack on entry to each instruction reachable from the
+  //  function entry. Each instruction must always see the same e-stack
+  //  (depth, and which operands are constants), as it would for code
+  //  from parser_type
+  //
+  std::vector<stack_model_type> stack_in( instr_count );
+  std::vector<bool>             reached( instr_count, false );
+  std::vector<bool>             native( instr_count, false );
+  std::vector<size_t>           resume_points;
+  std::vector<size_t>           worklist;
+
+  bool consistent = true;
+  auto reach = [&]( int64_t index, const stack_model_type &stack ) {
+    if ( index < 0 || index >= static_cast<int64_t>( instr_count ) ) {
+      return;
+    }
+    if ( !reached[index] ) {
+      reached[index]  = true;
+      stack_in[index] = stack;
+      worklist.push_back( static_cast<size_t>( index ) );
+    }
+    else if ( stack_in[index] != stack ) {
+      consistent = false;
+    }
+  };
+
+  reach( static_cast<int64_t>( entry ), stack_model_type() );
+
+  while ( !worklist.empty() && consistent ) {
+    size_t i = worklist.back();
+    worklist.pop_back();
+
+    stack_model_type stack = stack_in[i];
+    bool    falls_through;
+    int64_t target;
+    native[i] = model_instruction( instructions_[i], i, instr_count, stack, &falls_through, &target );
+
+    if ( native[i] ) {
+      if ( falls_through ) {
+        reach( static_cast<int64_t>( i ) + 1, stack );
+      }
+      if ( target >= 0 ) {
+        reach( target, stack );
+      }
+    }
+    else if ( instructions_[i].id == INSTRUCTION_ID_TYPE_CALL && i + 1U < instr_count ) {
+      // the call returns (through the interpreter) with the same e-stack
+      //
+      reach( static_cast<int64_t>( i ) + 1, stack_in[i] );
+      resume_points.push_back( i + 1U );
+    }
+  }
+
+  if ( !consistent ) {
+    return false;
+  }
+
+  code_generator_type generator( instructions_, stack_in, reached, native );
+  if ( !generator.generate( entry, resume_points ) ) {
+    return false;
+  }
+
+  // Copy into an executable buffer (never writable and executable at once)
+  //
+  const std::vector<uint8_t> &code = generator.code();
+  const size_t page = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+  const size_t buffer_size = ( code.size() + page - 1U ) / page * page;
+
+  void *buffer = mmap( nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( buffer == MAP_FAILED ) {
+    return false;
+  }
+  std::memcpy( buffer, code.data(), code.size() );
+  if ( mprotect( buffer, buffer_size, PROT_READ | PROT_EXEC ) != 0 ) {
+    munmap( buffer, buffer_size );
+    return false;
+  }
+  buffers_.emplace_back( buffer, buffer_size );
+
+  native_function_type function = reinterpret_cast<native_function_type>( buffer );
+  functions_[entry].code = function;
+  for ( size_t k=0U; k<resume_points.size(); ++k ) {
+    resume_points_[ resume_points[k] ] = resume_point_type{ function, static_cast<uint32_t>( k + 1U ), static_cast<uint32_t>( stack_in[ resume_points[k] ].size() ) };
+  }
+
+  return true;
+#else
+  (void)entry;
+  return false;
+#endif
+}
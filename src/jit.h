@@ -0,0 +1,153 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "data_stack_type.h"
+#include "instruction_type.h"
+#include "operand_data_type.h"
+#include "result_sink.h"
+
+
+// Native code generation ("JIT") for hot functions, on x86-64.
+//
+// Each function is counted as it is called; once a function has been
+//  called threshold times, the instructions reachable from its entry
+//  point (up to its RETURNs) are translated into x86-64 code, in an
+//  mmap'd executable buffer. Operand i of the function's e-stack lives in
+//  SSE register xmm<i>; the int32 and size_t operands used by
+//  OP-ASSIGN are always constants, so are tracked at compile time
+//  instead.
+//
+// The native code runs until it reaches an instruction it does not
+//  handle (CALL, RETURN, TAILCALL, and anything unsupported), then hands the
+//  e-stack back to the interpreter, which carries on from that
+//  instruction. When the interpreter returns to a call site in compiled
+//  code, it re-enters the native code there.
+//
+// Native code is only generated where supported (x86-64, with the System
+//  V calling convention); elsewhere, nothing is compiled and the
+//  interpreter runs everything
+//
+class jit_type {
+
+  public:
+    static constexpr size_t DEFAULT_THRESHOLD = 100U;
+
+    // Most e-stack operands a compiled function can hold
+    //
+    static constexpr size_t MAX_DEPTH = 14U;
+
+    jit_type(
+             const std::vector<instruction_type> &instructions
+            ,data_stack_type                     &data
+            ,result_sink_type                    *results
+            ,size_t                               threshold = DEFAULT_THRESHOLD
+            );
+    ~jit_type();
+
+    jit_type( const jit_type & ) = delete;
+    jit_type &operator=( const jit_type & ) = delete;
+
+    static bool available();
+
+    // Called once the interpreter has set up the frame for a call to the
+    //  function at entry. If the function has been compiled, runs it and
+    //  returns true; evaluation_stack then holds the function's e-stack,
+    //  and the interpreter should continue from *next_index
+    //
+    bool call(
+              size_t                          entry
+             ,size_t                          stack_frame_base
+             ,std::vector<operand_data_type> &evaluation_stack
+             ,size_t                         *next_index
+             );
+
+    // Likewise, called once the interpreter has returned to
+    //  return_address; re-enters the native code if that is a call site
+    //  in a compiled function
+    //
+    bool resume(
+                size_t                          return_address
+               ,size_t                          stack_frame_base
+               ,std::vector<operand_data_type> &evaluation_stack
+               ,size_t                          evaluation_stack_base
+               ,size_t                         *next_index
+               );
+
+    // Functions compiled so far
+    //
+    size_t compiled_count() const { return buffers_.size(); }
+
+    // Passed to the native code; see jit.cpp
+    //
+    struct context_type {
+      uint64_t  scratch[MAX_DEPTH];
+      char     *data;
+      char     *frame;
+      size_t   *size;
+      size_t    max_size;
+      size_t   *high_water_mark;
+      result_sink_type *results;  // statement results, or null to drop them
+      void    (*print)( context_type *context, double value, size_t depth );
+    };
+
+    // Returns (e-stack depth << 32) | next instruction index
+    //
+    typedef uint64_t (*native_function_type)( context_type *context, size_t entry );
+
+  private:
+    struct function_type {
+      uint32_t              calls;
+      bool                  failed;
+      native_function_type  code;
+    };
+
+    struct resume_point_type {
+      native_function_type  code;
+      uint32_t              entry;
+      uint32_t              depth;
+    };
+
+    bool compile_( size_t entry );
+    bool run_(
+              native_function_type            code
+             ,size_t                          entry
+             ,size_t                          stack_frame_base
+             ,std::vector<operand_data_type> &evaluation_stack
+             ,size_t                         *next_index
+             );
+
+    const std::vector<instruction_type> &instructions_;
+    data_stack_type                     &data_;
+    size_t                               threshold_;
+
+    context_type                         context_;
+    std::vector<function_type>           functions_;     // by entry index
+    std::vector<resume_point_type>       resume_points_; // by return address
+    std::vector<std::pair<void*,size_t>> buffers_;
+};
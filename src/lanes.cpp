@@ -0,0 +1,415 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Vector extensions are a GCC/Clang feature; the AVX2 kernel is only
+//  built for x86-64, where SSE2 is always there as the fallback
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define SINTERP_LANES 1
+#else
+#define SINTERP_LANES 0
+#endif
+
+#if SINTERP_LANES && defined(__x86_64__)
+#define SINTERP_LANES_AVX2 1
+#else
+#define SINTERP_LANES_AVX2 0
+#endif
+
+#include <algorithm>
+
+#include "lanes.h"
+
+
+namespace {
+
+#if SINTERP_LANES
+
+  // One register: a double per lane. Registers are only 8-byte aligned
+  //  in memory (they are the caller's doubles)
+  //
+  typedef double  lane_double_type __attribute__(( vector_size( 8U * lane_program_type::LANES ), aligned( 8 ) ));
+  typedef int64_t lane_mask_type   __attribute__(( vector_size( 8U * lane_program_type::LANES ), aligned( 8 ) ));
+
+
+  // The scalar handlers' 1.0/0.0 for true/false, from a comparison's
+  //  all-ones/all-zeros lanes (vandpd with the bits of 1.0)
+  //
+  // NOTE: vectors are passed by reference; passing them by value is
+  //  ABI-dependent on the target
+  //
+  inline __attribute__(( always_inline )) void set_one_if( lane_double_type &dst, const lane_mask_type &mask )
+  {
+    const lane_mask_type one_bits = lane_mask_type{} + static_cast<int64_t>( 0x3FF0000000000000LL );
+    dst = reinterpret_cast<lane_double_type>( mask & one_bits );
+  }
+
+
+  // NOTE: always inlined, so that it is compiled for the target of
+  //  each kernel below
+  //
+  inline __attribute__(( always_inline )) bool run_ops(
+                                                       const lane_program_type::op_type *op
+                                                      ,const lane_program_type::op_type *end
+                                                      ,lane_double_type                 *r
+                                                      )
+  {
+    const lane_double_type zero = lane_double_type{};
+
+    for ( ; op != end; ++op ) {
+      switch ( op->code ) {
+      case lane_program_type::OP_CODE_TYPE_CONSTANT:
+        r[op->dst] = zero + op->constant;
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_COPY:
+        r[op->dst] = r[op->a];
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_NOT:
+        set_one_if( r[op->dst], r[op->a] == zero );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_NEGATE:
+        r[op->dst] = r[op->a] * -1.0;
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_ADD:
+        r[op->dst] = r[op->a] + r[op->b];
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_SUBTRACT:
+        r[op->dst] = r[op->a] - r[op->b];
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_MULTIPLY:
+        r[op->dst] = r[op->a] * r[op->b];
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_DIVIDE:
+        {
+          // the scalar engine fails on divide by zero
+          //
+          lane_mask_type divide_by_zero = ( r[op->b] == zero );
+          for ( size_t lane = 0U; lane < lane_program_type::LANES; ++lane ) {
+            if ( divide_by_zero[lane] ) {
+              return false;
+            }
+          }
+          r[op->dst] = r[op->a] / r[op->b];
+        }
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_EQ:
+        set_one_if( r[op->dst], r[op->a] == r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_NEQ:
+        set_one_if( r[op->dst], r[op->a] != r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_GE:
+        set_one_if( r[op->dst], r[op->a] >= r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_GT:
+        set_one_if( r[op->dst], r[op->a] > r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_LE:
+        set_one_if( r[op->dst], r[op->a] <= r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_LT:
+        set_one_if( r[op->dst], r[op->a] < r[op->b] );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_AND:
+        set_one_if( r[op->dst], ( r[op->a] != zero ) & ( r[op->b] != zero ) );
+        break;
+
+      case lane_program_type::OP_CODE_TYPE_OR:
+        set_one_if( r[op->dst], ( r[op->a] != zero ) | ( r[op->b] != zero ) );
+        break;
+      }
+    }
+
+    return true;
+  }
+
+
+  bool run_sse2( const lane_program_type::op_type *begin, const lane_program_type::op_type *end, double *registers )
+  {
+    return run_ops( begin, end, reinterpret_cast<lane_double_type*>( registers ) );
+  }
+
+#if SINTERP_LANES_AVX2
+  __attribute__(( target( "avx2" ) ))
+  bool run_avx2( const lane_program_type::op_type *begin, const lane_program_type::op_type *end, double *registers )
+  {
+    return run_ops( begin, end, reinterpret_cast<lane_double_type*>( registers ) );
+  }
+#endif
+
+#endif
+
+
+  // What the compiler knows about an e-stack slot: a double, or the
+  //  constant address/flag operands of an ASSIGN.
+  //
+  // A double is in reg: the slot's own register, or (after a load that
+  //  was not copied) a global's register
+  //
+  enum slot_type {
+     SLOT_TYPE_DOUBLE
+    ,SLOT_TYPE_SIZET
+    ,SLOT_TYPE_INT32
+  };
+
+  struct slot_data_type {
+    slot_type type;
+    size_t    value;
+    size_t    reg;
+  };
+
+}
+
+
+lane_program_type::lane_program_type()
+  :ops_{}
+  ,registers_{ 0U }
+  ,avx2_{ false }
+{
+}
+
+
+bool lane_program_type::compile( const std::vector<instruction_type> &instructions, size_t initial_data_size )
+{
+  ops_.clear();
+  registers_ = 0U;
+
+#if SINTERP_LANES
+  // Globals come first in the registers, so find how far the d-stack
+  //  grows; the e-stack slots follow
+  //
+  size_t data_size     = initial_data_size;
+  size_t max_data_size = initial_data_size;
+  for ( const instruction_type &instruction : instructions ) {
+    if ( instruction.id == INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) {
+      if ( ( instruction.arg.i32 < 0 ) && ( static_cast<size_t>( -instruction.arg.i32 ) > data_size ) ) {
+        return false;
+      }
+      data_size    += instruction.arg.i32;
+      max_data_size = std::max( max_data_size, data_size );
+    }
+  }
+  if ( ( initial_data_size % 8U ) != 0U || ( max_data_size % 8U ) != 0U ) {
+    return false;
+  }
+
+  const uint32_t stack_base = static_cast<uint32_t>( max_data_size / 8U );
+
+  std::vector<slot_data_type> slots;
+  size_t                      max_depth = 0U;
+  data_size = initial_data_size;
+
+  auto global = [&]( size_t addr, uint32_t *reg ) {
+    if ( ( ( addr % 8U ) != 0U ) || ( addr + 8U > data_size ) ) {
+      return false;
+    }
+    *reg = static_cast<uint32_t>( addr / 8U );
+    return true;
+  };
+
+  auto top_doubles = [&]( size_t count ) {
+    if ( slots.size() < count ) {
+      return false;
+    }
+    for ( size_t i = slots.size() - count; i < slots.size(); ++i ) {
+      if ( slots[i].type != SLOT_TYPE_DOUBLE ) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  auto emit = [&]( op_code_type code, size_t dst, size_t a, size_t b, double constant ) {
+    ops_.push_back( op_type{ code, static_cast<uint32_t>( dst ), static_cast<uint32_t>( a ), static_cast<uint32_t>( b ), constant } );
+  };
+
+  // A global is about to be stored to: slots still reading it from its
+  //  register get their own copy first
+  //
+  auto store_global = [&]( uint32_t reg, size_t value_reg ) {
+    if ( value_reg == reg ) {
+      return;
+    }
+    for ( size_t i = 0U; i < slots.size(); ++i ) {
+      if ( ( slots[i].type == SLOT_TYPE_DOUBLE ) && ( slots[i].reg == reg ) ) {
+        emit( OP_CODE_TYPE_COPY, stack_base + i, reg, 0U, 0.0 );
+        slots[i].reg = stack_base + i;
+      }
+    }
+    emit( OP_CODE_TYPE_COPY, reg, value_reg, 0U, 0.0 );
+  };
+
+  for ( const instruction_type &instruction : instructions ) {
+    const size_t depth = slots.size();
+    uint32_t     reg;
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+      emit( OP_CODE_TYPE_CONSTANT, stack_base + depth, 0U, 0U, instruction.arg.d );
+      slots.push_back( slot_data_type{ SLOT_TYPE_DOUBLE, 0U, stack_base + depth } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+      slots.push_back( slot_data_type{ SLOT_TYPE_INT32, static_cast<size_t>( instruction.arg.i32 ), 0U } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+      slots.push_back( slot_data_type{ SLOT_TYPE_SIZET, instruction.arg.sz, 0U } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+      if ( !top_doubles( 1U ) ) {
+        return false;
+      }
+      emit( ( instruction.id == INSTRUCTION_ID_TYPE_NOT ) ? OP_CODE_TYPE_NOT : OP_CODE_TYPE_NEGATE, stack_base + depth - 1U, slots.back().reg, 0U, 0.0 );
+      slots.back().reg = stack_base + depth - 1U;
+      break;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+      {
+        if ( !top_doubles( 2U ) ) {
+          return false;
+        }
+        op_code_type code = OP_CODE_TYPE_ADD;
+        switch ( instruction.id ) {
+        case INSTRUCTION_ID_TYPE_SUBTRACT: code = OP_CODE_TYPE_SUBTRACT; break;
+        case INSTRUCTION_ID_TYPE_MULTIPLY: code = OP_CODE_TYPE_MULTIPLY; break;
+        case INSTRUCTION_ID_TYPE_DIVIDE:   code = OP_CODE_TYPE_DIVIDE;   break;
+        case INSTRUCTION_ID_TYPE_EQ:       code = OP_CODE_TYPE_EQ;       break;
+        case INSTRUCTION_ID_TYPE_NEQ:      code = OP_CODE_TYPE_NEQ;      break;
+        case INSTRUCTION_ID_TYPE_GE:       code = OP_CODE_TYPE_GE;       break;
+        case INSTRUCTION_ID_TYPE_GT:       code = OP_CODE_TYPE_GT;       break;
+        case INSTRUCTION_ID_TYPE_LE:       code = OP_CODE_TYPE_LE;       break;
+        case INSTRUCTION_ID_TYPE_LT:       code = OP_CODE_TYPE_LT;       break;
+        case INSTRUCTION_ID_TYPE_AND:      code = OP_CODE_TYPE_AND;      break;
+        case INSTRUCTION_ID_TYPE_OR:       code = OP_CODE_TYPE_OR;       break;
+        default:                                                         break;
+        }
+        emit( code, stack_base + depth - 2U, slots[depth - 2U].reg, slots[depth - 1U].reg, 0.0 );
+        slots.pop_back();
+        slots.back().reg = stack_base + depth - 2U;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+      // no copy; the slot reads the global's register until it is stored to
+      //
+      if ( !global( instruction.arg.sz, &reg ) ) {
+        return false;
+      }
+      slots.push_back( slot_data_type{ SLOT_TYPE_DOUBLE, 0U, reg } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+      if ( !top_doubles( 1U ) || !global( instruction.arg.sz, &reg ) ) {
+        return false;
+      }
+      store_global( reg, slots.back().reg );
+      break;
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+      // <address> <is_abs> <value>; only absolute (global) addresses
+      //
+      if ( !top_doubles( 1U ) || ( depth < 3U )
+           || ( slots[depth - 3U].type != SLOT_TYPE_SIZET )
+           || ( slots[depth - 2U].type != SLOT_TYPE_INT32 ) || ( slots[depth - 2U].value == 0U )
+           || !global( slots[depth - 3U].value, &reg ) ) {
+        return false;
+      }
+      store_global( reg, slots.back().reg );
+      slots.pop_back();
+      slots.pop_back();
+      slots.back() = slot_data_type{ SLOT_TYPE_DOUBLE, 0U, reg };
+      break;
+
+    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+      data_size += instruction.arg.i32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_CLEAR:
+      // statement results are not printed
+      //
+      slots.clear();
+      break;
+
+    default:
+      return false;
+    }
+
+    max_depth = std::max( max_depth, slots.size() );
+  }
+
+  registers_ = stack_base + max_depth;
+
+#if SINTERP_LANES_AVX2
+  avx2_ = __builtin_cpu_supports( "avx2" );
+#endif
+
+  return true;
+#else
+  (void)instructions;
+  (void)initial_data_size;
+  return false;
+#endif
+}
+
+
+bool lane_program_type::run( double *registers ) const
+{
+#if SINTERP_LANES
+#if SINTERP_LANES_AVX2
+  if ( avx2_ ) {
+    return run_avx2( ops_.data(), ops_.data() + ops_.size(), registers );
+  }
+#endif
+  return run_sse2( ops_.data(), ops_.data() + ops_.size(), registers );
+#else
+  (void)registers;
+  return false;
+#endif
+}
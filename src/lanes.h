@@ -0,0 +1,107 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "instruction_type.h"
+
+
+// Lane-parallel evaluation: runs a branch-free program over LANES rows
+//  at once, with each double in a SIMD vector of one value per row.
+//
+// A program can be run this way if it has no jumps or calls, and only
+//  uses doubles: every e-stack slot and every 8-byte global then has a
+//  fixed place, a register, while it runs. Each instruction becomes one
+//  vector operation on registers (ADD is vaddpd, LT is vcmppd, and so
+//  on); pushes and pops just pick the register.
+//
+// Vectors are GCC/Clang vector extensions. Where AVX2 is available (at
+//  run time) a LANES-wide vector is two ymm registers; otherwise it is
+//  four SSE2 xmm registers. With other compilers, nothing can be
+//  compiled (so callers use the scalar engine)
+//
+class lane_program_type {
+
+  public:
+    static constexpr size_t LANES = 8U;
+
+    lane_program_type();
+
+    // Compile instructions, which start with initial_data_size bytes of
+    //  d-stack already in use (see parser_type::declare_global()).
+    //  Returns false if they cannot be run in lanes
+    //
+    bool compile( const std::vector<instruction_type> &instructions, size_t initial_data_size );
+
+    // Registers needed, LANES doubles each. The global at d-stack address
+    //  addr is register addr / 8, so lane l of it is at
+    //  registers[( addr / 8 ) * LANES + l]
+    //
+    size_t registers() const { return registers_; }
+
+    // Run the program once for each lane. registers holds the inputs,
+    //  and receives all globals. Returns false (part way through) if any
+    //  lane would fail, i.e. divide by zero; those rows have to be run by
+    //  the scalar engine to find out which
+    //
+    bool run( double *registers ) const;
+
+    // true if the AVX2 kernel is used
+    //
+    bool avx2() const { return avx2_; }
+
+    enum op_code_type {
+       OP_CODE_TYPE_CONSTANT    // dst = constant
+      ,OP_CODE_TYPE_COPY        // dst = a
+      ,OP_CODE_TYPE_NOT
+      ,OP_CODE_TYPE_NEGATE
+      ,OP_CODE_TYPE_ADD         // dst = a op b
+      ,OP_CODE_TYPE_SUBTRACT
+      ,OP_CODE_TYPE_MULTIPLY
+      ,OP_CODE_TYPE_DIVIDE
+      ,OP_CODE_TYPE_EQ
+      ,OP_CODE_TYPE_NEQ
+      ,OP_CODE_TYPE_GE
+      ,OP_CODE_TYPE_GT
+      ,OP_CODE_TYPE_LE
+      ,OP_CODE_TYPE_LT
+      ,OP_CODE_TYPE_AND
+      ,OP_CODE_TYPE_OR
+    };
+
+    struct op_type {
+      op_code_type code;
+      uint32_t     dst;
+      uint32_t     a;
+      uint32_t     b;
+      double       constant;
+    };
+
+  private:
+    std::vector<op_type> ops_;
+    size_t               registers_;
+    bool                 avx2_;
+};
@@ -0,0 +1,660 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <utility>
+
+#include "loop_trace.h"
+
+
+loop_tracer_type::loop_tracer_type(
+                                   const std::vector<instruction_type> &instructions
+                                  ,data_stack_type                     &data
+                                  ,result_sink_type                    *results
+                                  ,size_t                               threshold
+                                  )
+  :instructions_( instructions )
+  ,data_( data )
+  ,results_( results )
+  ,threshold_( threshold )
+  ,loops_( instructions.size() + 1U, loop_type{ 0U, false, NO_TRACE } )
+  ,traces_{}
+  ,slots_( MAX_DEPTH, operand_data_type( 0.0 ) )
+{
+}
+
+
+bool loop_tracer_type::back_edge(
+                                 size_t                          index
+                                ,size_t                          header
+                                ,size_t                          stack_frame_base
+                                ,std::vector<operand_data_type> &evaluation_stack
+                                ,size_t                          evaluation_stack_base
+                                ,size_t                         *next_index
+                                )
+{
+  loop_type &loop = loops_[header];
+
+  // Traces start (and end) with the function's e-stack empty, which it
+  //  is at the top of any while loop
+  //
+  if ( loop.failed || evaluation_stack.size() != evaluation_stack_base ) {
+    return false;
+  }
+
+  size_t depth = 0U;
+
+  if ( loop.trace == NO_TRACE ) {
+    if ( ++loop.back_edges < threshold_ ) {
+      return false;
+    }
+
+    trace_type trace;
+    if ( record_( header, stack_frame_base, trace, &depth, next_index ) ) {
+      loop.trace = traces_.size();
+      traces_.push_back( std::move( trace ) );
+    }
+    else if ( *next_index < header || *next_index > index ) {
+      // This iteration left the loop (so it was the last one); try
+      //  again if the loop gets hot again
+      //
+      loop.back_edges = 0U;
+    }
+    else {
+      loop.failed = true;
+    }
+  }
+
+  if ( loop.trace != NO_TRACE ) {
+    run_( traces_[ loop.trace ], stack_frame_base, &depth, next_index );
+  }
+
+  for ( size_t i=0U; i<depth; ++i ) {
+    evaluation_stack.push_back( slots_[i] );
+  }
+
+  return true;
+}
+
+
+// Run one op. Returns false (without changing anything) if the op
+//  exits the trace
+//
+bool loop_tracer_type::step_( const op_type &op, operand_data_type *slots, char *data, char *frame )
+{
+  operand_data_type *a = slots + op.a;
+
+#define TRACE_BINARY_OP( name, expr )                   \
+  case OP_CODE_TYPE_##name:                               \
+    {                                                     \
+      double value1 = a[0].value();                       \
+      double value2 = a[1].value();                       \
+      a->set_value( expr );                               \
+    }                                                     \
+    return true;
+
+#define TRACE_INT32_BINARY_OP( name, expr )             \
+  case OP_CODE_TYPE_##name:                               \
+    {                                                     \
+      int32_t value1 = a[0].ivalue();                     \
+      int32_t value2 = a[1].ivalue();                     \
+      *a = (expr);                                        \
+    }                                                     \
+    return true;
+
+#define TRACE_INT32_WRAP( expr )  operand_data_type( static_cast<int32_t>( expr ) )
+#define TRACE_INT32_TEST( expr )  operand_data_type( (expr) ? 1.0 : 0.0 )
+
+  switch ( op.code ) {
+  case OP_CODE_TYPE_PUSH:
+    *a = operand_data_type::from_bits( op.arg.bits );
+    return true;
+
+  case OP_CODE_TYPE_LOAD_FRAME:
+  case OP_CODE_TYPE_LOAD_ADDR:
+    {
+      double value;
+      std::memcpy( &value, ( op.code == OP_CODE_TYPE_LOAD_FRAME ) ? frame + op.arg.offset : data + op.arg.addr, sizeof( value ) );
+      *a = operand_data_type( value );
+    }
+    return true;
+
+  case OP_CODE_TYPE_LOAD_FRAME_I32:
+  case OP_CODE_TYPE_LOAD_ADDR_I32:
+    {
+      int32_t value;
+      std::memcpy( &value, ( op.code == OP_CODE_TYPE_LOAD_FRAME_I32 ) ? frame + op.arg.offset : data + op.arg.addr, sizeof( value ) );
+      *a = operand_data_type( value );
+    }
+    return true;
+
+  case OP_CODE_TYPE_STORE_FRAME:
+  case OP_CODE_TYPE_STORE_ADDR:
+    {
+      double value = a->value();
+      std::memcpy( ( op.code == OP_CODE_TYPE_STORE_FRAME ) ? frame + op.arg.offset : data + op.arg.addr, &value, sizeof( value ) );
+    }
+    return true;
+
+  case OP_CODE_TYPE_STORE_FRAME_I32:
+  case OP_CODE_TYPE_STORE_ADDR_I32:
+    {
+      int32_t value = a->ivalue();
+      std::memcpy( ( op.code == OP_CODE_TYPE_STORE_FRAME_I32 ) ? frame + op.arg.offset : data + op.arg.addr, &value, sizeof( value ) );
+    }
+    return true;
+
+  case OP_CODE_TYPE_MOVE:
+    *a = slots[ op.b ];
+    return true;
+
+  case OP_CODE_TYPE_NOT:
+    a->set_value( ( a->value() == 0.0 ) ? 1.0 : 0.0 );
+    return true;
+
+  case OP_CODE_TYPE_NEGATE:
+    a->set_value( -1.0 * a->value() );
+    return true;
+
+  case OP_CODE_TYPE_INEGATE:
+    *a = operand_data_type( static_cast<int32_t>( 0U - static_cast<uint32_t>( a->ivalue() ) ) );
+    return true;
+
+  case OP_CODE_TYPE_I2D:
+    a->set_value( static_cast<double>( a->ivalue() ) );
+    return true;
+
+  case OP_CODE_TYPE_D2I:
+    {
+      double value = a->value();
+      if ( !( value > -2147483649.0 && value < 2147483648.0 ) ) {
+        return false;
+      }
+      *a = operand_data_type( static_cast<int32_t>( value ) );
+    }
+    return true;
+
+  TRACE_BINARY_OP( ADD,      value1 + value2 )
+  TRACE_BINARY_OP( SUBTRACT, value1 - value2 )
+  TRACE_BINARY_OP( MULTIPLY, value1 * value2 )
+  TRACE_BINARY_OP( EQ,       ( value1 == value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( NEQ,      ( value1 != value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( GE,       ( value1 >= value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( GT,       ( value1 >  value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( LE,       ( value1 <= value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( LT,       ( value1 <  value2 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( AND,      ( value1 != 0.0 && value2 != 0.0 ) ? 1.0 : 0.0 )
+  TRACE_BINARY_OP( OR,       ( value1 != 0.0 || value2 != 0.0 ) ? 1.0 : 0.0 )
+
+  case OP_CODE_TYPE_DIVIDE:
+    if ( a[1].value() == 0.0 ) {
+      return false;
+    }
+    a->set_value( a[0].value() / a[1].value() );
+    return true;
+
+  TRACE_INT32_BINARY_OP( IADD,      TRACE_INT32_WRAP( static_cast<uint32_t>( value1 ) + static_cast<uint32_t>( value2 ) ) )
+  TRACE_INT32_BINARY_OP( ISUBTRACT, TRACE_INT32_WRAP( static_cast<uint32_t>( value1 ) - static_cast<uint32_t>( value2 ) ) )
+  TRACE_INT32_BINARY_OP( IMULTIPLY, TRACE_INT32_WRAP( static_cast<uint32_t>( value1 ) * static_cast<uint32_t>( value2 ) ) )
+  TRACE_INT32_BINARY_OP( IEQ,       TRACE_INT32_TEST( value1 == value2 ) )
+  TRACE_INT32_BINARY_OP( INEQ,      TRACE_INT32_TEST( value1 != value2 ) )
+  TRACE_INT32_BINARY_OP( IGE,       TRACE_INT32_TEST( value1 >= value2 ) )
+  TRACE_INT32_BINARY_OP( IGT,       TRACE_INT32_TEST( value1 >  value2 ) )
+  TRACE_INT32_BINARY_OP( ILE,       TRACE_INT32_TEST( value1 <= value2 ) )
+  TRACE_INT32_BINARY_OP( ILT,       TRACE_INT32_TEST( value1 <  value2 ) )
+
+  case OP_CODE_TYPE_IDIVIDE:
+    {
+      int32_t value1 = a[0].ivalue();
+      int32_t value2 = a[1].ivalue();
+      if ( value2 == 0 ) {
+        return false;
+      }
+      *a = operand_data_type( ( value2 == -1 ) ? static_cast<int32_t>( 0U - static_cast<uint32_t>( value1 ) ) : value1 / value2 );
+    }
+    return true;
+
+  case OP_CODE_TYPE_GUARD_ZERO:
+    return a->value() == 0.0;
+
+  case OP_CODE_TYPE_GUARD_NONZERO:
+    return a->value() != 0.0;
+
+  case OP_CODE_TYPE_PRINT_DOUBLE:
+  case OP_CODE_TYPE_PRINT_INT32:
+    if ( !results_ ) {
+      return true;
+    }
+    if ( op.code == OP_CODE_TYPE_PRINT_INT32 ) {
+      results_->put( a->ivalue() );
+    }
+    else {
+      results_->put( a->value() );
+    }
+    if ( op.b > 1 ) {
+      results_->stack_size_warning( static_cast<size_t>( op.b ) );
+    }
+    return true;
+  }
+
+#undef TRACE_INT32_TEST
+#undef TRACE_INT32_WRAP
+#undef TRACE_INT32_BINARY_OP
+#undef TRACE_BINARY_OP
+
+  return true;
+}
+
+
+// Record one iteration of the loop at header, running it as it goes.
+//  Returns true if the iteration got back to header, with the trace;
+//  otherwise, *next_index is the instruction the interpreter should
+//  carry on from, and the first *depth slots hold its e-stack
+//
+bool loop_tracer_type::record_(
+                               size_t                          header
+                              ,size_t                          stack_frame_base
+                              ,trace_type                     &trace
+                              ,size_t                         *depth
+                              ,size_t                         *next_index
+                              )
+{
+  operand_data_type *slots = slots_.data();
+  char              *data  = data_.data();
+  char              *frame = data + stack_frame_base;
+
+  // Slots known to hold a constant pushed by the trace (which is how
+  //  assignment targets are given)
+  //
+  std::vector<bool>    known( MAX_DEPTH, false );
+  std::vector<int64_t> constant( MAX_DEPTH, 0 );
+
+  size_t d  = 0U;
+  size_t pc = header;
+
+  auto add_exit = [&trace]( size_t index, size_t exit_depth ) {
+    trace.exits.push_back( exit_type{ index, exit_depth } );
+    return static_cast<uint32_t>( trace.exits.size() - 1U );
+  };
+
+  auto make_op = []( op_code_type code, size_t a ) {
+    op_type op{};
+    op.code = code;
+    op.a    = static_cast<int32_t>( a );
+    return op;
+  };
+
+  // Add an op to the trace, and run it
+  //
+  auto emit = [&]( const op_type &op ) {
+    trace.ops.push_back( op );
+    return step_( op, slots, data, frame );
+  };
+
+  // A conditional jump, on the value in slot: guard the direction it
+  //  goes this time, and return the next instruction
+  //
+  auto guard = [&]( size_t slot, size_t if_zero, size_t if_nonzero, size_t exit_depth ) {
+    bool    zero = ( slots[slot].value() == 0.0 );
+    op_type op   = make_op( zero ? OP_CODE_TYPE_GUARD_ZERO : OP_CODE_TYPE_GUARD_NONZERO, slot );
+    op.exit = add_exit( zero ? if_nonzero : if_zero, exit_depth );
+    trace.ops.push_back( op );
+    return zero ? if_zero : if_nonzero;
+  };
+
+  while ( pc < instructions_.size()
+       && trace.ops.size() + 3U <= MAX_LENGTH
+       && d + 2U <= MAX_DEPTH ) {
+
+    const instruction_type &instruction = instructions_[pc];
+
+    op_type op{};
+    bool    ok = true;
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+      op = make_op( OP_CODE_TYPE_PUSH, d );
+      if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+        op.arg.bits = operand_data_type( instruction.arg.d ).bits();
+        known[d]    = false;
+      }
+      else if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+        op.arg.bits = operand_data_type( instruction.arg.i32 ).bits();
+        known[d]    = true;
+        constant[d] = instruction.arg.i32;
+      }
+      else {
+        op.arg.bits = operand_data_type( instruction.arg.sz ).bits();
+        known[d]    = true;
+        constant[d] = static_cast<int64_t>( instruction.arg.sz );
+      }
+      emit( op );
+      ++d;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) ? OP_CODE_TYPE_LOAD_FRAME : OP_CODE_TYPE_LOAD_FRAME_I32, d );
+      op.arg.offset = instruction.arg.i32;
+      emit( op );
+      known[d++] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_COPYFROMADDR ) ? OP_CODE_TYPE_LOAD_ADDR : OP_CODE_TYPE_LOAD_ADDR_I32, d );
+      op.arg.addr = instruction.arg.sz;
+      emit( op );
+      known[d++] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+      if ( d < 1U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 ) ? OP_CODE_TYPE_STORE_FRAME_I32 : OP_CODE_TYPE_STORE_FRAME, d - 1U );
+      op.arg.offset = instruction.arg.i32;
+      emit( op );
+      if ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP ) {
+        --d;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+      if ( d < 1U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOADDR ) ? OP_CODE_TYPE_STORE_ADDR : OP_CODE_TYPE_STORE_ADDR_I32, d - 1U );
+      op.arg.addr = instruction.arg.sz;
+      emit( op );
+      break;
+
+    case INSTRUCTION_ID_TYPE_POP:
+      if ( d < instruction.arg.sz ) {
+        ok = false;
+        break;
+      }
+      d -= instruction.arg.sz;
+      break;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+    case INSTRUCTION_ID_TYPE_INEGATE:
+    case INSTRUCTION_ID_TYPE_D2I:
+      if ( d < 1U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_NOT )     ? OP_CODE_TYPE_NOT
+                  : ( instruction.id == INSTRUCTION_ID_TYPE_NEGATE )  ? OP_CODE_TYPE_NEGATE
+                  : ( instruction.id == INSTRUCTION_ID_TYPE_INEGATE ) ? OP_CODE_TYPE_INEGATE
+                  :                                                     OP_CODE_TYPE_D2I
+                  , d - 1U );
+      if ( op.code == OP_CODE_TYPE_D2I ) {
+        op.exit = add_exit( pc, d );
+      }
+      ok = emit( op );
+      known[d - 1U] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_I2D:
+      if ( instruction.arg.i32 < 0 || d < static_cast<size_t>( instruction.arg.i32 ) + 1U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( OP_CODE_TYPE_I2D, d - 1U - instruction.arg.i32 );
+      emit( op );
+      known[ op.a ] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+      if ( d < 2U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( static_cast<op_code_type>( OP_CODE_TYPE_ADD + ( instruction.id - INSTRUCTION_ID_TYPE_ADD ) ), d - 2U );
+      if ( op.code == OP_CODE_TYPE_DIVIDE ) {
+        op.exit = add_exit( pc, d );
+      }
+      ok = emit( op );
+      if ( ok ) {
+        known[--d - 1U] = false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+      if ( d < 2U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( ( instruction.id == INSTRUCTION_ID_TYPE_AND ) ? OP_CODE_TYPE_AND : OP_CODE_TYPE_OR, d - 2U );
+      emit( op );
+      known[--d - 1U] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_ISUBTRACT:
+    case INSTRUCTION_ID_TYPE_IDIVIDE:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+    case INSTRUCTION_ID_TYPE_IGE:
+    case INSTRUCTION_ID_TYPE_IGT:
+    case INSTRUCTION_ID_TYPE_ILE:
+    case INSTRUCTION_ID_TYPE_ILT:
+      if ( d < 2U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( static_cast<op_code_type>( OP_CODE_TYPE_IADD + ( instruction.id - INSTRUCTION_ID_TYPE_IADD ) ), d - 2U );
+      if ( op.code == OP_CODE_TYPE_IDIVIDE ) {
+        op.exit = add_exit( pc, d );
+      }
+      ok = emit( op );
+      if ( ok ) {
+        known[--d - 1U] = false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      {
+        // The target must be constants pushed in the trace
+        //
+        if ( d < 3U || !known[d - 3U] || !known[d - 2U] ) {
+          ok = false;
+          break;
+        }
+        bool i32 = ( instruction.id == INSTRUCTION_ID_TYPE_ASSIGN_I32 );
+        if ( constant[d - 2U] ) {
+          op = make_op( i32 ? OP_CODE_TYPE_STORE_ADDR_I32 : OP_CODE_TYPE_STORE_ADDR, d - 1U );
+          op.arg.addr = static_cast<size_t>( constant[d - 3U] );
+        }
+        else {
+          op = make_op( i32 ? OP_CODE_TYPE_STORE_FRAME_I32 : OP_CODE_TYPE_STORE_FRAME, d - 1U );
+          op.arg.offset = static_cast<int32_t>( constant[d - 3U] );
+        }
+        emit( op );
+
+        op   = make_op( OP_CODE_TYPE_MOVE, d - 3U );
+        op.b = static_cast<int32_t>( d - 1U );
+        emit( op );
+
+        d -= 2U;
+        known[d - 1U] = false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_CLEAR:
+      if ( d > 0U ) {
+        op   = make_op( ( slots[d - 1U].type() == OPERAND_TYPE_INT32 ) ? OP_CODE_TYPE_PRINT_INT32 : OP_CODE_TYPE_PRINT_DOUBLE, d - 1U );
+        op.b = static_cast<int32_t>( d );
+        emit( op );
+        d = 0U;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_JCEQZ:
+    case INSTRUCTION_ID_TYPE_JEQZ:
+    case INSTRUCTION_ID_TYPE_JNEZ:
+      if ( d < 1U ) {
+        ok = false;
+        break;
+      }
+      {
+        size_t taken = pc + instruction.arg.i32;
+        if ( instruction.id == INSTRUCTION_ID_TYPE_JCEQZ ) {
+          pc = guard( d - 1U, taken, pc + 1U, d - 1U );
+          --d;
+        }
+        else if ( instruction.id == INSTRUCTION_ID_TYPE_JEQZ ) {
+          pc = guard( d - 1U, taken, pc + 1U, d );
+        }
+        else {
+          pc = guard( d - 1U, pc + 1U, taken, d );
+        }
+      }
+      continue;
+
+    case INSTRUCTION_ID_TYPE_JMP:
+      if ( instruction.arg.i32 < 0 ) {
+        // Back to the header closes the loop; any other backward jump
+        //  is an inner loop
+        //
+        if ( pc + instruction.arg.i32 == header && d == 0U ) {
+          *depth      = 0U;
+          *next_index = header;
+          return true;
+        }
+        ok = false;
+        break;
+      }
+      pc += instruction.arg.i32;
+      continue;
+
+    // Superinstructions (see optimize.h), as the sequences they replace
+    //
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      op = make_op( OP_CODE_TYPE_LOAD_FRAME, d );
+      op.arg.offset = instruction.arg.i32;
+      emit( op );
+      op = make_op( OP_CODE_TYPE_LOAD_FRAME, d + 1U );
+      op.arg.offset = instruction.arg2;
+      emit( op );
+      emit( make_op( OP_CODE_TYPE_ADD, d ) );
+      known[d++] = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+      if ( d < 1U ) {
+        ok = false;
+        break;
+      }
+      op = make_op( OP_CODE_TYPE_PUSH, d );
+      op.arg.bits = operand_data_type( instruction.arg.d ).bits();
+      emit( op );
+      emit( make_op( ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD ) ? OP_CODE_TYPE_ADD
+                   : ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ ) ? OP_CODE_TYPE_LT
+                   :                                                                 OP_CODE_TYPE_LE
+                   , d - 1U ) );
+      known[d - 1U] = false;
+      if ( instruction.id != INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD ) {
+        pc = guard( d - 1U, pc + instruction.arg2, pc + 1U, d - 1U );
+        --d;
+        continue;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+    case INSTRUCTION_ID_TYPE_LPARENS:
+    case INSTRUCTION_ID_TYPE_RPARENS:
+    case INSTRUCTION_ID_TYPE_COMMA:
+    case INSTRUCTION_ID_TYPE_FN:
+      break;
+
+    default:
+      // calls, returns, d-stack size changes: not traced
+      //
+      ok = false;
+      break;
+    }
+
+    if ( !ok ) {
+      break;
+    }
+
+    ++pc;
+  }
+
+  // Not traceable from here on: the interpreter takes over, at an
+  //  instruction none of which has run
+  //
+  *depth      = d;
+  *next_index = pc;
+  return false;
+}
+
+
+void loop_tracer_type::run_(
+                            const trace_type               &trace
+                           ,size_t                          stack_frame_base
+                           ,size_t                         *depth
+                           ,size_t                         *next_index
+                           )
+{
+  operand_data_type *slots = slots_.data();
+  char              *data  = data_.data();
+  char              *frame = data + stack_frame_base;
+
+  const op_type *begin = trace.ops.data();
+  const op_type *end   = begin + trace.ops.size();
+
+  for ( ;; ) {
+    for ( const op_type *op = begin; op != end; ++op ) {
+      if ( !step_( *op, slots, data, frame ) ) {
+        const exit_type &exit = trace.exits[ op->exit ];
+        *depth      = exit.depth;
+        *next_index = exit.index;
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "data_stack_type.h"
+#include "instruction_type.h"
+#include "operand_data_type.h"
+#include "result_sink.h"
+
+
+// Trace recording for hot loops.
+//
+// Every backward jump (the end of a while loop) is counted against the
+//  loop header it jumps to. Once a header has been jumped to threshold
+//  times, the next iteration is recorded: it is run by the recorder
+//  itself, which translates each instruction it executes into trace ops.
+//  Conditional jumps become guards, in the direction that was taken, and
+//  e-stack operands become fixed slots (the depth of every op is known
+//  once the path is), so the trace has no jumps, no e-stack size
+//  bookkeeping, and no dispatch on operand types: the types observed
+//  while recording pick the specialized ops.
+//
+// The trace then runs in its own, guard-checked interpreter, iteration
+//  after iteration, until a guard fails (typically the loop condition).
+//  The slots are then copied back to the e-stack, and the interpreter
+//  carries on from the instruction the guard exits to. Ops that could
+//  fail (divide by zero, out-of-range conversion) exit before they run,
+//  so that the interpreter reports the error.
+//
+// Only loops whose iteration is a straight path through arithmetic,
+//  loads, stores, assignments and statement results are traced; a call,
+//  return, inner loop, or change to the d-stack size ends recording, and
+//  the loop is not tried again (unless the recorded iteration was simply
+//  the last one)
+//
+class loop_tracer_type {
+
+  public:
+    static constexpr size_t DEFAULT_THRESHOLD = 100U;
+
+    // Most e-stack slots, and ops, a trace can have
+    //
+    static constexpr size_t MAX_DEPTH  = 32U;
+    static constexpr size_t MAX_LENGTH = 1024U;
+
+    loop_tracer_type(
+                     const std::vector<instruction_type> &instructions
+                    ,data_stack_type                     &data
+                    ,result_sink_type                    *results
+                    ,size_t                               threshold = DEFAULT_THRESHOLD
+                    );
+
+    loop_tracer_type( const loop_tracer_type & ) = delete;
+    loop_tracer_type &operator=( const loop_tracer_type & ) = delete;
+
+    // Called by the interpreter before the backward jump at index, to
+    //  header. If a trace for the loop was run (or recorded), returns
+    //  true; the interpreter should then continue from *next_index
+    //
+    bool back_edge(
+                   size_t                          index
+                  ,size_t                          header
+                  ,size_t                          stack_frame_base
+                  ,std::vector<operand_data_type> &evaluation_stack
+                  ,size_t                          evaluation_stack_base
+                  ,size_t                         *next_index
+                  );
+
+    size_t trace_count() const { return traces_.size(); }
+
+  private:
+    enum op_code_type {
+       OP_CODE_TYPE_PUSH              // a: slot; arg.bits: operand
+      ,OP_CODE_TYPE_LOAD_FRAME        // a: slot; arg.offset: from the stack frame base
+      ,OP_CODE_TYPE_LOAD_FRAME_I32
+      ,OP_CODE_TYPE_LOAD_ADDR         // a: slot; arg.addr
+      ,OP_CODE_TYPE_LOAD_ADDR_I32
+      ,OP_CODE_TYPE_STORE_FRAME       // a: slot; arg.offset
+      ,OP_CODE_TYPE_STORE_FRAME_I32
+      ,OP_CODE_TYPE_STORE_ADDR        // a: slot; arg.addr
+      ,OP_CODE_TYPE_STORE_ADDR_I32
+      ,OP_CODE_TYPE_MOVE              // a: destination slot; b: source slot
+
+      // a: operand (and result) slot
+      //
+      ,OP_CODE_TYPE_NOT
+      ,OP_CODE_TYPE_NEGATE
+      ,OP_CODE_TYPE_INEGATE
+      ,OP_CODE_TYPE_I2D
+      ,OP_CODE_TYPE_D2I               // exits if out of range
+
+      // a: left operand (and result) slot; the right operand is in a+1
+      //
+      ,OP_CODE_TYPE_ADD
+      ,OP_CODE_TYPE_SUBTRACT
+      ,OP_CODE_TYPE_DIVIDE            // exits on divide by zero
+      ,OP_CODE_TYPE_MULTIPLY
+      ,OP_CODE_TYPE_EQ
+      ,OP_CODE_TYPE_NEQ
+      ,OP_CODE_TYPE_GE
+      ,OP_CODE_TYPE_GT
+      ,OP_CODE_TYPE_LE
+      ,OP_CODE_TYPE_LT
+      ,OP_CODE_TYPE_AND
+      ,OP_CODE_TYPE_OR
+      ,OP_CODE_TYPE_IADD
+      ,OP_CODE_TYPE_ISUBTRACT
+      ,OP_CODE_TYPE_IDIVIDE           // exits on divide by zero
+      ,OP_CODE_TYPE_IMULTIPLY
+      ,OP_CODE_TYPE_IEQ
+      ,OP_CODE_TYPE_INEQ
+      ,OP_CODE_TYPE_IGE
+      ,OP_CODE_TYPE_IGT
+      ,OP_CODE_TYPE_ILE
+      ,OP_CODE_TYPE_ILT
+
+      // a: slot; exits unless the slot is zero/non-zero
+      //
+      ,OP_CODE_TYPE_GUARD_ZERO
+      ,OP_CODE_TYPE_GUARD_NONZERO
+
+      // statement result; a: top slot; b: e-stack depth
+      //
+      ,OP_CODE_TYPE_PRINT_DOUBLE
+      ,OP_CODE_TYPE_PRINT_INT32
+    };
+
+    union op_arg_type {
+      uint64_t bits;
+      int32_t  offset;
+      size_t   addr;
+    };
+
+    struct op_type {
+      op_code_type code;
+      int32_t      a;
+      int32_t      b;
+      uint32_t     exit;  // index into trace_type::exits
+      op_arg_type  arg;
+    };
+
+    // Where the interpreter picks up when an op exits, and how many
+    //  slots then hold the e-stack
+    //
+    struct exit_type {
+      size_t index;
+      size_t depth;
+    };
+
+    struct trace_type {
+      std::vector<op_type>   ops;
+      std::vector<exit_type> exits;
+    };
+
+    struct loop_type {
+      uint32_t back_edges;
+      bool     failed;
+      size_t   trace;      // index into traces_, or NO_TRACE
+    };
+
+    static constexpr size_t NO_TRACE = static_cast<size_t>( -1 );
+
+    bool step_( const op_type &op, operand_data_type *slots, char *data, char *frame );
+
+    bool record_(
+                 size_t                          header
+                ,size_t                          stack_frame_base
+                ,trace_type                     &trace
+                ,size_t                         *depth
+                ,size_t                         *next_index
+                );
+
+    void run_(
+              const trace_type               &trace
+             ,size_t                          stack_frame_base
+             ,size_t                         *depth
+             ,size_t                         *next_index
+             );
+
+    const std::vector<instruction_type> &instructions_;
+    data_stack_type                     &data_;
+    result_sink_type                    *results_;  // statement results, or null to drop them
+    size_t                               threshold_;
+
+    std::vector<loop_type>               loops_;   // by header index
+    std::vector<trace_type>              traces_;
+    std::vector<operand_data_type>       slots_;
+};
@@ -20,6 +20,8 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -28,7 +30,14 @@
 #include <vector>
 
 #include "evaluate.h"
+#include "ir.h"
+#include "optimize.h"
 #include "parser_type.h"
+#include "profile.h"
+#include "sampler.h"
+#include "register_vm.h"
+#include "result_sink.h"
+#include "verify.h"
 
 
 // test driver
@@ -40,7 +49,27 @@ int main( int argc, char* argv[] )
     return 1;
   }
 
-  bool cmd_line_mode = false;
+  bool                  cmd_line_mode = false;
+  evaluate_options_type options;
+  bool                  use_registers = false;
+  bool                  show_time     = false;
+  size_t                dstack_max    = data_stack_type::DEFAULT_MAX_SIZE;
+  bool                  dstack_stats  = false;
+  bool                  fuse          = false;
+  bool                  fold          = false;
+  bool                  dce           = false;
+  bool                  branches      = false;
+  std::string           ir_passes;
+  bool                  ir_dump       = false;
+  bool                  inline_calls  = false;
+  size_t                inline_budget = DEFAULT_INLINE_BUDGET;
+  bool                  profile       = false;
+  bool                  hot_ngrams    = false;
+  std::string           sample_path;
+  unsigned              sample_rate   = sampler_type::DEFAULT_FREQUENCY;
+  bool                  verify_first  = true;
+  std::string           results_mode;
+
   // handle command-line options
   int iarg = 1;
   for ( ; iarg < argc; ++iarg ) {
@@ -53,6 +82,96 @@ int main( int argc, char* argv[] )
     if ( std::strcmp( argv[iarg], "-c" ) == 0U ) {
       cmd_line_mode = true;
     }
+    else if ( std::strcmp( argv[iarg], "--threaded" ) == 0U ) {
+      options.engine = EVALUATE_ENGINE_TYPE_THREADED;
+    }
+    else if ( std::strcmp( argv[iarg], "--no-trace" ) == 0U ) {
+      options.trace = false;
+    }
+    else if ( std::strcmp( argv[iarg], "--no-checks" ) == 0U ) {
+      options.checks = false;
+    }
+    else if ( std::strcmp( argv[iarg], "--registers" ) == 0U ) {
+      use_registers = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--time" ) == 0U ) {
+      show_time = true;
+    }
+    else if ( std::strncmp( argv[iarg], "--dstack-max=", 13U ) == 0U ) {
+      dstack_max = std::strtoull( argv[iarg] + 13U, nullptr, 10 );
+    }
+    else if ( std::strcmp( argv[iarg], "--dstack-stats" ) == 0U ) {
+      dstack_stats = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--fuse" ) == 0U ) {
+      fuse = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--fold" ) == 0U ) {
+      fold = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--dce" ) == 0U ) {
+      dce = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--branches" ) == 0U ) {
+      branches = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--ir" ) == 0U ) {
+      ir_passes = "gvn";
+    }
+    else if ( std::strncmp( argv[iarg], "--ir=", 5U ) == 0U ) {
+      ir_passes = argv[iarg] + 5U;
+    }
+    else if ( std::strcmp( argv[iarg], "--ir-dump" ) == 0U ) {
+      ir_dump = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--loop-traces" ) == 0U ) {
+      options.loop_traces = true;
+    }
+    else if ( std::strncmp( argv[iarg], "--loop-trace-threshold=", 23U ) == 0U ) {
+      options.loop_trace_threshold = std::strtoull( argv[iarg] + 23U, nullptr, 10 );
+    }
+    else if ( std::strcmp( argv[iarg], "--inline" ) == 0U ) {
+      inline_calls = true;
+    }
+    else if ( std::strncmp( argv[iarg], "--inline-budget=", 16U ) == 0U ) {
+      inline_budget = std::strtoull( argv[iarg] + 16U, nullptr, 10 );
+    }
+    else if ( std::strcmp( argv[iarg], "--profile" ) == 0U ) {
+      profile = true;
+    }
+    else if ( std::strcmp( argv[iarg], "--profile-ngrams" ) == 0U ) {
+      hot_ngrams = true;
+    }
+    else if ( std::strncmp( argv[iarg], "--sample=", 9U ) == 0U ) {
+      sample_path = argv[iarg] + 9U;
+    }
+    else if ( std::strncmp( argv[iarg], "--sample-rate=", 14U ) == 0U ) {
+      sample_rate = static_cast<unsigned>( std::strtoul( argv[iarg] + 14U, nullptr, 10 ) );
+    }
+    else if ( std::strcmp( argv[iarg], "--no-verify" ) == 0U ) {
+      verify_first = false;
+    }
+    else if ( std::strcmp( argv[iarg], "--jit" ) == 0U ) {
+      options.jit = true;
+    }
+    else if ( std::strncmp( argv[iarg], "--jit-threshold=", 16U ) == 0U ) {
+      options.jit_threshold = std::strtoull( argv[iarg] + 16U, nullptr, 10 );
+    }
+    else if ( std::strncmp( argv[iarg], "--results=", 10U ) == 0U ) {
+      results_mode = argv[iarg] + 10U;
+      if ( results_mode != "stream" && results_mode != "text" && results_mode != "binary" && results_mode != "null" ) {
+        std::cerr << "ERROR: --results must be stream, text, binary or null\n";
+        return 1;
+      }
+    }
+  }
+
+  // Statement results: the text sink formats much faster than iostream,
+  //  but buffers, so it is only the default when there is no trace to
+  //  keep in step with
+  //
+  if ( results_mode.empty() ) {
+    results_mode = options.trace ? "stream" : "text";
   }
 
   if ( iarg >= argc ) {
@@ -93,11 +212,229 @@ int main( int argc, char* argv[] )
 
   if ( process_ok ) {
 
-    print_statements( parser.statements() );
+    // NOTE: the register machine is lowered from the unoptimized
+    //  instructions
+    //
+    std::vector<instruction_type> instructions( parser.statements() );
+    if ( inline_calls ) {
+      std::vector<inline_site_type> sites;
+      inline_small_functions( instructions, inline_budget, &sites );
+      for ( const inline_site_type &site : sites ) {
+        std::cout << "inline: call at " << site.call_index << " to function at " << site.function
+                  << " (" << site.size << " instructions): ";
+        if ( site.inlined ) {
+          std::cout << "inlined\n";
+        }
+        else {
+          std::cout << "not inlined, " << site.reason << "\n";
+        }
+      }
+    }
+    if ( fold ) {
+      fold_report_type report;
+      size_t before = instructions.size();
+      fold_constants( instructions, &report );
+      std::cout << "fold: " << report.folded << " operation(s) folded, " << report.globals << " constant global load(s) replaced, "
+                << report.branches << " branch(es) resolved; " << before << " -> " << instructions.size() << " instructions\n";
+    }
+    if ( branches ) {
+      branch_report_type report;
+      size_t before = instructions.size();
+      simplify_branches( instructions, &report );
+      std::cout << "branches: " << report.threaded << " jump(s) threaded, " << report.jumps << " no-op jump(s) removed, "
+                << report.short_circuits << " short-circuit(s) turned into jumps; " << before << " -> " << instructions.size() << " instructions\n";
+    }
+    if ( dce ) {
+      dce_report_type report;
+      size_t before = instructions.size();
+      eliminate_dead_code( instructions, &report );
+      std::cout << "dce: " << report.blocks << " unreachable block(s) (" << report.functions << " function(s) never called), "
+                << report.statements << " dead statement(s); " << before << " -> " << instructions.size() << " instructions, "
+                << report.bytes << " bytes removed\n";
+    }
+    if ( !ir_passes.empty() ) {
+      ir_pass_manager_type passes;
+      size_t               start = 0U;
+      while ( start <= ir_passes.size() ) {
+        size_t end = ir_passes.find( ',', start );
+        if ( end == std::string::npos ) {
+          end = ir_passes.size();
+        }
+        const std::string name( ir_passes, start, end - start );
+        if ( !passes.add( name ) ) {
+          std::cerr << "ERROR: unknown IR pass '" << name << "'\n";
+          return 1;
+        }
+        start = end + 1U;
+      }
+
+      size_t before = instructions.size();
+      if ( passes.run( instructions, ir_dump ? &std::cout : nullptr ) ) {
+        std::cout << "ir:";
+        for ( const auto &result : passes.results() ) {
+          std::cout << " " << result.first << ": " << result.second << " change(s);";
+        }
+        std::cout << " " << before << " -> " << instructions.size() << " instructions\n";
+      }
+      else {
+        std::cout << "ir: not built (or did not verify); instructions left as they are\n";
+      }
+    }
+    if ( fuse ) {
+      fuse_superinstructions( instructions );
+    }
+
+    print_statements( instructions );
+
+    // Verified instructions cannot underflow the e-stack, jump out of
+    //  range, or return from the top level, so they are run without
+    //  the run-time checks
+    //
+    if ( verify_first ) {
+      verify_error_type error;
+      if ( !verify( instructions, &error ) ) {
+        std::cerr << "ERROR: verification failed at instruction " << error.index << ": " << error.message << "\n";
+        return 1;
+      }
+      options.checks = false;
+    }
+
+    if ( options.jit ) {
+      if ( !jit_type::available() ) {
+        std::cerr << "WARNING: no native code generation on this platform; --jit ignored\n";
+      }
+      else if ( options.trace || profile || hot_ngrams ) {
+        std::cerr << "WARNING: --jit needs --no-trace (and no --profile or --profile-ngrams); ignored\n";
+      }
+    }
+
+    if ( options.loop_traces && ( options.trace || profile || hot_ngrams ) ) {
+      std::cerr << "WARNING: --loop-traces needs --no-trace (and no --profile or --profile-ngrams); ignored\n";
+    }
+
+    std::vector<size_t>   execution_counts;
+    std::vector<uint64_t> execution_cycles;
+    if ( profile || hot_ngrams ) {
+      options.execution_counts = &execution_counts;
+      options.execution_cycles = &execution_cycles;
+    }
+
+    register_program_type register_program;
+    if ( use_registers ) {
+      if ( lower_to_registers( parser.statements(), register_program ) ) {
+        print_register_program( register_program );
+      }
+      else {
+        std::cerr << "WARNING: instructions cannot be lowered to registers; using stack machine\n";
+        use_registers = false;
+      }
+    }
+
+    // The program is frozen here; all mutable execution state lives in
+    // the context, which is what a second thread would need its own copy of.
+    //
+    program_type     program( instructions, parser.function_names() );
+    vm_context_type  context( dstack_max );
+    data_stack_type &data = context.data;
+    if ( !data.valid() ) {
+      std::cerr << "ERROR: could not reserve d-stack of " << dstack_max << " bytes\n";
+      return 1;
+    }
+
+    stream_result_sink_type stream_results( std::cout );
+    text_result_sink_type   text_results( std::cout );
+    binary_result_sink_type binary_results;
+    null_result_sink_type   null_results;
+    if ( results_mode == "stream" ) {
+      context.results = &stream_results;
+    }
+    else if ( results_mode == "text" ) {
+      context.results = &text_results;
+    }
+    else if ( results_mode == "binary" ) {
+      context.results = &binary_results;
+    }
+    else {
+      context.results = &null_results;
+    }
+
+    // Sample the call stack, for a flame graph
+    //
+    call_stack_type call_stack;
+    sampler_type    sampler;
+    bool            sampling = false;
+    if ( !sample_path.empty() ) {
+      if ( use_registers ) {
+        std::cerr << "WARNING: --sample is not supported with --registers; ignored\n";
+      }
+      else {
+        context.call_stack = &call_stack;
+        sampling = sampler.start( call_stack, sample_rate );
+        if ( !sampling ) {
+          std::cerr << "WARNING: could not start the sampler; --sample ignored\n";
+        }
+      }
+    }
+
+    size_t jit_compiled = 0U;
+    options.jit_compiled = &jit_compiled;
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    bool evaluate_ok = use_registers
+      ? evaluate_registers( register_program, data, context.results )
+      : evaluate( program, context, options );
+    sampler.stop();
+    context.results->flush();
+
+    if ( results_mode == "binary" ) {
+      std::cerr << "results: " << binary_results.values().size() << " value(s), not printed\n";
+    }
+    else if ( results_mode == "null" ) {
+      std::cerr << "results: " << null_results.count() << " value(s), not printed\n";
+    }
+
+    if ( !evaluate_ok ) {
+      if ( data.overflowed() ) {
+        std::cerr << "ERROR: d-stack overflow (maximum size is " << data.max_size() << " bytes)\n";
+      }
+      else if ( !use_registers ) {
+        std::cerr << "ERROR: evaluation error at instruction " << context.pc << "\n";
+      }
+      else {
+        std::cerr << "ERROR: evaluation error\n";
+      }
+    }
+
+    if ( dstack_stats ) {
+      std::cerr << "d-stack high-water mark: " << data.high_water_mark() << " of " << data.max_size() << " bytes\n";
+    }
+
+    if ( show_time ) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start_time );
+      std::cerr << "evaluation time: " << elapsed.count() << " us\n";
+      if ( options.jit && !use_registers ) {
+        std::cerr << "jit: " << jit_compiled << " function(s) compiled\n";
+      }
+    }
+
+    if ( profile && !use_registers ) {
+      print_profile( instructions, execution_counts, execution_cycles, 20U );
+    }
+
+    if ( hot_ngrams && !use_registers ) {
+      print_hot_ngrams( instructions, execution_counts, 3U, 10U );
+    }
 
-    std::vector<char> data;
-    if ( !evaluate( parser.statements(), data ) ) {
-      std::cerr << "ERROR: evaluation error\n";
+    if ( sampling ) {
+      std::ofstream sample_file( sample_path );
+      sampler.write_folded( sample_file, program );
+      if ( !sample_file ) {
+        std::cerr << "ERROR: could not write samples to " << sample_path << "\n";
+      }
+      else {
+        std::cerr << "sampler: " << sampler.samples() << " sample(s), " << sampler.dropped() << " dropped, written to " << sample_path << "\n";
+      }
     }
 
   }
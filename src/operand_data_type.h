@@ -0,0 +1,131 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+enum operand_type {
+   OPERAND_TYPE_DOUBLE
+  ,OPERAND_TYPE_INT32
+  ,OPERAND_TYPE_SIZET
+};
+
+
+// An e-stack operand, packed into 8 bytes ("NaN-boxing").
+//
+// Doubles are stored as-is. The other types are stored in the payload of
+// a negative quiet NaN, with the top 16 bits as the tag:
+//
+//   0xFFFC'0000'iiii'iiii  int32  (i = value)
+//   0xFFFD'aaaa'aaaa'aaaa  size_t (a = address; 48 bits)
+//
+// NOTE: this relies on no double value ever having one of these bit
+//  patterns. Arithmetic only ever produces the default NaN
+//  (0xFFF8'0000'0000'0000 or 0x7FF8'0000'0000'0000) or propagates the
+//  payload of a NaN operand, and the parser never produces NaN
+//  literals, so a tagged pattern cannot be created from script code.
+//
+class operand_data_type {
+
+  public:
+    explicit operand_data_type( double in_value )
+      :bits_{ bits_of_( in_value ) }
+    {}
+
+    explicit operand_data_type( int32_t in_ivalue )
+      :bits_{ TAG_INT32 | static_cast<uint32_t>( in_ivalue ) }
+    {}
+
+    explicit operand_data_type( size_t in_addr )
+      :bits_{ TAG_SIZET | ( static_cast<uint64_t>( in_addr ) & PAYLOAD_MASK ) }
+    {}
+
+    void set_value( double in_value )
+    {
+      bits_ = bits_of_( in_value );
+    }
+
+    operand_type type() const
+    {
+      if ( ( bits_ & TAG_MASK ) == TAG_INT32 ) {
+        return OPERAND_TYPE_INT32;
+      }
+      if ( ( bits_ & TAG_MASK ) == TAG_SIZET ) {
+        return OPERAND_TYPE_SIZET;
+      }
+      return OPERAND_TYPE_DOUBLE;
+    }
+
+    // NOTE: the accessors do not check the type; as with the
+    //  instructions themselves, it is up to the code generator to
+    //  use operands consistently
+    //
+    double value() const
+    {
+      double rv;
+      std::memcpy( &rv, &bits_, sizeof( rv ) );
+      return rv;
+    }
+
+    int32_t ivalue() const
+    {
+      return static_cast<int32_t>( static_cast<uint32_t>( bits_ ) );
+    }
+
+    size_t addr() const
+    {
+      return static_cast<size_t>( bits_ & PAYLOAD_MASK );
+    }
+
+    // The raw 8 bytes, for code that moves operands in and out of
+    //  native code (see jit.h)
+    //
+    uint64_t bits() const { return bits_; }
+
+    static operand_data_type from_bits( uint64_t in_bits )
+    {
+      operand_data_type rv( 0.0 );
+      rv.bits_ = in_bits;
+      return rv;
+    }
+
+  private:
+    static constexpr uint64_t TAG_MASK     = 0xFFFF000000000000ULL;
+    static constexpr uint64_t TAG_INT32    = 0xFFFC000000000000ULL;
+    static constexpr uint64_t TAG_SIZET    = 0xFFFD000000000000ULL;
+    static constexpr uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+
+    static uint64_t bits_of_( double in_value )
+    {
+      uint64_t rv;
+      std::memcpy( &rv, &in_value, sizeof( rv ) );
+      return rv;
+    }
+
+    uint64_t bits_;
+};
+
+static_assert( sizeof( operand_data_type ) == 8U, "operand_data_type should pack into 8 bytes" );
@@ -0,0 +1,1529 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "cfg.h"
+#include "optimize.h"
+#include "parser_type.h"
+#include "verify.h"
+
+
+namespace {
+
+  struct pattern_type {
+    instruction_id_type ids[3];
+    size_t              length;
+    instruction_id_type fused;
+  };
+
+
+  // NOTE: longer patterns first, so they are preferred
+  //
+  const pattern_type patterns[] = {
+     { { INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET, INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET, INSTRUCTION_ID_TYPE_ADD    }, 3U, INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD }
+    ,{ { INSTRUCTION_ID_TYPE_PUSHDOUBLE,          INSTRUCTION_ID_TYPE_LT,                  INSTRUCTION_ID_TYPE_JCEQZ  }, 3U, INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ }
+    ,{ { INSTRUCTION_ID_TYPE_PUSHDOUBLE,          INSTRUCTION_ID_TYPE_LE,                  INSTRUCTION_ID_TYPE_JCEQZ  }, 3U, INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ }
+    ,{ { INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET,   INSTRUCTION_ID_TYPE_POP,                 INSTRUCTION_ID_TYPE_FN     }, 2U, INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP }
+    ,{ { INSTRUCTION_ID_TYPE_PUSHDOUBLE,          INSTRUCTION_ID_TYPE_ADD,                 INSTRUCTION_ID_TYPE_FN     }, 2U, INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD }
+  };
+
+
+  // Does the pattern match at i (without crossing an entry point)?
+  //
+  bool matches(
+               const std::vector<instruction_type> &instructions
+              ,const std::vector<bool>             &is_entry
+              ,size_t                               i
+              ,const pattern_type                  &pattern
+              )
+  {
+    if ( i + pattern.length > instructions.size() ) {
+      return false;
+    }
+
+    for ( size_t j=0U; j<pattern.length; ++j ) {
+      if ( instructions[i + j].id != pattern.ids[j] ) {
+        return false;
+      }
+      if ( j > 0U && is_entry[i + j] ) {
+        return false;
+      }
+    }
+
+    if ( pattern.fused == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP && instructions[i + 1U].arg.sz != 1U ) {
+      return false;
+    }
+
+    return true;
+  }
+
+
+  // Build the superinstruction for the sequence at instructions[i]. Jump
+  //  offsets are left relative to i, in the original numbering
+  //
+  instruction_type fuse( const instruction_type *sequence, instruction_id_type fused )
+  {
+    instruction_type rv( sequence[0] );
+    rv.id = fused;
+
+    switch ( fused ) {
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      rv.arg2 = sequence[1].arg.i32;
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+      rv.arg2 = sequence[2].arg.i32 + 2;
+      break;
+
+    default:
+      break;
+    }
+
+    return rv;
+  }
+
+
+
+  // Drop the instructions that are not kept. A jump to a dropped
+  //  instruction goes to the next one kept. Returns the number dropped
+  //
+  size_t compact( std::vector<instruction_type> &instructions, const std::vector<bool> &keep )
+  {
+    std::vector<instruction_type> out;
+    std::vector<size_t>           old_index;                              // of each kept instruction
+    std::vector<size_t>           new_index( instructions.size() + 1U ); // of each original instruction
+
+    out.reserve( instructions.size() );
+    old_index.reserve( instructions.size() );
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      new_index[i] = out.size();
+      if ( keep[i] ) {
+        old_index.push_back( i );
+        out.push_back( instructions[i] );
+      }
+    }
+    new_index[ instructions.size() ] = out.size();
+
+    remap_jumps( out, old_index, new_index );
+
+    size_t removed = instructions.size() - out.size();
+    instructions.swap( out );
+    return removed;
+  }
+
+
+  bool is_frame_access( instruction_id_type id )
+  {
+    switch ( id ) {
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+
+  // A function, as far as the inliner is concerned
+  //
+  struct inline_candidate_type {
+    std::vector<size_t> body;   // reachable instructions, in order
+    std::string         reason; // why it cannot be inlined, if it cannot
+  };
+
+
+  inline_candidate_type examine_function(
+                                         const std::vector<instruction_type>  &instructions
+                                        ,const std::vector<verify_state_type> &states
+                                        ,size_t                                entry
+                                        ,size_t                                budget
+                                        )
+  {
+    inline_candidate_type candidate;
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      if ( states[i].reached && states[i].in_function && states[i].function == entry ) {
+        candidate.body.push_back( i );
+      }
+    }
+
+    for ( size_t i : candidate.body ) {
+      const instruction_type &instruction = instructions[i];
+
+      if ( instruction.id >= INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD
+        && instruction.id <= INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD ) {
+        candidate.reason = "contains superinstructions";
+      }
+
+      switch ( instruction.id ) {
+      case INSTRUCTION_ID_TYPE_CALL:
+        if ( instruction.arg.sz == entry ) {
+          candidate.reason = "recursive";
+        }
+        break;
+      case INSTRUCTION_ID_TYPE_TAILCALL:
+        candidate.reason = ( instruction.arg.sz == entry ) ? "recursive" : "makes a tail call";
+        break;
+      case INSTRUCTION_ID_TYPE_ASSIGN:
+      case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+        candidate.reason = "assigns through the e-stack";
+        break;
+      case INSTRUCTION_ID_TYPE_JMPA:
+        candidate.reason = "contains an absolute jump";
+        break;
+      case INSTRUCTION_ID_TYPE_CLEAR:
+        if ( states[i].e_depth != 0U ) {
+          candidate.reason = "prints a value";
+        }
+        break;
+      default:
+        break;
+      }
+
+      if ( !candidate.reason.empty() ) {
+        return candidate;
+      }
+    }
+
+    if ( candidate.body.size() > budget ) {
+      candidate.reason = "over budget";
+    }
+
+    return candidate;
+  }
+
+
+  // Append a copy of the function's body, for a call made with the
+  //  caller's d-stack at call_offset from its stack frame base. Jumps
+  //  that leave the body (calls) are added to fixups, with the index
+  //  they were copied from
+  //
+  void expand_function(
+                       const std::vector<instruction_type>            &instructions
+                      ,const std::vector<verify_state_type>           &states
+                      ,const inline_candidate_type                    &candidate
+                      ,int64_t                                         call_offset
+                      ,std::vector<instruction_type>                  &out
+                      ,std::vector<std::pair<size_t,size_t>>          &fixups
+                      )
+  {
+    const size_t entry = candidate.body.front();
+
+    std::map<size_t,size_t>               local;  // index in the function -> index in out
+    std::vector<std::pair<size_t,size_t>> jumps;  // (index in out, index in the function)
+    std::vector<size_t>                   exits;  // jumps past the copy
+
+    for ( size_t k=0U; k<candidate.body.size(); ++k ) {
+      const size_t             i           = candidate.body[k];
+      const instruction_type  &instruction = instructions[i];
+      const verify_state_type &state       = states[i];
+
+      local[i] = out.size();
+
+      switch ( instruction.id ) {
+      case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+        if ( i == entry ) {
+          continue;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_CLEAR:
+        // nothing on the e-stack (see examine_function), so it only
+        //  marks the end of a statement
+        //
+        continue;
+
+      case INSTRUCTION_ID_TYPE_RETURN:
+        // Drop whatever the function left on its e-stack and its locals,
+        //  then leave the copy
+        //
+        if ( state.e_depth > 0U ) {
+          out.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_POP ) );
+          out.back().arg.sz = state.e_depth;
+        }
+        if ( state.d_offset > 0 ) {
+          out.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) );
+          out.back().arg.i32 = -static_cast<int32_t>( state.d_offset );
+        }
+        if ( k + 1U < candidate.body.size() ) {
+          exits.push_back( out.size() );
+          out.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_JMP ) );
+        }
+        continue;
+
+      default:
+        break;
+      }
+
+      out.push_back( instruction );
+
+      // The function's stack frame base was the caller's end of stack,
+      //  plus the return address and old stack frame base that the call
+      //  pushed. The copy pushes neither, so its locals start right at
+      //  the caller's end of stack
+      //
+      if ( is_frame_access( instruction.id ) ) {
+        int64_t offset = instruction.arg.i32;
+        offset += call_offset + ( ( offset < 0 ) ? 16 : 0 );
+        out.back().arg.i32 = static_cast<int32_t>( offset );
+      }
+
+      if ( jump_type_of( instruction.id ) == JUMP_TYPE_RELATIVE ) {
+        jumps.push_back( std::make_pair( out.size() - 1U, i ) );
+      }
+      else if ( jump_type_of( instruction.id ) != JUMP_TYPE_NONE ) {
+        fixups.push_back( std::make_pair( out.size() - 1U, i ) );
+      }
+    }
+
+    const size_t end = out.size();
+
+    for ( const auto &jump : jumps ) {
+      size_t target = static_cast<size_t>( jump.second + instructions[jump.second].arg.i32 );
+      out[jump.first].arg.i32 = static_cast<int32_t>( local[target] ) - static_cast<int32_t>( jump.first );
+    }
+
+    for ( size_t exit : exits ) {
+      out[exit].arg.i32 = static_cast<int32_t>( end ) - static_cast<int32_t>( exit );
+    }
+  }
+
+
+  // Constant (push) of the truth value a comparison or NOT pushes
+  //
+  instruction_type truth( bool value )
+  {
+    return instruction_type( value ? 1.0 : 0.0 );
+  }
+
+
+  // Apply a unary operation to a constant, exactly as evaluate() would.
+  //  Returns false if it cannot be folded (including if it would fail
+  //  at run time, which is left to happen then)
+  //
+  bool fold_unary( instruction_id_type id, const instruction_type &operand, instruction_type *result )
+  {
+    if ( operand.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+      const double value = operand.arg.d;
+
+      switch ( id ) {
+      case INSTRUCTION_ID_TYPE_NOT:
+        *result = truth( value == 0.0 );
+        return true;
+      case INSTRUCTION_ID_TYPE_NEGATE:
+        *result = instruction_type( -1.0 * value );
+        return true;
+      case INSTRUCTION_ID_TYPE_D2I:
+        if ( !( value > -2147483649.0 && value < 2147483648.0 ) ) {
+          return false;
+        }
+        *result = instruction_type( static_cast<int>( static_cast<int32_t>( value ) ) );
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    if ( operand.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+      const int32_t value = operand.arg.i32;
+
+      switch ( id ) {
+      case INSTRUCTION_ID_TYPE_INEGATE:
+        *result = instruction_type( static_cast<int>( static_cast<int32_t>( 0U - static_cast<uint32_t>( value ) ) ) );
+        return true;
+      case INSTRUCTION_ID_TYPE_I2D:
+        *result = instruction_type( static_cast<double>( value ) );
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    return false;
+  }
+
+
+  // Likewise, for a binary operation
+  //
+  bool fold_binary( instruction_id_type id, const instruction_type &lhs, const instruction_type &rhs, instruction_type *result )
+  {
+    if ( lhs.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE && rhs.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+      const double value1 = lhs.arg.d;
+      const double value2 = rhs.arg.d;
+
+      switch ( id ) {
+      case INSTRUCTION_ID_TYPE_ADD:      *result = instruction_type( value1 + value2 ); return true;
+      case INSTRUCTION_ID_TYPE_SUBTRACT: *result = instruction_type( value1 - value2 ); return true;
+      case INSTRUCTION_ID_TYPE_MULTIPLY: *result = instruction_type( value1 * value2 ); return true;
+      case INSTRUCTION_ID_TYPE_DIVIDE:
+        if ( value2 == 0.0 ) {
+          return false;
+        }
+        *result = instruction_type( value1 / value2 );
+        return true;
+      case INSTRUCTION_ID_TYPE_EQ:  *result = truth( value1 == value2 ); return true;
+      case INSTRUCTION_ID_TYPE_NEQ: *result = truth( value1 != value2 ); return true;
+      case INSTRUCTION_ID_TYPE_GE:  *result = truth( value1 >= value2 ); return true;
+      case INSTRUCTION_ID_TYPE_GT:  *result = truth( value1 >  value2 ); return true;
+      case INSTRUCTION_ID_TYPE_LE:  *result = truth( value1 <= value2 ); return true;
+      case INSTRUCTION_ID_TYPE_LT:  *result = truth( value1 <  value2 ); return true;
+      case INSTRUCTION_ID_TYPE_AND: *result = truth( value1 != 0.0 && value2 != 0.0 ); return true;
+      case INSTRUCTION_ID_TYPE_OR:  *result = truth( value1 != 0.0 || value2 != 0.0 ); return true;
+      default:
+        return false;
+      }
+    }
+
+    if ( lhs.id == INSTRUCTION_ID_TYPE_PUSHINT32 && rhs.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+      const int32_t value1 = lhs.arg.i32;
+      const int32_t value2 = rhs.arg.i32;
+      const uint32_t u1    = static_cast<uint32_t>( value1 );
+      const uint32_t u2    = static_cast<uint32_t>( value2 );
+
+      switch ( id ) {
+      case INSTRUCTION_ID_TYPE_IADD:      *result = instruction_type( static_cast<int>( static_cast<int32_t>( u1 + u2 ) ) ); return true;
+      case INSTRUCTION_ID_TYPE_ISUBTRACT: *result = instruction_type( static_cast<int>( static_cast<int32_t>( u1 - u2 ) ) ); return true;
+      case INSTRUCTION_ID_TYPE_IMULTIPLY: *result = instruction_type( static_cast<int>( static_cast<int32_t>( u1 * u2 ) ) ); return true;
+      case INSTRUCTION_ID_TYPE_IDIVIDE:
+        if ( value2 == 0 ) {
+          return false;
+        }
+        *result = instruction_type( static_cast<int>( ( value2 == -1 ) ? static_cast<int32_t>( 0U - u1 ) : value1 / value2 ) );
+        return true;
+      case INSTRUCTION_ID_TYPE_IEQ:  *result = truth( value1 == value2 ); return true;
+      case INSTRUCTION_ID_TYPE_INEQ: *result = truth( value1 != value2 ); return true;
+      case INSTRUCTION_ID_TYPE_IGE:  *result = truth( value1 >= value2 ); return true;
+      case INSTRUCTION_ID_TYPE_IGT:  *result = truth( value1 >  value2 ); return true;
+      case INSTRUCTION_ID_TYPE_ILE:  *result = truth( value1 <= value2 ); return true;
+      case INSTRUCTION_ID_TYPE_ILT:  *result = truth( value1 <  value2 ); return true;
+      default:
+        return false;
+      }
+    }
+
+    return false;
+  }
+
+
+  // One folding pass over each basic block: operations on constants
+  //  become constants, and conditional jumps on constants become jumps
+  //  (or nothing). Instructions folded away are cleared in keep
+  //
+  void fold_expressions(
+                        std::vector<instruction_type> &instructions
+                       ,std::vector<bool>             &keep
+                       ,fold_report_type              &report
+                       )
+  {
+    const std::vector<bool> is_entry = find_entry_points( instructions );
+
+    // the pushes of the constants on top of the e-stack, innermost last
+    //
+    std::vector<size_t> constants;
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      if ( is_entry[i] ) {
+        constants.clear();
+      }
+
+      instruction_type &instruction = instructions[i];
+      instruction_type  result( 0.0 );
+
+      switch ( instruction.id ) {
+      case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+      case INSTRUCTION_ID_TYPE_PUSHINT32:
+        constants.push_back( i );
+        continue;
+
+      case INSTRUCTION_ID_TYPE_NOT:
+      case INSTRUCTION_ID_TYPE_NEGATE:
+      case INSTRUCTION_ID_TYPE_INEGATE:
+      case INSTRUCTION_ID_TYPE_D2I:
+        if ( !constants.empty() && fold_unary( instruction.id, instructions[ constants.back() ], &result ) ) {
+          instructions[ constants.back() ] = result;
+          keep[i] = false;
+          ++report.folded;
+          continue;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_I2D:
+        // converts the operand at depth arg.i32
+        //
+        if ( instruction.arg.i32 >= 0 && constants.size() > static_cast<size_t>( instruction.arg.i32 ) ) {
+          const size_t operand = constants[ constants.size() - 1U - instruction.arg.i32 ];
+          if ( fold_unary( instruction.id, instructions[ operand ], &result ) ) {
+            instructions[ operand ] = result;
+            keep[i] = false;
+            ++report.folded;
+            continue;
+          }
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_ADD:
+      case INSTRUCTION_ID_TYPE_SUBTRACT:
+      case INSTRUCTION_ID_TYPE_MULTIPLY:
+      case INSTRUCTION_ID_TYPE_DIVIDE:
+      case INSTRUCTION_ID_TYPE_EQ:
+      case INSTRUCTION_ID_TYPE_NEQ:
+      case INSTRUCTION_ID_TYPE_GE:
+      case INSTRUCTION_ID_TYPE_GT:
+      case INSTRUCTION_ID_TYPE_LE:
+      case INSTRUCTION_ID_TYPE_LT:
+      case INSTRUCTION_ID_TYPE_AND:
+      case INSTRUCTION_ID_TYPE_OR:
+      case INSTRUCTION_ID_TYPE_IADD:
+      case INSTRUCTION_ID_TYPE_ISUBTRACT:
+      case INSTRUCTION_ID_TYPE_IMULTIPLY:
+      case INSTRUCTION_ID_TYPE_IDIVIDE:
+      case INSTRUCTION_ID_TYPE_IEQ:
+      case INSTRUCTION_ID_TYPE_INEQ:
+      case INSTRUCTION_ID_TYPE_IGE:
+      case INSTRUCTION_ID_TYPE_IGT:
+      case INSTRUCTION_ID_TYPE_ILE:
+      case INSTRUCTION_ID_TYPE_ILT:
+        if ( constants.size() >= 2U ) {
+          const size_t lhs = constants[ constants.size() - 2U ];
+          const size_t rhs = constants[ constants.size() - 1U ];
+          if ( fold_binary( instruction.id, instructions[lhs], instructions[rhs], &result ) ) {
+            instructions[lhs] = result;
+            keep[rhs]         = false;
+            keep[i]           = false;
+            constants.pop_back();
+            ++report.folded;
+            continue;
+          }
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_JCEQZ:
+        // pops the condition: the push goes, and the jump is either
+        //  always or never taken
+        //
+        if ( !constants.empty() && instructions[ constants.back() ].id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+          const bool taken = ( instructions[ constants.back() ].arg.d == 0.0 );
+          keep[ constants.back() ] = false;
+          constants.pop_back();
+          ++report.branches;
+          if ( !taken ) {
+            keep[i] = false;
+            continue;
+          }
+          instruction.id = INSTRUCTION_ID_TYPE_JMP;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_JEQZ:
+      case INSTRUCTION_ID_TYPE_JNEZ:
+        // leaves the condition on the e-stack
+        //
+        if ( !constants.empty() && instructions[ constants.back() ].id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+          const bool zero  = ( instructions[ constants.back() ].arg.d == 0.0 );
+          const bool taken = ( instruction.id == INSTRUCTION_ID_TYPE_JEQZ ) ? zero : !zero;
+          ++report.branches;
+          if ( !taken ) {
+            keep[i] = false;
+            continue;
+          }
+          instruction.id = INSTRUCTION_ID_TYPE_JMP;
+        }
+        break;
+
+      default:
+        break;
+      }
+
+      constants.clear();
+    }
+  }
+
+
+  // Instructions that are run, in order, every time the program starts:
+  //  from the start, following unconditional forward jumps (over
+  //  function bodies) and returns from calls, up to the first other
+  //  control transfer
+  //
+  std::vector<bool> find_straight_line_start( const std::vector<instruction_type> &instructions )
+  {
+    std::vector<bool> on_path( instructions.size(), false );
+
+    size_t i = 0U;
+    while ( i < instructions.size() && !on_path[i] ) {
+      on_path[i] = true;
+
+      const instruction_type &instruction = instructions[i];
+      if ( instruction.id == INSTRUCTION_ID_TYPE_JMP ) {
+        if ( instruction.arg.i32 <= 0 ) {
+          break;
+        }
+        i += instruction.arg.i32;
+      }
+      else if ( instruction.id == INSTRUCTION_ID_TYPE_CALL ) {
+        ++i;
+      }
+      else if ( is_control_transfer( instruction.id ) ) {
+        break;
+      }
+      else {
+        ++i;
+      }
+    }
+
+    return on_path;
+  }
+
+
+  bool overlaps( size_t addr1, size_t size1, size_t addr2, size_t size2 )
+  {
+    return addr1 < addr2 + size2 && addr2 < addr1 + size1;
+  }
+
+
+  // Replace loads of globals that are only ever set once, to a constant,
+  //  before anything can read them, by that constant. A global qualifies
+  //  if it is initialized (copy-to-addr) on the straight-line start of
+  //  the program, from a constant, and nothing else can write to it: no
+  //  other copy-to-addr, no assignment (push-sizet of its address), and
+  //  no top-level stack-offset write (where the stack frame base is 0)
+  //  that overlaps it. All its loads must come after the store, so since
+  //  functions are defined before they are called, none of them can run
+  //  before it
+  //
+  void propagate_globals(
+                         std::vector<instruction_type>        &instructions
+                        ,const std::vector<verify_state_type> &states
+                        ,fold_report_type                     &report
+                        )
+  {
+    const std::vector<bool> is_entry = find_entry_points( instructions );
+    const std::vector<bool> on_path  = find_straight_line_start( instructions );
+
+    auto width_of = []( instruction_id_type id ) {
+      return ( id == INSTRUCTION_ID_TYPE_COPYTOADDR_I32 || id == INSTRUCTION_ID_TYPE_COPYFROMADDR_I32
+            || id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 ) ? 4U : 8U;
+    };
+
+    // Every write that could reach a global: (index, address, size)
+    //
+    struct write_type {
+      size_t index;
+      size_t addr;
+      size_t size;
+    };
+    std::vector<write_type> writes;
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      const instruction_type &instruction = instructions[i];
+      const bool top_level = states[i].reached && !states[i].in_function;
+
+      switch ( instruction.id ) {
+      case INSTRUCTION_ID_TYPE_COPYTOADDR:
+      case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+        writes.push_back( write_type{ i, instruction.arg.sz, width_of( instruction.id ) } );
+        break;
+
+      case INSTRUCTION_ID_TYPE_PUSHSIZET:
+        writes.push_back( write_type{ i, instruction.arg.sz, 8U } );
+        break;
+
+      case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+      case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+        if ( top_level && instruction.arg.i32 >= 0 ) {
+          writes.push_back( write_type{ i, static_cast<size_t>( instruction.arg.i32 ), width_of( instruction.id ) } );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_PUSHINT32:
+        // push-int32 offset ; push-int32 0 is an assignment target,
+        //  relative to the stack frame base
+        //
+        if ( top_level && instruction.arg.i32 >= 0 && i + 1U < instructions.size()
+          && instructions[i + 1U].id == INSTRUCTION_ID_TYPE_PUSHINT32 && instructions[i + 1U].arg.i32 == 0 ) {
+          writes.push_back( write_type{ i, static_cast<size_t>( instruction.arg.i32 ), 8U } );
+        }
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    for ( const write_type &store : writes ) {
+      const size_t            s           = store.index;
+      const instruction_type &instruction = instructions[s];
+
+      if ( ( instruction.id != INSTRUCTION_ID_TYPE_COPYTOADDR && instruction.id != INSTRUCTION_ID_TYPE_COPYTOADDR_I32 )
+        || !on_path[s] || s == 0U || is_entry[s] ) {
+        continue;
+      }
+
+      const instruction_type &value = instructions[s - 1U];
+      const instruction_id_type value_id = ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOADDR_I32 ) ? INSTRUCTION_ID_TYPE_PUSHINT32 : INSTRUCTION_ID_TYPE_PUSHDOUBLE;
+      if ( value.id != value_id ) {
+        continue;
+      }
+
+      bool only_write = true;
+      for ( const write_type &other : writes ) {
+        if ( other.index != s && overlaps( store.addr, store.size, other.addr, other.size ) ) {
+          only_write = false;
+          break;
+        }
+      }
+      if ( !only_write ) {
+        continue;
+      }
+
+      // All loads must come after the store, and be of the same variable
+      //
+      const instruction_id_type load_id = ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOADDR_I32 ) ? INSTRUCTION_ID_TYPE_COPYFROMADDR_I32 : INSTRUCTION_ID_TYPE_COPYFROMADDR;
+      std::vector<size_t> loads;
+      bool                loads_ok = true;
+      for ( size_t i=0U; i<instructions.size() && loads_ok; ++i ) {
+        const instruction_id_type id = instructions[i].id;
+        if ( ( id == INSTRUCTION_ID_TYPE_COPYFROMADDR || id == INSTRUCTION_ID_TYPE_COPYFROMADDR_I32 )
+          && overlaps( store.addr, store.size, instructions[i].arg.sz, width_of( id ) ) ) {
+          if ( i < s || id != load_id || instructions[i].arg.sz != store.addr ) {
+            loads_ok = false;
+          }
+          else {
+            loads.push_back( i );
+          }
+        }
+      }
+      if ( !loads_ok ) {
+        continue;
+      }
+
+      for ( size_t i : loads ) {
+        instructions[i] = value;
+        ++report.globals;
+      }
+    }
+  }
+
+
+  // Remove what cannot be reached (as found by verify), then jumps to the
+  //  next instruction, until there are none of either. Returns false if
+  //  the instructions do not verify
+  //
+  bool remove_dead_code( std::vector<instruction_type> &instructions, fold_report_type &report )
+  {
+    for ( ;; ) {
+      std::vector<verify_state_type> states;
+      if ( !verify( instructions, nullptr, &states ) ) {
+        return false;
+      }
+
+      std::vector<bool> keep( instructions.size(), true );
+      bool              changed = false;
+      for ( size_t i=0U; i<instructions.size(); ++i ) {
+        if ( !states[i].reached
+          || ( instructions[i].id == INSTRUCTION_ID_TYPE_JMP && instructions[i].arg.i32 == 1 ) ) {
+          keep[i] = false;
+          changed = true;
+        }
+      }
+
+      if ( !changed ) {
+        return true;
+      }
+      report.removed += compact( instructions, keep );
+    }
+  }
+
+
+  // e-stack effect of the instructions whose value can be dropped, along
+  //  with the instructions that computed it: no side effects, and they
+  //  cannot fail once verified (loads are in range; division and D2I can
+  //  fail, and are not here)
+  //
+  bool is_pure( instruction_id_type id, size_t *pops )
+  {
+    switch ( id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      *pops = 0U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+    case INSTRUCTION_ID_TYPE_INEGATE:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+      *pops = 1U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_ISUBTRACT:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+    case INSTRUCTION_ID_TYPE_IGE:
+    case INSTRUCTION_ID_TYPE_IGT:
+    case INSTRUCTION_ID_TYPE_ILE:
+    case INSTRUCTION_ID_TYPE_ILT:
+      *pops = 2U;
+      return true;
+
+    default:
+      return false;
+    }
+  }
+
+
+  // Within each block, find values that are computed by pure
+  //  instructions only to be popped, and drop the instructions along with
+  //  the pop; and drop statement ends (clear-stack) with nothing on the
+  //  e-stack, which do nothing. Returns the number of statements dropped
+  //
+  size_t remove_dead_statements(
+                                const std::vector<instruction_type>  &instructions
+                               ,const std::vector<verify_state_type> &states
+                               ,const std::vector<basic_block_type>  &blocks
+                               ,std::vector<bool>                    &keep
+                               )
+  {
+    // The instructions that computed each e-stack entry, if they are all
+    //  pure and in this block
+    //
+    struct value_type {
+      bool                pure{};
+      std::vector<size_t> computed_by;
+    };
+
+    size_t dropped = 0U;
+
+    for ( const basic_block_type &b : blocks ) {
+      std::vector<value_type> estack;
+
+      for ( size_t i=b.begin; i<b.end; ++i ) {
+        if ( !keep[i] || !states[i].reached ) {
+          break;
+        }
+
+        const instruction_type &instruction = instructions[i];
+
+        // anything not followed below leaves entries we know nothing about
+        //
+        if ( estack.size() != states[i].e_depth ) {
+          estack.assign( states[i].e_depth, value_type() );
+        }
+
+        size_t pops;
+        if ( instruction.id == INSTRUCTION_ID_TYPE_CLEAR && states[i].e_depth == 0U ) {
+          keep[i] = false;
+          ++dropped;
+        }
+        else if ( instruction.id == INSTRUCTION_ID_TYPE_POP ) {
+          const size_t n    = instruction.arg.sz;
+          bool         pure = true;
+          for ( size_t k=estack.size() - n; k<estack.size(); ++k ) {
+            pure = pure && estack[k].pure;
+          }
+          if ( pure ) {
+            for ( size_t k=estack.size() - n; k<estack.size(); ++k ) {
+              for ( size_t j : estack[k].computed_by ) {
+                keep[j] = false;
+              }
+            }
+            keep[i] = false;
+            ++dropped;
+          }
+          estack.resize( estack.size() - n );
+        }
+        else if ( is_pure( instruction.id, &pops ) ) {
+          value_type result;
+          result.pure = true;
+          for ( size_t k=estack.size() - pops; k<estack.size(); ++k ) {
+            result.pure = result.pure && estack[k].pure;
+            result.computed_by.insert( result.computed_by.end(), estack[k].computed_by.begin(), estack[k].computed_by.end() );
+          }
+          result.computed_by.push_back( i );
+          estack.resize( estack.size() - pops );
+          estack.push_back( result );
+        }
+        else {
+          estack.clear();
+        }
+      }
+    }
+
+    return dropped;
+  }
+
+
+  // How many entries an instruction reads from the top of the e-stack
+  //  (whether it pops them or not), for the instructions that can appear
+  //  in the right-hand side of && or ||. Returns false for any other
+  //
+  bool operands_of( const instruction_type &instruction, size_t *operands )
+  {
+    if ( is_pure( instruction.id, operands ) ) {
+      return true;
+    }
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+    case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+    case INSTRUCTION_ID_TYPE_CALL:
+      *operands = 0U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_JEQZ:
+    case INSTRUCTION_ID_TYPE_JNEZ:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_D2I:
+      *operands = 1U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_IDIVIDE:
+      *operands = 2U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_I2D:
+      *operands = static_cast<size_t>( instruction.arg.i32 ) + 1U;
+      return true;
+
+    case INSTRUCTION_ID_TYPE_POP:
+      *operands = instruction.arg.sz;
+      return true;
+
+    default:
+      return false;
+    }
+  }
+
+
+  // Point the jump at instructions[index] to target
+  //
+  void set_jump_target( instruction_type &instruction, size_t index, size_t target )
+  {
+    const int32_t offset = static_cast<int32_t>( target ) - static_cast<int32_t>( index );
+
+    switch ( jump_type_of( instruction.id ) ) {
+    case JUMP_TYPE_RELATIVE:
+      instruction.arg.i32 = offset;
+      break;
+    case JUMP_TYPE_RELATIVE_ARG2:
+      instruction.arg2    = offset;
+      break;
+    case JUMP_TYPE_ABSOLUTE:
+      instruction.arg.sz  = target;
+      break;
+    case JUMP_TYPE_NONE:
+      break;
+    }
+  }
+
+
+  // Where a jump from instructions[from] to target finally ends up, going
+  //  through any jumps it lands on that are certain to be taken (or not
+  //  taken): a jump, or a test of the value just tested, which has not
+  //  been popped
+  //
+  size_t thread_jump(
+                     const std::vector<instruction_type> &instructions
+                    ,size_t                               from
+                    ,size_t                               target
+                    )
+  {
+    const instruction_id_type tested = instructions[from].id;
+    const bool                keeps  = ( tested == INSTRUCTION_ID_TYPE_JEQZ || tested == INSTRUCTION_ID_TYPE_JNEZ );
+
+    const size_t original = target;
+
+    for ( size_t steps=0U; target < instructions.size(); ++steps ) {
+      // a chain longer than the program is a loop (while ( 1 ) {})
+      //
+      if ( steps == instructions.size() ) {
+        return original;
+      }
+
+      const instruction_type &next = instructions[target];
+      size_t                  next_target;
+
+      if ( next.id == INSTRUCTION_ID_TYPE_JMP ) {
+        next_target = target + next.arg.i32;
+      }
+      else if ( keeps && ( next.id == INSTRUCTION_ID_TYPE_JEQZ || next.id == INSTRUCTION_ID_TYPE_JNEZ ) ) {
+        next_target = ( next.id == tested ) ? target + next.arg.i32 : target + 1U;
+      }
+      else {
+        break;
+      }
+
+      if ( next_target == target ) {
+        break;
+      }
+      target = next_target;
+    }
+
+    return target;
+  }
+
+
+  // A && or || whose value is only tested by a jceqz:
+  //
+  //   x ; jeqz L ; y ; and ; L: jceqz T     (|| : jnez, or)
+  //
+  // where y leaves x alone, and nothing else jumps into y. Returns the
+  //  index of the jceqz, or 0 if the pattern does not match at j
+  //
+  size_t match_short_circuit(
+                             const std::vector<instruction_type>  &instructions
+                            ,const std::vector<verify_state_type> &states
+                            ,const std::vector<size_t>            &first_source
+                            ,const std::vector<size_t>            &last_source
+                            ,size_t                                j
+                            )
+  {
+    const instruction_type &test = instructions[j];
+    if ( ( test.id != INSTRUCTION_ID_TYPE_JEQZ && test.id != INSTRUCTION_ID_TYPE_JNEZ ) || test.arg.i32 < 3 ) {
+      return 0U;
+    }
+
+    const size_t l  = j + test.arg.i32;
+    const auto   op = ( test.id == INSTRUCTION_ID_TYPE_JEQZ ) ? INSTRUCTION_ID_TYPE_AND : INSTRUCTION_ID_TYPE_OR;
+    if ( l >= instructions.size() || instructions[l].id != INSTRUCTION_ID_TYPE_JCEQZ || instructions[l - 1U].id != op ) {
+      return 0U;
+    }
+
+    const size_t depth = states[j].e_depth;  // x is the top entry
+    for ( size_t i=j + 1U; i<l - 1U; ++i ) {
+      size_t operands;
+      if ( !states[i].reached || !operands_of( instructions[i], &operands ) || states[i].e_depth < depth + operands ) {
+        return 0U;
+      }
+      if ( first_source[i] < j + 1U || last_source[i] >= l - 1U ) {
+        return 0U;
+      }
+      int64_t target;
+      if ( jump_type_of( instructions[i].id ) == JUMP_TYPE_RELATIVE
+        && jump_target_of( instructions[i], i, &target )
+        && ( target <= static_cast<int64_t>( j ) || target >= static_cast<int64_t>( l ) ) ) {
+        return 0U;
+      }
+    }
+    if ( first_source[l - 1U] < j + 1U || last_source[l - 1U] >= l - 1U ) {
+      return 0U;
+    }
+
+    return l;
+  }
+
+}
+
+
+size_t fuse_superinstructions( std::vector<instruction_type> &instructions )
+{
+  const std::vector<bool> is_entry = find_entry_points( instructions );
+
+  std::vector<instruction_type> fused;
+  std::vector<size_t>           old_index;                              // of each fused instruction
+  std::vector<size_t>           new_index( instructions.size() + 1U ); // of each original instruction
+
+  fused.reserve( instructions.size() );
+  old_index.reserve( instructions.size() );
+
+  size_t i = 0U;
+  while ( i < instructions.size() ) {
+
+    size_t length = 1U;
+    instruction_type instruction( instructions[i] );
+
+    for ( const pattern_type &pattern : patterns ) {
+      if ( matches( instructions, is_entry, i, pattern ) ) {
+        instruction = fuse( &instructions[i], pattern.fused );
+        length      = pattern.length;
+        break;
+      }
+    }
+
+    for ( size_t j=0U; j<length; ++j ) {
+      new_index[i + j] = fused.size();
+    }
+    old_index.push_back( i );
+    fused.push_back( instruction );
+
+    i += length;
+  }
+  new_index[ instructions.size() ] = fused.size();
+
+  remap_jumps( fused, old_index, new_index );
+
+  size_t removed = instructions.size() - fused.size();
+  instructions.swap( fused );
+  return removed;
+}
+
+
+size_t fold_constants( std::vector<instruction_type> &instructions, fold_report_type *report )
+{
+  std::vector<verify_state_type> states;
+  if ( !verify( instructions, nullptr, &states ) ) {
+    return 0U;
+  }
+
+  const std::vector<instruction_type> original( instructions );
+  fold_report_type                    done;
+
+  // Folding can make more globals constant (their initial values), and
+  //  propagating them gives more to fold; repeat until neither changes
+  //  anything
+  //
+  for ( ;; ) {
+    const size_t before = done.folded + done.globals + done.branches;
+
+    std::vector<bool> keep( instructions.size(), true );
+    fold_expressions( instructions, keep, done );
+    done.removed += compact( instructions, keep );
+
+    if ( !remove_dead_code( instructions, done ) || !verify( instructions, nullptr, &states ) ) {
+      instructions = original;
+      return 0U;
+    }
+
+    propagate_globals( instructions, states, done );
+
+    if ( done.folded + done.globals + done.branches == before ) {
+      break;
+    }
+  }
+
+  if ( report ) {
+    *report = done;
+  }
+  return done.removed;
+}
+
+
+size_t eliminate_dead_code( std::vector<instruction_type> &instructions, dce_report_type *report )
+{
+  std::vector<verify_state_type> states;
+  if ( !verify( instructions, nullptr, &states ) ) {
+    return 0U;
+  }
+
+  const std::vector<instruction_type> original( instructions );
+  dce_report_type                     done;
+
+  // Dropping a statement can leave a jump to the next instruction, and
+  //  dropping that can leave a block empty; repeat until nothing changes
+  //
+  for ( ;; ) {
+    // Functions are reached through their calls, so the bodies of
+    //  functions that are never called (or only from unreachable code)
+    //  are not
+    //
+    const std::vector<basic_block_type> blocks  = build_cfg( instructions, true, nullptr );
+    const std::vector<bool>             reached = reachable_blocks( blocks, 0U );
+
+    std::vector<bool> keep( instructions.size(), true );
+    for ( size_t b=0U; b<blocks.size(); ++b ) {
+      if ( !reached[b] ) {
+        std::fill( keep.begin() + blocks[b].begin, keep.begin() + blocks[b].end, false );
+        ++done.blocks;
+      }
+    }
+
+    // The parser puts each function's body right after a jump over it; a
+    //  body that is all unreachable is a function never called
+    //
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      if ( !keep[i] || instructions[i].id != INSTRUCTION_ID_TYPE_JMP || instructions[i].arg.i32 <= 1 ) {
+        continue;
+      }
+      const size_t end      = i + instructions[i].arg.i32;
+      bool         all_dead = true;
+      bool         returns  = false;
+      for ( size_t j=i + 1U; j<end && all_dead; ++j ) {
+        all_dead = !keep[j];
+        returns  = returns || instructions[j].id == INSTRUCTION_ID_TYPE_RETURN || instructions[j].id == INSTRUCTION_ID_TYPE_TAILCALL;
+      }
+      if ( all_dead && returns ) {
+        ++done.functions;
+      }
+    }
+
+    done.statements += remove_dead_statements( instructions, states, blocks, keep );
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      if ( keep[i] && instructions[i].id == INSTRUCTION_ID_TYPE_JMP && instructions[i].arg.i32 == 1 ) {
+        keep[i] = false;
+      }
+    }
+
+    const size_t removed = compact( instructions, keep );
+    if ( removed == 0U ) {
+      break;
+    }
+    done.removed += removed;
+
+    if ( !verify( instructions, nullptr, &states ) ) {
+      instructions = original;
+      return 0U;
+    }
+  }
+
+  done.bytes = done.removed * sizeof( instruction_type );
+
+  if ( report ) {
+    *report = done;
+  }
+  return done.removed;
+}
+
+
+size_t simplify_branches( std::vector<instruction_type> &instructions, branch_report_type *report )
+{
+  std::vector<verify_state_type> states;
+  if ( !verify( instructions, nullptr, &states ) ) {
+    return 0U;
+  }
+
+  const std::vector<instruction_type> original( instructions );
+  const size_t                        original_size = instructions.size();
+  branch_report_type                  done;
+
+  // Each rewrite can make another possible (a && inside a || becomes the
+  //  condition once the || is gone, threading a jump can leave code
+  //  unreachable); repeat until nothing changes. Short-circuits go
+  //  first: threading a jump into the right-hand side of a || would
+  //  leave it with two ways in
+  //
+  for ( bool changed = true; changed; ) {
+    changed = false;
+
+    // The first and last instruction jumping to each one
+    //
+    std::vector<size_t> first_source( instructions.size() + 1U, instructions.size() );
+    std::vector<size_t> last_source( instructions.size() + 1U, 0U );
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      int64_t target;
+      if ( jump_target_of( instructions[i], i, &target )
+        && target >= 0 && target <= static_cast<int64_t>( instructions.size() ) ) {
+        first_source[target] = std::min( first_source[target], i );
+        last_source[target]  = std::max( last_source[target], i );
+      }
+    }
+
+    // Rebuild, without unreachable code (jumps threaded past) and jumps
+    //  to the next instruction, and with && and || that only feed a
+    //  jceqz turned into jumps:
+    //
+    //   x ; jeqz L ; y ; and ; L: jceqz T  ->  x ; jceqz T ; y ; jceqz T
+    //   x ; jnez L ; y ; or  ; L: jceqz T  ->  x ; jceqz Y ; jmp B ; Y: y ; jceqz T ; B:
+    //
+    //  On the x ; jeqz path the jceqz sees y instead of (x && y), which
+    //  is zero exactly when (x && y) is; likewise for ||
+    //
+    std::vector<instruction_type> out;
+    std::vector<size_t>           old_index;
+    std::vector<size_t>           new_index( instructions.size() + 1U );
+    out.reserve( instructions.size() + 16U );
+    old_index.reserve( instructions.size() + 16U );
+
+    size_t skip_op = instructions.size();  // the and/or of the current rewrite
+    size_t free_at = 0U;                   // no rewrite may start before this
+
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      new_index[i] = out.size();
+
+      instruction_type instruction = instructions[i];
+      int64_t          target;
+      const bool       jumps = jump_target_of( instruction, i, &target );
+
+      if ( !states[i].reached || i == skip_op ) {
+        changed = true;
+        continue;
+      }
+
+      if ( jumps && target == static_cast<int64_t>( i ) + 1 ) {
+        if ( instruction.id == INSTRUCTION_ID_TYPE_JMP || instruction.id == INSTRUCTION_ID_TYPE_JEQZ || instruction.id == INSTRUCTION_ID_TYPE_JNEZ ) {
+          ++done.jumps;
+          changed = true;
+          continue;
+        }
+        if ( instruction.id == INSTRUCTION_ID_TYPE_JCEQZ ) {
+          instruction    = instruction_type( INSTRUCTION_ID_TYPE_POP );
+          instruction.arg.sz = 1U;
+          ++done.jumps;
+          changed = true;
+        }
+      }
+
+      const size_t l = ( i >= free_at ) ? match_short_circuit( instructions, states, first_source, last_source, i ) : 0U;
+      if ( l != 0U ) {
+        const size_t t = l + instructions[l].arg.i32;
+
+        instruction.id = INSTRUCTION_ID_TYPE_JCEQZ;
+        if ( instructions[i].id == INSTRUCTION_ID_TYPE_JEQZ ) {
+          set_jump_target( instruction, i, t );
+          old_index.push_back( i );
+          out.push_back( instruction );
+        }
+        else {
+          set_jump_target( instruction, i, i + 1U );
+          old_index.push_back( i );
+          out.push_back( instruction );
+
+          instruction_type jump( INSTRUCTION_ID_TYPE_JMP );
+          set_jump_target( jump, i, l + 1U );
+          old_index.push_back( i );
+          out.push_back( jump );
+        }
+
+        skip_op = l - 1U;
+        free_at = l + 1U;
+        ++done.short_circuits;
+        changed = true;
+        continue;
+      }
+
+      old_index.push_back( i );
+      out.push_back( instruction );
+    }
+    new_index[ instructions.size() ] = out.size();
+
+    remap_jumps( out, old_index, new_index );
+    instructions.swap( out );
+
+    // Thread jumps through jumps
+    //
+    for ( size_t i=0U; i<instructions.size(); ++i ) {
+      const jump_type type = jump_type_of( instructions[i].id );
+      int64_t         target;
+      if ( ( type != JUMP_TYPE_RELATIVE && type != JUMP_TYPE_RELATIVE_ARG2 )
+        || !jump_target_of( instructions[i], i, &target ) ) {
+        continue;
+      }
+
+      const size_t threaded = thread_jump( instructions, i, static_cast<size_t>( target ) );
+      if ( threaded != static_cast<size_t>( target ) ) {
+        set_jump_target( instructions[i], i, threaded );
+        ++done.threaded;
+        changed = true;
+      }
+
+      // a jump to a return may as well return
+      //
+      if ( instructions[i].id == INSTRUCTION_ID_TYPE_JMP && threaded < instructions.size()
+        && instructions[threaded].id == INSTRUCTION_ID_TYPE_RETURN ) {
+        instructions[i] = instructions[threaded];
+        ++done.threaded;
+        changed = true;
+      }
+    }
+
+    if ( !verify( instructions, nullptr, &states ) ) {
+      instructions = original;
+      return 0U;
+    }
+  }
+
+  done.removed = original_size - instructions.size();
+
+  if ( report ) {
+    *report = done;
+  }
+  return done.threaded + done.jumps + done.short_circuits;
+}
+
+
+size_t inline_small_functions(
+                              std::vector<instruction_type> &instructions
+                             ,size_t                         budget
+                             ,std::vector<inline_site_type> *report
+                             )
+{
+  std::vector<verify_state_type> states;
+  if ( !verify( instructions, nullptr, &states ) ) {
+    return 0U;
+  }
+
+  const std::vector<bool> is_entry = find_entry_points( instructions );
+
+  std::map<size_t,inline_candidate_type> candidates;
+
+  std::vector<instruction_type>         out;
+  std::vector<size_t>                   new_index( instructions.size() + 1U ); // of each original instruction
+  std::vector<std::pair<size_t,size_t>> fixups;                                // (index in out, original index)
+  size_t                                inlined = 0U;
+
+  out.reserve( instructions.size() );
+
+  for ( size_t i=0U; i<instructions.size(); ++i ) {
+    const instruction_type &instruction = instructions[i];
+
+    new_index[i] = out.size();
+
+    if ( instruction.id == INSTRUCTION_ID_TYPE_CALL && states[i].reached ) {
+      size_t entry = instruction.arg.sz;
+      auto   found = candidates.find( entry );
+      if ( found == candidates.end() ) {
+        found = candidates.insert( std::make_pair( entry, examine_function( instructions, states, entry, budget ) ) ).first;
+      }
+      const inline_candidate_type &candidate = found->second;
+
+      if ( report ) {
+        inline_site_type site;
+        site.call_index = i;
+        site.function   = entry;
+        site.size       = candidate.body.size();
+        site.inlined    = candidate.reason.empty();
+        site.reason     = candidate.reason;
+        report->push_back( site );
+      }
+
+      if ( candidate.reason.empty() ) {
+        // The stack print before the call goes too
+        //
+        if ( i > 0U && !is_entry[i] && instructions[i - 1U].id == INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK
+          && !out.empty() && out.back().id == INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK ) {
+          out.pop_back();
+          new_index[i] = out.size();
+        }
+        expand_function( instructions, states, candidate, states[i].d_offset, out, fixups );
+        ++inlined;
+        continue;
+      }
+    }
+
+    out.push_back( instruction );
+    if ( jump_type_of( instruction.id ) != JUMP_TYPE_NONE ) {
+      fixups.push_back( std::make_pair( out.size() - 1U, i ) );
+    }
+  }
+  new_index[ instructions.size() ] = out.size();
+
+  // Remap jumps into the original instructions
+  //
+  for ( const auto &fixup : fixups ) {
+    instruction_type &instruction = out[ fixup.first ];
+
+    int64_t target;
+    if ( !jump_target_of( instructions[ fixup.second ], fixup.second, &target )
+      || target < 0 || target > static_cast<int64_t>( instructions.size() ) ) {
+      continue;
+    }
+
+    switch ( jump_type_of( instruction.id ) ) {
+    case JUMP_TYPE_RELATIVE:
+      instruction.arg.i32 = static_cast<int32_t>( new_index[ target ] ) - static_cast<int32_t>( fixup.first );
+      break;
+    case JUMP_TYPE_RELATIVE_ARG2:
+      instruction.arg2    = static_cast<int32_t>( new_index[ target ] ) - static_cast<int32_t>( fixup.first );
+      break;
+    case JUMP_TYPE_ABSOLUTE:
+      instruction.arg.sz  = new_index[ target ];
+      break;
+    case JUMP_TYPE_NONE:
+      break;
+    }
+  }
+
+  instructions.swap( out );
+  return inlined;
+}
+
+
+void print_hot_ngrams(
+                      const std::vector<instruction_type> &instructions
+                     ,const std::vector<size_t>           &execution_counts
+                     ,size_t                               max_n
+                     ,size_t                               top
+                     )
+{
+  const std::vector<bool> is_entry = find_entry_points( instructions );
+
+  for ( size_t n=2U; n<=max_n; ++n ) {
+
+    std::map<std::string,size_t> counts;
+
+    for ( size_t i=0U; i + n <= instructions.size() && i < execution_counts.size(); ++i ) {
+      if ( execution_counts[i] == 0U ) {
+        continue;
+      }
+
+      std::string name;
+      bool straight = true;
+      for ( size_t j=0U; j<n && straight; ++j ) {
+        if ( j > 0U && is_entry[i + j] ) {
+          straight = false;
+        }
+        if ( j + 1U < n && is_control_transfer( instructions[i + j].id ) ) {
+          straight = false;
+        }
+        if ( j > 0U ) {
+          name += " ; ";
+        }
+        name += instruction_name( instructions[i + j].id );
+      }
+
+      if ( straight ) {
+        counts[ name ] += execution_counts[i];
+      }
+    }
+
+    std::vector<std::pair<size_t,std::string>> sorted;
+    for ( const auto &entry : counts ) {
+      sorted.push_back( std::make_pair( entry.second, entry.first ) );
+    }
+    std::sort( sorted.begin(), sorted.end(), []( const std::pair<size_t,std::string> &lhs, const std::pair<size_t,std::string> &rhs ) {
+      return lhs.first > rhs.first || ( lhs.first == rhs.first && lhs.second < rhs.second );
+    } );
+
+    std::cout << "hottest " << n << "-grams:\n";
+    for ( size_t k=0U; k<sorted.size() && k<top; ++k ) {
+      std::cout << "  " << sorted[k].first << "  " << sorted[k].second << "\n";
+    }
+  }
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "instruction_type.h"
+
+
+// What the inliner did with a call site
+//
+struct inline_site_type {
+  size_t      call_index{};  // of the call, in the instructions as given
+  size_t      function{};    // entry index of the callee, likewise
+  size_t      size{};        // of the callee, in (reachable) instructions
+  bool        inlined{};
+  std::string reason;        // if not inlined
+};
+
+
+const size_t DEFAULT_INLINE_BUDGET = 16U;
+
+
+// Replace calls to small functions with a copy of the function's body,
+//  which then works directly on the caller's frame: frame offsets are
+//  rebased onto the call site's frame, returns become jumps past the
+//  copy, and the call's own bookkeeping (call, return, the debug stack
+//  prints around them) disappears. The caller still reserves the
+//  return value and argument slots, exactly as it did for the call.
+//
+// Only functions of at most budget reachable instructions are inlined,
+//  and not if they:
+//
+//   - call themselves (or tail call anything, which would reuse the
+//     caller's frame)
+//   - assign through the e-stack (the target offset is a pushed value,
+//     which cannot be rebased)
+//   - print an expression statement's value (a clear-stack with
+//     something on the e-stack), which would clear the caller's e-stack
+//
+// Calls made by an inlined function are kept as calls. The instructions
+//  must pass verify() (they are left alone otherwise), and not have been
+//  fused yet. Each call site is added to report, if given. Returns the
+//  number of call sites inlined
+//
+size_t inline_small_functions(
+                              std::vector<instruction_type> &instructions
+                             ,size_t                         budget
+                             ,std::vector<inline_site_type> *report
+                             );
+
+
+// What constant folding did
+//
+struct fold_report_type {
+  size_t folded{};    // operations evaluated at compile time
+  size_t globals{};   // loads of constant globals replaced by their value
+  size_t branches{};  // conditional jumps on constants resolved
+  size_t removed{};   // instructions removed, in all
+};
+
+
+// Constant folding and propagation: within each basic block, operations
+//  on constants (arithmetic, comparisons, NOT, NEGATE, && and ||, int32
+//  operations and conversions) are done at compile time, and conditional
+//  jumps on constants become jumps, or go. Operations that would fail at
+//  run time (division by zero, out-of-range conversions) are left alone.
+//  Loads of globals that are initialized to a constant and never written
+//  again become that constant, which can make more to fold. Code left
+//  unreachable is removed, along with jumps to the next instruction; so
+//  a while loop whose condition is always false leaves no code at all.
+//
+// The instructions must pass verify() (they are left alone otherwise),
+//  and not have been fused yet. Returns the number of instructions
+//  removed, and fills in report, if given
+//
+size_t fold_constants(
+                      std::vector<instruction_type> &instructions
+                     ,fold_report_type              *report
+                     );
+
+
+// What dead code elimination removed
+//
+struct dce_report_type {
+  size_t blocks{};      // basic blocks that cannot be reached
+  size_t functions{};   // of those, whole functions that are never called
+  size_t statements{};  // pure values computed only to be popped, and empty statements
+  size_t removed{};     // instructions removed, in all
+  size_t bytes{};       // size of the instructions removed
+};
+
+
+// Dead code elimination, on the control flow graph: basic blocks that
+//  cannot be reached from the start of the program (or from a call that
+//  can) are removed, which takes the bodies of functions that are never
+//  called, and anything after a return. Within blocks, values computed
+//  only to be popped, by instructions without side effects, go along
+//  with the pop, as do statement ends with nothing to print, and jumps
+//  to the next instruction.
+//
+// The instructions must pass verify() (they are left alone otherwise).
+//  Returns the number of instructions removed, and fills in report, if
+//  given
+//
+size_t eliminate_dead_code(
+                           std::vector<instruction_type> &instructions
+                          ,dce_report_type               *report
+                          );
+
+
+// What branch simplification did
+//
+struct branch_report_type {
+  size_t threaded{};        // jumps sent straight to where the jump they landed on goes
+  size_t jumps{};           // jumps to the next instruction removed
+  size_t short_circuits{};  // && and || tested by a jump, turned into jumps
+  size_t removed{};         // instructions removed, in all
+};
+
+
+// Branch simplification, for the jumps that if/else chains, while loops
+//  and short-circuit operators leave behind:
+//
+//   - a jump to a jump goes straight to where that one goes (and a jump
+//     to a return returns); so does a jeqz or jnez landing on another
+//     test of the same value
+//   - jumps to the next instruction are removed (a jceqz becomes a pop)
+//   - a && or || whose value is only tested by a jceqz (an if or while
+//     condition) becomes jumps, without the and/or re-testing the
+//     operands: x ; jeqz L ; y ; and ; L: jceqz T becomes
+//     x ; jceqz T ; y ; jceqz T
+//   - code no longer reached is removed
+//
+// The instructions must pass verify() (they are left alone otherwise).
+//  Returns the number of changes made, and fills in report, if given
+//
+size_t simplify_branches(
+                         std::vector<instruction_type> &instructions
+                        ,branch_report_type            *report
+                        );
+
+
+// Peephole pass: replace common instruction sequences (as emitted by
+//  parser_type) with superinstructions, which do the same work with a
+//  single dispatch:
+//
+//   copy-from-stack-offset a ; copy-from-stack-offset b ; add
+//   push-double c ; lt ; jceqz n
+//   push-double c ; le ; jceqz n
+//   copy-to-stack-offset a ; pop 1
+//   push-double c ; add
+//
+// Sequences are never fused across a jump target (or a call's return
+//  point), and all jump offsets and absolute targets are remapped.
+//  Returns the number of instructions removed
+//
+size_t fuse_superinstructions( std::vector<instruction_type> &instructions );
+
+
+// Report the most frequently executed n-grams (for n = 2 to max_n), given
+//  the execution count of each instruction (see
+//  evaluate_options_type::execution_counts). Only sequences that always
+//  execute together - no jump target inside, no jump before the end - are
+//  counted. Identical sequences at different places are summed
+//
+void print_hot_ngrams(
+                      const std::vector<instruction_type> &instructions
+                     ,const std::vector<size_t>           &execution_counts
+                     ,size_t                               max_n
+                     ,size_t                               top
+                     );
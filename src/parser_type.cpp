@@ -20,6 +20,7 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <cctype>
 #include <iostream>
 #include <map>
 
@@ -63,6 +64,11 @@
 // required (popping arguments off the stack, then handling
 // what to do with return value(s))
 //
+// The return value and each argument take an 8-byte slot,
+// whatever their type (an int is in the low 4 bytes), and
+// the caller pads the stack so that the return value slot
+// is 8-byte aligned
+//
 
 
 namespace {
@@ -106,8 +112,37 @@ namespace {
     ,{ 0,  "move-end-of-stack"      }
     ,{ 0,  "call"                   }
     ,{ 0,  "return"                 }
+    ,{ 0,  "tail-call"              }
 
     ,{ 0,  "print-dstack"           }
+
+    ,{ 0,  "i2d"                    }
+    ,{ 0,  "d2i"                    }
+
+    ,{ 0,  "iadd"                   }
+    ,{ 0,  "isubtract"              }
+    ,{ 0,  "idivide"                }
+    ,{ 0,  "imultiply"              }
+    ,{ 0,  "ieq"                    }
+    ,{ 0,  "ine"                    }
+    ,{ 0,  "ige"                    }
+    ,{ 0,  "igt"                    }
+    ,{ 0,  "ile"                    }
+    ,{ 0,  "ilt"                    }
+
+    ,{ 0,  "inegate"                }
+
+    ,{ 0,  "copy-to-addr-i32"       }
+    ,{ 0,  "copy-from-addr-i32"     }
+    ,{ 0,  "copy-to-stack-offset-i32" }
+    ,{ 0,  "copy-from-stack-offset-i32" }
+    ,{ 0,  "assign-i32"             }
+
+    ,{ 0,  "copy-from-stack-offset-x2-add" }
+    ,{ 0,  "push-double-lt-jceqz"   }
+    ,{ 0,  "push-double-le-jceqz"   }
+    ,{ 0,  "copy-to-stack-offset-pop" }
+    ,{ 0,  "push-double-add"        }
     
     ,{ 9,  "fn"                     }
 
@@ -133,6 +168,9 @@ namespace {
    
   };
 
+  static_assert( sizeof( operator_data ) / sizeof( operator_data[0] ) == INSTRUCTION_ID_TYPE_ASSIGN + 1
+               , "operator_data[] must match up with instruction_id_type" );
+
 
   bool is_keyword( const std::string &name )
   {
@@ -154,10 +192,59 @@ namespace {
     else if ( std::strcmp( "double", name.c_str() ) == 0 ) {
       return true;
     }
+    else if ( std::strcmp( "int",    name.c_str() ) == 0 ) {
+      return true;
+    }
+
+    return false;
+  }
+
+
+  // Variable/return type named by a type keyword. Returns false if
+  //  name is not a type
+  //
+  bool type_of_keyword( const std::string &name, operand_type *type )
+  {
+    if ( std::strcmp( "double", name.c_str() ) == 0 ) {
+      *type = OPERAND_TYPE_DOUBLE;
+      return true;
+    }
+    else if ( std::strcmp( "int", name.c_str() ) == 0 ) {
+      *type = OPERAND_TYPE_INT32;
+      return true;
+    }
 
     return false;
   }
 
+
+  // Size (and alignment) of a variable of the given type
+  //
+  size_t size_of_type( operand_type type )
+  {
+    return ( type == OPERAND_TYPE_INT32 ) ? 4U : 8U;
+  }
+
+
+  // Padding needed to align offset to alignment
+  //
+  size_t padding_for( size_t offset, size_t alignment )
+  {
+    return ( alignment - ( offset % alignment ) ) % alignment;
+  }
+
+
+  // true if a number token is an integer that fits in an int32, i.e.
+  //  it has no decimal point or exponent
+  //
+  bool is_int32_literal( const std::string &text )
+  {
+    if ( text.find_first_of( ".eE" ) != std::string::npos ) {
+      return false;
+    }
+    return std::atof( text.c_str() ) <= 2147483647.0;
+  }
+
 }
 
 
@@ -171,6 +258,226 @@ bool parser_type::anchor_jump_here_( size_t jump_idx )
 }
 
 
+// Emit whatever is needed to turn the operand at the given e-stack
+//  depth (0 is the top) into a value of type to. An integer literal
+//  is rewritten in place. Returns false if that cannot be done
+//
+bool parser_type::convert_operand_( size_t depth, operand_type to )
+{
+  if ( operand_types_.size() <= depth ) {
+    return false;
+  }
+
+  operand_info_type &operand = *(operand_types_.rbegin() + depth);
+
+  if ( operand.literal_idx != NO_LITERAL ) {
+    if ( to == OPERAND_TYPE_INT32 ) {
+      instruction_type &literal = statements_[ operand.literal_idx ];
+      literal = instruction_type( static_cast<int>( literal.arg.d ) );
+    }
+  }
+  else if ( operand.type == OPERAND_TYPE_INT32 && to == OPERAND_TYPE_DOUBLE ) {
+    statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_I2D ) );
+    statements_.back().arg.i32 = static_cast<int32_t>( depth );
+  }
+  else if ( operand.type == OPERAND_TYPE_DOUBLE && to == OPERAND_TYPE_INT32 ) {
+    // D2I only works on the top of the e-stack
+    //
+    if ( depth != 0U ) {
+      return false;
+    }
+    statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_D2I ) );
+  }
+
+  operand.type        = to;
+  operand.literal_idx = NO_LITERAL;
+
+  return true;
+}
+
+
+// Emit a built-in operator, picking the int32 or double form of it
+//  from the types of its operands
+//
+bool parser_type::emit_operator_( const instruction_type &op )
+{
+  instruction_type instruction( op );
+  operand_type     result_type = OPERAND_TYPE_DOUBLE;
+  size_t           nargs       = 1U;
+
+  if ( instruction.id == INSTRUCTION_ID_TYPE_NEGATE ) {
+
+    if ( operand_types_.empty() ) {
+      return false;
+    }
+
+    // An integer literal is simply negated in place, so that it can
+    //  still become an int32
+    //
+    if ( operand_types_.back().literal_idx != NO_LITERAL ) {
+      statements_[ operand_types_.back().literal_idx ].arg.d *= -1.0;
+      return true;
+    }
+
+    if ( operand_types_.back().type == OPERAND_TYPE_INT32 ) {
+      instruction.id = INSTRUCTION_ID_TYPE_INEGATE;
+      result_type    = OPERAND_TYPE_INT32;
+    }
+
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_NOT ) {
+
+    if ( !convert_operand_( 0U, OPERAND_TYPE_DOUBLE ) ) {
+      return false;
+    }
+
+  }
+  else if ( instruction.id >= INSTRUCTION_ID_TYPE_ADD && instruction.id <= INSTRUCTION_ID_TYPE_LT ) {
+
+    if ( operand_types_.size() < 2U ) {
+      return false;
+    }
+
+    const operand_info_type &lhs = *(operand_types_.rbegin() + 1U);
+    const operand_info_type &rhs = *(operand_types_.rbegin()     );
+
+    bool lhs_int = ( lhs.type == OPERAND_TYPE_INT32 );
+    bool rhs_int = ( rhs.type == OPERAND_TYPE_INT32 );
+
+    // int32 math if both operands are int32, or one is and the other
+    //  is an integer literal. Anything else (including two literals)
+    //  is done in double
+    //
+    if ( ( lhs_int || rhs_int )
+      && ( lhs_int || lhs.literal_idx != NO_LITERAL )
+      && ( rhs_int || rhs.literal_idx != NO_LITERAL ) ) {
+
+      convert_operand_( 1U, OPERAND_TYPE_INT32 );
+      convert_operand_( 0U, OPERAND_TYPE_INT32 );
+
+      instruction.id = static_cast<instruction_id_type>( instruction.id - INSTRUCTION_ID_TYPE_ADD + INSTRUCTION_ID_TYPE_IADD );
+      if ( instruction.id <= INSTRUCTION_ID_TYPE_IMULTIPLY ) {
+        result_type = OPERAND_TYPE_INT32;
+      }
+
+    }
+    else {
+
+      convert_operand_( 1U, OPERAND_TYPE_DOUBLE );
+      convert_operand_( 0U, OPERAND_TYPE_DOUBLE );
+
+    }
+    nargs = 2U;
+
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_AND || instruction.id == INSTRUCTION_ID_TYPE_OR ) {
+
+    // NOTE: the left-hand side was converted before its short-circuit
+    //  jump (see update_stacks_with_operator_)
+    //
+    if ( operand_types_.size() < 2U || !convert_operand_( 0U, OPERAND_TYPE_DOUBLE ) ) {
+      return false;
+    }
+    nargs = 2U;
+
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_ASSIGN ) {
+
+    // The value is converted to the type of the variable assigned to
+    //
+    if ( operand_types_.size() < 2U ) {
+      return false;
+    }
+
+    result_type = (operand_types_.rbegin() + 1U)->type;
+    if ( !convert_operand_( 0U, result_type ) ) {
+      return false;
+    }
+
+    if ( result_type == OPERAND_TYPE_INT32 ) {
+      instruction.id = INSTRUCTION_ID_TYPE_ASSIGN_I32;
+    }
+    nargs = 2U;
+
+  }
+
+  if ( operand_types_.size() < nargs ) {
+    return false;
+  }
+  operand_types_.resize( operand_types_.size() - nargs );
+  operand_types_.push_back( operand_info_type{ result_type, NO_LITERAL } );
+
+  statements_.emplace_back( instruction );
+
+  return true;
+}
+
+
+// If the expression just parsed (for a return statement) is nothing but
+//  a call to a function taking the same arguments, and returning the same
+//  type, as the current one, replace the call with a tail call: the
+//  arguments are stored over the current function's own, and the callee
+//  reuses the current frame, returning straight to our caller. Returns
+//  false (having emitted nothing) if this is not such a call
+//
+bool parser_type::emit_tail_call_()
+{
+  const call_site_type          call     = last_call_;
+  const symbol_table_data_type &function = current_fn_iter_->second;
+
+  if ( !call.function
+    || call.end != statements_.size()
+    || operand_types_.size() != 1U
+    || call.function->fn_nargs   != function.fn_nargs
+    || call.function->value_type != function.value_type ) {
+    return false;
+  }
+
+  // The argument stores (and any conversions before them) are kept, but
+  //  retargeted from the callee's new frame to the current one. The
+  //  arguments are all on the e-stack before the first store, so none
+  //  of them is overwritten before it has been read
+  //
+  std::vector<instruction_type> stores( statements_.begin() + call.begin + 1U, statements_.begin() + call.args_end );
+  statements_.erase( statements_.begin() + call.begin, statements_.end() );
+
+  for ( auto &store : stores ) {
+    if ( store.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET
+      || store.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 ) {
+      store.arg.i32 -= static_cast<int32_t>( call.args_base ) + 16;
+    }
+    statements_.push_back( store );
+  }
+
+  statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_TAILCALL ) );
+  statements_.back().arg.sz = call.entry;
+  statements_.back().arg2   = static_cast<int32_t>( call.function->fn_index );
+
+  last_call_ = call_site_type();
+
+  return true;
+}
+
+
+// Emit the instruction to copy a variable's value onto the e-stack
+//
+void parser_type::emit_load_( const symbol_table_data_type &variable )
+{
+  bool is_int = ( variable.value_type == OPERAND_TYPE_INT32 );
+
+  if ( !(variable.is_abs) ) {
+    statements_.emplace_back( instruction_type( is_int ? INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32 : INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) );
+    statements_.back().arg.i32    = variable.sfb_offset;
+  }
+  else {
+    statements_.emplace_back( instruction_type( is_int ? INSTRUCTION_ID_TYPE_COPYFROMADDR_I32 : INSTRUCTION_ID_TYPE_COPYFROMADDR ) );
+    statements_.back().arg.sz   = variable.addr;
+  }
+
+  operand_types_.push_back( operand_info_type{ variable.value_type, NO_LITERAL } );
+}
+
+
 // TODO. need to add symbol_table_ as a parameter?
 
 bool parser_type::statement_parser_( const token_type &last_token )
@@ -185,6 +492,7 @@ bool parser_type::statement_parser_( const token_type &last_token )
       // TODO. can we merge this with operand-expected?
       //
       case PARSE_MODE_START:
+        operand_types_.clear();
         parse_mode_ = PARSE_MODE_OPERAND_EXPECTED;
         reprocess   = true;
         break;
@@ -215,14 +523,7 @@ bool parser_type::statement_parser_( const token_type &last_token )
                   //  to copy the value (from either the stack
                   //  offset or the global offset) onto the e-stack
                   //
-                  if ( !(iter->second.is_abs) ) {
-                    statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) );
-                    statements_.back().arg.i32    = iter->second.sfb_offset;
-                  }
-                  else {
-                    statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYFROMADDR ) );
-                    statements_.back().arg.sz   = iter->second.addr;
-                  }
+                  emit_load_( iter->second );
 
                   // Next pass, we will be expecting an operator
                   //
@@ -272,6 +573,9 @@ bool parser_type::statement_parser_( const token_type &last_token )
             //
 
             statements_.emplace_back( std::atof( last_token.text.c_str() ) );
+            operand_types_.push_back( operand_info_type{
+                                        OPERAND_TYPE_DOUBLE
+                                       ,is_int32_literal( last_token.text ) ? statements_.size() - 1U : NO_LITERAL } );
             parse_mode_ = PARSE_MODE_OPERATOR_EXPECTED;
 
           }
@@ -379,7 +683,8 @@ bool parser_type::statement_parser_( const token_type &last_token )
                 parse_mode_ = PARSE_MODE_ERROR;
 
               }
-              else if ( statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) {
+              else if ( statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET
+                     || statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32 ) {
 
                 // NOTE: statements_.back().arg.i32 is assumed to have been set already.
                 // convert most-recently emitted instruction into a "push i32 onto e-stack"
@@ -393,7 +698,8 @@ bool parser_type::statement_parser_( const token_type &last_token )
                 statements_.back().arg.i32 = 0;
 
               }
-              else if ( statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMADDR ) {
+              else if ( statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMADDR
+                     || statements_.back().id == INSTRUCTION_ID_TYPE_COPYFROMADDR_I32 ) {
 
                 // NOTE: statements_.back().arg.sz is assumed to have been set already.
                 // convert most-recently emitted instruction into a "push sz onto e-stack"
@@ -602,35 +908,56 @@ bool parser_type::update_stacks_with_operator_(
           stack_space += (operator_stack_.back().symbol_data->fn_nargs * 8U);
         }
 
+        // ... plus any padding needed to align the return value (int
+        //  variables may have left the stack 4-byte aligned)
+        //
+        size_t padding = padding_for( current_offset_from_stack_frame_base_.back(), 8U );
+        stack_space += padding;
+
         // Emit instruction to reserve enough d-stack space for this function's
         //  return value (if any) + args (if any)
         //
-        size_t ret_val_offset = current_offset_from_stack_frame_base_.back();
+        size_t ret_val_offset = current_offset_from_stack_frame_base_.back() + padding;
+        call_site_type call;
+        call.begin = statements_.size();
         statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) );
         statements_.back().arg.i32  = stack_space;
 
         // And keep track of where we will be wrt the d-stack frame base
         //
         current_offset_from_stack_frame_base_.back() += stack_space;
+        call.args_base = current_offset_from_stack_frame_base_.back();
 
         // Emit instructions to transfer any args from e-stack to d-stack. These
         // are the function's arguments, passed in by the caller
         //
-        if ( operator_stack_.back().symbol_data->fn_nargs > 0U ) {
+        // The last argument is on the top of the e-stack; each is converted
+        //  to the type of its parameter first
+        //
+        const symbol_table_data_type *function = operator_stack_.back().symbol_data;
+        if ( function->fn_nargs > 0U ) {
           int32_t offset = -8;
-          for ( size_t i=0U; i<operator_stack_.back().symbol_data->fn_nargs; ++i, offset -= 8 ) {
+          for ( size_t i=0U; i<function->fn_nargs; ++i, offset -= 8 ) {
+            operand_type arg_type = function->fn_arg_types[ function->fn_nargs - 1U - i ];
+            if ( !convert_operand_( 0U, arg_type ) ) {
+              return false;
+            }
+
             // emit instruction to copy from e-stack to d-stack
             //
-            statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
+            statements_.emplace_back( instruction_type( ( arg_type == OPERAND_TYPE_INT32 ) ? INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 : INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
             statements_.back().arg.i32    = current_offset_from_stack_frame_base_.back() + offset;
 
             // emit instruction to pop top-most e-stack value
             //
             statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_POP ) );
             statements_.back().arg.sz  = 1U;
+            operand_types_.pop_back();
           }
         }
 
+        call.args_end = statements_.size();
+
         // debug: print out stack
         //
         statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK ) );
@@ -639,25 +966,35 @@ bool parser_type::update_stacks_with_operator_(
         //
         statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_CALL ) );
         statements_.back().arg.sz   = operator_stack_.back().arg.sz;
+        statements_.back().arg2     = static_cast<int32_t>( function->fn_index );
+        call.entry = operator_stack_.back().arg.sz;
+
+        // emit instruction to copy return value from d-stack to e-stack (as applicable)
+        //
+        if ( function_return_size ) {
+          statements_.emplace_back( instruction_type( ( function->value_type == OPERAND_TYPE_INT32 ) ? INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32 : INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) );
+          statements_.back().arg.i32    = ret_val_offset;
+          operand_types_.push_back( operand_info_type{ function->value_type, NO_LITERAL } );
+        }
 
         // emit instructions that will be executed when the function is
-        //  finished. this will do the appropriate cleanup of the d-stack
+        //  finished. this will do the appropriate cleanup of the d-stack:
+        //  both the args and the return value slot are released, so that
+        //  the d-stack is back where it was before the call
         //
-        if ( operator_stack_.back().symbol_data->fn_nargs > 0U ) {
+        if ( stack_space > 0U ) {
           statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) );
-          statements_.back().arg.i32  = operator_stack_.back().symbol_data->fn_nargs * -8;
+          statements_.back().arg.i32  = -static_cast<int32_t>( stack_space );
         }
+        current_offset_from_stack_frame_base_.back() -= stack_space;
 
         // debug: print out stack
         //
         statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK ) );
 
-        // emit instruction to copy return value from d-stack to e-stack (as applicable)
-        //
-        if ( function_return_size ) {
-          statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) );
-          statements_.back().arg.i32    = ret_val_offset;
-        }
+        call.end      = statements_.size();
+        call.function = function;
+        last_call_    = call;
 
       }
       else {
@@ -665,7 +1002,9 @@ bool parser_type::update_stacks_with_operator_(
         //  into the instructions
         //
 
-        statements_.emplace_back( operator_stack_.back() );
+        if ( !emit_operator_( operator_stack_.back() ) ) {
+          return false;
+        }
 
       }
 
@@ -705,6 +1044,15 @@ bool parser_type::update_stacks_with_operator_(
       //  store the location of the associated JEQZ/JNEZ. This is faster than
       //  searching backwards at the time the && or || is emitted as an instruction
       //
+      // The jump tests the left-hand side as a double, which is also what
+      //  is left on the e-stack if it is taken
+      //
+      if ( instruction_id == INSTRUCTION_ID_TYPE_AND || instruction_id == INSTRUCTION_ID_TYPE_OR ) {
+        if ( !convert_operand_( 0U, OPERAND_TYPE_DOUBLE ) ) {
+          return false;
+        }
+      }
+
       if ( instruction_id == INSTRUCTION_ID_TYPE_AND ) {
         statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_JEQZ ) );
         operator_stack_.back().linked_idx = statements_.size() - 1U;
@@ -722,6 +1070,54 @@ bool parser_type::update_stacks_with_operator_(
 }
 
 
+bool parser_type::declare_global( const std::string &name, operand_type type )
+{
+  if ( ( char_no_ != 0U ) || name.empty() || is_keyword( name ) ) {
+    return false;
+  }
+  if ( !std::isalpha( static_cast<unsigned char>( name[0] ) ) && ( name[0] != '_' ) ) {
+    return false;
+  }
+  for ( char c : name ) {
+    if ( !std::isalnum( static_cast<unsigned char>( c ) ) && ( c != '_' ) ) {
+      return false;
+    }
+  }
+  if ( symbol_table_.front().find( name ) != symbol_table_.front().end() ) {
+    return false;
+  }
+
+  // Laid out as a declaration would be, but with no instruction to
+  //  reserve the space; the program expects it to be there already
+  //
+  size_t variable_size = size_of_type( type );
+  size_t padding       = padding_for( new_variable_index_.front(), variable_size );
+
+  current_new_var_idx_.front() = new_variable_index_.front() + padding;
+  new_variable_index_.front() += padding + variable_size;
+  current_offset_from_stack_frame_base_.front() += padding + variable_size;
+
+  symbol_table_data_type new_variable;
+  new_variable.is_abs     = true;
+  new_variable.addr       = current_new_var_idx_.front();
+  new_variable.type       = SYMBOL_TYPE_VARIABLE;
+  new_variable.value_type = type;
+  symbol_table_.front().insert( std::make_pair( name, new_variable ) );
+
+  return true;
+}
+
+
+const symbol_table_data_type *parser_type::find_global( const std::string &name ) const
+{
+  auto iter = symbol_table_.front().find( name );
+  if ( iter == symbol_table_.front().end() ) {
+    return nullptr;
+  }
+  return &( iter->second );
+}
+
+
 bool parser_type::parse_char( char c )
 {
   ++char_no_;
@@ -1229,6 +1625,13 @@ bool parser_type::parse_char( char c )
   }
 
 
+  if ( lex_only_ ) {
+    tokens_lexed_ += tokens_.size();
+    tokens_.clear();
+    return true;
+  }
+
+
   // Stage 2: Grammar
   //
   if ( tokens_.size() > tokens_parsed_ ) {
@@ -1275,7 +1678,7 @@ bool parser_type::parse_char( char c )
             //  fn double x() {}
             //  fn int y() {}
             //
-            else if ( std::strcmp( "double", last_token.text.c_str() ) == 0 ) {
+            else if ( type_of_keyword( last_token.text, &new_variable_type_ ) ) {
 
               grammar_state_.back().mode = GRAMMAR_MODE_DEFINE_VARIABLE;
 
@@ -1313,7 +1716,6 @@ bool parser_type::parse_char( char c )
               grammar_state_.back().mode        = GRAMMAR_MODE_STATEMENT;
 
             }
-            // TODO. add int?
             else {
 
               grammar_state_.back().mode = GRAMMAR_MODE_STATEMENT;
@@ -1475,22 +1877,25 @@ bool parser_type::parse_char( char c )
             }
             // TODO. add warning if this shadows another symbol?
 
-            // TODO. always add doubles on 8-byte boundary,
-            // always add int32's on 4-byte boundary
+            // Doubles are placed on an 8-byte boundary, int32's
+            //  on a 4-byte boundary
             //
-            current_new_var_idx_.back() = new_variable_index_.back();
-            new_variable_index_.back() += 8U; // size of double
+            size_t variable_size = size_of_type( new_variable_type_ );
+            size_t padding       = padding_for( new_variable_index_.back(), variable_size );
+
+            current_new_var_idx_.back() = new_variable_index_.back() + padding;
+            new_variable_index_.back() += padding + variable_size;
 
             // Emit instruction to adjust the stack for the space
             //  allocated for this variable
             //
             statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) );
-            statements_.back().arg.i32  = 8; // size of double
+            statements_.back().arg.i32  = static_cast<int32_t>( padding + variable_size );
 
             // Track where we will be, relative to the base of the
             //  stack frame
             //
-            current_offset_from_stack_frame_base_.back() += 8U;
+            current_offset_from_stack_frame_base_.back() += padding + variable_size;
 
             // Add this variable to the current scope's
             //  symbol table
@@ -1504,6 +1909,7 @@ bool parser_type::parse_char( char c )
               new_variable.sfb_offset  = current_new_var_idx_.back();
             }
             new_variable.type        = SYMBOL_TYPE_VARIABLE;
+            new_variable.value_type  = new_variable_type_;
             // TODO. more efficient insert, using find_lower_bound
             symbol_table_.back().insert( std::make_pair( last_token.text, new_variable ) );
             grammar_state_.back().mode = GRAMMAR_MODE_CHECK_FOR_ASSIGN;
@@ -1553,13 +1959,15 @@ bool parser_type::parse_char( char c )
             //  worked on
             //
 
-            if ( !statement_parser_finalize_() ) {
+            if ( !statement_parser_finalize_() || !convert_operand_( 0U, new_variable_type_ ) ) {
 
               grammar_state_.back().mode = GRAMMAR_MODE_ERROR;
 
             }
             else {
 
+              bool is_int = ( new_variable_type_ == OPERAND_TYPE_INT32 );
+
               // distinguish between copy-to-absolute (for globals)
               //  vs copy-to-stack (for stack-local). Emit the
               //  appropriate instruction for the relevant case
@@ -1570,11 +1978,11 @@ bool parser_type::parse_char( char c )
               //  that doesn't involve it going into the symbol table
               //
               if ( symbol_table_.size() == 1 ) {
-                statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYTOADDR ) );
+                statements_.emplace_back( instruction_type( is_int ? INSTRUCTION_ID_TYPE_COPYTOADDR_I32 : INSTRUCTION_ID_TYPE_COPYTOADDR ) );
                 statements_.back().arg.sz   = current_new_var_idx_.back();
               }
               else {
-                statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
+                statements_.emplace_back( instruction_type( is_int ? INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 : INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
                 statements_.back().arg.i32    = current_new_var_idx_.back();
               }
 
@@ -1636,7 +2044,7 @@ bool parser_type::parse_char( char c )
               break;
             }
 
-            if ( !statement_parser_finalize_() ) {
+            if ( !statement_parser_finalize_() || !convert_operand_( 0U, OPERAND_TYPE_DOUBLE ) ) {
               std::cerr << "ERROR(1): parse error on character " << c << "\n";
               grammar_state_.back().mode = GRAMMAR_MODE_ERROR;
               break;
@@ -1683,25 +2091,39 @@ bool parser_type::parse_char( char c )
             }
 
             if ( grammar_state_.back().return_mode ) {
-              // For non-void functions ..
+              // return f(...) is a tail call, if possible; otherwise ...
               //
-              if ( function_parse_state_.back().return_size ) {
-                // copy top estack value into return location ..
+              if ( !emit_tail_call_() ) {
+
+                // For non-void functions ..
                 //
-                // NOTE: 8 for return contents (if any), 8 for return address, 8 for old stack frame addr -> 24
-                int32_t offset = -(16 + static_cast<int>(function_parse_state_.back().return_size)); // TODO. size_t -> negative int!
-                offset -= (current_fn_iter_->second.fn_nargs * 8);
-                statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
-                statements_.back().arg.i32    = offset;
-                // .. and pop top estack value
+                if ( function_parse_state_.back().return_size ) {
+                  // convert the value to the return type ..
+                  //
+                  operand_type return_type = function_parse_state_.back().return_type;
+                  if ( !convert_operand_( 0U, return_type ) ) {
+                    std::cerr << "ERROR(3): parse error on character " << c << "\n";
+                    return false;
+                  }
+
+                  // copy top estack value into return location ..
+                  //
+                  // NOTE: 8 for return contents (if any), 8 for return address, 8 for old stack frame addr -> 24
+                  int32_t offset = -(16 + static_cast<int>(function_parse_state_.back().return_size)); // TODO. size_t -> negative int!
+                  offset -= (current_fn_iter_->second.fn_nargs * 8);
+                  statements_.emplace_back( instruction_type( ( return_type == OPERAND_TYPE_INT32 ) ? INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 : INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ) );
+                  statements_.back().arg.i32    = offset;
+                  // .. and pop top estack value
+                  //
+                  statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_POP ) );
+                  statements_.back().arg.sz  = 1U;
+                }
+
+                // return
                 //
-                statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_POP ) );
-                statements_.back().arg.sz  = 1U;
-              }
+                statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_RETURN ) );
 
-              // return
-              //
-              statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_RETURN ) );
+              }
 
               grammar_state_.back().return_mode      = false;
               // from this point on, any code encountered is unreachable,
@@ -1915,7 +2337,7 @@ bool parser_type::parse_char( char c )
             bool fn_type_found = false;
 
             if ( last_token.id == TOKEN_ID_TYPE_NAME ) {
-              if ( std::strcmp( "double", last_token.text.c_str() ) == 0 ) {
+              if ( type_of_keyword( last_token.text, &new_variable_type_ ) ) {
                 grammar_state_.back().mode = GRAMMAR_MODE_EXPECT_FUNCTION_NAME;
                 fn_type_found = true;
               }
@@ -1951,7 +2373,11 @@ bool parser_type::parse_char( char c )
               new_function.addr        = statements_.size();
               new_function.type        = SYMBOL_TYPE_FUNCTION;
               new_function.fn_nargs    = 0U;
-              new_function.fn_ret_size = 8U; // TODO. allow int, void returns
+              new_function.fn_ret_size = 8U; // TODO. allow void returns
+              new_function.value_type  = new_variable_type_;
+              new_function.name        = last_token.text;
+              new_function.fn_index    = function_names_.size();
+              function_names_.push_back( last_token.text );
               // TODO. more efficient insert, using find_lower_bound
               auto rv = symbol_table_.back().insert( std::make_pair( last_token.text, new_function ) );
               current_fn_iter_ = rv.first;
@@ -1989,7 +2415,7 @@ bool parser_type::parse_char( char c )
             else {
               bool arg_type_found = false;
               if ( last_token.id == TOKEN_ID_TYPE_NAME ) {
-                if ( std::strcmp( "double", last_token.text.c_str() ) == 0 ) {
+                if ( type_of_keyword( last_token.text, &new_variable_type_ ) ) {
                   grammar_state_.back().mode = GRAMMAR_MODE_EXPECT_FUNCTION_ARG_NAME;
                   arg_type_found = true;
                 }
@@ -2017,16 +2443,20 @@ bool parser_type::parse_char( char c )
                 grammar_state_.back().mode = GRAMMAR_MODE_ERROR;
                 break;
               }
+              // NOTE: every argument takes an 8-byte slot
+              //
               current_new_var_idx_.back() = new_variable_index_.back();
-              new_variable_index_.back() += 8U; // size of double
+              new_variable_index_.back() += 8U;
               
               symbol_table_data_type new_variable;
               new_variable.sfb_offset = current_new_var_idx_.back();
               new_variable.type       = SYMBOL_TYPE_VARIABLE;
+              new_variable.value_type = new_variable_type_;
               // TODO. more efficient insert, using find_lower_bound
               symbol_table_.back().insert( std::make_pair( last_token.text, new_variable ) );
 
               ++(current_fn_iter_->second.fn_nargs);
+              current_fn_iter_->second.fn_arg_types.push_back( new_variable_type_ );
               grammar_state_.back().mode = GRAMMAR_MODE_FUNCTION_ARG_END;
             }
             else {
@@ -2058,6 +2488,11 @@ bool parser_type::parse_char( char c )
                     ; ++iter ) {
               iter->second.sfb_offset -= (16 + (current_fn_iter_->second.fn_nargs) * 8);
             }
+
+            // The arguments are below the stack frame base; locals
+            //  start at the base itself
+            //
+            new_variable_index_.back() = 0U;
           
             if ( last_token.id == TOKEN_ID_TYPE_LCURLY_BRACE ) {
               grammar_state_.back().mode = GRAMMAR_MODE_DEFINE_FUNCTION_BODY;
@@ -2065,6 +2500,7 @@ bool parser_type::parse_char( char c )
               ++curly_braces_;
 
               function_parse_state_.emplace_back( function_parse_state_type() );
+              function_parse_state_.back().return_type = current_fn_iter_->second.value_type;
               
               statements_.emplace_back( instruction_type( INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK ) );
 
@@ -2137,51 +2573,83 @@ bool parser_type::parse_char( char c )
 }
 
 
+const char *instruction_name( instruction_id_type id )
+{
+  return operator_data[ id ].text;
+}
+
+
+void print_statement( size_t i, const instruction_type &instruction )
+{
+  if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
+    std::cout << i << ": push-double " << instruction.arg.d << "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
+    std::cout << i << ": push-int32 " << instruction.arg.i32 << "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_POP ) {
+    std::cout << i << ": pop " << instruction.arg.sz << "\n";
+  }
+  else if ( instruction.id >= INSTRUCTION_ID_TYPE_JNEZ &&
+            instruction.id <= INSTRUCTION_ID_TYPE_JMP ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.i32 <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOADDR ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYFROMADDR ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYTOADDR_I32 ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYFROMADDR_I32 ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.sz <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32 ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32 ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.i32 <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHSIZET ||
+            instruction.id == INSTRUCTION_ID_TYPE_TAILCALL ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.sz <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ||
+            instruction.id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP ||
+            instruction.id == INSTRUCTION_ID_TYPE_I2D ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.i32 <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.i32 << " " << instruction.arg2 <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ ||
+            instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.d << " " << instruction.arg2 <<
+      "\n";
+  }
+  else if ( instruction.id == INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD ) {
+    std::cout << i << ": " << operator_data[ instruction.id ].text <<
+      " " << instruction.arg.d <<
+      "\n";
+  }
+  else {
+    std::cout << i << ": " << operator_data[ instruction.id ].text << "\n";
+  }
+}
+
+
 void print_statements( const std::vector<instruction_type> &statement )
 {
-  size_t i = 0U;
-  for ( std::vector<instruction_type>::const_iterator iter( statement.begin() )
-          ; iter != statement.end()
-          ; ++iter, ++i ) {
-    if ( iter->id == INSTRUCTION_ID_TYPE_PUSHDOUBLE ) {
-      std::cout << i << ": push-double " << iter->arg.d << "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_PUSHINT32 ) {
-      std::cout << i << ": push-int32 " << iter->arg.i32 << "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_POP ) {
-      std::cout << i << ": pop " << iter->arg.sz << "\n";
-    }
-    else if ( iter->id >= INSTRUCTION_ID_TYPE_JNEZ &&
-              iter->id <= INSTRUCTION_ID_TYPE_JMP ) {
-      std::cout << i << ": " << operator_data[ iter->id ].text <<
-        " " << iter->arg.i32 <<
-        "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_COPYTOADDR ||
-              iter->id == INSTRUCTION_ID_TYPE_COPYFROMADDR ) {
-      std::cout << i << ": " << operator_data[ iter->id ].text <<
-        " " << iter->arg.sz <<
-        "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET ||
-              iter->id == INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET ) {
-      std::cout << i << ": " << operator_data[ iter->id ].text <<
-        " " << iter->arg.i32 <<
-        "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_PUSHSIZET ) {
-      std::cout << i << ": " << operator_data[ iter->id ].text <<
-        " " << iter->arg.sz <<
-        "\n";
-    }
-    else if ( iter->id == INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK ) {
-      std::cout << i << ": " << operator_data[ iter->id ].text <<
-        " " << iter->arg.i32 <<
-        "\n";
-    }
-    else {
-      std::cout << i << ": " << operator_data[ iter->id ].text << "\n";
-    }
+  for ( size_t i = 0U; i < statement.size(); ++i ) {
+    print_statement( i, statement[i] );
   }
 }
@@ -43,25 +43,56 @@ class parser_type {
       ,tokens_{}
       ,grammar_state_{ grammar_state_type( GRAMMAR_MODE_STATEMENT_START, curly_braces_, false ) }
       ,function_parse_state_{}
+      ,function_names_{}
       ,symbol_table_( 1U )
       ,current_new_var_idx_{ 0U }
       ,new_variable_index_{ 0U }
       ,current_offset_from_stack_frame_base_{ 0U }
+      ,operand_types_{}
+      ,last_call_{}
+      ,new_variable_type_{ OPERAND_TYPE_DOUBLE }
       ,char_no_{}
       ,curly_braces_{}
       ,line_no_{}
       ,tokens_parsed_{}
+      ,tokens_lexed_{}
+      ,lex_only_{ false }
       ,lex_mode_{ LEX_MODE_START }
       ,parse_mode_{ PARSE_MODE_START }
     {
     }
 
+    // Declare a global variable before any input is parsed. Its space is
+    //  not reserved by the program (the first data_size() bytes of the
+    //  d-stack, as of the last declare_global(), must be set up before
+    //  evaluation), so it can be used to pass values in. Returns false if
+    //  name is not a valid, new variable name, or parsing has started
+    //
+    bool declare_global( const std::string &name, operand_type type );
+
+    // Global variable or function, or null if there is none called name
+    //
+    const symbol_table_data_type *find_global( const std::string &name ) const;
+
     bool parse_char( char c );
 
+    // Tokenize only: tokens are counted (see tokens_lexed()) and dropped,
+    //  and no statements are produced. For timing the lexer on its own
+    //  (see bench/bench.cpp); set before any input is parsed
+    //
+    void set_lex_only( bool lex_only ) { lex_only_ = lex_only; }
+
+    size_t tokens_lexed() const { return tokens_lexed_; }
+
     size_t data_size() { return new_variable_index_.front(); }
 
     const std::vector<instruction_type> &statements() { return statements_; }
 
+    // Names of the functions defined, by the index that CALL and TAILCALL
+    //  carry in arg2 (pass them to program_type to keep them)
+    //
+    const std::vector<std::string> &function_names() const { return function_names_; }
+
   
   private:
 
@@ -196,8 +227,9 @@ class parser_type {
 
 
     struct function_parse_state_type {
-      size_t return_size{ 8U };
-      bool   code_path_inactive{};
+      size_t       return_size{ 8U };
+      operand_type return_type{ OPERAND_TYPE_DOUBLE };
+      bool         code_path_inactive{};
     };
 
   
@@ -218,6 +250,32 @@ class parser_type {
 
 
   
+    // The static type of an operand on the e-stack, while an expression
+    //  is being parsed. An integer literal is emitted as a double, but
+    //  remembers where it was emitted (literal_idx), so that it can be
+    //  turned into an int32 if it meets an int32 operand
+    //
+    static const size_t NO_LITERAL = static_cast<size_t>( -1 );
+
+    struct operand_info_type {
+      operand_type type;
+      size_t       literal_idx;
+    };
+
+
+    // Where the most recent call to a user function was emitted, so that
+    //  "return f(...)" can be turned into a tail call
+    //
+    struct call_site_type {
+      size_t                        begin{};     // the MOVE-END-OF-STACK reserving the callee's frame
+      size_t                        args_end{};  // end of the argument stores
+      size_t                        end{};       // end of the whole call sequence
+      size_t                        args_base{}; // the stack frame offset the argument stores are relative to
+      size_t                        entry{};
+      const symbol_table_data_type *function{};
+    };
+
+
     enum parse_mode_type {
        PARSE_MODE_ERROR
       ,PARSE_MODE_START
@@ -229,6 +287,14 @@ class parser_type {
 
     bool anchor_jump_here_( size_t idx );
 
+    bool convert_operand_( size_t depth, operand_type to );
+
+    bool emit_operator_( const instruction_type &op );
+
+    bool emit_tail_call_();
+
+    void emit_load_( const symbol_table_data_type &variable );
+
     bool statement_parser_( const token_type &last_token );
 
     bool statement_parser_finalize_();
@@ -250,11 +316,15 @@ class parser_type {
     std::vector<token_type>                                    tokens_;
     std::vector<grammar_state_type>                            grammar_state_;
     std::vector<function_parse_state_type>                     function_parse_state_;
+    std::vector<std::string>                                   function_names_;
   
     std::deque<std::map<std::string,symbol_table_data_type>>   symbol_table_;
     std::vector<size_t>                                        current_new_var_idx_;
     std::vector<size_t>                                        new_variable_index_;
     std::vector<size_t>                                        current_offset_from_stack_frame_base_;
+    std::vector<operand_info_type>                             operand_types_;
+    call_site_type                                             last_call_;
+    operand_type                                               new_variable_type_;
 
     std::map<std::string,symbol_table_data_type>::iterator     current_fn_iter_;
 
@@ -262,10 +332,20 @@ class parser_type {
     size_t                                                     curly_braces_;
     size_t                                                     line_no_;
     size_t                                                     tokens_parsed_;
+    size_t                                                     tokens_lexed_;
+    bool                                                       lex_only_;
 
     lex_mode_type                                              lex_mode_;
     parse_mode_type                                            parse_mode_;
 };
 
 
+// Mnemonic name of an instruction, as used by print_statements()
+//
+const char *instruction_name( instruction_id_type id );
+
+// One line of print_statements(): instruction i, with its arguments
+//
+void print_statement( size_t i, const instruction_type &instruction );
+
 void print_statements( const std::vector<instruction_type> &statement );
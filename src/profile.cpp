@@ -0,0 +1,118 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "parser_type.h"
+#include "profile.h"
+
+
+namespace {
+
+  struct profile_entry_type {
+    size_t   key;    // instruction_id_type, or instruction index
+    size_t   count;
+    uint64_t cycles;
+  };
+
+
+  void sort_hottest( std::vector<profile_entry_type> &entries )
+  {
+    std::sort( entries.begin(), entries.end(), []( const profile_entry_type &lhs, const profile_entry_type &rhs ) {
+      return lhs.cycles > rhs.cycles || ( lhs.cycles == rhs.cycles && lhs.key < rhs.key );
+    } );
+  }
+
+
+  double percent_of( uint64_t part, uint64_t total )
+  {
+    return ( total == 0U ) ? 0.0 : 100.0 * static_cast<double>( part ) / static_cast<double>( total );
+  }
+
+}
+
+
+void print_profile(
+                   const std::vector<instruction_type> &instructions
+                  ,const std::vector<size_t>           &execution_counts
+                  ,const std::vector<uint64_t>         &execution_cycles
+                  ,size_t                               top
+                  )
+{
+  const size_t size = std::min( instructions.size(), std::min( execution_counts.size(), execution_cycles.size() ) );
+
+  std::vector<profile_entry_type> by_type( INSTRUCTION_ID_TYPE_ASSIGN + 1 );
+  std::vector<profile_entry_type> by_index;
+  uint64_t                        total_cycles = 0U;
+  size_t                          total_count  = 0U;
+
+  for ( size_t id = 0U; id < by_type.size(); ++id ) {
+    by_type[id] = profile_entry_type{ id, 0U, 0U };
+  }
+
+  for ( size_t i = 0U; i < size; ++i ) {
+    if ( execution_counts[i] == 0U ) {
+      continue;
+    }
+    profile_entry_type &type = by_type[ instructions[i].id ];
+    type.count  += execution_counts[i];
+    type.cycles += execution_cycles[i];
+    by_index.push_back( profile_entry_type{ i, execution_counts[i], execution_cycles[i] } );
+
+    total_count  += execution_counts[i];
+    total_cycles += execution_cycles[i];
+  }
+
+  by_type.erase( std::remove_if( by_type.begin(), by_type.end(), []( const profile_entry_type &entry ) {
+    return entry.count == 0U;
+  } ), by_type.end() );
+  sort_hottest( by_type );
+  sort_hottest( by_index );
+
+  const char *unit = profile_clock_unit();
+
+  std::cout << "profile: " << total_count << " instructions, " << total_cycles << " " << unit << "\n";
+
+  std::cout << "by instruction type:\n";
+  std::cout << "  " << std::setw( 14 ) << unit << std::setw( 8 ) << "%" << std::setw( 14 ) << "count" << std::setw( 10 ) << "per exec" << "  instruction\n";
+  for ( const profile_entry_type &entry : by_type ) {
+    std::cout << "  " << std::setw( 14 ) << entry.cycles
+              << std::setw( 8 ) << std::fixed << std::setprecision( 2 ) << percent_of( entry.cycles, total_cycles )
+              << std::setw( 14 ) << entry.count
+              << std::setw( 10 ) << std::setprecision( 1 ) << static_cast<double>( entry.cycles ) / static_cast<double>( entry.count )
+              << std::defaultfloat << std::setprecision( 6 )
+              << "  " << instruction_name( static_cast<instruction_id_type>( entry.key ) ) << "\n";
+  }
+
+  std::cout << "hottest instructions:\n";
+  std::cout << "  " << std::setw( 14 ) << unit << std::setw( 8 ) << "%" << std::setw( 14 ) << "count" << "  instruction\n";
+  for ( size_t k = 0U; k < by_index.size() && k < top; ++k ) {
+    const profile_entry_type &entry = by_index[k];
+    std::cout << "  " << std::setw( 14 ) << entry.cycles
+              << std::setw( 8 ) << std::fixed << std::setprecision( 2 ) << percent_of( entry.cycles, total_cycles )
+              << std::defaultfloat << std::setprecision( 6 )
+              << std::setw( 14 ) << entry.count << "  ";
+    print_statement( entry.key, instructions[ entry.key ] );
+  }
+}
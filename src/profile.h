@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "instruction_type.h"
+
+#if defined(_MSC_VER) && ( defined(_M_X64) || defined(_M_IX86) )
+#include <intrin.h>
+#define SINTERP_PROFILE_RDTSC 1
+#elif ( defined(__GNUC__) || defined(__clang__) ) && ( defined(__x86_64__) || defined(__i386__) )
+#include <x86intrin.h>
+#define SINTERP_PROFILE_RDTSC 1
+#else
+#include <chrono>
+#define SINTERP_PROFILE_RDTSC 0
+#endif
+
+
+// Clock for the profiling (COUNT) policy: the time-stamp counter where
+//  there is one, otherwise steady_clock nanoseconds. Reading it costs a
+//  few tens of cycles, which every instruction's time includes
+//
+inline uint64_t profile_clock()
+{
+#if SINTERP_PROFILE_RDTSC
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+}
+
+// Name of a profile_clock() tick, for reports
+//
+inline const char *profile_clock_unit()
+{
+  return SINTERP_PROFILE_RDTSC ? "cycles" : "ns";
+}
+
+
+// Print, from the execution counts and times of each instruction (see
+//  evaluate_options_type), the time per instruction type, hottest first,
+//  and the top hottest instructions, as print_statements() shows them
+//
+void print_profile(
+                   const std::vector<instruction_type> &instructions
+                  ,const std::vector<size_t>           &execution_counts
+                  ,const std::vector<uint64_t>         &execution_cycles
+                  ,size_t                               top
+                  );
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "data_stack_type.h"
+#include "instruction_type.h"
+#include "operand_data_type.h"
+#include "result_sink.h"
+#include "sampler.h"
+
+
+// A compiled program: the instructions, copied out of the parser, with
+//  nothing that refers back to it (symbol table pointers are dropped).
+//  Given the parser's function_names(), it also keeps the name of each
+//  function called, by entry point, for profiles.
+//  A program cannot be changed once built, so any number of threads can
+//  evaluate it at the same time, each with its own vm_context_type
+//
+class program_type {
+
+  public:
+    explicit program_type(
+                          const std::vector<instruction_type> &instructions
+                         ,const std::vector<std::string>      &function_names = std::vector<std::string>()
+                         )
+      :instructions_( instructions )
+    {
+      for ( instruction_type &instruction : instructions_ ) {
+        if ( ( instruction.id == INSTRUCTION_ID_TYPE_CALL || instruction.id == INSTRUCTION_ID_TYPE_TAILCALL )
+          && instruction.arg2 >= 0 && static_cast<size_t>( instruction.arg2 ) < function_names.size() ) {
+          function_names_[ instruction.arg.sz ] = function_names[ instruction.arg2 ];
+        }
+        instruction.symbol_data = nullptr;
+        instruction.linked_idx  = 0U;
+      }
+    }
+
+    const std::vector<instruction_type> &instructions() const { return instructions_; }
+
+    size_t size() const { return instructions_.size(); }
+
+    // Name of the function at entry, or null if it is not known
+    //
+    const std::string *function_name( size_t entry ) const
+    {
+      auto iter = function_names_.find( entry );
+      return ( iter != function_names_.end() ) ? &(iter->second) : nullptr;
+    }
+
+  private:
+    std::vector<instruction_type> instructions_;
+    std::map<size_t,std::string>  function_names_;
+};
+
+
+// Everything that changes while a program runs: the d-stack, the
+//  e-stack, the registers (stack frame base, e-stack base, instruction
+//  index), where the debug trace is written, and where statement results
+//  go. By default results are printed to out, as the CLI prints them;
+//  results can be pointed at any sink, or null to drop them. If
+//  call_stack is set, calls and returns keep it up to date (for
+//  sampler_type). evaluate() starts from a reset context, and leaves the final
+//  state in it (so pc is where evaluation stopped, after an error).
+//
+// A context is used by one thread at a time; it can be reused for any
+//  number of evaluations
+//
+struct vm_context_type {
+
+  explicit vm_context_type(
+                           size_t        dstack_max = data_stack_type::DEFAULT_MAX_SIZE
+                          ,std::ostream &out        = std::cout
+                          )
+    :data( dstack_max )
+    ,evaluation_stack{}
+    ,evaluation_stack_base( 0U )
+    ,stack_frame_base( 0U )
+    ,pc( 0U )
+    ,out( &out )
+    ,stream_results( out )
+    ,results( &stream_results )
+    ,call_stack( nullptr )
+  {
+  }
+
+  vm_context_type( const vm_context_type & ) = delete;
+  vm_context_type &operator=( const vm_context_type & ) = delete;
+
+  void reset()
+  {
+    data.resize( 0U );
+    evaluation_stack.clear();
+    evaluation_stack_base = 0U;
+    stack_frame_base      = 0U;
+    pc                    = 0U;
+    if ( call_stack ) {
+      call_stack->clear();
+    }
+  }
+
+  data_stack_type                data;
+  std::vector<operand_data_type> evaluation_stack;
+  size_t                         evaluation_stack_base;
+  size_t                         stack_frame_base;
+  size_t                         pc;
+  std::ostream                  *out;
+  stream_result_sink_type        stream_results;
+  result_sink_type              *results;
+  call_stack_type               *call_stack;
+};
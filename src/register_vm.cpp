@@ -0,0 +1,979 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "register_vm.h"
+
+
+// Lowering
+//
+// The stack-machine instructions are walked in order, while keeping a
+// "symbolic" e-stack: rather than a value, each e-stack slot records
+// where its value can be found. Loads and constants are not copied
+// anywhere; they are simply recorded as the slot's operand, and used
+// in place by whichever instruction consumes them.
+//
+// Each e-stack slot i has a "home" register, ri. A slot's value is moved
+// to its home register ("materialized") only when it has to be:
+//
+//   - before a jump, and at a jump target, all slots must be in their
+//     home registers, so that every path into the target agrees on
+//     where the values are
+//   - before anything that writes memory (stores, calls, moving the
+//     end of the d-stack), slots that refer to memory are materialized,
+//     so they still read the value they had when pushed
+//
+// A slot's operand is always one of: its own home register, a constant,
+// an integer (only used by the assignment protocol; see below), or a
+// memory location. In particular, a slot never refers to another slot's
+// home register, so materializing slots never needs to be ordered.
+//
+// Assignment: the parser emits
+//   push addr/offset, push is-absolute, <value>, assign
+// The first two are compile-time constants, so they are tracked as
+// integers and the whole sequence becomes a single move.
+//
+
+
+namespace {
+
+  struct slot_type {
+    register_operand_type operand;
+    bool                  is_integer{};
+    int64_t               integer{};
+  };
+
+
+  bool operator==( const register_operand_type &lhs, const register_operand_type &rhs )
+  {
+    return lhs.base == rhs.base && lhs.offset == rhs.offset;
+  }
+
+
+  bool operator==( const slot_type &lhs, const slot_type &rhs )
+  {
+    if ( lhs.is_integer || rhs.is_integer ) {
+      return lhs.is_integer == rhs.is_integer && lhs.integer == rhs.integer;
+    }
+    return lhs.operand == rhs.operand;
+  }
+
+
+  class lowering_type {
+
+    public:
+      explicit lowering_type( register_program_type &program )
+        :program_( program )
+        ,stack_{}
+        ,constant_index_{}
+        ,last_def_{ SIZE_MAX }
+      {
+      }
+
+      bool lower( const std::vector<instruction_type> &instructions );
+
+    private:
+
+      register_operand_type home_( size_t slot ) const
+      {
+        register_operand_type rv;
+        rv.base   = REGISTER_BASE_TYPE_REGISTER;
+        rv.offset = static_cast<ptrdiff_t>( slot * sizeof( double ) );
+        return rv;
+      }
+
+      static bool is_memory_( const register_operand_type &operand )
+      {
+        return operand.base == REGISTER_BASE_TYPE_ABSOLUTE || operand.base == REGISTER_BASE_TYPE_FRAME;
+      }
+
+      register_operand_type constant_( double value );
+
+      void emit_( const register_instruction_type &instruction )
+      {
+        program_.instructions.push_back( instruction );
+        last_def_ = SIZE_MAX;
+      }
+
+      void push_( const register_operand_type &operand )
+      {
+        slot_type slot;
+        slot.operand = operand;
+        stack_.push_back( slot );
+        if ( stack_.size() + 1U > program_.window_size ) {
+          program_.window_size = stack_.size() + 1U;
+        }
+      }
+
+      void push_integer_( int64_t value )
+      {
+        push_( register_operand_type() );
+        stack_.back().is_integer = true;
+        stack_.back().integer    = value;
+      }
+
+      void materialize_( size_t slot );
+      bool materialize_for_jump_();
+      void materialize_memory_( size_t skip_from );
+
+      bool unary_( register_opcode_type opcode );
+      bool binary_( register_opcode_type opcode );
+      bool store_( const register_operand_type &dst );
+
+      register_program_type                   &program_;
+      std::vector<slot_type>                   stack_;
+      std::map<uint64_t,size_t>                constant_index_;
+      size_t                                   last_def_; // instruction that last defined the top slot's register
+  };
+
+
+  register_operand_type lowering_type::constant_( double value )
+  {
+    uint64_t bits;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+
+    auto iter = constant_index_.find( bits );
+    if ( iter == constant_index_.end() ) {
+      iter = constant_index_.insert( std::make_pair( bits, program_.constants.size() ) ).first;
+      program_.constants.push_back( value );
+    }
+
+    register_operand_type rv;
+    rv.base   = REGISTER_BASE_TYPE_CONSTANT;
+    rv.offset = static_cast<ptrdiff_t>( iter->second * sizeof( double ) );
+    return rv;
+  }
+
+
+  void lowering_type::materialize_( size_t slot )
+  {
+    if ( stack_[slot].is_integer || stack_[slot].operand == home_( slot ) ) {
+      return;
+    }
+
+    register_instruction_type mov;
+    mov.opcode = REGISTER_OPCODE_TYPE_MOV;
+    mov.dst    = home_( slot );
+    mov.a      = stack_[slot].operand;
+    emit_( mov );
+
+    stack_[slot].operand = home_( slot );
+  }
+
+
+  bool lowering_type::materialize_for_jump_()
+  {
+    for ( size_t i=0U; i<stack_.size(); ++i ) {
+      materialize_( i );
+    }
+    return true;
+  }
+
+
+  void lowering_type::materialize_memory_( size_t skip_from )
+  {
+    for ( size_t i=0U; i<stack_.size() && i<skip_from; ++i ) {
+      if ( !stack_[i].is_integer && is_memory_( stack_[i].operand ) ) {
+        materialize_( i );
+      }
+    }
+  }
+
+
+  bool lowering_type::unary_( register_opcode_type opcode )
+  {
+    if ( stack_.empty() || stack_.back().is_integer ) {
+      return false;
+    }
+
+    register_instruction_type instruction;
+    instruction.opcode = opcode;
+    instruction.dst    = home_( stack_.size() - 1U );
+    instruction.a      = stack_.back().operand;
+    emit_( instruction );
+
+    stack_.back().operand = instruction.dst;
+    last_def_             = program_.instructions.size() - 1U;
+    return true;
+  }
+
+
+  bool lowering_type::binary_( register_opcode_type opcode )
+  {
+    if ( stack_.size() < 2U || stack_.back().is_integer || (stack_.rbegin() + 1U)->is_integer ) {
+      return false;
+    }
+
+    register_instruction_type instruction;
+    instruction.opcode = opcode;
+    instruction.dst    = home_( stack_.size() - 2U );
+    instruction.a      = (stack_.rbegin() + 1U)->operand;
+    instruction.b      = stack_.back().operand;
+    emit_( instruction );
+
+    stack_.pop_back();
+    stack_.back().operand = instruction.dst;
+    last_def_             = program_.instructions.size() - 1U;
+    return true;
+  }
+
+
+  bool lowering_type::store_( const register_operand_type &dst )
+  {
+    // Store the top slot's value into dst. The value stays on the
+    // e-stack; afterwards, it is simply read back from dst
+    //
+    if ( stack_.empty() || stack_.back().is_integer ) {
+      return false;
+    }
+
+    size_t emitted = program_.instructions.size();
+    materialize_memory_( stack_.size() - 1U );
+
+    if ( last_def_ != SIZE_MAX
+      && emitted == program_.instructions.size()
+      && stack_.back().operand == home_( stack_.size() - 1U ) ) {
+      // The value was computed by the previous instruction; compute it
+      // straight into dst instead
+      //
+      program_.instructions[ last_def_ ].dst = dst;
+      last_def_ = SIZE_MAX;
+    }
+    else {
+      register_instruction_type mov;
+      mov.opcode = REGISTER_OPCODE_TYPE_MOV;
+      mov.dst    = dst;
+      mov.a      = stack_.back().operand;
+      emit_( mov );
+    }
+
+    stack_.back().operand = dst;
+    return true;
+  }
+
+
+  bool lowering_type::lower( const std::vector<instruction_type> &instructions )
+  {
+    const size_t count = instructions.size();
+
+    // Find all jump targets, and fix the e-stack state expected at
+    // function entry points
+    //
+    std::vector<bool>                     is_target( count + 1U, false );
+    std::map<size_t,std::vector<slot_type>> target_state;
+    for ( size_t i=0U; i<count; ++i ) {
+      int64_t target;
+      if ( !jump_target_of( instructions[i], i, &target ) ) {
+        continue;
+      }
+      if ( target < 0 || target > static_cast<int64_t>( count ) ) {
+        return false;
+      }
+
+      is_target[ target ] = true;
+      if ( instructions[i].id == INSTRUCTION_ID_TYPE_CALL || instructions[i].id == INSTRUCTION_ID_TYPE_TAILCALL ) {
+        target_state[ target ] = std::vector<slot_type>();
+      }
+    }
+
+    std::vector<size_t> register_pc( count + 1U, 0U );
+    std::vector<size_t> fixups; // indices of jumps/calls whose n is (still) a stack pc
+
+    bool reachable = true;
+    for ( size_t pc=0U; pc<=count; ++pc ) {
+
+      if ( is_target[pc] ) {
+        if ( reachable ) {
+          materialize_for_jump_();
+          auto iter = target_state.find( pc );
+          if ( iter != target_state.end() && !(iter->second == stack_) ) {
+            return false;
+          }
+        }
+        else {
+          auto iter = target_state.find( pc );
+          stack_ = ( iter != target_state.end() ) ? iter->second : std::vector<slot_type>();
+        }
+        target_state[ pc ] = stack_;
+        last_def_ = SIZE_MAX;
+      }
+      else if ( !reachable ) {
+        // Unreachable by fall-through, and not a jump target: dead code
+        //
+        stack_.clear();
+      }
+
+      register_pc[pc] = program_.instructions.size();
+      reachable       = true;
+
+      if ( pc == count ) {
+        break;
+      }
+
+      const instruction_type &instruction = instructions[pc];
+
+      switch ( instruction.id ) {
+      case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+        push_( constant_( instruction.arg.d ) );
+        break;
+
+      case INSTRUCTION_ID_TYPE_PUSHINT32:
+        push_integer_( instruction.arg.i32 );
+        break;
+
+      case INSTRUCTION_ID_TYPE_PUSHSIZET:
+        push_integer_( static_cast<int64_t>( instruction.arg.sz ) );
+        break;
+
+      case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+        {
+          register_operand_type operand;
+          operand.base   = REGISTER_BASE_TYPE_ABSOLUTE;
+          operand.offset = static_cast<ptrdiff_t>( instruction.arg.sz );
+          push_( operand );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+        {
+          register_operand_type operand;
+          operand.base   = REGISTER_BASE_TYPE_FRAME;
+          operand.offset = instruction.arg.i32;
+          push_( operand );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_COPYTOADDR:
+        {
+          register_operand_type operand;
+          operand.base   = REGISTER_BASE_TYPE_ABSOLUTE;
+          operand.offset = static_cast<ptrdiff_t>( instruction.arg.sz );
+          if ( !store_( operand ) ) {
+            return false;
+          }
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+        {
+          register_operand_type operand;
+          operand.base   = REGISTER_BASE_TYPE_FRAME;
+          operand.offset = instruction.arg.i32;
+          if ( !store_( operand ) ) {
+            return false;
+          }
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_ASSIGN:
+        {
+          if ( stack_.size() < 3U ) {
+            return false;
+          }
+
+          const slot_type &target   = *(stack_.rbegin() + 2U);
+          const slot_type &absolute = *(stack_.rbegin() + 1U);
+          if ( !target.is_integer || !absolute.is_integer ) {
+            return false;
+          }
+
+          register_operand_type operand;
+          if ( absolute.integer ) {
+            operand.base   = REGISTER_BASE_TYPE_ABSOLUTE;
+          }
+          else {
+            operand.base   = REGISTER_BASE_TYPE_FRAME;
+          }
+          operand.offset = static_cast<ptrdiff_t>( target.integer );
+
+          if ( !store_( operand ) ) {
+            return false;
+          }
+
+          slot_type value = stack_.back();
+          stack_.pop_back();
+          stack_.pop_back();
+          stack_.back() = value;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_NOT:
+        if ( !unary_( REGISTER_OPCODE_TYPE_NOT ) ) {
+          return false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_NEGATE:
+        if ( !unary_( REGISTER_OPCODE_TYPE_NEGATE ) ) {
+          return false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_ADD:
+      case INSTRUCTION_ID_TYPE_SUBTRACT:
+      case INSTRUCTION_ID_TYPE_DIVIDE:
+      case INSTRUCTION_ID_TYPE_MULTIPLY:
+      case INSTRUCTION_ID_TYPE_EQ:
+      case INSTRUCTION_ID_TYPE_NEQ:
+      case INSTRUCTION_ID_TYPE_GE:
+      case INSTRUCTION_ID_TYPE_GT:
+      case INSTRUCTION_ID_TYPE_LE:
+      case INSTRUCTION_ID_TYPE_LT:
+      case INSTRUCTION_ID_TYPE_AND:
+      case INSTRUCTION_ID_TYPE_OR:
+        // NOTE: these register opcodes are in the same order as
+        //  the corresponding instruction_id_type entries
+        //
+        if ( !binary_( static_cast<register_opcode_type>( REGISTER_OPCODE_TYPE_ADD + (instruction.id - INSTRUCTION_ID_TYPE_ADD) ) ) ) {
+          return false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_CLEAR:
+        if ( !stack_.empty() ) {
+          if ( stack_.back().is_integer ) {
+            return false;
+          }
+          register_instruction_type print;
+          print.opcode = REGISTER_OPCODE_TYPE_PRINT;
+          print.a      = stack_.back().operand;
+          print.n      = stack_.size();
+          emit_( print );
+        }
+        stack_.clear();
+        break;
+
+      case INSTRUCTION_ID_TYPE_POP:
+        if ( stack_.size() < instruction.arg.sz ) {
+          return false;
+        }
+        stack_.resize( stack_.size() - instruction.arg.sz );
+        break;
+
+      case INSTRUCTION_ID_TYPE_JNEZ:
+      case INSTRUCTION_ID_TYPE_JEQZ:
+      case INSTRUCTION_ID_TYPE_JCEQZ:
+        {
+          if ( stack_.empty() || stack_.back().is_integer ) {
+            return false;
+          }
+
+          register_instruction_type jump;
+          jump.opcode = ( instruction.id == INSTRUCTION_ID_TYPE_JNEZ ) ? REGISTER_OPCODE_TYPE_JNZ : REGISTER_OPCODE_TYPE_JZ;
+          jump.n      = pc + instruction.arg.i32;
+
+          if ( instruction.id == INSTRUCTION_ID_TYPE_JCEQZ ) {
+            // The tested value is consumed, so it can be tested
+            // wherever it is
+            //
+            jump.a = stack_.back().operand;
+            stack_.pop_back();
+            materialize_for_jump_();
+          }
+          else {
+            materialize_for_jump_();
+            jump.a = stack_.back().operand;
+          }
+
+          auto iter = target_state.find( jump.n );
+          if ( iter != target_state.end() ) {
+            if ( !(iter->second == stack_) ) {
+              return false;
+            }
+          }
+          else {
+            target_state[ jump.n ] = stack_;
+          }
+
+          fixups.push_back( program_.instructions.size() );
+          emit_( jump );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_JMP:
+      case INSTRUCTION_ID_TYPE_JMPA:
+        {
+          register_instruction_type jump;
+          jump.opcode = REGISTER_OPCODE_TYPE_JMP;
+          jump.n      = ( instruction.id == INSTRUCTION_ID_TYPE_JMP ) ? pc + instruction.arg.i32 : instruction.arg.sz;
+
+          materialize_for_jump_();
+
+          auto iter = target_state.find( jump.n );
+          if ( iter != target_state.end() ) {
+            if ( !(iter->second == stack_) ) {
+              return false;
+            }
+          }
+          else {
+            target_state[ jump.n ] = stack_;
+          }
+
+          fixups.push_back( program_.instructions.size() );
+          emit_( jump );
+          reachable = false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+        {
+          materialize_memory_( stack_.size() );
+
+          register_instruction_type move;
+          move.opcode   = REGISTER_OPCODE_TYPE_MOVE_END_OF_STACK;
+          move.a.offset = instruction.arg.i32;
+          emit_( move );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_CALL:
+        {
+          // The callee gets its own register window, so only slots
+          // that refer to memory need attention
+          //
+          materialize_memory_( stack_.size() );
+
+          register_instruction_type call;
+          call.opcode = REGISTER_OPCODE_TYPE_CALL;
+          call.n      = instruction.arg.sz;
+
+          fixups.push_back( program_.instructions.size() );
+          emit_( call );
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_RETURN:
+        {
+          register_instruction_type ret;
+          ret.opcode = REGISTER_OPCODE_TYPE_RETURN;
+          emit_( ret );
+          reachable = false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_TAILCALL:
+        {
+          // The callee takes over this function's frame and register
+          //  window
+          //
+          materialize_memory_( stack_.size() );
+
+          register_instruction_type call;
+          call.opcode = REGISTER_OPCODE_TYPE_TAILCALL;
+          call.n      = instruction.arg.sz;
+
+          fixups.push_back( program_.instructions.size() );
+          emit_( call );
+          reachable = false;
+        }
+        break;
+
+      case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+        // d-stack dumps are a debugging aid for the stack machine; skip them
+        //
+        break;
+
+      case INSTRUCTION_ID_TYPE_I2D:
+      case INSTRUCTION_ID_TYPE_D2I:
+      case INSTRUCTION_ID_TYPE_IADD:
+      case INSTRUCTION_ID_TYPE_ISUBTRACT:
+      case INSTRUCTION_ID_TYPE_IDIVIDE:
+      case INSTRUCTION_ID_TYPE_IMULTIPLY:
+      case INSTRUCTION_ID_TYPE_IEQ:
+      case INSTRUCTION_ID_TYPE_INEQ:
+      case INSTRUCTION_ID_TYPE_IGE:
+      case INSTRUCTION_ID_TYPE_IGT:
+      case INSTRUCTION_ID_TYPE_ILE:
+      case INSTRUCTION_ID_TYPE_ILT:
+      case INSTRUCTION_ID_TYPE_INEGATE:
+      case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+      case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+      case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+      case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+      case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+        // int32 registers are not supported (yet); left to the stack machine
+        //
+        return false;
+
+      case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+      case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+      case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+      case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+        // lowered from unoptimized instructions only
+        //
+        return false;
+
+      case INSTRUCTION_ID_TYPE_COMMA:
+      case INSTRUCTION_ID_TYPE_FINALIZE:
+      case INSTRUCTION_ID_TYPE_FN:
+      case INSTRUCTION_ID_TYPE_LPARENS:
+      case INSTRUCTION_ID_TYPE_RPARENS:
+        // NOTE. These should never occur...
+        break;
+      }
+    }
+
+    // Jump and call targets were recorded as stack-machine indices;
+    // convert them to register-machine indices
+    //
+    for ( size_t i : fixups ) {
+      program_.instructions[i].n = register_pc[ program_.instructions[i].n ];
+    }
+
+    return true;
+  }
+
+
+  const char *opcode_name( register_opcode_type opcode )
+  {
+    // NOTE: needs to match up with register_opcode_type enum
+    //
+    static const char * const names[] = {
+       "mov"
+      ,"not"
+      ,"negate"
+      ,"add"
+      ,"subtract"
+      ,"divide"
+      ,"multiply"
+      ,"eq"
+      ,"ne"
+      ,"ge"
+      ,"gt"
+      ,"le"
+      ,"lt"
+      ,"and"
+      ,"or"
+      ,"jz"
+      ,"jnz"
+      ,"jmp"
+      ,"print"
+      ,"move-end-of-stack"
+      ,"call"
+      ,"return"
+      ,"tail-call"
+    };
+
+    return names[ opcode ];
+  }
+
+
+  void print_operand( const register_program_type &program, const register_operand_type &operand )
+  {
+    switch ( operand.base ) {
+    case REGISTER_BASE_TYPE_REGISTER:
+      std::cout << "r" << ( operand.offset / sizeof( double ) );
+      break;
+    case REGISTER_BASE_TYPE_ABSOLUTE:
+      std::cout << "[" << operand.offset << "]";
+      break;
+    case REGISTER_BASE_TYPE_FRAME:
+      std::cout << "[sfb" << ( operand.offset < 0 ? "" : "+" ) << operand.offset << "]";
+      break;
+    case REGISTER_BASE_TYPE_CONSTANT:
+      std::cout << "#" << program.constants[ operand.offset / sizeof( double ) ];
+      break;
+    case REGISTER_BASE_TYPE_COUNT:
+      break;
+    }
+  }
+
+}
+
+
+bool lower_to_registers(
+                        const std::vector<instruction_type> &instructions
+                       ,register_program_type              &program
+                       )
+{
+  program = register_program_type();
+
+  lowering_type lowering( program );
+  return lowering.lower( instructions );
+}
+
+
+bool evaluate_registers(
+                        const register_program_type &program
+                       ,data_stack_type             &data
+                       ,result_sink_type            *results
+                       )
+{
+  // data is the "data stack" (d-stack), laid out exactly as for
+  //  evaluate(), except that return addresses are register-machine
+  //  instruction indices
+
+  std::vector<double> registers( program.window_size );
+  size_t              window_base{};
+  size_t              stack_frame_base{};
+
+  // Operand bases; these need recomputing whenever the register file
+  //  may have been reallocated, or the frame changes
+  //
+  char *bases[ REGISTER_BASE_TYPE_COUNT ];
+  auto rebase = [&]() {
+    bases[ REGISTER_BASE_TYPE_REGISTER ] = reinterpret_cast<char*>( registers.data() + window_base );
+    bases[ REGISTER_BASE_TYPE_ABSOLUTE ] = data.data();
+    bases[ REGISTER_BASE_TYPE_FRAME    ] = data.data() + stack_frame_base;
+    bases[ REGISTER_BASE_TYPE_CONSTANT ] = reinterpret_cast<char*>( const_cast<double*>( program.constants.data() ) );
+  };
+  rebase();
+
+  auto read = [&]( const register_operand_type &operand ) {
+    double value;
+    std::memcpy( &value, bases[ operand.base ] + operand.offset, sizeof( value ) );
+    return value;
+  };
+
+  auto write = [&]( const register_operand_type &operand, double value ) {
+    std::memcpy( bases[ operand.base ] + operand.offset, &value, sizeof( value ) );
+  };
+
+  size_t pc = 0U;
+  while ( pc < program.instructions.size() ) {
+
+    const register_instruction_type &instruction = program.instructions[pc];
+    ++pc;
+
+    switch ( instruction.opcode ) {
+    case REGISTER_OPCODE_TYPE_MOV:
+      write( instruction.dst, read( instruction.a ) );
+      break;
+
+    case REGISTER_OPCODE_TYPE_NOT:
+      write( instruction.dst, ( read( instruction.a ) == 0.0 ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_NEGATE:
+      write( instruction.dst, -1.0 * read( instruction.a ) );
+      break;
+
+    case REGISTER_OPCODE_TYPE_ADD:
+      write( instruction.dst, read( instruction.a ) + read( instruction.b ) );
+      break;
+
+    case REGISTER_OPCODE_TYPE_SUBTRACT:
+      write( instruction.dst, read( instruction.a ) - read( instruction.b ) );
+      break;
+
+    case REGISTER_OPCODE_TYPE_DIVIDE:
+      {
+        double divisor = read( instruction.b );
+        if ( divisor == 0.0 ) {
+          return false;
+        }
+        write( instruction.dst, read( instruction.a ) / divisor );
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_MULTIPLY:
+      write( instruction.dst, read( instruction.a ) * read( instruction.b ) );
+      break;
+
+    case REGISTER_OPCODE_TYPE_EQ:
+      write( instruction.dst, ( read( instruction.a ) == read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_NEQ:
+      write( instruction.dst, ( read( instruction.a ) != read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_GE:
+      write( instruction.dst, ( read( instruction.a ) >= read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_GT:
+      write( instruction.dst, ( read( instruction.a ) > read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_LE:
+      write( instruction.dst, ( read( instruction.a ) <= read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_LT:
+      write( instruction.dst, ( read( instruction.a ) < read( instruction.b ) ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_AND:
+      write( instruction.dst, ( read( instruction.a ) != 0.0 && read( instruction.b ) != 0.0 ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_OR:
+      write( instruction.dst, ( read( instruction.a ) != 0.0 || read( instruction.b ) != 0.0 ) ? 1.0 : 0.0 );
+      break;
+
+    case REGISTER_OPCODE_TYPE_JZ:
+      if ( read( instruction.a ) == 0.0 ) {
+        pc = instruction.n;
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_JNZ:
+      if ( read( instruction.a ) != 0.0 ) {
+        pc = instruction.n;
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_JMP:
+      pc = instruction.n;
+      break;
+
+    case REGISTER_OPCODE_TYPE_PRINT:
+      if ( results ) {
+        results->put( read( instruction.a ) );
+        if ( instruction.n > 1U ) {
+          results->stack_size_warning( instruction.n );
+        }
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_MOVE_END_OF_STACK:
+      // NOTE: the d-stack never moves, so no rebase() is needed
+      //
+      if ( !data.resize( data.size() + instruction.a.offset ) ) {
+        return false;
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_CALL:
+      {
+        // push return address, then the current stack frame base
+        //
+        if ( !data.resize( data.size() + 16U ) ) {
+          return false;
+        }
+        *(reinterpret_cast<size_t*>( &(data[data.size()-16U]) )) = pc;
+        *(reinterpret_cast<size_t*>( &(data[data.size()- 8U]) )) = stack_frame_base;
+
+        stack_frame_base = data.size();
+
+        // New register window for the function
+        //
+        window_base += program.window_size;
+        if ( registers.size() < window_base + program.window_size ) {
+          registers.resize( window_base + program.window_size );
+        }
+
+        rebase();
+        pc = instruction.n;
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_RETURN:
+      {
+        if ( window_base == 0U ) {
+          return false;
+        }
+
+        size_t old_stack_frame_base = *(reinterpret_cast<size_t*>(&(data[stack_frame_base -  8])));
+        size_t return_address       = *(reinterpret_cast<size_t*>(&(data[stack_frame_base - 16])));
+        data.resize( stack_frame_base - 16 );
+
+        window_base     -= program.window_size;
+        stack_frame_base = old_stack_frame_base;
+
+        rebase();
+        pc = return_address;
+      }
+      break;
+
+    case REGISTER_OPCODE_TYPE_TAILCALL:
+      {
+        if ( window_base == 0U ) {
+          return false;
+        }
+
+        // drop the rest of the frame; the return address and caller's
+        //  stack frame base stay where they are
+        //
+        data.resize( stack_frame_base );
+        pc = instruction.n;
+      }
+      break;
+    }
+  }
+
+  return true;
+}
+
+
+void print_register_program( const register_program_type &program )
+{
+  for ( size_t i=0U; i<program.instructions.size(); ++i ) {
+
+    const register_instruction_type &instruction = program.instructions[i];
+
+    std::cout << i << ": " << opcode_name( instruction.opcode );
+
+    switch ( instruction.opcode ) {
+    case REGISTER_OPCODE_TYPE_MOV:
+    case REGISTER_OPCODE_TYPE_NOT:
+    case REGISTER_OPCODE_TYPE_NEGATE:
+      std::cout << " ";
+      print_operand( program, instruction.dst );
+      std::cout << ", ";
+      print_operand( program, instruction.a );
+      break;
+
+    case REGISTER_OPCODE_TYPE_JZ:
+    case REGISTER_OPCODE_TYPE_JNZ:
+      std::cout << " ";
+      print_operand( program, instruction.a );
+      std::cout << ", " << instruction.n;
+      break;
+
+    case REGISTER_OPCODE_TYPE_JMP:
+    case REGISTER_OPCODE_TYPE_CALL:
+    case REGISTER_OPCODE_TYPE_TAILCALL:
+      std::cout << " " << instruction.n;
+      break;
+
+    case REGISTER_OPCODE_TYPE_PRINT:
+      std::cout << " ";
+      print_operand( program, instruction.a );
+      break;
+
+    case REGISTER_OPCODE_TYPE_MOVE_END_OF_STACK:
+      std::cout << " " << instruction.a.offset;
+      break;
+
+    case REGISTER_OPCODE_TYPE_RETURN:
+      break;
+
+    default:
+      std::cout << " ";
+      print_operand( program, instruction.dst );
+      std::cout << ", ";
+      print_operand( program, instruction.a );
+      std::cout << ", ";
+      print_operand( program, instruction.b );
+      break;
+    }
+
+    std::cout << "\n";
+  }
+}
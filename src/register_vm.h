@@ -0,0 +1,128 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "data_stack_type.h"
+#include "instruction_type.h"
+#include "result_sink.h"
+
+
+// Register-machine form of the instructions.
+//
+// Instead of pushing/popping an evaluation stack, each instruction names
+// its operands directly (three-address form). An operand is a location
+// relative to one of a few bases:
+//
+//   register  - a temporary, in the current function's register window
+//   absolute  - a d-stack address (globals)
+//   frame     - a d-stack offset from the stack frame base (locals, args)
+//   constant  - an entry in the program's constant pool
+//
+// Variables are therefore used in place, and only intermediate results
+// occupy registers.
+//
+enum register_base_type {
+   REGISTER_BASE_TYPE_REGISTER = 0
+  ,REGISTER_BASE_TYPE_ABSOLUTE
+  ,REGISTER_BASE_TYPE_FRAME
+  ,REGISTER_BASE_TYPE_CONSTANT
+
+  ,REGISTER_BASE_TYPE_COUNT
+};
+
+
+struct register_operand_type {
+  register_base_type base{ REGISTER_BASE_TYPE_REGISTER };
+  ptrdiff_t          offset{}; // in bytes, from base
+};
+
+
+enum register_opcode_type {
+   REGISTER_OPCODE_TYPE_MOV = 0
+  ,REGISTER_OPCODE_TYPE_NOT
+  ,REGISTER_OPCODE_TYPE_NEGATE
+
+  ,REGISTER_OPCODE_TYPE_ADD
+  ,REGISTER_OPCODE_TYPE_SUBTRACT
+  ,REGISTER_OPCODE_TYPE_DIVIDE
+  ,REGISTER_OPCODE_TYPE_MULTIPLY
+  ,REGISTER_OPCODE_TYPE_EQ
+  ,REGISTER_OPCODE_TYPE_NEQ
+  ,REGISTER_OPCODE_TYPE_GE
+  ,REGISTER_OPCODE_TYPE_GT
+  ,REGISTER_OPCODE_TYPE_LE
+  ,REGISTER_OPCODE_TYPE_LT
+  ,REGISTER_OPCODE_TYPE_AND
+  ,REGISTER_OPCODE_TYPE_OR
+
+  ,REGISTER_OPCODE_TYPE_JZ
+  ,REGISTER_OPCODE_TYPE_JNZ
+  ,REGISTER_OPCODE_TYPE_JMP
+
+  ,REGISTER_OPCODE_TYPE_PRINT
+  ,REGISTER_OPCODE_TYPE_MOVE_END_OF_STACK
+  ,REGISTER_OPCODE_TYPE_CALL
+  ,REGISTER_OPCODE_TYPE_RETURN
+  ,REGISTER_OPCODE_TYPE_TAILCALL
+};
+
+
+// NOTE: MOVE_END_OF_STACK takes its (signed) adjustment from a.offset
+//
+struct register_instruction_type {
+  register_opcode_type  opcode{ REGISTER_OPCODE_TYPE_MOV };
+  register_operand_type dst;
+  register_operand_type a;
+  register_operand_type b;
+  size_t                n{}; // jump/call target, or e-stack size for print
+};
+
+
+struct register_program_type {
+  std::vector<register_instruction_type> instructions;
+  std::vector<double>                    constants;
+  size_t                                 window_size{}; // registers per function call
+};
+
+
+// Lower stack-machine instructions (as emitted by parser_type) into
+// register form. Returns false if the instructions use a construct the
+// register machine cannot express
+//
+bool lower_to_registers(
+                        const std::vector<instruction_type> &instructions
+                       ,register_program_type              &program
+                       );
+
+// Statement results go to results (if not null)
+//
+bool evaluate_registers(
+                        const register_program_type &program
+                       ,data_stack_type             &data
+                       ,result_sink_type            *results
+                       );
+
+void print_register_program( const register_program_type &program );
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <charconv>
+#include <cstring>
+
+#include "result_sink.h"
+
+
+namespace {
+
+  const char   RESULT_PREFIX[]  = " => ";
+  const char   WARNING_PREFIX[] = "WARNING: final stack size is ";
+
+  // as iostream's default floating-point format
+  //
+  const int    DOUBLE_PRECISION = 6;
+
+}
+
+
+text_result_sink_type::text_result_sink_type( std::ostream &out, size_t buffer_size )
+  :out_( out )
+  ,buffer_( ( buffer_size < MAX_LINE ) ? MAX_LINE : buffer_size )
+  ,used_( 0U )
+{
+}
+
+
+text_result_sink_type::~text_result_sink_type()
+{
+  flush();
+}
+
+
+char *text_result_sink_type::reserve_()
+{
+  if ( buffer_.size() - used_ < MAX_LINE ) {
+    out_.write( buffer_.data(), static_cast<std::streamsize>( used_ ) );
+    used_ = 0U;
+  }
+  return buffer_.data() + used_;
+}
+
+
+void text_result_sink_type::put( double value )
+{
+  char *begin = reserve_();
+  char *end   = begin + MAX_LINE;
+  char *p     = begin;
+
+  std::memcpy( p, RESULT_PREFIX, sizeof( RESULT_PREFIX ) - 1U );
+  p += sizeof( RESULT_PREFIX ) - 1U;
+  p  = std::to_chars( p, end - 1, value, std::chars_format::general, DOUBLE_PRECISION ).ptr;
+  *p++ = '\n';
+
+  used_ += p - begin;
+}
+
+
+void text_result_sink_type::put( int32_t value )
+{
+  char *begin = reserve_();
+  char *end   = begin + MAX_LINE;
+  char *p     = begin;
+
+  std::memcpy( p, RESULT_PREFIX, sizeof( RESULT_PREFIX ) - 1U );
+  p += sizeof( RESULT_PREFIX ) - 1U;
+  p  = std::to_chars( p, end - 1, value ).ptr;
+  *p++ = '\n';
+
+  used_ += p - begin;
+}
+
+
+void text_result_sink_type::stack_size_warning( size_t size )
+{
+  char *begin = reserve_();
+  char *end   = begin + MAX_LINE;
+  char *p     = begin;
+
+  std::memcpy( p, WARNING_PREFIX, sizeof( WARNING_PREFIX ) - 1U );
+  p += sizeof( WARNING_PREFIX ) - 1U;
+  p  = std::to_chars( p, end - 1, size ).ptr;
+  *p++ = '\n';
+
+  used_ += p - begin;
+}
+
+
+void text_result_sink_type::flush()
+{
+  if ( used_ != 0U ) {
+    out_.write( buffer_.data(), static_cast<std::streamsize>( used_ ) );
+    used_ = 0U;
+  }
+  out_.flush();
+}
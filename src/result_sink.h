@@ -0,0 +1,152 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+
+// Where the results of expression statements go. CLEAR hands the value
+//  left on the e-stack to the sink, and, if there was more than one,
+//  the e-stack size (the CLI prints " => value" and a warning).
+//
+// A sink is used by one evaluation at a time; sinks that buffer write
+//  out what is left when flushed or destroyed
+//
+class result_sink_type {
+
+  public:
+    virtual ~result_sink_type() {}
+
+    virtual void put( double value ) = 0;
+    virtual void put( int32_t value ) = 0;
+
+    // the statement left size values on the e-stack (called after put())
+    //
+    virtual void stack_size_warning( size_t size ) = 0;
+
+    virtual void flush() {}
+};
+
+
+// The CLI format, through iostream formatting
+//
+class stream_result_sink_type : public result_sink_type {
+
+  public:
+    explicit stream_result_sink_type( std::ostream &out ) :out_( out ) {}
+
+    void put( double value ) override  { out_ << " => " << value << "\n"; }
+    void put( int32_t value ) override { out_ << " => " << value << "\n"; }
+
+    void stack_size_warning( size_t size ) override
+    {
+      out_ << "WARNING: final stack size is " << size << "\n";
+    }
+
+    void flush() override { out_.flush(); }
+
+  private:
+    std::ostream &out_;
+};
+
+
+// The CLI format, formatted with std::to_chars into a large buffer that
+//  is written to out when full (and when flushed). Doubles are written as
+//  iostream writes them by default (%g, 6 significant digits)
+//
+// NOTE: anything else written to out in the meantime comes out ahead of
+//  buffered results
+//
+class text_result_sink_type : public result_sink_type {
+
+  public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64U * 1024U;
+
+    explicit text_result_sink_type( std::ostream &out, size_t buffer_size = DEFAULT_BUFFER_SIZE );
+    ~text_result_sink_type() override;
+
+    text_result_sink_type( const text_result_sink_type & ) = delete;
+    text_result_sink_type &operator=( const text_result_sink_type & ) = delete;
+
+    void put( double value ) override;
+    void put( int32_t value ) override;
+    void stack_size_warning( size_t size ) override;
+    void flush() override;
+
+  private:
+    // room for the longest line
+    //
+    static constexpr size_t MAX_LINE = 64U;
+
+    char *reserve_();
+
+    std::ostream      &out_;
+    std::vector<char>  buffer_;
+    size_t             used_;
+};
+
+
+// Results as raw doubles (int32 results are converted), for a caller to
+//  use directly
+//
+class binary_result_sink_type : public result_sink_type {
+
+  public:
+    void put( double value ) override  { values_.push_back( value ); }
+    void put( int32_t value ) override { values_.push_back( static_cast<double>( value ) ); }
+
+    void stack_size_warning( size_t ) override { ++warnings_; }
+
+    const std::vector<double> &values() const { return values_; }
+    size_t warnings() const { return warnings_; }
+
+    void clear()
+    {
+      values_.clear();
+      warnings_ = 0U;
+    }
+
+  private:
+    std::vector<double> values_;
+    size_t              warnings_{};
+};
+
+
+// Drops results (but counts them), for benchmarking
+//
+class null_result_sink_type : public result_sink_type {
+
+  public:
+    void put( double ) override  { ++count_; }
+    void put( int32_t ) override { ++count_; }
+
+    void stack_size_warning( size_t ) override {}
+
+    size_t count() const { return count_; }
+
+  private:
+    size_t count_{};
+};
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sampler.h"
+
+#include <algorithm>
+#include <map>
+
+#include "program.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/time.h>
+#define SINTERP_SAMPLER_POSIX 1
+#else
+#define SINTERP_SAMPLER_POSIX 0
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#define SINTERP_SAMPLER_THREAD_TIMER 1
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#else
+#define SINTERP_SAMPLER_THREAD_TIMER 0
+#endif
+
+
+namespace {
+
+  // The running sampler, for the signal handler
+  //
+  std::atomic<sampler_type*> active_sampler{ nullptr };
+
+#if SINTERP_SAMPLER_POSIX
+  struct sigaction previous_action;
+#endif
+
+#if SINTERP_SAMPLER_THREAD_TIMER
+  timer_t timer_id;
+#endif
+
+}
+
+
+sampler_type::sampler_type( size_t buffer_size )
+  :buffer_( buffer_size )
+  ,used_( 0U )
+  ,last_( 0U )
+  ,samples_( 0U )
+  ,dropped_( 0U )
+  ,stack_( nullptr )
+  ,running_( false )
+{
+}
+
+
+sampler_type::~sampler_type()
+{
+  stop();
+}
+
+
+bool sampler_type::available()
+{
+  return SINTERP_SAMPLER_POSIX;
+}
+
+
+bool sampler_type::start( const call_stack_type &stack, unsigned frequency )
+{
+#if SINTERP_SAMPLER_POSIX
+  if ( running_ || frequency == 0U ) {
+    return false;
+  }
+
+  sampler_type *expected = nullptr;
+  if ( !active_sampler.compare_exchange_strong( expected, this ) ) {
+    return false;
+  }
+
+  stack_   = &stack;
+  used_    = 0U;
+  last_    = 0U;
+  samples_ = 0U;
+  dropped_ = 0U;
+
+  struct sigaction action{};
+  action.sa_handler = &sampler_type::on_signal;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset( &action.sa_mask );
+  if ( sigaction( SIGPROF, &action, &previous_action ) != 0 ) {
+    active_sampler.store( nullptr );
+    return false;
+  }
+
+  const long period_ns = std::max( 1000L, 1000000000L / static_cast<long>( frequency ) );
+
+#if SINTERP_SAMPLER_THREAD_TIMER
+  // On Linux, a high-resolution timer signalling this thread (the
+  //  process CPU-time timer below only fires on scheduler ticks, which
+  //  can be as coarse as 250 Hz). It measures elapsed time, which for a
+  //  busy interpreter is its CPU time
+  //
+  struct sigevent event{};
+  event.sigev_notify           = SIGEV_THREAD_ID;
+  event.sigev_signo            = SIGPROF;
+  event.sigev_notify_thread_id = static_cast<pid_t>( syscall( SYS_gettid ) );
+
+  struct itimerspec timer{};
+  timer.it_interval.tv_sec  = period_ns / 1000000000L;
+  timer.it_interval.tv_nsec = period_ns % 1000000000L;
+  timer.it_value            = timer.it_interval;
+  if ( timer_create( CLOCK_MONOTONIC, &event, &timer_id ) != 0 ) {
+    sigaction( SIGPROF, &previous_action, nullptr );
+    active_sampler.store( nullptr );
+    return false;
+  }
+  if ( timer_settime( timer_id, 0, &timer, nullptr ) != 0 ) {
+    timer_delete( timer_id );
+    sigaction( SIGPROF, &previous_action, nullptr );
+    active_sampler.store( nullptr );
+    return false;
+  }
+#else
+  struct itimerval timer{};
+  timer.it_interval.tv_sec  = period_ns / 1000000000L;
+  timer.it_interval.tv_usec = ( period_ns % 1000000000L ) / 1000L;
+  timer.it_value            = timer.it_interval;
+  if ( setitimer( ITIMER_PROF, &timer, nullptr ) != 0 ) {
+    sigaction( SIGPROF, &previous_action, nullptr );
+    active_sampler.store( nullptr );
+    return false;
+  }
+#endif
+
+  running_ = true;
+  return true;
+#else
+  (void)stack;
+  (void)frequency;
+  return false;
+#endif
+}
+
+
+void sampler_type::stop()
+{
+#if SINTERP_SAMPLER_POSIX
+  if ( !running_ ) {
+    return;
+  }
+
+#if SINTERP_SAMPLER_THREAD_TIMER
+  timer_delete( timer_id );
+#else
+  struct itimerval timer{};
+  setitimer( ITIMER_PROF, &timer, nullptr );
+#endif
+  sigaction( SIGPROF, &previous_action, nullptr );
+
+  active_sampler.store( nullptr );
+  running_ = false;
+#endif
+}
+
+
+void sampler_type::on_signal( int )
+{
+  sampler_type *sampler = active_sampler.load( std::memory_order_relaxed );
+  if ( sampler ) {
+    sampler->take_sample();
+  }
+}
+
+
+// NOTE: runs in the signal handler
+//
+void sampler_type::take_sample()
+{
+  ++samples_;
+
+  const size_t depth  = stack_->depth();
+  const size_t frames = std::min( depth, call_stack_type::MAX_FRAMES );
+
+  // Same stack as last time?
+  //
+  if ( last_ < used_ && buffer_[ last_ + 1U ] == depth ) {
+    size_t i = 0U;
+    while ( i < frames && buffer_[ last_ + 2U + i ] == stack_->frame( i ) ) {
+      ++i;
+    }
+    if ( i == frames ) {
+      ++buffer_[ last_ ];
+      return;
+    }
+  }
+
+  if ( buffer_.size() - used_ < frames + 2U ) {
+    ++dropped_;
+    return;
+  }
+
+  last_ = used_;
+  buffer_[ used_++ ] = 1U;
+  buffer_[ used_++ ] = depth;
+  for ( size_t i=0U; i<frames; ++i ) {
+    buffer_[ used_++ ] = stack_->frame( i );
+  }
+}
+
+
+void sampler_type::write_folded( std::ostream &out, const program_type &program ) const
+{
+  // Merge repeats of each stack, and list them in order
+  //
+  std::map<std::string,size_t> folded;
+
+  for ( size_t offset = 0U; offset < used_; ) {
+    const size_t count  = buffer_[ offset ];
+    const size_t depth  = buffer_[ offset + 1U ];
+    const size_t frames = std::min( depth, call_stack_type::MAX_FRAMES );
+
+    std::string line( "[top]" );
+    for ( size_t i=0U; i<frames; ++i ) {
+      const size_t       entry = buffer_[ offset + 2U + i ];
+      const std::string *name  = program.function_name( entry );
+      line += ';';
+      line += name ? *name : "fn@" + std::to_string( entry );
+    }
+    if ( depth > frames ) {
+      line += ";[truncated]";
+    }
+
+    folded[ line ] += count;
+    offset += frames + 2U;
+  }
+
+  for ( const auto &stack : folded ) {
+    out << stack.first << ' ' << stack.second << '\n';
+  }
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class program_type;
+
+
+// Shadow call stack: the entry point of each function being run, as
+//  CALL pushes, RETURN pops and TAILCALL replaces them (see
+//  vm_context_type::call_stack). It is kept so that a signal handler,
+//  interrupting the thread that runs the program, can read a consistent
+//  copy at any time.
+//
+// Only the outermost MAX_FRAMES functions are recorded; depth() counts
+//  them all
+//
+class call_stack_type {
+
+  public:
+    static constexpr size_t MAX_FRAMES = 256U;
+
+    call_stack_type() :depth_( 0U ) {}
+
+    call_stack_type( const call_stack_type & ) = delete;
+    call_stack_type &operator=( const call_stack_type & ) = delete;
+
+    // NOTE: a release store of the depth, so that the handler never sees
+    //  a frame before its entry point is written; on x86 this is a plain
+    //  store, and costs the interpreter no more than that
+    //
+    void push( size_t entry )
+    {
+      const size_t depth = depth_.load( std::memory_order_relaxed );
+      frames_[ ( depth < MAX_FRAMES ) ? depth : MAX_FRAMES ] = entry;
+      depth_.store( depth + 1U, std::memory_order_release );
+    }
+
+    void pop()
+    {
+      const size_t depth = depth_.load( std::memory_order_relaxed );
+      depth_.store( depth - ( depth > 0U ), std::memory_order_relaxed );
+    }
+
+    void replace_top( size_t entry )
+    {
+      const size_t depth = depth_.load( std::memory_order_relaxed );
+      if ( depth > 0U ) {
+        frames_[ ( depth <= MAX_FRAMES ) ? depth - 1U : MAX_FRAMES ] = entry;
+      }
+    }
+
+    void clear() { depth_.store( 0U, std::memory_order_relaxed ); }
+
+    size_t depth() const { return depth_.load( std::memory_order_acquire ); }
+
+    // entry point of frame i (0 is the outermost), for i < MAX_FRAMES
+    //
+    size_t frame( size_t i ) const { return frames_[ i ]; }
+
+  private:
+    size_t              frames_[ MAX_FRAMES + 1U ];  // the last is scratch, for deeper frames
+    std::atomic<size_t> depth_;
+};
+
+
+// Statistical profiler: samples a call_stack_type on a timer (SIGPROF;
+//  on Linux, from a high-resolution timer on the calling thread, and
+//  elsewhere from setitimer( ITIMER_PROF )), and writes the samples in
+//  the "folded stack" format read by flamegraph.pl and speedscope:
+//
+//   [top];outer;inner 42
+//
+// one line per distinct stack, outermost function first, with the
+//  number of samples taken in it. Code outside any function is [top].
+//
+// The signal handler copies the stack into a buffer allocated by the
+//  constructor (a repeat of the previous sample only bumps its count), so
+//  it neither allocates nor locks; samples that do not fit are counted
+//  as dropped. Only one sampler can run at a time; it must be started on
+//  the thread that runs the program, and stack must be that program's.
+//
+// Sampling is only available on POSIX systems; elsewhere start() fails
+//
+class sampler_type {
+
+  public:
+    static constexpr unsigned DEFAULT_FREQUENCY   = 1000U;     // Hz
+    static constexpr size_t   DEFAULT_BUFFER_SIZE = 1U << 20;  // words
+
+    explicit sampler_type( size_t buffer_size = DEFAULT_BUFFER_SIZE );
+    ~sampler_type();
+
+    sampler_type( const sampler_type & ) = delete;
+    sampler_type &operator=( const sampler_type & ) = delete;
+
+    static bool available();
+
+    // Start sampling stack, frequency times a second of CPU time. Fails if
+    //  sampling is not available, or another sampler is running
+    //
+    bool start( const call_stack_type &stack, unsigned frequency = DEFAULT_FREQUENCY );
+
+    void stop();
+
+    size_t samples() const { return samples_; }
+    size_t dropped() const { return dropped_; }
+
+    // Write the samples taken (after stop()) as folded stacks, naming
+    //  functions as program does (or fn@<entry> if it cannot)
+    //
+    void write_folded( std::ostream &out, const program_type &program ) const;
+
+  private:
+    static void on_signal( int signal_number );
+
+    void take_sample();
+
+    // Each sample is stored as: count, depth, then min( depth,
+    //  MAX_FRAMES ) entry points
+    //
+    std::vector<size_t>     buffer_;
+    size_t                  used_;
+    size_t                  last_;     // offset of the last sample, or used_ if none
+    size_t                  samples_;
+    size_t                  dropped_;
+    const call_stack_type  *stack_;
+    bool                    running_;
+};
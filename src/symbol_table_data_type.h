@@ -22,6 +22,11 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
+#include "operand_data_type.h"
+
 enum symbol_type {
    SYMBOL_TYPE_VARIABLE
   ,SYMBOL_TYPE_FUNCTION
@@ -34,4 +39,16 @@ struct symbol_table_data_type {
   int32_t     sfb_offset{};
   bool        is_abs{};
   symbol_type type{ SYMBOL_TYPE_VARIABLE };
+
+  // variable type, or function return type; OPERAND_TYPE_DOUBLE
+  //  or OPERAND_TYPE_INT32
+  //
+  operand_type              value_type{ OPERAND_TYPE_DOUBLE };
+  std::vector<operand_type> fn_arg_types;
+
+  // function name and index (see parser_type::function_names());
+  //  variables leave them empty
+  //
+  std::string               name;
+  size_t                    fn_index{};
 };
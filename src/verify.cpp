@@ -0,0 +1,600 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "verify.h"
+
+
+namespace {
+
+  const size_t  TOP_LEVEL = std::numeric_limits<size_t>::max();
+  const int64_t NO_LIMIT  = std::numeric_limits<int64_t>::max();
+
+
+  // An abstract e-stack slot. Only integer pushes (which the parser uses
+  //  for assignment targets) are tracked as constants
+  //
+  struct slot_type {
+    bool    known{};
+    int64_t value{};
+  };
+
+
+  // Abstract state before an instruction
+  //
+  struct state_type {
+    size_t                 function{ TOP_LEVEL }; // entry index of the enclosing function
+    int64_t                d_offset{};            // d-stack size, relative to the stack frame base
+    std::vector<slot_type> stack;
+  };
+
+
+  struct function_info_type {
+    // (calling function, caller's d-stack offset at the call) for each call site
+    //
+    std::vector<std::pair<size_t,int64_t>> callers;
+
+    // functions that tail call this one (which then runs in their frame)
+    //
+    std::vector<size_t> tail_callers;
+
+    int64_t min_caller_offset{ NO_LIMIT };
+    int64_t global_limit{ NO_LIMIT };
+  };
+
+
+  class verifier_type {
+
+    public:
+      verifier_type(
+                    const std::vector<instruction_type> &instructions
+                   ,verify_error_type                   *error
+                   )
+        :instructions_( instructions )
+        ,error_( error )
+        ,reached_( instructions.size() + 1U, false )
+        ,states_( instructions.size() + 1U )
+        ,worklist_{}
+        ,functions_{}
+      {
+      }
+
+      bool run();
+
+      void get_states( std::vector<verify_state_type> &states ) const;
+
+    private:
+      bool fail_( size_t index, const std::string &message )
+      {
+        if ( error_ ) {
+          error_->index   = index;
+          error_->message = message;
+        }
+        return false;
+      }
+
+      bool need_( size_t index, const state_type &state, size_t n )
+      {
+        if ( state.stack.size() < n ) {
+          std::ostringstream message;
+          message << "e-stack underflow (needs " << n << ", has " << state.stack.size() << ")";
+          return fail_( index, message.str() );
+        }
+        return true;
+      }
+
+      bool flow_( size_t from, int64_t target, const state_type &state );
+      bool step_( size_t index );
+
+      bool check_frame_access_( size_t index, const state_type &state, int64_t offset, int64_t width );
+      bool check_absolute_access_( size_t index, const state_type &state, int64_t address, int64_t width );
+      bool check_accesses_( size_t index );
+
+      const std::vector<instruction_type> &instructions_;
+      verify_error_type                   *error_;
+
+      std::vector<bool>                    reached_;
+      std::vector<state_type>              states_;
+      std::deque<size_t>                   worklist_;
+      std::map<size_t,function_info_type>  functions_;
+  };
+
+
+  // Merge state into the state before target
+  //
+  bool verifier_type::flow_( size_t from, int64_t target, const state_type &state )
+  {
+    if ( target < 0 || target > static_cast<int64_t>( instructions_.size() ) ) {
+      std::ostringstream message;
+      message << "jump target " << target << " is out of range";
+      return fail_( from, message.str() );
+    }
+
+    size_t index = static_cast<size_t>( target );
+
+    if ( !reached_[index] ) {
+      reached_[index] = true;
+      states_[index]  = state;
+      worklist_.push_back( index );
+      return true;
+    }
+
+    state_type &current = states_[index];
+
+    if ( current.function != state.function ) {
+      std::ostringstream message;
+      message << "control flows into instruction " << index << " from another function";
+      return fail_( from, message.str() );
+    }
+
+    if ( current.d_offset != state.d_offset ) {
+      std::ostringstream message;
+      message << "inconsistent d-stack size at instruction " << index
+              << " (" << current.d_offset << " vs " << state.d_offset << ")";
+      return fail_( from, message.str() );
+    }
+
+    if ( current.stack.size() != state.stack.size() ) {
+      std::ostringstream message;
+      message << "inconsistent e-stack depth at instruction " << index
+              << " (" << current.stack.size() << " vs " << state.stack.size() << ")";
+      return fail_( from, message.str() );
+    }
+
+    bool changed = false;
+    for ( size_t i=0U; i<current.stack.size(); ++i ) {
+      if ( current.stack[i].known
+        && ( !state.stack[i].known || state.stack[i].value != current.stack[i].value ) ) {
+        current.stack[i].known = false;
+        changed = true;
+      }
+    }
+
+    if ( changed ) {
+      worklist_.push_back( index );
+    }
+
+    return true;
+  }
+
+
+  bool verifier_type::step_( size_t index )
+  {
+    if ( index == instructions_.size() ) {
+      if ( states_[index].function != TOP_LEVEL ) {
+        return fail_( index, "function runs off the end of the instructions" );
+      }
+      return true;
+    }
+
+    const instruction_type &instruction = instructions_[index];
+    state_type state( states_[index] );
+
+    bool    falls_through = true;
+    int64_t target;
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      state.stack.push_back( slot_type() );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHINT32:
+      state.stack.push_back( slot_type{ true, instruction.arg.i32 } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_PUSHSIZET:
+      state.stack.push_back( slot_type{ true, static_cast<int64_t>( instruction.arg.sz ) } );
+      break;
+
+    case INSTRUCTION_ID_TYPE_NOT:
+    case INSTRUCTION_ID_TYPE_NEGATE:
+    case INSTRUCTION_ID_TYPE_INEGATE:
+    case INSTRUCTION_ID_TYPE_D2I:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_ADD:
+      if ( !need_( index, state, 1U ) ) {
+        return false;
+      }
+      state.stack.back() = slot_type();
+      break;
+
+    case INSTRUCTION_ID_TYPE_ADD:
+    case INSTRUCTION_ID_TYPE_SUBTRACT:
+    case INSTRUCTION_ID_TYPE_DIVIDE:
+    case INSTRUCTION_ID_TYPE_MULTIPLY:
+    case INSTRUCTION_ID_TYPE_EQ:
+    case INSTRUCTION_ID_TYPE_NEQ:
+    case INSTRUCTION_ID_TYPE_GE:
+    case INSTRUCTION_ID_TYPE_GT:
+    case INSTRUCTION_ID_TYPE_LE:
+    case INSTRUCTION_ID_TYPE_LT:
+    case INSTRUCTION_ID_TYPE_AND:
+    case INSTRUCTION_ID_TYPE_OR:
+    case INSTRUCTION_ID_TYPE_IADD:
+    case INSTRUCTION_ID_TYPE_ISUBTRACT:
+    case INSTRUCTION_ID_TYPE_IDIVIDE:
+    case INSTRUCTION_ID_TYPE_IMULTIPLY:
+    case INSTRUCTION_ID_TYPE_IEQ:
+    case INSTRUCTION_ID_TYPE_INEQ:
+    case INSTRUCTION_ID_TYPE_IGE:
+    case INSTRUCTION_ID_TYPE_IGT:
+    case INSTRUCTION_ID_TYPE_ILE:
+    case INSTRUCTION_ID_TYPE_ILT:
+      if ( !need_( index, state, 2U ) ) {
+        return false;
+      }
+      state.stack.pop_back();
+      state.stack.back() = slot_type();
+      break;
+
+    case INSTRUCTION_ID_TYPE_I2D:
+      if ( instruction.arg.i32 < 0 ) {
+        return fail_( index, "negative e-stack depth" );
+      }
+      if ( !need_( index, state, static_cast<size_t>( instruction.arg.i32 ) + 1U ) ) {
+        return false;
+      }
+      *(state.stack.rbegin() + instruction.arg.i32) = slot_type();
+      break;
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      if ( !need_( index, state, 3U ) ) {
+        return false;
+      }
+      state.stack.pop_back();
+      state.stack.pop_back();
+      state.stack.back() = slot_type();
+      break;
+
+    case INSTRUCTION_ID_TYPE_CLEAR:
+      state.stack.clear();
+      break;
+
+    case INSTRUCTION_ID_TYPE_POP:
+      if ( !need_( index, state, instruction.arg.sz ) ) {
+        return false;
+      }
+      state.stack.resize( state.stack.size() - instruction.arg.sz );
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+      if ( !need_( index, state, 1U ) ) {
+        return false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+      if ( !need_( index, state, 1U ) ) {
+        return false;
+      }
+      state.stack.pop_back();
+      break;
+
+    case INSTRUCTION_ID_TYPE_JNEZ:
+    case INSTRUCTION_ID_TYPE_JEQZ:
+      if ( !need_( index, state, 1U ) ) {
+        return false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LT_JCEQZ:
+    case INSTRUCTION_ID_TYPE_PUSHDOUBLE_LE_JCEQZ:
+      if ( !need_( index, state, 1U ) ) {
+        return false;
+      }
+      state.stack.pop_back();
+      break;
+
+    case INSTRUCTION_ID_TYPE_JMP:
+    case INSTRUCTION_ID_TYPE_JMPA:
+      falls_through = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_MOVE_END_OF_STACK:
+      state.d_offset += instruction.arg.i32;
+      if ( state.d_offset < 0 ) {
+        return fail_( index, "d-stack shrinks below the stack frame base" );
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_CALL:
+      {
+        if ( instruction.arg.sz >= instructions_.size() ) {
+          std::ostringstream message;
+          message << "call target " << instruction.arg.sz << " is out of range";
+          return fail_( index, message.str() );
+        }
+
+        functions_[ instruction.arg.sz ].callers.push_back( std::make_pair( state.function, state.d_offset ) );
+
+        // The callee starts with an empty e-stack and frame; the caller's
+        //  state is unchanged when it returns
+        //
+        state_type entry;
+        entry.function = instruction.arg.sz;
+        if ( !flow_( index, static_cast<int64_t>( instruction.arg.sz ), entry ) ) {
+          return false;
+        }
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_RETURN:
+      if ( state.function == TOP_LEVEL ) {
+        return fail_( index, "return outside of a function" );
+      }
+      falls_through = false;
+      break;
+
+    case INSTRUCTION_ID_TYPE_TAILCALL:
+      {
+        if ( state.function == TOP_LEVEL ) {
+          return fail_( index, "tail call outside of a function" );
+        }
+        if ( instruction.arg.sz >= instructions_.size() ) {
+          std::ostringstream message;
+          message << "call target " << instruction.arg.sz << " is out of range";
+          return fail_( index, message.str() );
+        }
+
+        functions_[ instruction.arg.sz ].tail_callers.push_back( state.function );
+
+        state_type entry;
+        entry.function = instruction.arg.sz;
+        if ( !flow_( index, static_cast<int64_t>( instruction.arg.sz ), entry ) ) {
+          return false;
+        }
+        falls_through = false;
+      }
+      break;
+
+    case INSTRUCTION_ID_TYPE_DEBUG_PRINT_STACK:
+    case INSTRUCTION_ID_TYPE_COMMA:
+    case INSTRUCTION_ID_TYPE_FINALIZE:
+    case INSTRUCTION_ID_TYPE_FN:
+    case INSTRUCTION_ID_TYPE_LPARENS:
+    case INSTRUCTION_ID_TYPE_RPARENS:
+      break;
+    }
+
+    if ( instruction.id != INSTRUCTION_ID_TYPE_CALL
+      && instruction.id != INSTRUCTION_ID_TYPE_TAILCALL
+      && jump_target_of( instruction, index, &target ) ) {
+      if ( !flow_( index, target, state ) ) {
+        return false;
+      }
+    }
+
+    if ( falls_through ) {
+      return flow_( index, static_cast<int64_t>( index + 1U ), state );
+    }
+
+    return true;
+  }
+
+
+  // Check a width-byte access at offset from the stack frame base
+  //
+  bool verifier_type::check_frame_access_( size_t index, const state_type &state, int64_t offset, int64_t width )
+  {
+    std::ostringstream message;
+
+    if ( offset + width > state.d_offset ) {
+      message << "stack offset " << offset << " is beyond the end of the frame (" << state.d_offset << ")";
+      return fail_( index, message.str() );
+    }
+
+    if ( state.function == TOP_LEVEL ) {
+      if ( offset < 0 ) {
+        message << "stack offset " << offset << " is below the d-stack";
+        return fail_( index, message.str() );
+      }
+      return true;
+    }
+
+    // The return address and caller's stack frame base occupy [-16,0)
+    //
+    if ( offset + width > -16 && offset < 0 ) {
+      message << "stack offset " << offset << " overlaps the call bookkeeping";
+      return fail_( index, message.str() );
+    }
+
+    int64_t lowest = -( 16 + functions_[ state.function ].min_caller_offset );
+    if ( offset < lowest ) {
+      message << "stack offset " << offset << " is below what every caller provides (" << lowest << ")";
+      return fail_( index, message.str() );
+    }
+
+    return true;
+  }
+
+
+  bool verifier_type::check_absolute_access_( size_t index, const state_type &state, int64_t address, int64_t width )
+  {
+    int64_t limit = ( state.function == TOP_LEVEL ) ? state.d_offset : functions_[ state.function ].global_limit;
+
+    if ( address < 0 || address + width > limit ) {
+      std::ostringstream message;
+      message << "address " << address << " is beyond the d-stack (" << limit << ")";
+      return fail_( index, message.str() );
+    }
+
+    return true;
+  }
+
+
+  bool verifier_type::check_accesses_( size_t index )
+  {
+    const instruction_type &instruction = instructions_[index];
+    const state_type       &state       = states_[index];
+
+    switch ( instruction.id ) {
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR:
+      return check_absolute_access_( index, state, static_cast<int64_t>( instruction.arg.sz ), 8 );
+
+    case INSTRUCTION_ID_TYPE_COPYFROMADDR_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOADDR_I32:
+      return check_absolute_access_( index, state, static_cast<int64_t>( instruction.arg.sz ), 4 );
+
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_POP:
+      return check_frame_access_( index, state, instruction.arg.i32, 8 );
+
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_I32:
+    case INSTRUCTION_ID_TYPE_COPYTOSTACKOFFSET_I32:
+      return check_frame_access_( index, state, instruction.arg.i32, 4 );
+
+    case INSTRUCTION_ID_TYPE_COPYFROMSTACKOFFSET_COPYFROMSTACKOFFSET_ADD:
+      return check_frame_access_( index, state, instruction.arg.i32, 8 )
+          && check_frame_access_( index, state, instruction.arg2, 8 );
+
+    case INSTRUCTION_ID_TYPE_ASSIGN:
+    case INSTRUCTION_ID_TYPE_ASSIGN_I32:
+      {
+        int64_t width = ( instruction.id == INSTRUCTION_ID_TYPE_ASSIGN_I32 ) ? 4 : 8;
+
+        const slot_type &target   = *(state.stack.rbegin() + 2U);
+        const slot_type &absolute = *(state.stack.rbegin() + 1U);
+        if ( !target.known || !absolute.known ) {
+          return fail_( index, "assignment target is not a constant" );
+        }
+        if ( absolute.value ) {
+          return check_absolute_access_( index, state, target.value, width );
+        }
+        return check_frame_access_( index, state, static_cast<int32_t>( target.value ), width );
+      }
+
+    default:
+      return true;
+    }
+  }
+
+
+  bool verifier_type::run()
+  {
+    // Stack depths, d-stack offsets, and control flow
+    //
+    reached_[0] = true;
+    worklist_.push_back( 0U );
+
+    while ( !worklist_.empty() ) {
+      size_t index = worklist_.front();
+      worklist_.pop_front();
+      if ( !step_( index ) ) {
+        return false;
+      }
+    }
+
+    // What each function's callers provide: frame space below the
+    //  function's stack frame base, and globals. A function that is
+    //  tail called runs in its tail caller's frame, so it gets whatever
+    //  the tail caller's callers provide
+    //
+    for ( auto &entry : functions_ ) {
+      for ( const auto &caller : entry.second.callers ) {
+        if ( caller.second < entry.second.min_caller_offset ) {
+          entry.second.min_caller_offset = caller.second;
+        }
+      }
+    }
+
+    bool changed = true;
+    while ( changed ) {
+      changed = false;
+      for ( auto &entry : functions_ ) {
+        for ( const auto &caller : entry.second.callers ) {
+          int64_t limit = ( caller.first == TOP_LEVEL ) ? caller.second : functions_[ caller.first ].global_limit;
+          if ( limit < entry.second.global_limit ) {
+            entry.second.global_limit = limit;
+            changed = true;
+          }
+        }
+        for ( size_t tail_caller : entry.second.tail_callers ) {
+          const function_info_type &from = functions_[ tail_caller ];
+          if ( from.min_caller_offset < entry.second.min_caller_offset ) {
+            entry.second.min_caller_offset = from.min_caller_offset;
+            changed = true;
+          }
+          if ( from.global_limit < entry.second.global_limit ) {
+            entry.second.global_limit = from.global_limit;
+            changed = true;
+          }
+        }
+      }
+    }
+
+    // d-stack accesses
+    //
+    for ( size_t i=0U; i<instructions_.size(); ++i ) {
+      if ( reached_[i] && !check_accesses_( i ) ) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+
+  void verifier_type::get_states( std::vector<verify_state_type> &states ) const
+  {
+    states.assign( instructions_.size(), verify_state_type() );
+    for ( size_t i=0U; i<instructions_.size(); ++i ) {
+      states[i].reached     = reached_[i];
+      states[i].in_function = ( states_[i].function != TOP_LEVEL );
+      states[i].function    = states_[i].function;
+      states[i].d_offset    = states_[i].d_offset;
+      states[i].e_depth     = states_[i].stack.size();
+    }
+  }
+
+}
+
+
+bool verify(
+            const std::vector<instruction_type> &instructions
+           ,verify_error_type                   *error
+           ,std::vector<verify_state_type>      *states
+           )
+{
+  verifier_type verifier( instructions, error );
+  bool rv = verifier.run();
+  if ( states ) {
+    verifier.get_states( *states );
+  }
+  return rv;
+}
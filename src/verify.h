@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019-2020 Ray Li
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instruction_type.h"
+
+
+struct verify_error_type {
+  size_t      index{};  // of the offending instruction
+  std::string message;
+};
+
+
+// What verification found out about an instruction: the abstract state
+//  before it
+//
+struct verify_state_type {
+  bool    reached{};
+  bool    in_function{};  // false: at the top level
+  size_t  function{};     // entry index of the enclosing function
+  int64_t d_offset{};     // d-stack size, relative to the stack frame base
+  size_t  e_depth{};      // e-stack depth, relative to the frame's e-stack base
+};
+
+
+// Static verification of instructions, by abstract interpretation.
+//
+// Every reachable instruction is checked, along every path, for:
+//
+//   - e-stack depth: each instruction has enough operands, and every
+//     path into an instruction agrees on the depth
+//   - jump and call targets are in range, and do not cross between
+//     functions (or between a function and the top level)
+//   - d-stack accesses: stack-offset accesses stay between the lowest
+//     offset every caller provides (args, return value) and the current
+//     end of the frame, and never touch the call bookkeeping; absolute
+//     (global) accesses stay below the d-stack size at every call site
+//   - assignment targets are compile-time constants, checked as above
+//   - return only occurs inside a function
+//
+// Instructions that pass can be evaluated with the CHECKS policy off (see
+//  evaluate.h). Returns false, with the first error found, otherwise.
+//  If states is given, it receives the state before each instruction
+//  (which other passes can use to find functions, frame sizes and
+//  stack depths)
+//
+bool verify(
+            const std::vector<instruction_type> &instructions
+           ,verify_error_type                   *error
+           ,std::vector<verify_state_type>      *states = nullptr
+           );